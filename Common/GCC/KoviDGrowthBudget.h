@@ -0,0 +1,112 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+// The code-growth budget of the GCC plugins, set with
+// -fplugin-arg-<plugin>-max-function-growth=<percent> and
+// -fplugin-arg-<plugin>-max-module-growth=<percent>. See KoviDBudget.h for
+// the cost model. Sizes are GIMPLE statements. GCC hands the functions to
+// the plugins one at a time, so the size of the unit is that of the
+// functions seen so far. Include it after the GCC headers and
+// KoviDSelection.h.
+
+#ifndef KOVID_GROWTHBUDGET_GCC_H
+#define KOVID_GROWTHBUDGET_GCC_H
+
+#include <cstdlib>
+#include <cstring>
+
+#include "KoviDBudget.h"
+
+struct kovid_growth_budget {
+  kovid::budget::Budget budget;
+  // The function being charged, and its account.
+  function *fun = NULL;
+  kovid::budget::Account account;
+};
+
+// The budget of this compilation, shared by all transforms of all KoviD
+// plugins loaded into the compiler, which compiles one unit. g++ emits the
+// static of an inline function as a unique global symbol (STB_GNU_UNIQUE),
+// which the dynamic linker binds to a single instance in the process, even
+// across plugins loaded with RTLD_LOCAL, so each plugin must keep it visible
+// and be built with g++ without -fno-gnu-unique.
+__attribute__((visibility("default"))) inline kovid_growth_budget &
+kovid_budget() {
+  static kovid_growth_budget budget;
+  return budget;
+}
+
+// Handle the max-function-growth= and max-module-growth= plugin arguments.
+// Returns false if arg is neither of them.
+inline bool kovid_parse_budget_argument(const plugin_argument &arg) {
+  unsigned *limit;
+  if (!strcmp(arg.key, "max-function-growth"))
+    limit = &kovid_budget().budget.Limit.FunctionPercent;
+  else if (!strcmp(arg.key, "max-module-growth"))
+    limit = &kovid_budget().budget.Limit.ModulePercent;
+  else
+    return false;
+  *limit = arg.value ? strtoul(arg.value, NULL, 10) : 0;
+  return true;
+}
+
+// The same, for the plugins that ignore the arguments they do not know.
+inline void kovid_parse_budget_arguments(const plugin_name_args *plugin_info) {
+  for (int i = 0; i < plugin_info->argc; ++i)
+    kovid_parse_budget_argument(plugin_info->argv[i]);
+}
+
+inline uint64_t kovid_count_statements(function *fun) {
+  uint64_t count = 0;
+  basic_block bb;
+  FOR_EACH_BB_FN(bb, fun) {
+    for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+         gsi_next(&gsi))
+      ++count;
+  }
+  return count;
+}
+
+// Try to spend cost statements of growth of fun on transform t. Call it
+// before rewriting: the size of fun is taken when it is first charged.
+inline bool kovid_charge(function *fun, kovid::rules::Transform t,
+                         uint64_t cost) {
+  kovid_growth_budget &b = kovid_budget();
+  if (b.budget.Limit.empty())
+    return true;
+  if (fun != b.fun) {
+    b.fun = fun;
+    b.account = kovid::budget::Account(kovid_count_statements(fun));
+    b.budget.addToModule(b.account.Size);
+  }
+  if (b.budget.charge(b.account, t, cost, kovid_is_heavy(fun->decl)))
+    return true;
+
+  statistics_counter_event(fun, "kovid_budget rewrites refused", 1);
+  if (dump_enabled_p())
+    dump_printf_loc(MSG_MISSED_OPTIMIZATION,
+                    dump_user_location_t::from_function_decl(fun->decl),
+                    "%s does not fit the growth budget\n",
+                    kovid::rules::transformName(t));
+  return false;
+}
+
+// Write what fun spent to the pass dump (-details).
+inline void kovid_report_budget(function *fun) {
+  kovid_growth_budget &b = kovid_budget();
+  if (fun != b.fun || !dump_file || !(dump_flags & TDF_DETAILS))
+    return;
+  fprintf(dump_file, "Growth budget: grew by %lu statements from %lu",
+          (unsigned long)b.account.spent(), (unsigned long)b.account.Size);
+  for (int t = 0; t < kovid::rules::NumTransforms; ++t)
+    if (b.account.Spent[t] || b.account.Denied[t])
+      fprintf(dump_file, "; %s %lu, %u refused",
+              kovid::rules::transformName(kovid::rules::Transform(t)),
+              (unsigned long)b.account.Spent[t], b.account.Denied[t]);
+  fprintf(dump_file, "; the unit grew by %lu from %lu\n",
+          (unsigned long)b.budget.moduleSpent(),
+          (unsigned long)b.budget.moduleSize());
+}
+
+#endif // KOVID_GROWTHBUDGET_GCC_H
@@ -0,0 +1,59 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+// The content-keyed seeds of the per-function constants of the GCC plugins.
+// See KoviDHash.h. The key is STR_GCC_CRYPTO_KEY unless the plugin is given
+// another one. Include it after the GCC headers.
+
+#ifndef KOVID_SEED_GCC_H
+#define KOVID_SEED_GCC_H
+
+#include <string>
+
+#include "KoviDHash.h"
+#include "KoviDRules.h"
+
+// The key of this compilation, shared by all transforms of the plugin.
+inline std::string &kovid_seed_key() {
+  static std::string key;
+  return key;
+}
+
+// The seed of the constants of transform t in fun: a keyed hash of the
+// codes, operand counts and constant operands of its statements. Variable
+// names, locations and debug statements are left out, so it only changes
+// when the code of fun does.
+inline uint64_t kovid_function_seed(function *fun, kovid::rules::Transform t) {
+  kovid::hash::Hasher hasher(kovid_seed_key());
+  hasher.add(t);
+
+  basic_block bb;
+  FOR_EACH_BB_FN(bb, fun) {
+    for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+         gsi_next(&gsi)) {
+      gimple *stmt = gsi_stmt(gsi);
+      if (is_gimple_debug(stmt))
+        continue;
+      hasher.add(gimple_code(stmt));
+      if (is_gimple_assign(stmt))
+        hasher.add(gimple_assign_rhs_code(stmt));
+      hasher.add(gimple_num_ops(stmt));
+      for (unsigned i = 0; i < gimple_num_ops(stmt); ++i) {
+        tree op = gimple_op(stmt, i);
+        if (!op) {
+          hasher.add(0ULL);
+        } else if (TREE_CODE(op) == INTEGER_CST) {
+          hasher.add(TREE_INT_CST_LOW(op));
+        } else {
+          hasher.add(TREE_CODE(op));
+        }
+      }
+    }
+    // Keep the block boundaries apart.
+    hasher.add(~0ULL);
+  }
+  return hasher.finish();
+}
+
+#endif // KOVID_SEED_GCC_H
@@ -0,0 +1,151 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+// Selective obfuscation for the GCC plugins: the kovid_* annotations and the
+// rules file given with -fplugin-arg-<plugin>-rules=<file>. See KoviDRules.h
+// for the rules format. Include it after the GCC headers.
+//
+// GCC has no annotate attribute of its own, so the plugins register one
+// that takes a single string, as clang's does; only "kovid_skip" and
+// "kovid_heavy" mean anything to them.
+
+#ifndef KOVID_SELECTION_GCC_H
+#define KOVID_SELECTION_GCC_H
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "attribs.h"
+#include "langhooks.h"
+
+#include "KoviDRules.h"
+
+// The rules of this compilation, shared by all transforms of the plugin.
+inline kovid::rules::RuleSet &kovid_rules() {
+  static kovid::rules::RuleSet rules;
+  return rules;
+}
+
+// Load the rules file path. Returns false after reporting why it could not.
+inline bool kovid_load_rules(const char *plugin, const char *path) {
+  std::string error;
+  if (kovid_rules().load(path, error))
+    return true;
+  fprintf(stderr, "%s: rules: %s\n", plugin, error.c_str());
+  return false;
+}
+
+// The kovid::rules::Annotation bits of the annotate attributes of decl.
+inline unsigned kovid_annotations(tree decl) {
+  unsigned annotations = kovid::rules::None;
+  for (tree attr = lookup_attribute("annotate", DECL_ATTRIBUTES(decl)); attr;
+       attr = lookup_attribute("annotate", TREE_CHAIN(attr))) {
+    tree arg = TREE_VALUE(attr) ? TREE_VALUE(TREE_VALUE(attr)) : NULL_TREE;
+    if (arg && TREE_CODE(arg) == STRING_CST)
+      // The length counts the terminating NUL.
+      annotations |= kovid::rules::parseAnnotation(
+          TREE_STRING_POINTER(arg), TREE_STRING_LENGTH(arg) - 1);
+  }
+  return annotations;
+}
+
+// The names the rules match a decl by: its assembler name and, if that
+// differs, "ns::f(int)" for C++.
+struct kovid_rule_names {
+  std::string name;
+  std::string printable;
+};
+
+typedef std::map<unsigned, kovid_rule_names> kovid_rule_name_map;
+
+// The rule names of the functions renamed so far, by DECL_UID. The renaming
+// runs in the GIMPLE lowering of each function, before the IPA passes of
+// this plugin and of the other KoviD plugins loaded into the compiler, which
+// still have to match the original names. Shared by the plugins like
+// kovid_budget (see KoviDGrowthBudget.h).
+__attribute__((visibility("default"))) inline kovid_rule_name_map &
+kovid_original_names() {
+  static kovid_rule_name_map names;
+  return names;
+}
+
+inline kovid_rule_names kovid_get_rule_names(tree decl) {
+  kovid_rule_name_map::const_iterator it =
+      kovid_original_names().find(DECL_UID(decl));
+  if (it != kovid_original_names().end())
+    return it->second;
+
+  kovid_rule_names names;
+  names.name = IDENTIFIER_POINTER(DECL_ASSEMBLER_NAME(decl));
+  // "ns::f(int)" for C++, the plain name for C.
+  names.printable = lang_hooks.decl_printable_name(decl, 2);
+  if (names.printable == names.name)
+    names.printable.clear();
+  return names;
+}
+
+// Called by the renaming before it renames decl, so that the rules keep
+// matching the original names.
+inline void kovid_record_original_name(tree decl) {
+  kovid_original_names()[DECL_UID(decl)] = kovid_get_rule_names(decl);
+}
+
+// Whether transform t may touch the function or variable decl. A renamed
+// function is matched by its original names.
+inline bool kovid_should_transform(tree decl, kovid::rules::Transform t) {
+  unsigned annotations = kovid_annotations(decl);
+  if (annotations || kovid_rules().empty())
+    return kovid::rules::shouldTransform(kovid_rules(), t, annotations, "");
+
+  kovid_rule_names names = kovid_get_rule_names(decl);
+  return kovid::rules::shouldTransform(kovid_rules(), t, annotations,
+                                       names.name, names.printable);
+}
+
+// Whether decl was annotated kovid_heavy: it is always transformed and gets
+// no cheaper treatment in hot code.
+inline bool kovid_is_heavy(tree decl) {
+  return kovid_annotations(decl) & kovid::rules::Heavy;
+}
+
+inline tree kovid_handle_annotate_attribute(tree *node, tree name, tree args,
+                                            int, bool *no_add_attrs) {
+  if (!DECL_P(*node) || TREE_CODE(TREE_VALUE(args)) != STRING_CST) {
+    warning(OPT_Wattributes, "%qE attribute needs a string on a function or "
+                             "variable, ignored", name);
+    *no_add_attrs = true;
+  }
+  return NULL_TREE;
+}
+
+// PLUGIN_ATTRIBUTES callback. Every KoviD plugin registers it, so only the
+// first one loaded adds the attribute.
+inline void kovid_register_attributes(void *, void *) {
+  static const attribute_spec annotate_attr = {
+      "annotate", 1, 1, true, false, false, false,
+      kovid_handle_annotate_attribute, NULL};
+  if (!lookup_attribute_spec(get_identifier("annotate")))
+    register_attribute(&annotate_attr);
+}
+
+// The value of the rules= plugin argument, or NULL.
+inline const char *kovid_rules_argument(const plugin_name_args *plugin_info) {
+  for (int i = 0; i < plugin_info->argc; ++i)
+    if (!strcmp(plugin_info->argv[i].key, "rules"))
+      return plugin_info->argv[i].value ? plugin_info->argv[i].value : "";
+  return NULL;
+}
+
+// Called from plugin_init: register the annotate attribute and load the
+// rules file, if there is one. Returns false if it cannot be loaded.
+inline bool kovid_init_selection(const char *base_name, const char *plugin,
+                                 const char *rules_path) {
+  register_callback(base_name, PLUGIN_ATTRIBUTES, kovid_register_attributes,
+                    NULL);
+  return !rules_path || kovid_load_rules(plugin, rules_path);
+}
+
+#endif // KOVID_SELECTION_GCC_H
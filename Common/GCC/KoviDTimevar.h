@@ -0,0 +1,26 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+// The -ftime-report entries of the GCC plugins. A plugin cannot add its own
+// timevars to timevar.def, so the KoviD passes run under TV_PLUGIN_RUN
+// ("plugin execution"), and each transform, and each phase of one, is a
+// client item of the timer, timed with
+//
+//   auto_client_timevar tv(g_timer, "KoviD instruction-obf: collect");
+//
+// -ftime-report lists the client items by name after the timevars. The
+// names are those of the LLVM time-trace entries (KoviDTimeTrace.h), and
+// must be string literals: the timer keeps the pointers. The numbers of
+// items processed are statistics counters, for -fdump-statistics. Include
+// it after the GCC headers.
+
+#ifndef KOVID_TIMEVAR_GCC_H
+#define KOVID_TIMEVAR_GCC_H
+
+#include "timevar.h"
+
+// The tv_id of the pass_data of the KoviD passes.
+#define KOVID_TV_PASS TV_PLUGIN_RUN
+
+#endif // KOVID_TIMEVAR_GCC_H
@@ -0,0 +1,145 @@
+#!/bin/sh
+#
+# Smoke test of a KoviD GCC plugin, run by "make check": builds a small C
+# program with the plugin, checks that the transform left its mark on the
+# output and runs the program.
+#
+# Usage: check-plugin.sh <transform> <cxx> <plugin> <top>
+#
+# <transform> is one of the transforms of the combined plugin, or "all" for
+# the combined plugin with every transform. <cxx> is the g++ the plugin was
+# built for; the program is compiled as C with it. <top> is the top of the
+# source tree, for the string runtime.
+#
+# License: Apache License v2.0 with LLVM Exceptions
+# Author: djolertrk
+
+set -e
+
+TRANSFORM=$1
+CXX=$2
+PLUGIN=$3
+TOP=$4
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+# -fplugin-arg-<name>-<key>=<value>
+ARG=-fplugin-arg-$(basename "$PLUGIN" .so)
+
+cat > "$DIR/smoke.c" <<'EOF'
+#include <stdio.h>
+
+/* Packed into the encrypted blob. */
+static const char *greeting = "kovid smoke greeting";
+/* Encrypted in place. */
+static char buffer[] = "kovid smoke buffer";
+/* Passed to the kernel, so decrypted at startup even with page decryption. */
+static const char *path = "/dev/null";
+
+__attribute__((noinline)) static int kovid_smoke_add(int a, int b) {
+  return a + b;
+}
+
+int main(void) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return 1;
+  fclose(file);
+  printf("%s\n%s\n%d\n", greeting, buffer, kovid_smoke_add(40, 2));
+  return 0;
+}
+EOF
+printf 'kovid smoke greeting\nkovid smoke buffer\n42\n' > "$DIR/expected"
+
+fail() {
+  echo "check-plugin.sh: $TRANSFORM: $*" >&2
+  exit 1
+}
+
+# The runtime is only linked when the strings are decrypted.
+RUNTIME=
+with_runtime() {
+  for source in "$TOP"/StringEncryption/Runtime/*.c; do
+    object=$DIR/$(basename "$source" .c).o
+    "$CXX" -x c -O1 -c "$source" -o "$object"
+    RUNTIME="$RUNTIME $object"
+  done
+}
+
+# Build the program with the plugin and the extra arguments, with the
+# remarks in $DIR/remarks, and check its output.
+build_and_run() {
+  "$CXX" -x c -O1 -fplugin="$PLUGIN" -fopt-info-optimized="$DIR/remarks" \
+    "$@" -c "$DIR/smoke.c" -o "$DIR/smoke.o"
+  "$CXX" "$DIR/smoke.o" $RUNTIME -o "$DIR/smoke"
+  "$DIR/smoke" > "$DIR/output" || fail "the program failed"
+  cmp -s "$DIR/output" "$DIR/expected" ||
+    fail "wrong output: $(cat "$DIR/output")"
+}
+
+expect_remark() {
+  grep -q "$1" "$DIR/remarks" 2>/dev/null || fail "no '$1' remark"
+}
+
+expect_renamed() {
+  if nm "$DIR/smoke.o" | grep -q kovid_smoke_add; then
+    fail "kovid_smoke_add was not renamed"
+  fi
+  nm "$DIR/smoke.o" | grep -q ' t _[0-9a-f]' || fail "no renamed function"
+}
+
+expect_encrypted() {
+  if grep -q -a -e "kovid smoke" -e /dev/null "$1"; then
+    fail "plaintext strings in $1; was the plugin built with a key?"
+  fi
+}
+
+expect_no_debug_info() {
+  if objdump -h "$DIR/smoke.o" | grep -q '\.debug_info'; then
+    fail "debug info left in the object"
+  fi
+}
+
+case $TRANSFORM in
+rename-code)
+  mkdir "$DIR/maps"
+  build_and_run "$ARG-map=$DIR/maps"
+  expect_renamed
+  ls "$DIR"/maps/*.kovidmap > /dev/null 2>&1 || fail "no rename map"
+  ;;
+instruction-obf)
+  build_and_run
+  expect_remark "obfuscated .* add statements"
+  ;;
+dummy-code-insertion)
+  build_and_run
+  expect_remark "inserted dummy code"
+  ;;
+string-encryption)
+  with_runtime
+  for decryption in startup page; do
+    build_and_run "$ARG-decryption=$decryption"
+    expect_encrypted "$DIR/smoke"
+    expect_remark "encrypted .* strings in greeting"
+  done
+  ;;
+metadata-unused-code-removal)
+  build_and_run -g
+  expect_no_debug_info
+  ;;
+all)
+  with_runtime
+  ALL=rename-code,dummy-code-insertion,instruction-obf,string-encryption
+  ALL=$ALL,metadata-unused-code-removal
+  build_and_run -g "$ARG-transforms=$ALL" "$ARG-string-decryption=page"
+  expect_renamed
+  expect_remark "obfuscated .* add statements"
+  expect_remark "inserted dummy code"
+  expect_encrypted "$DIR/smoke"
+  expect_no_debug_info
+  ;;
+*)
+  fail "unknown transform"
+  ;;
+esac
+echo "check-plugin.sh: $TRANSFORM: ok"
@@ -0,0 +1,119 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// KoviD Code-Growth Budget
+// ------------------------
+//
+// How much bigger the transforms may make each function and the whole unit.
+// This header is shared by the LLVM passes and the GCC plugins, so it only
+// depends on the C++11 standard library.
+//
+// Sizes are counted in IR instructions (LLVM) or GIMPLE statements (GCC).
+// Every transform that grows the code asks for the cost of a rewrite, the
+// number of instructions it adds net of those it replaces, before doing it.
+// The request is granted while the growth of the function stays within
+// FunctionPercent of its size when it was first charged, and the growth of
+// the unit within ModulePercent of the size of the unit. A limit of 0 means
+// no limit.
+//
+// The transforms are charged in the order they run, which is their priority:
+// instruction obfuscation first, then the dummy code. kovid_heavy functions
+// are charged like the others but never refused.
+//
+
+#ifndef KOVID_BUDGET_H
+#define KOVID_BUDGET_H
+
+#include <cstdint>
+
+#include "KoviDRules.h"
+
+namespace kovid {
+namespace budget {
+
+struct Limits {
+  unsigned FunctionPercent = 0;
+  unsigned ModulePercent = 0;
+
+  bool empty() const { return !FunctionPercent && !ModulePercent; }
+};
+
+/// The spending of one function of Size instructions.
+struct Account {
+  uint64_t Size;
+  uint64_t Spent[rules::NumTransforms] = {};
+  unsigned Denied[rules::NumTransforms] = {};
+
+  explicit Account(uint64_t Size = 0) : Size(Size) {}
+
+  uint64_t spent() const {
+    uint64_t Total = 0;
+    for (int T = 0; T < rules::NumTransforms; ++T)
+      Total += Spent[T];
+    return Total;
+  }
+
+  unsigned denied() const {
+    unsigned Total = 0;
+    for (int T = 0; T < rules::NumTransforms; ++T)
+      Total += Denied[T];
+    return Total;
+  }
+};
+
+/// The growth that Percent allows for Size instructions, or UINT64_MAX if
+/// there is no limit.
+inline uint64_t allowance(uint64_t Size, unsigned Percent) {
+  return Percent ? Size * Percent / 100 : UINT64_MAX;
+}
+
+/// The limits and the spending of one unit.
+class Budget {
+public:
+  Limits Limit;
+
+  Budget() {}
+  explicit Budget(const Limits &Limit) : Limit(Limit) {}
+
+  /// Start a unit of ModuleSize instructions.
+  void beginModule(uint64_t ModuleSize) {
+    Size = ModuleSize;
+    Spent = 0;
+  }
+
+  /// Add a function to the size of the unit, for callers that only learn it
+  /// one function at a time.
+  void addToModule(uint64_t FunctionSize) { Size += FunctionSize; }
+
+  /// Try to spend Cost instructions of growth of A on transform T. Returns
+  /// false, and counts the refusal, if that does not fit. Unlimited
+  /// requests (kovid_heavy functions) are always granted.
+  bool charge(Account &A, rules::Transform T, uint64_t Cost,
+              bool Unlimited = false) {
+    if (!Unlimited &&
+        (A.spent() + Cost > allowance(A.Size, Limit.FunctionPercent) ||
+         Spent + Cost > allowance(Size, Limit.ModulePercent))) {
+      ++A.Denied[T];
+      return false;
+    }
+    A.Spent[T] += Cost;
+    Spent += Cost;
+    return true;
+  }
+
+  uint64_t moduleSize() const { return Size; }
+  uint64_t moduleSpent() const { return Spent; }
+
+private:
+  uint64_t Size = 0;
+  uint64_t Spent = 0;
+};
+
+} // namespace budget
+} // namespace kovid
+
+#endif // KOVID_BUDGET_H
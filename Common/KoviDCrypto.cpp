@@ -0,0 +1,131 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+#include "KoviDCrypto.h"
+
+#include <cstring>
+
+using namespace kovid::crypto;
+
+KeyStream::KeyStream(const std::string &Key) : Key(Key) {
+  if (Key.empty())
+    return;
+  Extended = Key;
+  while (Extended.size() < Key.size() + 8)
+    Extended += Key;
+  WordStep = 8 % Key.size();
+}
+
+void KeyStream::apply(char *Data, size_t Size, uint64_t Start) const {
+  if (Key.empty())
+    return;
+  size_t K = Start % Key.size();
+  size_t I = 0;
+  for (; I + 8 <= Size; I += 8) {
+    uint64_t Word, Stream;
+    std::memcpy(&Word, Data + I, 8);
+    std::memcpy(&Stream, Extended.data() + K, 8);
+    Word ^= Stream;
+    std::memcpy(Data + I, &Word, 8);
+    K += WordStep;
+    if (K >= Key.size())
+      K -= Key.size();
+  }
+  for (; I < Size; ++I) {
+    Data[I] ^= Key[K];
+    if (++K == Key.size())
+      K = 0;
+  }
+}
+
+std::unique_ptr<Cipher> kovid::crypto::createCipher(const std::string &Key,
+                                                    CipherKind Kind) {
+  switch (Kind) {
+  case CipherKind::Xor:
+    return std::unique_ptr<Cipher>(new KeyStream(Key));
+  }
+  return nullptr;
+}
+
+const Cipher &kovid::crypto::getCipher(const std::string &Key,
+                                       CipherKind Kind) {
+  static thread_local std::unique_ptr<Cipher> Last;
+  static thread_local std::string LastKey;
+  if (!Last || Last->kind() != Kind || LastKey != Key) {
+    Last = createCipher(Key, Kind);
+    LastKey = Key;
+  }
+  return *Last;
+}
+
+namespace {
+
+// The two hex digits of every byte, and the value of every hex digit (0xff
+// for the other characters).
+struct HexTables {
+  char Digits[256][2];
+  unsigned char Values[256];
+
+  HexTables() {
+    static const char Hex[] = "0123456789abcdef";
+    for (unsigned B = 0; B < 256; ++B) {
+      Digits[B][0] = Hex[B >> 4];
+      Digits[B][1] = Hex[B & 0xf];
+      Values[B] = 0xff;
+    }
+    for (unsigned C = '0'; C <= '9'; ++C)
+      Values[C] = C - '0';
+    for (unsigned C = 'a'; C <= 'f'; ++C)
+      Values[C] = C - 'a' + 10;
+    for (unsigned C = 'A'; C <= 'F'; ++C)
+      Values[C] = C - 'A' + 10;
+  }
+};
+
+const HexTables &hexTables() {
+  static const HexTables Tables;
+  return Tables;
+}
+
+} // end anonymous namespace
+
+void kovid::crypto::hexEncode(const char *Data, size_t Size, char *Out) {
+  const HexTables &T = hexTables();
+  for (size_t I = 0; I < Size; ++I)
+    std::memcpy(Out + 2 * I, T.Digits[static_cast<unsigned char>(Data[I])], 2);
+}
+
+bool kovid::crypto::hexDecode(const char *Hex, size_t Size, char *Out) {
+  if (Size % 2 != 0)
+    return false;
+  const HexTables &T = hexTables();
+  for (size_t I = 0; I < Size / 2; ++I) {
+    unsigned char Hi = T.Values[static_cast<unsigned char>(Hex[2 * I])];
+    unsigned char Lo = T.Values[static_cast<unsigned char>(Hex[2 * I + 1])];
+    if ((Hi | Lo) == 0xff)
+      return false;
+    Out[I] = static_cast<char>(Hi << 4 | Lo);
+  }
+  return true;
+}
+
+std::string kovid::crypto::encryptName(const std::string &Name,
+                                       const Cipher &Key) {
+  std::string Encrypted = Name;
+  Key.apply(Encrypted);
+  return hexEncode(Encrypted);
+}
+
+bool kovid::crypto::decryptName(const char *Hex, size_t Size,
+                                const Cipher &Key, std::string &Original) {
+  if (Size == 0 || Size % 2 != 0)
+    return false;
+  Original.resize(Size / 2);
+  if (!hexDecode(Hex, Size, &Original[0]))
+    return false;
+  Key.apply(Original);
+  return true;
+}
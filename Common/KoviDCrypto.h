@@ -0,0 +1,145 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// KoviD Cipher Core
+// -----------------
+//
+// The key stream and the hex encoding of the encrypted names and strings,
+// shared by the LLVM passes, the GCC plugins, kovid-deobfuscator and the
+// LLDB plugin so that what one encrypts the others decrypt. It is built as
+// the KoviDCrypto static library (the GCC Makefiles compile KoviDCrypto.cpp
+// into each plugin) and only depends on the C++11 standard library.
+//
+// Everything that encrypts or decrypts goes through the Cipher interface, a
+// stream cipher addressed by position, and createCipher / getCipher pick the
+// implementation from a CipherKind. The only one is the repeating-key XOR,
+// KeyStream: byte I of a stream is XORed with Key[I % Key.size()]. It is
+// applied a 64-bit word at a time from a copy of the key extended by a word,
+// so that no byte pays for a modulo, and a stream can start anywhere in the
+// key, as the packed strings do. The runtime in StringEncryption/Runtime
+// dispatches on the same ids (KOVID_CIPHER_* in KoviDStringRuntime.h), so a
+// new cipher is a new CipherKind, a case in createCipher and an entry in the
+// cipher table of the runtime.
+//
+
+#ifndef KOVID_CRYPTO_H
+#define KOVID_CRYPTO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace kovid {
+namespace crypto {
+
+/// The ciphers, numbered like the KOVID_CIPHER_* ids of the runtime.
+enum class CipherKind : unsigned { Xor = 0 };
+
+/// A stream cipher addressed by position: the byte at stream position P
+/// only depends on the key and P, so any part of a stream can be encrypted
+/// or decrypted by itself. Encryption and decryption are the same call.
+class Cipher {
+public:
+  virtual ~Cipher() = default;
+
+  virtual CipherKind kind() const = 0;
+
+  /// Encrypt or decrypt \p Size bytes of \p Data, the part of the stream
+  /// that starts at position \p Start.
+  virtual void apply(char *Data, size_t Size, uint64_t Start = 0) const = 0;
+
+  void apply(std::string &Data, uint64_t Start = 0) const {
+    if (!Data.empty())
+      apply(&Data[0], Data.size(), Start);
+  }
+};
+
+/// The cipher \p Kind keyed with \p Key.
+std::unique_ptr<Cipher> createCipher(const std::string &Key,
+                                     CipherKind Kind = CipherKind::Xor);
+
+/// Same as createCipher, built once per thread, key and kind. The passes
+/// rename and encrypt many functions and strings with one key; the result is
+/// only valid until the next call on the thread.
+const Cipher &getCipher(const std::string &Key,
+                        CipherKind Kind = CipherKind::Xor);
+
+/// The repeating-key XOR, with the key expanded once for the word-at-a-time
+/// loop.
+class KeyStream final : public Cipher {
+public:
+  explicit KeyStream(const std::string &Key);
+
+  /// For keys that are literals, such as the build-time key macros.
+  template <size_t N>
+  explicit KeyStream(const char (&Key)[N]) : KeyStream(std::string(Key, N - 1)) {}
+
+  const std::string &key() const { return Key; }
+  size_t size() const { return Key.size(); }
+  bool empty() const { return Key.empty(); }
+
+  CipherKind kind() const override { return CipherKind::Xor; }
+
+  /// The key stream byte at \p Pos.
+  unsigned char at(uint64_t Pos) const {
+    return static_cast<unsigned char>(Key[Pos % Key.size()]);
+  }
+
+  /// XOR \p Size bytes of \p Data with the key stream starting at key byte
+  /// \p Start; applying it twice is the identity. An empty key does nothing.
+  void apply(char *Data, size_t Size, uint64_t Start = 0) const override;
+  using Cipher::apply;
+
+private:
+  std::string Key;
+  // The key followed by its first 8 bytes, repeated as needed for keys
+  // shorter than a word.
+  std::string Extended;
+  // 8 % Key.size(), how far a word moves in the key.
+  size_t WordStep = 0;
+};
+
+/// Write two lowercase hex digits per byte of \p Data to \p Out, which has
+/// room for 2 * \p Size characters.
+void hexEncode(const char *Data, size_t Size, char *Out);
+
+inline std::string hexEncode(const std::string &Data) {
+  std::string Hex(2 * Data.size(), '\0');
+  if (!Data.empty())
+    hexEncode(Data.data(), Data.size(), &Hex[0]);
+  return Hex;
+}
+
+/// Decode the \p Size hex digits of \p Hex, in either case, into \p Out,
+/// which has room for \p Size / 2 bytes. Returns false if \p Size is odd or
+/// a character is not a hex digit.
+bool hexDecode(const char *Hex, size_t Size, char *Out);
+
+inline bool hexDecode(const std::string &Hex, std::string &Out) {
+  Out.resize(Hex.size() / 2);
+  return Hex.empty() || hexDecode(Hex.data(), Hex.size(), &Out[0]);
+}
+
+/// The hex encoded encryption of \p Name, as the renaming writes it after
+/// the leading '_'.
+std::string encryptName(const std::string &Name, const Cipher &Key);
+
+/// Decrypt the \p Size characters of a name written by encryptName. Returns
+/// false if they are not such a name.
+bool decryptName(const char *Hex, size_t Size, const Cipher &Key,
+                 std::string &Original);
+
+inline bool decryptName(const std::string &Hex, const Cipher &Key,
+                        std::string &Original) {
+  return decryptName(Hex.data(), Hex.size(), Key, Original);
+}
+
+} // namespace crypto
+} // namespace kovid
+
+#endif // KOVID_CRYPTO_H
@@ -0,0 +1,89 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// KoviD Keyed Hashing
+// -------------------
+//
+// The per-function constants of the transforms, such as the values the
+// opaque slots hold and the offsets of the dummy arithmetic, are derived
+// from a keyed hash of the contents of the function. The output of a pass
+// is then a pure function of the key, its options and the input: the same
+// compile gives bit-identical output on every run and on every machine, and
+// editing one function does not change the obfuscated code of the others.
+// This header is shared by the LLVM passes and the GCC plugins, so it only
+// depends on the C++11 standard library.
+//
+// The hash is 64-bit FNV-1a over the key and the fed values, each value as
+// its 8 little-endian bytes so that the host does not matter, finished with
+// the SplitMix64 mixer. It is not meant to resist an attacker who knows the
+// contents of the function, only to spread the constants.
+//
+
+#ifndef KOVID_HASH_H
+#define KOVID_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kovid {
+namespace hash {
+
+/// The SplitMix64 finalizer.
+inline uint64_t mix(uint64_t X) {
+  X ^= X >> 30;
+  X *= 0xbf58476d1ce4e5b9ULL;
+  X ^= X >> 27;
+  X *= 0x94d049bb133111ebULL;
+  return X ^ (X >> 31);
+}
+
+/// Accumulates the contents of one function, keyed.
+class Hasher {
+public:
+  explicit Hasher(const std::string &Key) {
+    addBytes(Key.data(), Key.size());
+    // Keep "ab" + "c" apart from "a" + "bc".
+    add(Key.size());
+  }
+
+  void add(uint64_t Value) {
+    for (int I = 0; I < 8; ++I)
+      step(static_cast<unsigned char>(Value >> (8 * I)));
+  }
+
+  void addBytes(const char *Data, size_t Size) {
+    for (size_t I = 0; I < Size; ++I)
+      step(static_cast<unsigned char>(Data[I]));
+  }
+
+  void add(const std::string &S) {
+    addBytes(S.data(), S.size());
+    add(S.size());
+  }
+
+  /// The seed of the function.
+  uint64_t finish() const { return mix(State); }
+
+private:
+  uint64_t State = 0xcbf29ce484222325ULL;
+
+  void step(unsigned char Byte) {
+    State ^= Byte;
+    State *= 0x100000001b3ULL;
+  }
+};
+
+/// The \p Index-th constant of the function with seed \p Seed.
+inline uint64_t derive(uint64_t Seed, uint64_t Index) {
+  return mix(Seed + (Index + 1) * 0x9e3779b97f4a7c15ULL);
+}
+
+} // namespace hash
+} // namespace kovid
+
+#endif // KOVID_HASH_H
@@ -0,0 +1,356 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// KoviD Selection Rules
+// ---------------------
+//
+// Which functions and globals each transform may touch. This header is shared
+// by the LLVM passes and the GCC plugins, so it only depends on the C++11
+// standard library and POSIX regular expressions.
+//
+// There are two sources of selection:
+//
+// * Annotations on the declarations, __attribute__((annotate("kovid_skip")))
+//   to leave a symbol alone entirely and annotate("kovid_heavy") to always
+//   obfuscate it, whatever the rules say, without the cheaper treatment of
+//   hot code.
+//
+// * A rules file, given with -kovid-rules=<file> (LLVM) or
+//   -fplugin-arg-<plugin>-rules=<file> (GCC):
+//
+//     # Comments start with '#'.
+//     [instruction-obf]          # the transform the rules below apply to,
+//     deny fast_path_*           # as named by -kovid-transforms, or "*"
+//     deny re:^simd_[a-z]+$      # for all of them
+//     [string-encryption]
+//     allow secret_*
+//
+//   A pattern is a glob ('*', '?' and '[...]') or, after "re:", an extended
+//   regular expression. It is matched against the symbol name and, for C++,
+//   the demangled name ("ns::f(int)"), both as they are before renaming. A
+//   symbol is transformed if no deny rule matches it and, when the transform
+//   has allow rules, one of them does.
+//
+// The patterns are compiled once, when the rules are loaded: exact names and
+// "prefix*" globs go into hash sets, the remaining globs are matched
+// without recursion, and all regular expressions of a list are joined into a
+// single regex_t. Checking a symbol does not depend on the
+// number of plain names and prefixes in the file.
+//
+
+#ifndef KOVID_RULES_H
+#define KOVID_RULES_H
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <regex.h>
+
+namespace kovid {
+namespace rules {
+
+enum Transform {
+  RenameCode,
+  DummyCodeInsertion,
+  InstructionObfuscation,
+  StringEncryption,
+  RemoveMetadataAndUnusedCode,
+  NumTransforms
+};
+
+/// The names used by -kovid-transforms and in rules file sections.
+inline const char *transformName(Transform T) {
+  static const char *const Names[NumTransforms] = {
+      "rename-code", "dummy-code-insertion", "instruction-obf",
+      "string-encryption", "metadata-unused-code-removal"};
+  return Names[T];
+}
+
+/// The annotations understood on functions and global variables.
+enum Annotation { None = 0, Skip = 1, Heavy = 2 };
+
+static const char SkipAnnotation[] = "kovid_skip";
+static const char HeavyAnnotation[] = "kovid_heavy";
+
+/// The Annotation that the annotate() string \p Str stands for.
+inline unsigned parseAnnotation(const char *Str, size_t Size) {
+  if (Size == sizeof(SkipAnnotation) - 1 &&
+      !std::memcmp(Str, SkipAnnotation, Size))
+    return Skip;
+  if (Size == sizeof(HeavyAnnotation) - 1 &&
+      !std::memcmp(Str, HeavyAnnotation, Size))
+    return Heavy;
+  return None;
+}
+
+/// Match \p Name against the glob \p Pattern. '*' backtracks only to the
+/// last star, which keeps the match linear in practice.
+inline bool globMatch(const std::string &Pattern, const std::string &Name) {
+  size_t P = 0, N = 0, StarP = std::string::npos, StarN = 0;
+  while (N < Name.size()) {
+    if (P < Pattern.size()) {
+      char C = Pattern[P];
+      if (C == '*') {
+        StarP = P++;
+        StarN = N;
+        continue;
+      }
+      if (C == '[') {
+        size_t End = Pattern.find(']', P + 2);
+        if (End != std::string::npos) {
+          bool Negate = Pattern[P + 1] == '!' || Pattern[P + 1] == '^';
+          bool Found = false;
+          for (size_t I = P + 1 + Negate; I < End; ++I) {
+            if (I + 2 < End && Pattern[I + 1] == '-') {
+              Found |= Name[N] >= Pattern[I] && Name[N] <= Pattern[I + 2];
+              I += 2;
+            } else {
+              Found |= Name[N] == Pattern[I];
+            }
+          }
+          if (Found != Negate) {
+            P = End + 1;
+            ++N;
+            continue;
+          }
+        } else if (Name[N] == C) {
+          ++P;
+          ++N;
+          continue;
+        }
+      } else if (C == '?' || C == Name[N]) {
+        ++P;
+        ++N;
+        continue;
+      }
+    }
+    if (StarP == std::string::npos)
+      return false;
+    P = StarP + 1;
+    N = ++StarN;
+  }
+  while (P < Pattern.size() && Pattern[P] == '*')
+    ++P;
+  return P == Pattern.size();
+}
+
+/// The compiled patterns of one allow or deny list.
+class PatternList {
+public:
+  PatternList() {}
+  PatternList(const PatternList &) = delete;
+  PatternList &operator=(const PatternList &) = delete;
+  ~PatternList() { clearRegex(); }
+
+  bool empty() const {
+    return Exact.empty() && Prefixes.empty() && Globs.empty() &&
+           Regexes.empty();
+  }
+
+  void add(const std::string &Pattern) {
+    if (Pattern.compare(0, 3, "re:") == 0) {
+      Regexes.push_back(Pattern.substr(3));
+      return;
+    }
+    size_t Meta = Pattern.find_first_of("*?[");
+    if (Meta == std::string::npos) {
+      Exact.insert(Pattern);
+    } else if (Meta == Pattern.size() - 1 && Pattern[Meta] == '*') {
+      Prefixes.insert(Pattern.substr(0, Meta));
+      PrefixSizes.insert(Meta);
+    } else {
+      Globs.push_back(Pattern);
+    }
+  }
+
+  /// Compile the regular expressions added so far. Returns false, with the
+  /// error in \p Error, if one of them is invalid.
+  bool compile(std::string &Error) {
+    clearRegex();
+    if (Regexes.empty())
+      return true;
+
+    // Check them one at a time first, for a precise error message.
+    for (size_t I = 0; I < Regexes.size(); ++I) {
+      regex_t Single;
+      int Status =
+          regcomp(&Single, Regexes[I].c_str(), REG_EXTENDED | REG_NOSUB);
+      if (Status != 0) {
+        char Message[256];
+        regerror(Status, &Single, Message, sizeof(Message));
+        Error = "invalid regular expression '" + Regexes[I] + "': " + Message;
+        return false;
+      }
+      regfree(&Single);
+    }
+
+    std::string Joined;
+    for (size_t I = 0; I < Regexes.size(); ++I)
+      Joined += (I ? "|(" : "(") + Regexes[I] + ")";
+    if (regcomp(&Regex, Joined.c_str(), REG_EXTENDED | REG_NOSUB) != 0) {
+      Error = "cannot compile the regular expressions";
+      return false;
+    }
+    HasRegex = true;
+    return true;
+  }
+
+  bool matches(const std::string &Name) const {
+    if (Exact.count(Name))
+      return true;
+    for (std::set<size_t>::const_iterator I = PrefixSizes.begin(),
+                                          E = PrefixSizes.end();
+         I != E && *I <= Name.size(); ++I)
+      if (Prefixes.count(Name.substr(0, *I)))
+        return true;
+    for (size_t I = 0; I < Globs.size(); ++I)
+      if (globMatch(Globs[I], Name))
+        return true;
+    return HasRegex && regexec(&Regex, Name.c_str(), 0, nullptr, 0) == 0;
+  }
+
+private:
+  std::unordered_set<std::string> Exact;
+  std::unordered_set<std::string> Prefixes;
+  std::set<size_t> PrefixSizes;
+  std::vector<std::string> Globs;
+  std::vector<std::string> Regexes;
+  regex_t Regex;
+  bool HasRegex = false;
+
+  void clearRegex() {
+    if (HasRegex)
+      regfree(&Regex);
+    HasRegex = false;
+  }
+};
+
+/// The allow and deny lists of every transform.
+class RuleSet {
+public:
+  bool empty() const { return Empty; }
+
+  /// Parse and compile the rules in \p Text. Returns false, with the error
+  /// and its line in \p Error, if they are malformed.
+  bool parse(const std::string &Text, std::string &Error) {
+    std::istringstream In(Text);
+    std::string Line;
+    // The transforms the current section applies to; none before the first.
+    int First = -1, Last = -1;
+    for (unsigned LineNo = 1; std::getline(In, Line); ++LineNo) {
+      size_t Hash = Line.find('#');
+      if (Hash != std::string::npos)
+        Line.erase(Hash);
+      size_t Begin = Line.find_first_not_of(" \t\r");
+      if (Begin == std::string::npos)
+        continue;
+      Line = Line.substr(Begin, Line.find_last_not_of(" \t\r") + 1 - Begin);
+
+      std::string Where = "line " + std::to_string(LineNo) + ": ";
+      if (Line[0] == '[') {
+        if (Line[Line.size() - 1] != ']') {
+          Error = Where + "expected ']'";
+          return false;
+        }
+        std::string Name = Line.substr(1, Line.size() - 2);
+        if (Name == "*") {
+          First = 0;
+          Last = NumTransforms - 1;
+          continue;
+        }
+        First = -1;
+        for (int T = 0; T < NumTransforms; ++T)
+          if (Name == transformName(Transform(T)))
+            First = Last = T;
+        if (First < 0) {
+          Error = Where + "unknown transform '" + Name + "'";
+          return false;
+        }
+        continue;
+      }
+
+      size_t Space = Line.find_first_of(" \t");
+      std::string Action = Line.substr(0, Space);
+      std::string Pattern;
+      if (Space != std::string::npos)
+        Pattern = Line.substr(Line.find_first_not_of(" \t", Space));
+      if ((Action != "allow" && Action != "deny") || Pattern.empty()) {
+        Error = Where + "expected 'allow <pattern>' or 'deny <pattern>'";
+        return false;
+      }
+      if (First < 0) {
+        Error = Where + "rule outside of a [transform] section";
+        return false;
+      }
+      for (int T = First; T <= Last; ++T)
+        (Action == "allow" ? Allow : Deny)[T].add(Pattern);
+      Empty = false;
+    }
+
+    for (int T = 0; T < NumTransforms; ++T)
+      if (!Allow[T].compile(Error) || !Deny[T].compile(Error))
+        return false;
+    return true;
+  }
+
+  /// Read and parse the rules file \p Path.
+  bool load(const std::string &Path, std::string &Error) {
+    std::ifstream In(Path.c_str());
+    if (!In) {
+      Error = "cannot open '" + Path + "'";
+      return false;
+    }
+    std::ostringstream Text;
+    Text << In.rdbuf();
+    if (!parse(Text.str(), Error)) {
+      Error = Path + ": " + Error;
+      return false;
+    }
+    return true;
+  }
+
+  /// Whether the rules let \p T transform the symbol called \p Name, also
+  /// known as \p Demangled if that is not empty.
+  bool allows(Transform T, const std::string &Name,
+              const std::string &Demangled = std::string()) const {
+    if (Empty)
+      return true;
+    if (Deny[T].matches(Name) ||
+        (!Demangled.empty() && Deny[T].matches(Demangled)))
+      return false;
+    return Allow[T].empty() || Allow[T].matches(Name) ||
+           (!Demangled.empty() && Allow[T].matches(Demangled));
+  }
+
+private:
+  PatternList Allow[NumTransforms];
+  PatternList Deny[NumTransforms];
+  bool Empty = true;
+};
+
+/// Annotations take precedence over the rules: kovid_skip symbols are never
+/// transformed and kovid_heavy ones always are.
+inline bool shouldTransform(const RuleSet &Rules, Transform T,
+                            unsigned Annotations, const std::string &Name,
+                            const std::string &Demangled = std::string()) {
+  if (Annotations & Skip)
+    return false;
+  if (Annotations & Heavy)
+    return true;
+  return Rules.allows(T, Name, Demangled);
+}
+
+} // namespace rules
+} // namespace kovid
+
+#endif // KOVID_RULES_H
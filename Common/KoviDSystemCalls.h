@@ -0,0 +1,78 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// KoviD System Call Wrappers
+// --------------------------
+//
+// The C library functions that hand the memory of a string argument to the
+// kernel as it is, without reading it first. The kernel does not raise a
+// fault for the program when it reads a no-access page, the call fails with
+// EFAULT instead, so the strings passed to these functions cannot be
+// decrypted a page at a time, on first touch. This header is shared by the
+// LLVM passes and the GCC plugins, so it only depends on the C++11 standard
+// library.
+//
+// The list is the usual glibc and musl wrappers that take a path, a name,
+// an argument vector or a buffer to write. The stdio functions that write a
+// string are included too: on an unbuffered stream, such as stderr, glibc
+// writes it straight from the caller's memory.
+//
+
+#ifndef KOVID_SYSTEM_CALLS_H
+#define KOVID_SYSTEM_CALLS_H
+
+#include <string>
+
+namespace kovid {
+
+/// Whether the C library function \p Name may pass the memory of a string
+/// argument to the kernel. The large file ("64"), fortified ("__*_2") and
+/// "_unlocked" variants of the functions count as the functions.
+inline bool passesStringsToKernel(const std::string &Name) {
+  static const char *const Wrappers[] = {
+      "syscall", "open", "openat", "creat", "fopen", "freopen", "opendir",
+      "access", "faccessat", "euidaccess", "eaccess", "stat", "lstat",
+      "fstatat", "statx", "statfs", "statvfs", "__xstat", "__lxstat",
+      "__fxstatat", "truncate", "execve", "execv", "execvp", "execvpe",
+      "execl", "execlp", "execle", "execveat", "fexecve", "posix_spawn",
+      "posix_spawnp", "system", "popen", "write", "pwrite", "writev",
+      "pwritev", "pwritev2", "send", "sendto", "sendmsg", "fputs", "fwrite",
+      "puts", "mkdir", "mkdirat", "rmdir", "unlink", "unlinkat", "remove",
+      "rename", "renameat", "renameat2", "link", "linkat", "symlink",
+      "symlinkat", "readlink", "readlinkat", "chdir", "chroot", "chmod",
+      "fchmodat", "chown", "lchown", "fchownat", "mknod", "mknodat",
+      "mkfifo", "mkfifoat", "utime", "utimes", "lutimes", "futimesat",
+      "utimensat", "mount", "umount", "umount2", "swapon", "swapoff", "acct",
+      "pivot_root", "setxattr", "lsetxattr", "fsetxattr", "getxattr",
+      "lgetxattr", "fgetxattr", "removexattr", "lremovexattr",
+      "fremovexattr", "listxattr", "llistxattr", "inotify_add_watch",
+      "fanotify_mark", "name_to_handle_at", "memfd_create", "dlopen",
+      "dlmopen", "bind", "connect", "sethostname", "setdomainname", "prctl",
+      "pthread_setname_np"};
+
+  std::string Base = Name;
+  // __open_2, __openat64_2, ...
+  if (Base.size() > 4 && Base.compare(0, 2, "__") == 0 &&
+      Base.compare(Base.size() - 2, 2, "_2") == 0)
+    Base = Base.substr(2, Base.size() - 4);
+  static const char Unlocked[] = "_unlocked";
+  size_t UnlockedSize = sizeof(Unlocked) - 1;
+  if (Base.size() > UnlockedSize &&
+      Base.compare(Base.size() - UnlockedSize, UnlockedSize, Unlocked) == 0)
+    Base.resize(Base.size() - UnlockedSize);
+  if (Base.size() > 2 && Base.compare(Base.size() - 2, 2, "64") == 0)
+    Base.resize(Base.size() - 2);
+
+  for (const char *Wrapper : Wrappers)
+    if (Base == Wrapper)
+      return true;
+  return false;
+}
+
+} // namespace kovid
+
+#endif // KOVID_SYSTEM_CALLS_H
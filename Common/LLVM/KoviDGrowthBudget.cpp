@@ -0,0 +1,142 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+//
+// The code-growth budget of the LLVM passes. See KoviDBudget.h for the cost
+// model.
+//
+
+#include "KoviDGrowthBudget.h"
+#include "KoviDOptions.h"
+#include "KoviDSelection.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Passes/PassBuilder.h"
+
+#include <map>
+#include <mutex>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "kovid-budget"
+
+STATISTIC(NumGrowthRefused, "Number of rewrites refused by the growth budget");
+
+static cl::opt<unsigned> &MaxFunctionGrowth = kovid::getSharedOption<unsigned>(
+    "kovid-max-function-growth",
+    cl::desc("Largest growth of a function by the KoviD transforms, in "
+             "percent of its size (0 for no limit)"),
+    cl::value_desc("percent"), cl::init(0));
+
+static cl::opt<unsigned> &MaxModuleGrowth = kovid::getSharedOption<unsigned>(
+    "kovid-max-module-growth",
+    cl::desc("Largest growth of a module by the KoviD transforms, in percent "
+             "of its size (0 for no limit)"),
+    cl::value_desc("percent"), cl::init(0));
+
+namespace kovid {
+namespace detail {
+
+/// The budgets of the modules being transformed, until GrowthBudgetAnalysis
+/// releases them. The registered options are the only state all plugins
+/// share (see KoviDOptions.h), so they are kept in a hidden option.
+struct GrowthBudgets : cl::opt<bool> {
+  using cl::opt<bool>::opt;
+
+  std::mutex Mutex;
+  std::map<const Module *,
+           std::pair<std::string, std::shared_ptr<GrowthBudget>>>
+      Budgets;
+};
+
+} // namespace detail
+} // namespace kovid
+
+static kovid::detail::GrowthBudgets &SharedBudgets =
+    kovid::detail::getSharedOptionOf<kovid::detail::GrowthBudgets>(
+        "kovid-growth-budgets", cl::ReallyHidden);
+
+kovid::GrowthBudget::GrowthBudget() {
+  Budget.Limit.FunctionPercent = MaxFunctionGrowth;
+  Budget.Limit.ModulePercent = MaxModuleGrowth;
+}
+
+std::shared_ptr<kovid::GrowthBudget>
+kovid::GrowthBudget::get(const Module &M) {
+  std::lock_guard<std::mutex> Lock(SharedBudgets.Mutex);
+  auto &Entry = SharedBudgets.Budgets[&M];
+  if (!Entry.second || Entry.first != M.getModuleIdentifier()) {
+    Entry.first = M.getModuleIdentifier();
+    Entry.second = std::make_shared<GrowthBudget>();
+  }
+  return Entry.second;
+}
+
+void kovid::GrowthBudget::release(const Module *M) {
+  if (!M)
+    return;
+  std::lock_guard<std::mutex> Lock(SharedBudgets.Mutex);
+  SharedBudgets.Budgets.erase(M);
+}
+
+AnalysisKey kovid::GrowthBudgetAnalysis::Key;
+
+void kovid::registerGrowthBudgetAnalysis(PassBuilder &PB) {
+  PB.registerAnalysisRegistrationCallback([](ModuleAnalysisManager &MAM) {
+    MAM.registerPass([] { return GrowthBudgetAnalysis(); });
+  });
+}
+
+bool kovid::GrowthBudget::charge(const Function &F, rules::Transform T,
+                                 uint64_t Cost) {
+  const Module *M = F.getParent();
+  if (M != CurrentModule) {
+    uint64_t Size = 0;
+    for (const Function &G : *M)
+      Size += G.getInstructionCount();
+    Budget.beginModule(Size);
+    CurrentModule = M;
+    Accounts.clear();
+  }
+  auto It = Accounts.find(&F);
+  if (It == Accounts.end())
+    It = Accounts.insert({&F, budget::Account(F.getInstructionCount())}).first;
+
+  if (Budget.charge(It->second, T, Cost, isHeavy(F)))
+    return true;
+  ++NumGrowthRefused;
+  return false;
+}
+
+void kovid::GrowthBudget::emitReport(const Function &F,
+                                     OptimizationRemarkEmitter &ORE) const {
+  auto It = Accounts.find(&F);
+  if (It == Accounts.end())
+    return;
+  const budget::Account &Account = It->second;
+  ORE.emit([&]() {
+    OptimizationRemarkAnalysis R(DEBUG_TYPE, "GrowthBudget", &F);
+    R << "grew by " << ore::NV("Growth", Account.spent())
+      << " instructions from " << ore::NV("Size", Account.Size);
+    if (Budget.Limit.FunctionPercent)
+      R << " (limit "
+        << ore::NV("Limit", budget::allowance(Account.Size,
+                                              Budget.Limit.FunctionPercent))
+        << ")";
+    for (int T = 0; T < rules::NumTransforms; ++T)
+      if (Account.Spent[T] || Account.Denied[T]) {
+        R << "; " << rules::transformName(rules::Transform(T)) << " "
+          << ore::NV("Spent", Account.Spent[T]);
+        if (Account.Denied[T])
+          R << ", " << ore::NV("Refused", Account.Denied[T]) << " refused";
+      }
+    R << "; the module grew by "
+      << ore::NV("ModuleGrowth", Budget.moduleSpent()) << " from "
+      << ore::NV("ModuleSize", Budget.moduleSize());
+    return R;
+  });
+}
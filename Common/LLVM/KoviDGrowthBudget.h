@@ -0,0 +1,112 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_GROWTHBUDGET_H
+#define KOVID_GROWTHBUDGET_H
+
+#include "KoviDBudget.h"
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IR/ValueMap.h"
+
+#include <memory>
+
+namespace llvm {
+class OptimizationRemarkEmitter;
+class PassBuilder;
+} // namespace llvm
+
+namespace kovid {
+
+/// The code-growth budget of the module being transformed, with the limits
+/// of -kovid-max-function-growth and -kovid-max-module-growth. One instance
+/// is shared by the transforms of a pipeline, and get() gives the instance
+/// of a module that all KoviD plugins loaded into the compiler share. See
+/// KoviDBudget.h for the cost model.
+class GrowthBudget {
+public:
+  GrowthBudget();
+
+  /// The budget of \p M, created on first use, that the passes of every
+  /// loaded KoviD plugin charge, so that the limits hold for all of them
+  /// together. It is kept until the pipeline is done with \p M, see
+  /// GrowthBudgetAnalysis. The budget of a module is told apart from that of
+  /// an earlier one at the same address by the module identifier.
+  static std::shared_ptr<GrowthBudget> get(const llvm::Module &M);
+
+  /// Drop the budget of \p M, if it has one.
+  static void release(const llvm::Module *M);
+
+  /// Try to spend \p Cost instructions of growth of \p F on \p T. The sizes
+  /// of \p F and of its module are taken the first time one of them is
+  /// charged, so call it before rewriting. kovid_heavy functions are always
+  /// granted.
+  bool charge(const llvm::Function &F, rules::Transform T, uint64_t Cost);
+
+  /// Report, as an analysis remark, what \p F spent and what it was refused.
+  /// Nothing is reported for a function that was not charged.
+  void emitReport(const llvm::Function &F,
+                  llvm::OptimizationRemarkEmitter &ORE) const;
+
+private:
+  /// The accounts are dropped with their function, so that a function that
+  /// is created later at the same address, e.g. between the extension
+  /// points, starts with an account of its own. A replaced function keeps
+  /// its account: it is only replaced by a function through a cast.
+  struct AccountMapConfig : llvm::ValueMapConfig<const llvm::Function *> {
+    enum { FollowRAUW = false };
+  };
+
+  budget::Budget Budget;
+  const llvm::Module *CurrentModule = nullptr;
+  /// The accounts of the functions charged so far, which the passes may
+  /// visit in turn, one pass over all functions after the other.
+  llvm::ValueMap<const llvm::Function *, budget::Account, AccountMapConfig>
+      Accounts;
+};
+
+/// Keeps the budget of a module for as long as the module analysis manager
+/// holds the result, which is the whole pipeline: the result is never
+/// invalidated, and the budget is released when the analysis manager drops
+/// it. The plugins require it at the early simplification EP, before any of
+/// their transforms run. A module whose pipeline does not require it keeps
+/// its budget until the process exits.
+class GrowthBudgetAnalysis
+    : public llvm::AnalysisInfoMixin<GrowthBudgetAnalysis> {
+public:
+  class Result {
+  public:
+    explicit Result(const llvm::Module &M) : M(&M) {}
+    Result(Result &&Other) : M(Other.M) { Other.M = nullptr; }
+    Result(const Result &) = delete;
+    ~Result() { GrowthBudget::release(M); }
+
+    bool invalidate(llvm::Module &, const llvm::PreservedAnalyses &,
+                    llvm::ModuleAnalysisManager::Invalidator &) {
+      return false;
+    }
+
+  private:
+    const llvm::Module *M;
+  };
+
+  Result run(llvm::Module &M, llvm::ModuleAnalysisManager &) {
+    return Result(M);
+  }
+
+private:
+  friend llvm::AnalysisInfoMixin<GrowthBudgetAnalysis>;
+  static llvm::AnalysisKey Key;
+};
+
+/// Register GrowthBudgetAnalysis with the module analyses of \p PB.
+void registerGrowthBudgetAnalysis(llvm::PassBuilder &PB);
+
+} // namespace kovid
+
+#endif // KOVID_GROWTHBUDGET_H
@@ -0,0 +1,83 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_OPTIONS_H
+#define KOVID_OPTIONS_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <string>
+
+namespace kovid {
+
+namespace detail {
+
+/// The name of \p T, as the compiler spells it, e.g. "unsigned int".
+template <typename T> llvm::StringRef typeName() {
+  llvm::StringRef Name = __PRETTY_FUNCTION__;
+  size_t Start = Name.find("T = ");
+  if (Start == llvm::StringRef::npos)
+    return Name;
+  Name = Name.drop_front(Start + 4);
+  return Name.take_until([](char C) { return C == ';' || C == ']'; });
+}
+
+/// Registers the option \p Name of type OptT in the first plugin to ask for
+/// it, and returns that registration to the others. The registered options
+/// are the only state all plugins share, so the type is recorded there too,
+/// as a hidden option named after the option and its type; an option found
+/// without the marker of the expected type was registered with another type
+/// (or by a plugin that predates the marker), and using it would be
+/// undefined behavior.
+template <typename OptT, typename... Mods>
+OptT &getSharedOptionOf(llvm::StringRef Name, const Mods &...Ms) {
+  llvm::StringMap<llvm::cl::Option *> &Options =
+      llvm::cl::getRegisteredOptions();
+  // Leaked, like the options themselves.
+  std::string *Marker = new std::string(
+      ("kovid-option-type:" + Name + ":" + typeName<OptT>()).str());
+
+  auto It = Options.find(Name);
+  if (It != Options.end()) {
+    if (!Options.count(*Marker))
+      llvm::report_fatal_error(
+          llvm::Twine("KoviD option '") + Name +
+          "' is already registered with another type; the loaded KoviD "
+          "plugins were built from different sources");
+    delete Marker;
+    return *static_cast<OptT *>(It->second);
+  }
+
+  new llvm::cl::opt<bool>(llvm::StringRef(*Marker), llvm::cl::ReallyHidden);
+  return *new OptT(Name, Ms...);
+}
+
+} // namespace detail
+
+/// The command line option \p Name of the KoviD libraries. Every KoviD
+/// plugin links them, and several plugins may be loaded into the same
+/// compiler. The first one registers the option and the others use that
+/// registration, instead of failing on a duplicate option; a registration
+/// of another type is a fatal error. Call it from a static initializer, so
+/// the option exists before the command line is parsed.
+template <typename T, typename... Mods>
+llvm::cl::opt<T> &getSharedOption(llvm::StringRef Name, const Mods &...Ms) {
+  return detail::getSharedOptionOf<llvm::cl::opt<T>>(Name, Ms...);
+}
+
+/// Same as getSharedOption, for an option that is given any number of
+/// values.
+template <typename T, typename... Mods>
+llvm::cl::list<T> &getSharedList(llvm::StringRef Name, const Mods &...Ms) {
+  return detail::getSharedOptionOf<llvm::cl::list<T>>(Name, Ms...);
+}
+
+} // namespace kovid
+
+#endif // KOVID_OPTIONS_H
@@ -0,0 +1,128 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+//
+// Where the transforms run. By default the plugins register at the early
+// simplification EP, so the optimizer runs over the obfuscated code and
+// the injected operations get in the way of inlining, LICM and
+// vectorization. -kovid-extension-point moves all or some of the transforms
+// to the vectorizer start EP or to the optimizer last EP, where they see
+// IR that is already optimized:
+//
+//   -kovid-extension-point=optimizer-last
+//   -kovid-extension-point=instruction-obf=optimizer-last,vectorizer-start
+//
+// An entry without a transform, vectorizer-start in the second example,
+// applies to the transforms that have none.
+//
+
+#include "KoviDPipeline.h"
+#include "KoviDOptions.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+static cl::opt<std::string> &ExtensionPoints =
+    kovid::getSharedOption<std::string>(
+        "kovid-extension-point",
+        cl::desc("Where the KoviD transforms run: early-simplification "
+                 "(the default), vectorizer-start or optimizer-last, for all "
+                 "transforms or as a list of <transform>=<point>"),
+        cl::value_desc("[transform=]point,..."));
+
+static bool parseExtensionPoint(StringRef Name, kovid::ExtensionPoint &EP) {
+  if (Name == "early-simplification")
+    EP = kovid::ExtensionPoint::EarlySimplification;
+  else if (Name == "vectorizer-start")
+    EP = kovid::ExtensionPoint::VectorizerStart;
+  else if (Name == "optimizer-last")
+    EP = kovid::ExtensionPoint::OptimizerLast;
+  else
+    return false;
+  return true;
+}
+
+/// The extension point of every transform, parsed the first time it is
+/// needed.
+static const kovid::ExtensionPoint *getExtensionPoints() {
+  static kovid::ExtensionPoint *Points = [] {
+    auto *P = new kovid::ExtensionPoint[kovid::rules::NumTransforms];
+    bool Explicit[kovid::rules::NumTransforms] = {};
+    kovid::ExtensionPoint Default = kovid::ExtensionPoint::EarlySimplification;
+
+    SmallVector<StringRef, 8> Entries;
+    StringRef(ExtensionPoints).split(Entries, ',', -1, /*KeepEmpty=*/false);
+    for (StringRef Entry : Entries) {
+      StringRef Transform, Point = Entry.trim();
+      if (Point.contains('='))
+        std::tie(Transform, Point) = Point.split('=');
+
+      kovid::ExtensionPoint EP;
+      if (!parseExtensionPoint(Point, EP))
+        report_fatal_error("-kovid-extension-point: unknown extension point '" +
+                               Point + "'",
+                           /*gen_crash_diag=*/false);
+      if (Transform.empty()) {
+        Default = EP;
+        continue;
+      }
+
+      int T = 0;
+      while (T < kovid::rules::NumTransforms &&
+             Transform != transformName(kovid::rules::Transform(T)))
+        ++T;
+      if (T == kovid::rules::NumTransforms)
+        report_fatal_error("-kovid-extension-point: unknown transform '" +
+                               Transform + "'",
+                           /*gen_crash_diag=*/false);
+      P[T] = EP;
+      Explicit[T] = true;
+    }
+
+    for (int T = 0; T < kovid::rules::NumTransforms; ++T)
+      if (!Explicit[T])
+        P[T] = Default;
+    return P;
+  }();
+  return Points;
+}
+
+kovid::ExtensionPoint kovid::getExtensionPoint(rules::Transform T) {
+  return getExtensionPoints()[T];
+}
+
+void kovid::registerTransformPasses(PassBuilder &PB, rules::Transform T,
+                                    TransformPasses Passes) {
+  auto AddFunctionPasses = [Passes](ModulePassManager &MPM) {
+    FunctionPassManager FPM;
+    Passes.Run(FPM);
+    MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+    if (Passes.Finish)
+      Passes.Finish(MPM);
+  };
+
+  PB.registerPipelineEarlySimplificationEPCallback(
+      [=](ModulePassManager &MPM, auto) {
+        if (Passes.Setup)
+          Passes.Setup(MPM);
+        if (getExtensionPoint(T) == ExtensionPoint::EarlySimplification)
+          AddFunctionPasses(MPM);
+      });
+  PB.registerVectorizerStartEPCallback([=](FunctionPassManager &FPM, auto) {
+    if (getExtensionPoint(T) == ExtensionPoint::VectorizerStart)
+      Passes.Run(FPM);
+  });
+  PB.registerOptimizerLastEPCallback([=](ModulePassManager &MPM, auto) {
+    if (getExtensionPoint(T) == ExtensionPoint::OptimizerLast)
+      AddFunctionPasses(MPM);
+    else if (getExtensionPoint(T) == ExtensionPoint::VectorizerStart &&
+             Passes.Finish)
+      Passes.Finish(MPM);
+  });
+}
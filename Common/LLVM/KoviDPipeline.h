@@ -0,0 +1,51 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_PIPELINE_H
+#define KOVID_PIPELINE_H
+
+#include "KoviDRules.h"
+
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+
+#include <functional>
+
+namespace kovid {
+
+/// Where in the optimization pipeline a transform runs.
+enum class ExtensionPoint {
+  /// Before the optimizer, which then cleans up after the transform.
+  EarlySimplification,
+  /// After the loop passes and the inliner, before the vectorizers.
+  VectorizerStart,
+  /// On the optimized, vectorized IR, just before code generation.
+  OptimizerLast
+};
+
+/// The extension point of \p T, as chosen with -kovid-extension-point.
+/// Defaults to EarlySimplification.
+ExtensionPoint getExtensionPoint(rules::Transform T);
+
+/// The passes a standalone plugin runs for one transform.
+struct TransformPasses {
+  /// Module passes that run at the early simplification EP, wherever the
+  /// transform itself runs, e.g. ApplyAnnotationsPass.
+  std::function<void(llvm::ModulePassManager &)> Setup;
+  /// The function passes of the transform.
+  std::function<void(llvm::FunctionPassManager &)> Run;
+  /// Module passes that run after the function passes (at the optimizer
+  /// last EP if those run at the vectorizer start one), or none.
+  std::function<void(llvm::ModulePassManager &)> Finish;
+};
+
+/// Register \p Passes of \p T at the extension point chosen for it.
+void registerTransformPasses(llvm::PassBuilder &PB, rules::Transform T,
+                             TransformPasses Passes);
+
+} // namespace kovid
+
+#endif // KOVID_PIPELINE_H
@@ -0,0 +1,116 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+//
+// The content-keyed seeds of the per-function constants. See KoviDHash.h.
+//
+
+#include "KoviDSeed.h"
+#include "KoviDOptions.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/IntrinsicInst.h"
+
+using namespace llvm;
+
+#ifndef KOVID_SEED_KEY
+#define KOVID_SEED_KEY "default_key"
+#endif
+
+static cl::opt<std::string> &SeedKey = kovid::getSharedOption<std::string>(
+    "kovid-seed-key",
+    cl::desc("Key of the hash the per-function constants of the KoviD "
+             "transforms are derived from (default: the key generated when "
+             "the plugins were built)"),
+    cl::value_desc("key"), cl::init(KOVID_SEED_KEY));
+
+namespace {
+
+/// Feeds the contents of one function to a Hasher. Arguments, blocks and
+/// instructions are identified by their position in the function.
+class FunctionHasher {
+public:
+  FunctionHasher(const Function &F, kovid::hash::Hasher &H) : H(H) {
+    for (const Argument &A : F.args())
+      Numbers[&A] = Numbers.size();
+    for (const BasicBlock &BB : F) {
+      Numbers[&BB] = Numbers.size();
+      for (const Instruction &I : BB)
+        if (!isa<DbgInfoIntrinsic>(I))
+          Numbers[&I] = Numbers.size();
+    }
+  }
+
+  void addFunction(const Function &F) {
+    addType(F.getFunctionType());
+    for (const BasicBlock &BB : F) {
+      for (const Instruction &I : BB)
+        if (!isa<DbgInfoIntrinsic>(I))
+          addInstruction(I);
+      // Keep the block boundaries apart. Not the size of the block, which
+      // counts the debug intrinsics.
+      H.add(~0ULL);
+    }
+  }
+
+private:
+  kovid::hash::Hasher &H;
+  DenseMap<const Value *, unsigned> Numbers;
+
+  void addType(const Type *Ty) {
+    H.add(Ty->getTypeID());
+    if (Ty->isIntegerTy())
+      H.add(Ty->getIntegerBitWidth());
+    else if (auto *VTy = dyn_cast<VectorType>(Ty))
+      H.add(VTy->getElementCount().getKnownMinValue());
+    else if (auto *ATy = dyn_cast<ArrayType>(Ty))
+      H.add(ATy->getNumElements());
+    for (const Type *Sub : Ty->subtypes())
+      addType(Sub);
+  }
+
+  void addValue(const Value *V) {
+    auto It = Numbers.find(V);
+    if (It != Numbers.end()) {
+      H.add(1);
+      H.add(It->second);
+    } else if (auto *CI = dyn_cast<ConstantInt>(V)) {
+      H.add(2);
+      const APInt &Value = CI->getValue();
+      H.add(Value.getBitWidth());
+      for (unsigned I = 0; I < Value.getNumWords(); ++I)
+        H.add(Value.getRawData()[I]);
+    } else if (auto *GV = dyn_cast<GlobalValue>(V)) {
+      H.add(3);
+      H.add(GV->getName().str());
+    } else {
+      H.add(4);
+      H.add(V->getValueID());
+    }
+  }
+
+  void addInstruction(const Instruction &I) {
+    H.add(I.getOpcode());
+    addType(I.getType());
+    if (auto *Cmp = dyn_cast<CmpInst>(&I))
+      H.add(Cmp->getPredicate());
+    H.add(I.getNumOperands());
+    for (const Value *Op : I.operands())
+      addValue(Op);
+  }
+};
+
+} // end anonymous namespace
+
+uint64_t kovid::functionSeed(const Function &F, rules::Transform T) {
+  hash::Hasher H(SeedKey);
+  H.add(T);
+  FunctionHasher(F, H).addFunction(F);
+  return H.finish();
+}
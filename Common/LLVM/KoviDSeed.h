@@ -0,0 +1,28 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_SEED_H
+#define KOVID_SEED_H
+
+#include "KoviDHash.h"
+#include "KoviDRules.h"
+
+#include "llvm/IR/Function.h"
+
+#include <cstdint>
+
+namespace kovid {
+
+/// The seed of the per-function constants of \p T in \p F: a hash, keyed
+/// with -kovid-seed-key, of the instructions of \p F, their types and their
+/// constant operands. It does not depend on value names, debug info or any
+/// other function, so it only changes when the code of \p F does. Derive
+/// the constants from it with hash::derive.
+uint64_t functionSeed(const llvm::Function &F, rules::Transform T);
+
+} // namespace kovid
+
+#endif // KOVID_SEED_H
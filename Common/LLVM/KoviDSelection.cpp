@@ -0,0 +1,125 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+//
+// Selective obfuscation for the LLVM passes: the kovid_* annotations and
+// the -kovid-rules file. See KoviDRules.h for the rules format.
+//
+
+#include "KoviDSelection.h"
+#include "KoviDOptions.h"
+
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "kovid-selection"
+
+static cl::opt<std::string> &RulesFile = kovid::getSharedOption<std::string>(
+    "kovid-rules",
+    cl::desc("File of allow/deny rules that select the functions and globals "
+             "each KoviD transform applies to"),
+    cl::value_desc("file"));
+
+/// The rules, compiled the first time they are needed.
+static const kovid::rules::RuleSet &getRules() {
+  static const kovid::rules::RuleSet *Rules = [] {
+    auto *R = new kovid::rules::RuleSet();
+    std::string Error;
+    if (!RulesFile.empty() && !R->load(RulesFile, Error))
+      report_fatal_error(Twine("-kovid-rules: ") + Error,
+                         /*gen_crash_diag=*/false);
+    return R;
+  }();
+  return *Rules;
+}
+
+static unsigned getAnnotations(const GlobalValue &GV) {
+  unsigned Annotations = kovid::rules::None;
+  if (auto *F = dyn_cast<Function>(&GV)) {
+    if (F->hasFnAttribute(kovid::rules::SkipAnnotation))
+      Annotations |= kovid::rules::Skip;
+    if (F->hasFnAttribute(kovid::rules::HeavyAnnotation))
+      Annotations |= kovid::rules::Heavy;
+  } else if (auto *Var = dyn_cast<GlobalVariable>(&GV)) {
+    if (Var->hasAttribute(kovid::rules::SkipAnnotation))
+      Annotations |= kovid::rules::Skip;
+    if (Var->hasAttribute(kovid::rules::HeavyAnnotation))
+      Annotations |= kovid::rules::Heavy;
+  }
+  return Annotations;
+}
+
+bool kovid::applyAnnotations(Module &M) {
+  GlobalVariable *GA = M.getNamedGlobal("llvm.global.annotations");
+  if (!GA || !GA->hasInitializer())
+    return false;
+  auto *Entries = dyn_cast<ConstantArray>(GA->getInitializer());
+  if (!Entries)
+    return false;
+
+  bool Changed = false;
+  for (const Use &Op : Entries->operands()) {
+    // { annotated value, annotation string, file, line[, arguments] }
+    auto *Entry = dyn_cast<ConstantStruct>(Op.get());
+    if (!Entry || Entry->getNumOperands() < 2)
+      continue;
+    auto *Str = dyn_cast<GlobalVariable>(
+        Entry->getOperand(1)->stripPointerCasts());
+    auto *Data = Str && Str->hasInitializer()
+                     ? dyn_cast<ConstantDataSequential>(Str->getInitializer())
+                     : nullptr;
+    if (!Data || !Data->isCString())
+      continue;
+    StringRef Annotation = Data->getAsCString();
+    if (!rules::parseAnnotation(Annotation.data(), Annotation.size()))
+      continue;
+
+    Value *Annotated = Entry->getOperand(0)->stripPointerCasts();
+    LLVM_DEBUG(dbgs() << "Annotation " << Annotation << " on "
+                      << Annotated->getName() << "\n");
+    if (auto *F = dyn_cast<Function>(Annotated)) {
+      Changed |= !F->hasFnAttribute(Annotation);
+      F->addFnAttr(Annotation);
+    } else if (auto *Var = dyn_cast<GlobalVariable>(Annotated)) {
+      Changed |= !Var->hasAttribute(Annotation);
+      Var->addAttribute(Annotation);
+    }
+  }
+  return Changed;
+}
+
+bool kovid::shouldTransform(const GlobalValue &GV, rules::Transform T) {
+  unsigned Annotations = getAnnotations(GV);
+  const rules::RuleSet &Rules = getRules();
+  if (Annotations || Rules.empty())
+    return rules::shouldTransform(Rules, T, Annotations, "");
+
+  std::string Name = GV.getName().str();
+  std::string Demangled;
+  if (StringRef(Name).startswith("_Z")) {
+    Demangled = demangle(Name);
+    if (Demangled == Name)
+      Demangled.clear();
+  }
+  return rules::shouldTransform(Rules, T, Annotations, Name, Demangled);
+}
+
+bool kovid::isHeavy(const GlobalValue &GV) {
+  return getAnnotations(GV) & rules::Heavy;
+}
+
+PreservedAnalyses kovid::ApplyAnnotationsPass::run(Module &M,
+                                                   ModuleAnalysisManager &) {
+  if (!applyAnnotations(M))
+    return PreservedAnalyses::all();
+  return PreservedAnalyses::none();
+}
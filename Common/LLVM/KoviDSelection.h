@@ -0,0 +1,39 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_SELECTION_H
+#define KOVID_SELECTION_H
+
+#include "KoviDRules.h"
+
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+
+namespace kovid {
+
+/// Copy the kovid_skip and kovid_heavy entries of llvm.global.annotations to
+/// "kovid_skip" and "kovid_heavy" attributes of the functions and variables
+/// they annotate, so the passes can check them in constant time. Returns true
+/// if any attribute was added.
+bool applyAnnotations(llvm::Module &M);
+
+/// Whether \p T may transform \p GV, given its kovid_* attributes and the
+/// rules file named by -kovid-rules.
+bool shouldTransform(const llvm::GlobalValue &GV, rules::Transform T);
+
+/// Whether \p GV was annotated kovid_heavy: it is always transformed and
+/// gets no cheaper treatment in hot code.
+bool isHeavy(const llvm::GlobalValue &GV);
+
+/// Runs applyAnnotations, ahead of the function passes.
+struct ApplyAnnotationsPass : llvm::PassInfoMixin<ApplyAnnotationsPass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+} // namespace kovid
+
+#endif // KOVID_SELECTION_H
@@ -0,0 +1,45 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+//
+// The time-trace entries of the transforms. LLVM already traces every pass,
+// but the combined pass runs all transforms under one name and each
+// transform has phases of its own, so the entries here say which transform,
+// which phase and how many items the time went to. The names are fixed, so
+// that a trace aggregated over a whole build adds them up per transform and
+// phase, and the counts are in the detail.
+//
+
+#include "KoviDTimeTrace.h"
+
+#include "llvm/Support/TimeProfiler.h"
+
+#include <string>
+
+using namespace llvm;
+
+kovid::TransformTimeScope::TransformTimeScope(rules::Transform T,
+                                              StringRef Phase, StringRef Unit,
+                                              uint64_t Count, StringRef Items)
+    : Active(getTimeTraceProfilerInstance() != nullptr) {
+  if (!Active)
+    return;
+  std::string Name = "KoviD ";
+  Name += transformName(T);
+  if (!Phase.empty())
+    Name += (": " + Phase).str();
+  timeTraceProfilerBegin(Name, [&] {
+    std::string Detail = Unit.str();
+    if (!Items.empty())
+      Detail += " (" + std::to_string(Count) + " " + Items.str() + ")";
+    return Detail;
+  });
+}
+
+kovid::TransformTimeScope::~TransformTimeScope() {
+  if (Active)
+    timeTraceProfilerEnd();
+}
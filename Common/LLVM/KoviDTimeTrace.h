@@ -0,0 +1,43 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_TIMETRACE_H
+#define KOVID_TIMETRACE_H
+
+#include "KoviDRules.h"
+
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+
+namespace kovid {
+
+/// A time-trace entry of transform \p T, for -ftime-trace (clang) and
+/// -time-trace (opt). It is named "KoviD <transform>", or
+/// "KoviD <transform>: <phase>" for a phase of it, and its detail is the
+/// function or module the entry is about, followed by "(<N> <items>)" if
+/// \p Items is given, e.g.
+///
+///   KoviD instruction-obf: rewrite    main (12 candidates)
+///
+/// Nothing is done unless a trace is being recorded.
+class TransformTimeScope {
+public:
+  TransformTimeScope(rules::Transform T, llvm::StringRef Phase,
+                     llvm::StringRef Unit, uint64_t Count = 0,
+                     llvm::StringRef Items = "");
+  ~TransformTimeScope();
+
+  TransformTimeScope(const TransformTimeScope &) = delete;
+  TransformTimeScope &operator=(const TransformTimeScope &) = delete;
+
+private:
+  bool Active;
+};
+
+} // namespace kovid
+
+#endif // KOVID_TIMETRACE_H
@@ -6,6 +6,19 @@
  * two statements, EXCEPT it specifically checks if the function
  * is named "a" and skips it (to avoid a known ICE).
  *
+ * With -fplugin-arg-<plugin>-placement=cold the dummy statements go to a
+ * cold block instead of the first one, so the hot path does not pay for
+ * them. The pass runs right after "cfg", before the profile is estimated,
+ * so the cold blocks mostly come from the source: calls to cold and
+ * noreturn functions, __builtin_expect and [[unlikely]]. The block counts
+ * are used when they are already known.
+ *
+ * The value stored to the dummy variable and the offset added to and
+ * subtracted from it are derived from a keyed hash of the function (see
+ * Common/GCC/KoviDSeed.h), so they differ between functions but not
+ * between builds. Both are below 2^16, so the int arithmetic cannot
+ * overflow.
+ *
  * Author: djolertrk
  * License: Apache v2.0 with LLVM-exception
  */
@@ -28,16 +41,231 @@
 #include "diagnostic.h"
 #include "print-tree.h"
 #include "opts.h"
-
+#include "dumpfile.h"
+#include "statistics.h"
+#include "predict.h"
+#include "attribs.h"
+
+#include "DummyCodeInsertion.h"
+#include "KoviDSelection.h"
+#include "KoviDGrowthBudget.h"
+#include "KoviDSeed.h"
+#include "KoviDTimevar.h"
+
+#ifndef KOVID_COMBINED_PLUGIN
 int plugin_is_GPL_compatible;
+#endif
+
+#ifndef STR_GCC_CRYPTO_KEY
+#define STR_GCC_CRYPTO_KEY "default_key"
+#endif
 extern struct gcc_options global_options;
 
+// Blocks run at most 1/cold_ratio as often as the entry block are cold.
+static const int cold_ratio = 8;
+
+// Whether bb calls a cold or noreturn function (error paths), holds an
+// unlikely prediction, or is never run according to the profile.
+static bool is_marked_cold(function *fun, basic_block bb) {
+  if (bb->count.initialized_p() && probably_never_executed_bb_p(fun, bb))
+    return true;
+  for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+       gsi_next(&gsi)) {
+    gimple *stmt = gsi_stmt(gsi);
+    if (gimple_code(stmt) == GIMPLE_PREDICT &&
+        gimple_predict_outcome(stmt) == NOT_TAKEN)
+      return true;
+    if (!is_gimple_call(stmt))
+      continue;
+    if (gimple_call_flags(stmt) & ECF_NORETURN)
+      return true;
+    tree callee = gimple_call_fndecl(stmt);
+    if (callee && lookup_attribute("cold", DECL_ATTRIBUTES(callee)))
+      return true;
+  }
+  return false;
+}
+
+// The block that the __builtin_expect hint of the condition ending bb says
+// is unlikely, if it is only reached from bb.
+static basic_block unexpected_successor(basic_block bb) {
+  gcond *cond = safe_dyn_cast<gcond *>(last_stmt(bb));
+  if (!cond || (gimple_cond_code(cond) != EQ_EXPR &&
+                gimple_cond_code(cond) != NE_EXPR))
+    return NULL;
+  tree lhs = gimple_cond_lhs(cond), rhs = gimple_cond_rhs(cond);
+  if (TREE_CODE(rhs) != INTEGER_CST)
+    return NULL;
+
+  // _2 = __builtin_expect (_1, 0); if (_2 != 0)
+  for (gimple_stmt_iterator gsi = gsi_last_bb(bb); !gsi_end_p(gsi);
+       gsi_prev(&gsi)) {
+    gimple *stmt = gsi_stmt(gsi);
+    if (!gimple_call_builtin_p(stmt, BUILT_IN_EXPECT) ||
+        !gimple_call_lhs(stmt) ||
+        !operand_equal_p(gimple_call_lhs(stmt), lhs, 0))
+      continue;
+    tree expected = gimple_call_arg(stmt, 1);
+    if (TREE_CODE(expected) != INTEGER_CST)
+      return NULL;
+    bool taken = tree_int_cst_equal(expected, rhs) ==
+                 (gimple_cond_code(cond) == EQ_EXPR);
+    edge true_edge, false_edge;
+    extract_true_false_edges_from_block(bb, &true_edge, &false_edge);
+    basic_block unlikely = taken ? false_edge->dest : true_edge->dest;
+    return single_pred_p(unlikely) ? unlikely : NULL;
+  }
+  return NULL;
+}
+
+// The cold block of fun the dummy code goes to, or NULL if there is none.
+static basic_block find_cold_block(function *fun, basic_block entry) {
+  hash_set<basic_block> unexpected;
+  basic_block bb;
+  FOR_EACH_BB_FN(bb, fun) {
+    if (basic_block succ = unexpected_successor(bb))
+      unexpected.add(succ);
+  }
+
+  basic_block coldest = NULL;
+  FOR_EACH_BB_FN(bb, fun) {
+    // Do not put statements on the path of abnormal edges.
+    if (bb == entry || bb_has_abnormal_pred(bb))
+      continue;
+    if (unexpected.contains(bb) || is_marked_cold(fun, bb))
+      return bb;
+    if (bb->count.initialized_p() && entry->count.initialized_p() &&
+        bb->count.apply_scale(cold_ratio, 1) <= entry->count &&
+        (!coldest || bb->count < coldest->count))
+      coldest = bb;
+  }
+  return coldest;
+}
+
+// Insert the dummy code into fun. Shared with the combined KoviD plugin.
+bool kovid_insert_dummy_code(function *fun, bool cold_placement) {
+  // If it's an external decl, skip
+  if (DECL_EXTERNAL(fun->decl))
+    return false;
+
+  if (!kovid_should_transform(fun->decl, kovid::rules::DummyCodeInsertion))
+    return false;
+  auto_client_timevar tv(g_timer, "KoviD dummy-code-insertion");
+
+  // Get the cgraph node for this function
+  cgraph_node *node = cgraph_node::get(fun->decl);
+  if (!node)
+    return false;
+
+  if (dump_file && (dump_flags & TDF_DETAILS)) {
+    fprintf(dump_file, "Current Function: ");
+    print_generic_expr(dump_file, fun->decl, TDF_NONE);
+    fprintf(dump_file, "...\n");
+  }
+
+  // We'll count all real statements
+  size_t total_stmts = 0;
+  // We'll also store the first block that actually has statements
+  basic_block first_real_bb = nullptr;
+
+  // The artificial blocks typically have indexes < NUM_FIXED_BLOCKS.
+  int last_bb_index = last_basic_block_for_fn(fun);
+  for (int i = NUM_FIXED_BLOCKS; i < last_bb_index; ++i) {
+    basic_block bb = BASIC_BLOCK_FOR_FN(fun, i);
+    if (!bb)
+      continue;
+
+    for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+         gsi_next(&gsi)) {
+      total_stmts++;
+      if (!first_real_bb)
+        first_real_bb = bb;
+    }
+  }
+
+  // If fewer than 2 statements, skip to avoid ICE in trivial funcs
+  if (total_stmts < 2)
+    return false;
+
+  // Insert dummy code at the start of the block that had the first stmt.
+  if (!first_real_bb)
+    return false;
+
+  // The three statements below.
+  if (!kovid_charge(fun, kovid::rules::DummyCodeInsertion, 3))
+    return false;
+
+  // Seeded from the function before the dummy code goes in.
+  uint64_t seed = kovid_function_seed(fun, kovid::rules::DummyCodeInsertion);
+  int initial = kovid::hash::derive(seed, 0) % 0x10000;
+  int offset = 1 + kovid::hash::derive(seed, 1) % 0xffff;
+
+  // Build a volatile int type
+  tree volatile_int_type =
+      build_qualified_type(integer_type_node, TYPE_QUAL_VOLATILE);
+
+  // Create local var "dummy"
+  tree dummy_var = create_tmp_var(volatile_int_type, "dummy");
+  // Force memory-based storage
+  TREE_ADDRESSABLE(dummy_var) = 1;
+
+  // Insert at the front, or after the labels of the cold block.
+  basic_block cold_bb = NULL;
+  if (cold_placement) {
+    auto_client_timevar placement_tv(g_timer,
+                                     "KoviD dummy-code-insertion: placement");
+    cold_bb = find_cold_block(fun, first_real_bb);
+  }
+  gimple_stmt_iterator gsi =
+      cold_bb ? gsi_after_labels(cold_bb) : gsi_start_bb(first_real_bb);
+
+  // 1) dummy = initial
+  gimple *set0 = gimple_build_assign(
+      dummy_var, build_int_cst(volatile_int_type, initial));
+  gsi_insert_before(&gsi, set0, GSI_SAME_STMT);
+
+  // 2) dummy = dummy + offset
+  {
+    tree plus_expr = build2(PLUS_EXPR, volatile_int_type, dummy_var,
+                            build_int_cst(volatile_int_type, offset));
+    gimple *add1 = gimple_build_assign(dummy_var, plus_expr);
+    gsi_insert_before(&gsi, add1, GSI_SAME_STMT);
+  }
+
+  // 3) dummy = dummy - offset
+  {
+    tree minus_expr = build2(MINUS_EXPR, volatile_int_type, dummy_var,
+                             build_int_cst(volatile_int_type, offset));
+    gimple *sub1 = gimple_build_assign(dummy_var, minus_expr);
+    gsi_insert_before(&gsi, sub1, GSI_SAME_STMT);
+  }
+
+  statistics_counter_event(fun, "dummy_code_insertion functions", 1);
+  if (cold_bb)
+    statistics_counter_event(fun, "dummy_code_insertion cold placements", 1);
+  if (dump_enabled_p()) {
+    if (cold_bb)
+      dump_printf_loc(MSG_OPTIMIZED_LOCATIONS,
+                      dump_user_location_t::from_function_decl(fun->decl),
+                      "inserted dummy code in cold block %d\n",
+                      cold_bb->index);
+    else
+      dump_printf_loc(MSG_OPTIMIZED_LOCATIONS,
+                      dump_user_location_t::from_function_decl(fun->decl),
+                      "inserted dummy code\n");
+  }
+
+  return true;
+}
+
+#ifndef KOVID_COMBINED_PLUGIN
+
 // Basic pass data for a GIMPLE pass
 static const pass_data my_pass_data = {
     GIMPLE_PASS,            // type
     "dummy_code_insertion", // name
-    OPTGROUP_NONE,          // optinfo_flags
-    TV_NONE,                // tv_id
+    OPTGROUP_OTHER,         // optinfo_flags
+    KOVID_TV_PASS,          // tv_id
     0,                      // properties_required
     0,                      // properties_provided
     0,                      // properties_destroyed
@@ -45,87 +273,18 @@ static const pass_data my_pass_data = {
     0                       // todo_flags_finish
 };
 
+// Set by -fplugin-arg-<plugin>-placement=cold.
+static bool cold_placement = false;
+
 namespace {
 
 struct dummy_code_insertion_plugin : gimple_opt_pass {
   dummy_code_insertion_plugin(gcc::context *ctx)
       : gimple_opt_pass(my_pass_data, ctx) {}
 
-  unsigned int execute(function *) override {
-    // If it's an external decl, skip
-    if (DECL_EXTERNAL(cfun->decl))
-      return 0;
-
-    // Get the cgraph node for this function
-    cgraph_node *node = cgraph_node::get(cfun->decl);
-    if (!node)
-      return 0;
-
-    fprintf(stderr, "Crrent Function: ");
-    print_generic_expr(stderr, cfun->decl, TDF_NONE);
-    fprintf(stderr, "...\n");
-
-    // We'll count all real statements
-    size_t total_stmts = 0;
-    // We'll also store the first block that actually has statements
-    basic_block first_real_bb = nullptr;
-
-    // The artificial blocks typically have indexes < NUM_FIXED_BLOCKS.
-    int last_bb_index = last_basic_block_for_fn(cfun);
-    for (int i = NUM_FIXED_BLOCKS; i < last_bb_index; ++i) {
-      basic_block bb = BASIC_BLOCK_FOR_FN(cfun, i);
-      if (!bb)
-        continue;
-
-      for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
-           gsi_next(&gsi)) {
-        total_stmts++;
-        if (!first_real_bb)
-          first_real_bb = bb;
-      }
-    }
-
-    // If fewer than 2 statements, skip to avoid ICE in trivial funcs
-    if (total_stmts < 2)
-      return 0;
-
-    // Insert dummy code at the start of the block that had the first stmt.
-    if (!first_real_bb)
-      return 0;
-
-    // Build a volatile int type
-    tree volatile_int_type =
-        build_qualified_type(integer_type_node, TYPE_QUAL_VOLATILE);
-
-    // Create local var "dummy"
-    tree dummy_var = create_tmp_var(volatile_int_type, "dummy");
-    // Force memory-based storage
-    TREE_ADDRESSABLE(dummy_var) = 1;
-
-    // Insert at the front
-    gimple_stmt_iterator gsi = gsi_start_bb(first_real_bb);
-
-    // 1) dummy = 0
-    gimple *set0 =
-        gimple_build_assign(dummy_var, build_int_cst(volatile_int_type, 0));
-    gsi_insert_before(&gsi, set0, GSI_SAME_STMT);
-
-    // 2) dummy = dummy + 1
-    {
-      tree plus_expr = build2(PLUS_EXPR, volatile_int_type, dummy_var,
-                              build_int_cst(volatile_int_type, 1));
-      gimple *add1 = gimple_build_assign(dummy_var, plus_expr);
-      gsi_insert_before(&gsi, add1, GSI_SAME_STMT);
-    }
-
-    // 3) dummy = dummy - 1
-    {
-      tree minus_expr = build2(MINUS_EXPR, volatile_int_type, dummy_var,
-                               build_int_cst(volatile_int_type, 1));
-      gimple *sub1 = gimple_build_assign(dummy_var, minus_expr);
-      gsi_insert_before(&gsi, sub1, GSI_SAME_STMT);
-    }
-
+  unsigned int execute(function *fun) override {
+    kovid_insert_dummy_code(fun, cold_placement);
+    kovid_report_budget(fun);
     return 0; // no analysis preserved
   }
 };
@@ -142,6 +301,19 @@ int plugin_init(struct plugin_name_args *plugin_info,
     return 1;
   }
 
+  // Even at -O0, where nothing is inserted, so that annotate() compiles.
+  if (!kovid_init_selection(plugin_info->base_name, "Dummy Code Insertion",
+                            kovid_rules_argument(plugin_info)))
+    return 1;
+
+  kovid_parse_budget_arguments(plugin_info);
+  kovid_seed_key() = STR_GCC_CRYPTO_KEY;
+  for (int i = 0; i < plugin_info->argc; ++i) {
+    const plugin_argument &arg = plugin_info->argv[i];
+    if (!strcmp(arg.key, "placement") && arg.value)
+      cold_placement = !strcmp(arg.value, "cold");
+  }
+
   fprintf(stderr, "KoviD Dummy Code Insertion Plugin loaded.\n");
 
   int optLevel = global_options.x_optimize;
@@ -172,3 +344,5 @@ int plugin_init(struct plugin_name_args *plugin_info,
 
   return 0;
 }
+
+#endif // KOVID_COMBINED_PLUGIN
@@ -0,0 +1,23 @@
+/*
+ * Dummy Code Insertion GCC Plugin
+ * -------------------------------
+ *
+ * The transform of the plugin, shared by the standalone plugin and the
+ * combined KoviD GCC plugin. Include it after the GCC headers.
+ *
+ * Author: djolertrk
+ * License: Apache v2.0 with LLVM-exception
+ */
+
+#ifndef KOVID_DUMMYCODEINSERTION_GCC_H
+#define KOVID_DUMMYCODEINSERTION_GCC_H
+
+// Insert dummy code at the start of fun if it has at least two statements.
+// With cold_placement, it goes to the start of a cold block instead, when
+// fun has one: a block that calls a cold or noreturn function, that the
+// branch hints (__builtin_expect, [[unlikely]]) make unlikely, or that the
+// profile counts say is rarely run. Only meant for -O1 and higher. Returns
+// true if fun was changed.
+bool kovid_insert_dummy_code(function *fun, bool cold_placement = false);
+
+#endif // KOVID_DUMMYCODEINSERTION_GCC_H
@@ -13,94 +13,198 @@
 // both human readers and automated analysis tools.
 //
 // The pass creates a dummy local variable and performs a series of volatile
-// load/store and arithmetic operations (adding 1 then subtracting 1) on that
+// load/store and arithmetic operations (adding C then subtracting C) on that
 // variable. Each inserted instruction is tagged with metadata ("dummy") to help
-// prevent it from being optimized away by later optimization passes.
+// prevent it from being optimized away by later optimization passes. The
+// stored value and C are derived from a keyed hash of the function (see
+// KoviDSeed.h), so they differ between functions but not between builds.
 //
+// The sequence is six instructions, charged to the growth budget; functions
+// that are too small for it (see -kovid-max-function-growth) are skipped.
+//
+// By default the sequence runs on every call, at the start of the entry
+// block. With -kovid-dummy-placement=cold only the alloca stays there, and
+// the memory round-trips move to the coldest block of the function: one
+// that calls a cold function or ends in unreachable (error paths), or
+// whose BlockFrequencyInfo frequency, which reflects profiles and
+// __builtin_expect through the branch weights, is at most
+// 1/-kovid-dummy-cold-ratio of the entry's. Functions without such a block
+// keep the sequence in the entry block.
+//
+
+#include "DummyCodeInsertion.h"
+#include "KoviDOptions.h"
+#include "KoviDSeed.h"
+#include "KoviDSelection.h"
+#include "KoviDTimeTrace.h"
 
-#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/IR/Constants.h"
-#include "llvm/IR/Function.h"
-#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Metadata.h"
-#include "llvm/IR/Module.h"
-#include "llvm/IR/PassManager.h"
-#include "llvm/Pass.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/Passes/PassPlugin.h"
-#include "llvm/Support/raw_ostream.h"
-
-#include <algorithm>
-#include <sstream>
-#include <string>
+#include "llvm/Support/CommandLine.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "kovid-dummy-code-insertion"
+
+STATISTIC(NumFunctionsWithDummyCode,
+          "Number of functions dummy code was inserted into");
+STATISTIC(NumColdPlacements, "Number of dummy sequences put in a cold block");
+
 namespace {
 
-struct DummyCodeInsertion : public PassInfoMixin<DummyCodeInsertion> {
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
-    // Skip function declarations.
-    if (F.isDeclaration())
-      return PreservedAnalyses::all();
-
-    LLVMContext &Ctx = F.getContext();
-    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
-
-    // Create a dummy local variable of type i32.
-    AllocaInst *dummyAlloca =
-        Builder.CreateAlloca(Type::getInt32Ty(Ctx), nullptr, "dummy");
-
-    // Create a metadata node with a "dummy" tag.
-    MDNode *dummyMD = MDNode::get(Ctx, MDString::get(Ctx, "dummy"));
-
-    // Insert a volatile store of 0.
-    StoreInst *store0 = Builder.CreateStore(
-        ConstantInt::get(Type::getInt32Ty(Ctx), 0), dummyAlloca);
-    store0->setVolatile(true);
-    store0->setMetadata("dummy", dummyMD);
-
-    // Insert a volatile load.
-    LoadInst *dummyLoad =
-        Builder.CreateLoad(Type::getInt32Ty(Ctx), dummyAlloca, "dummy.load");
-    dummyLoad->setVolatile(true);
-    dummyLoad->setMetadata("dummy", dummyMD);
-
-    // Insert dummy arithmetic: add 1 then subtract 1.
-    Value *added = Builder.CreateAdd(
-        dummyLoad, ConstantInt::get(Type::getInt32Ty(Ctx), 1), "dummy.add");
-    Value *subtracted = Builder.CreateSub(
-        added, ConstantInt::get(Type::getInt32Ty(Ctx), 1), "dummy.sub");
-
-    // Insert a volatile store of the result.
-    StoreInst *storeResult = Builder.CreateStore(subtracted, dummyAlloca);
-    storeResult->setVolatile(true);
-    storeResult->setMetadata("dummy", dummyMD);
-
-    // This inserted code is now marked volatile and carries "dummy" metadata,
-    // which should help prevent it from being optimized away.
-
-    return PreservedAnalyses::none();
-  }
-};
+enum class Placement { Entry, Cold };
+
+static cl::opt<Placement> &DummyPlacement = kovid::getSharedOption<Placement>(
+    "kovid-dummy-placement",
+    cl::desc("Where the dummy code goes in each function"),
+    cl::init(Placement::Entry),
+    cl::values(clEnumValN(Placement::Entry, "entry",
+                          "At the start of the entry block"),
+               clEnumValN(Placement::Cold, "cold",
+                          "In the coldest block, if there is a cold one")));
+
+static cl::opt<unsigned> &ColdRatio = kovid::getSharedOption<unsigned>(
+    "kovid-dummy-cold-ratio",
+    cl::desc("With -kovid-dummy-placement=cold, blocks that run at most "
+             "1/N as often as the entry block are cold"),
+    cl::init(8));
+
+/// The instructions of the dummy sequence.
+static const unsigned DummyCodeCost = 6;
 
 } // end anonymous namespace
 
-PassPluginLibraryInfo getPassPluginInfo() {
-  const auto callback = [](PassBuilder &PB) {
-    PB.registerPipelineEarlySimplificationEPCallback(
-        [&](ModulePassManager &MPM, auto) {
-          MPM.addPass(createModuleToFunctionPassAdaptor(DummyCodeInsertion()));
-          return true;
-        });
-  };
-
-  return {LLVM_PLUGIN_API_VERSION, "kovid-dummy-code-insertion", "0.0.1",
-          callback};
-};
-
-extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
-  return getPassPluginInfo();
+/// Whether \p BB is on an error path or calls a function marked cold.
+static bool isMarkedCold(const BasicBlock &BB) {
+  if (isa<UnreachableInst>(BB.getTerminator()))
+    return true;
+  for (const Instruction &I : BB)
+    if (auto *CB = dyn_cast<CallBase>(&I))
+      if (CB->hasFnAttr(Attribute::Cold))
+        return true;
+  return false;
+}
+
+/// The coldest block of \p F other than the entry block, or nullptr if none
+/// of them is cold.
+static BasicBlock *findColdBlock(Function &F, BlockFrequencyInfo &BFI) {
+  BasicBlock *Entry = &F.getEntryBlock();
+  uint64_t EntryFreq = BFI.getEntryFreq();
+  BasicBlock *Coldest = nullptr;
+  uint64_t ColdestFreq = UINT64_MAX;
+  for (BasicBlock &BB : F) {
+    // The sequence could not go before the first instruction of a pad.
+    if (&BB == Entry || BB.isEHPad())
+      continue;
+    uint64_t Freq =
+        isMarkedCold(BB) ? 0 : BFI.getBlockFreq(&BB).getFrequency();
+    if (Freq < ColdestFreq) {
+      Coldest = &BB;
+      ColdestFreq = Freq;
+    }
+  }
+  if (!Coldest || ColdestFreq * ColdRatio > EntryFreq)
+    return nullptr;
+  return Coldest;
+}
+
+bool kovid::insertDummyCode(Function &F, FunctionAnalysisManager &FAM,
+                            GrowthBudget *Budget) {
+  // Skip function declarations, and the functions the rules exclude.
+  if (F.isDeclaration() || !shouldTransform(F, rules::DummyCodeInsertion))
+    return false;
+  TransformTimeScope Trace(rules::DummyCodeInsertion, "", F.getName());
+
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+
+  if (Budget &&
+      !Budget->charge(F, rules::DummyCodeInsertion, DummyCodeCost)) {
+    ORE.emit([&]() {
+      return OptimizationRemarkMissed(DEBUG_TYPE, "OverBudget", &F)
+             << "no dummy code inserted into "
+             << ore::NV("Function", F.getName())
+             << ": it does not fit the growth budget";
+    });
+    return false;
+  }
+
+  BasicBlock *Cold = nullptr;
+  if (DummyPlacement == Placement::Cold) {
+    TransformTimeScope Placement(rules::DummyCodeInsertion, "placement",
+                                 F.getName(), F.size(), "blocks");
+    Cold = findColdBlock(F, FAM.getResult<BlockFrequencyAnalysis>(F));
+  }
+
+  // Seeded from the function before the dummy code goes in.
+  uint64_t Seed = functionSeed(F, rules::DummyCodeInsertion);
+  uint32_t Initial = hash::derive(Seed, 0);
+  uint32_t Offset = hash::derive(Seed, 1);
+
+  LLVMContext &Ctx = F.getContext();
+  IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+
+  // Create a dummy local variable of type i32. It stays in the entry block,
+  // where it is a static alloca and costs nothing at run time.
+  AllocaInst *dummyAlloca =
+      Builder.CreateAlloca(Type::getInt32Ty(Ctx), nullptr, "dummy");
+  if (Cold) {
+    Builder.SetInsertPoint(&*Cold->getFirstInsertionPt());
+    ++NumColdPlacements;
+  }
+
+  // Create a metadata node with a "dummy" tag.
+  MDNode *dummyMD = MDNode::get(Ctx, MDString::get(Ctx, "dummy"));
+
+  // Insert a volatile store of the initial value.
+  StoreInst *store0 = Builder.CreateStore(
+      ConstantInt::get(Type::getInt32Ty(Ctx), Initial), dummyAlloca);
+  store0->setVolatile(true);
+  store0->setMetadata("dummy", dummyMD);
+
+  // Insert a volatile load.
+  LoadInst *dummyLoad =
+      Builder.CreateLoad(Type::getInt32Ty(Ctx), dummyAlloca, "dummy.load");
+  dummyLoad->setVolatile(true);
+  dummyLoad->setMetadata("dummy", dummyMD);
+
+  // Insert dummy arithmetic: add the offset then subtract it.
+  Value *added = Builder.CreateAdd(
+      dummyLoad, ConstantInt::get(Type::getInt32Ty(Ctx), Offset), "dummy.add");
+  Value *subtracted = Builder.CreateSub(
+      added, ConstantInt::get(Type::getInt32Ty(Ctx), Offset), "dummy.sub");
+
+  // Insert a volatile store of the result.
+  StoreInst *storeResult = Builder.CreateStore(subtracted, dummyAlloca);
+  storeResult->setVolatile(true);
+  storeResult->setMetadata("dummy", dummyMD);
+
+  // This inserted code is now marked volatile and carries "dummy" metadata,
+  // which should help prevent it from being optimized away.
+  ++NumFunctionsWithDummyCode;
+  ORE.emit([&]() {
+    OptimizationRemark R(DEBUG_TYPE, "DummyCodeInserted", &F);
+    R << "inserted dummy code into " << ore::NV("Function", F.getName());
+    if (Cold)
+      R << " in cold block " << ore::NV("Block", Cold->getName());
+    return R;
+  });
+  return true;
+}
+
+PreservedAnalyses kovid::DummyCodeInsertion::run(Function &F,
+                                                 FunctionAnalysisManager &AM) {
+  std::shared_ptr<GrowthBudget> Budget =
+      UseBudget ? GrowthBudget::get(*F.getParent()) : nullptr;
+  bool Changed = insertDummyCode(F, AM, Budget.get());
+  if (Budget)
+    Budget->emitReport(F, AM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  return PreservedAnalyses::none();
 }
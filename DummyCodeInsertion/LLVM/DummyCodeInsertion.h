@@ -0,0 +1,40 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+#ifndef KOVID_DUMMYCODEINSERTION_H
+#define KOVID_DUMMYCODEINSERTION_H
+
+#include "KoviDGrowthBudget.h"
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+
+#include <memory>
+
+namespace kovid {
+
+/// Insert the volatile dummy sequence into \p F and report it as a remark.
+/// It goes at the start of the entry block or, with
+/// -kovid-dummy-placement=cold, of the coldest block of \p F, as the block
+/// frequencies from \p FAM tell. Returns false (and leaves \p F untouched)
+/// for declarations, the functions the selection rules exclude and, with a
+/// \p Budget, those the sequence does not fit in.
+bool insertDummyCode(llvm::Function &F, llvm::FunctionAnalysisManager &FAM,
+                     GrowthBudget *Budget = nullptr);
+
+/// With \p UseBudget, the dummy code is charged to the growth budget of the
+/// module that all loaded KoviD plugins share (GrowthBudget::get).
+struct DummyCodeInsertion : public llvm::PassInfoMixin<DummyCodeInsertion> {
+  explicit DummyCodeInsertion(bool UseBudget = false) : UseBudget(UseBudget) {}
+
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &AM);
+
+private:
+  bool UseBudget;
+};
+
+} // namespace kovid
+
+#endif // KOVID_DUMMYCODEINSERTION_H
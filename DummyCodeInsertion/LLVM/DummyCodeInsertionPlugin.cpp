@@ -0,0 +1,36 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+#include "DummyCodeInsertion.h"
+#include "KoviDPipeline.h"
+#include "KoviDSelection.h"
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+using namespace llvm;
+
+static PassPluginLibraryInfo getPassPluginInfo() {
+  const auto callback = [](PassBuilder &PB) {
+    kovid::TransformPasses Passes;
+    Passes.Setup = [](ModulePassManager &MPM) {
+      MPM.addPass(kovid::ApplyAnnotationsPass());
+      // Releases the growth budget of the module after the pipeline.
+      MPM.addPass(RequireAnalysisPass<kovid::GrowthBudgetAnalysis, Module>());
+    };
+    Passes.Run = [](FunctionPassManager &FPM) {
+      FPM.addPass(kovid::DummyCodeInsertion(/*UseBudget=*/true));
+    };
+    kovid::registerGrowthBudgetAnalysis(PB);
+    kovid::registerTransformPasses(PB, kovid::rules::DummyCodeInsertion,
+                                   Passes);
+  };
+
+  return {LLVM_PLUGIN_API_VERSION, "kovid-dummy-code-insertion", "0.0.1",
+          callback};
+};
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return getPassPluginInfo();
+}
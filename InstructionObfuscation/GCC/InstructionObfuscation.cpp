@@ -6,11 +6,15 @@
  *     x = a + b
  * and replaces them with a more "obfuscated" sequence:
  *
- *   dummy = 42 + 0
- *   temp  = dummy - 42
+ *   dummy = C + 0
+ *   temp  = dummy - C
  *   left  = a + temp
  *   x     = left + b
  *
+ * C, in [1, 127] so that it fits every integer type, is derived per rewrite
+ * from a keyed hash of the function (see Common/GCC/KoviDSeed.h), so the
+ * output only depends on the key and the code of the function.
+ *
  * We collect all the original ADD statements first, to avoid re-transforming
  * the newly inserted statements and causing an infinite loop.
  *
@@ -35,40 +39,41 @@
 #include "cgraph.h"
 #include "diagnostic.h"
 #include "print-tree.h"
+#include "dumpfile.h"
+#include "statistics.h"
 
-int plugin_is_GPL_compatible;
+#include "InstructionObfuscation.h"
+#include "KoviDSelection.h"
+#include "KoviDGrowthBudget.h"
+#include "KoviDSeed.h"
+#include "KoviDTimevar.h"
 
-// Basic pass data for a GIMPLE pass
-static const pass_data my_pass_data = {
-    GIMPLE_PASS,                // type
-    "instruction_obfuscation",  // name
-    OPTGROUP_NONE,              // optinfo_flags
-    TV_NONE,                    // tv_id
-    0,                          // properties_required
-    0,                          // properties_provided
-    0,                          // properties_destroyed
-    0,                          // todo_flags_start
-    0                           // todo_flags_finish
-};
+#ifndef KOVID_COMBINED_PLUGIN
+int plugin_is_GPL_compatible;
+#endif
 
-namespace {
+#ifndef STR_GCC_CRYPTO_KEY
+#define STR_GCC_CRYPTO_KEY "default_key"
+#endif
 
-struct instruction_obfuscation_plugin : gimple_opt_pass {
-  instruction_obfuscation_plugin(gcc::context *ctx)
-      : gimple_opt_pass(my_pass_data, ctx) {}
+// Obfuscate the add statements of fun. Shared with the combined KoviD plugin.
+int kovid_obfuscate_instructions(function *fun) {
+  if (!kovid_should_transform(fun->decl, kovid::rules::InstructionObfuscation))
+    return 0;
+  auto_client_timevar tv(g_timer, "KoviD instruction-obf");
 
-  unsigned int execute(function *) override {
-    fprintf(stderr,
-            "\n[instruction_obfuscation_plugin] Scanning function: %s\n",
-            current_function_name());
+  if (dump_file && (dump_flags & TDF_DETAILS))
+    fprintf(dump_file, "Scanning function: %s\n", current_function_name());
 
-    // We'll gather all add statements in a vector so we don't transform
-    // newly inserted statements again.
-    std::vector<gimple_stmt_iterator> add_stmts;
+  // We'll gather all add statements in a vector so we don't transform
+  // newly inserted statements again.
+  std::vector<gimple_stmt_iterator> add_stmts;
 
-    // 1) Collect all statements of the form: X = op0 + op1
+  // 1) Collect all statements of the form: X = op0 + op1
+  {
+    auto_client_timevar collect_tv(g_timer, "KoviD instruction-obf: collect");
     basic_block bb;
-    FOR_EACH_BB_FN(bb, cfun) {
+    FOR_EACH_BB_FN(bb, fun) {
       for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
            gsi_next(&gsi)) {
         gimple *stmt = gsi_stmt(gsi);
@@ -78,70 +83,123 @@ struct instruction_obfuscation_plugin : gimple_opt_pass {
         }
       }
     }
+  }
+  statistics_counter_event(fun, "instruction_obfuscation candidates",
+                           add_stmts.size());
+
+  // Seeded before the first rewrite, from the code as it came in.
+  uint64_t seed =
+      kovid_function_seed(fun, kovid::rules::InstructionObfuscation);
+
+  // 2) Transform them (outside the main loop).
+  auto_client_timevar rewrite_tv(g_timer, "KoviD instruction-obf: rewrite");
+  int num_obfuscated = 0;
+  for (gimple_stmt_iterator gsi : add_stmts) {
+    // If the statement was removed or replaced in the meantime,
+    // skip if it's no longer valid. (We can check gsi_end_p.)
+    if (gsi_end_p(gsi))
+      continue;
+
+    gimple *stmt = gsi_stmt(gsi);
+    if (!stmt)
+      continue;
+
+    // Double-check it's still an add statement:
+    if (gimple_code(stmt) != GIMPLE_ASSIGN ||
+        gimple_assign_rhs_code(stmt) != PLUS_EXPR) {
+      continue;
+    }
 
-    // 2) Transform them (outside the main loop).
-    for (gimple_stmt_iterator gsi : add_stmts) {
-      // If the statement was removed or replaced in the meantime,
-      // skip if it's no longer valid. (We can check gsi_end_p.)
-      if (gsi_end_p(gsi))
-        continue;
-
-      gimple *stmt = gsi_stmt(gsi);
-      if (!stmt)
-        continue;
-
-      // Double-check it's still an add statement:
-      if (gimple_code(stmt) != GIMPLE_ASSIGN ||
-          gimple_assign_rhs_code(stmt) != PLUS_EXPR) {
-        continue;
-      }
+    tree lhs = gimple_assign_lhs(stmt);
+    tree op0 = gimple_assign_rhs1(stmt);
+    tree op1 = gimple_assign_rhs2(stmt);
+
+    tree type = TREE_TYPE(lhs);
+    if (!INTEGRAL_TYPE_P(type))
+      continue;
+
+    // Three statements more than the add.
+    if (!kovid_charge(fun, kovid::rules::InstructionObfuscation, 3))
+      continue;
 
-      tree lhs = gimple_assign_lhs(stmt);
-      tree op0 = gimple_assign_rhs1(stmt);
-      tree op1 = gimple_assign_rhs2(stmt);
-
-      tree type = TREE_TYPE(lhs);
-      if (!INTEGRAL_TYPE_P(type))
-        continue;
-
-      fprintf(stderr, "  Obfuscating statement: ");
-      print_gimple_stmt(stderr, stmt, 0, TDF_SLIM);
-      fprintf(stderr, "\n");
-
-      // The sequence:
-      //   1) dummy = 42 + 0
-      //   2) temp  = dummy - 42
-      //   3) left  = op0 + temp
-      //   4) lhs   = left + op1
-
-      // Step 1) dummy = 42 + 0
-      tree dummy_var = create_tmp_var(type, "dummy");
-      gimple *dummy_stmt = gimple_build_assign(
-          dummy_var, build2(PLUS_EXPR, type, build_int_cst(type, 42),
-                            build_int_cst(type, 0)));
-      gsi_insert_before(&gsi, dummy_stmt, GSI_SAME_STMT);
-
-      // Step 2) temp = dummy - 42
-      tree temp_var = create_tmp_var(type, "temp");
-      gimple *temp_stmt =
-          gimple_build_assign(temp_var, build2(MINUS_EXPR, type, dummy_var,
-                                               build_int_cst(type, 42)));
-      gsi_insert_before(&gsi, temp_stmt, GSI_SAME_STMT);
-
-      // Step 3) left = op0 + temp
-      tree left_var = create_tmp_var(type, "left");
-      gimple *left_stmt =
-          gimple_build_assign(left_var, build2(PLUS_EXPR, type, op0, temp_var));
-      gsi_insert_before(&gsi, left_stmt, GSI_SAME_STMT);
-
-      // Step 4) final = left + op1
-      gimple *final_stmt =
-          gimple_build_assign(lhs, build2(PLUS_EXPR, type, left_var, op1));
-
-      // Replace the original statement
-      gsi_replace(&gsi, final_stmt, true);
+    if (dump_file && (dump_flags & TDF_DETAILS)) {
+      fprintf(dump_file, "  Obfuscating statement: ");
+      print_gimple_stmt(dump_file, stmt, 0, TDF_SLIM);
     }
 
+    // The sequence:
+    //   1) dummy = C + 0
+    //   2) temp  = dummy - C
+    //   3) left  = op0 + temp
+    //   4) lhs   = left + op1
+    int c = 1 + kovid::hash::derive(seed, num_obfuscated) % 127;
+
+    // Step 1) dummy = C + 0
+    tree dummy_var = create_tmp_var(type, "dummy");
+    gimple *dummy_stmt = gimple_build_assign(
+        dummy_var, build2(PLUS_EXPR, type, build_int_cst(type, c),
+                          build_int_cst(type, 0)));
+    gsi_insert_before(&gsi, dummy_stmt, GSI_SAME_STMT);
+
+    // Step 2) temp = dummy - C
+    tree temp_var = create_tmp_var(type, "temp");
+    gimple *temp_stmt =
+        gimple_build_assign(temp_var, build2(MINUS_EXPR, type, dummy_var,
+                                             build_int_cst(type, c)));
+    gsi_insert_before(&gsi, temp_stmt, GSI_SAME_STMT);
+
+    // Step 3) left = op0 + temp
+    tree left_var = create_tmp_var(type, "left");
+    gimple *left_stmt =
+        gimple_build_assign(left_var, build2(PLUS_EXPR, type, op0, temp_var));
+    gsi_insert_before(&gsi, left_stmt, GSI_SAME_STMT);
+
+    // Step 4) final = left + op1
+    gimple *final_stmt =
+        gimple_build_assign(lhs, build2(PLUS_EXPR, type, left_var, op1));
+
+    // Replace the original statement
+    gsi_replace(&gsi, final_stmt, true);
+    ++num_obfuscated;
+  }
+
+  if (num_obfuscated) {
+    statistics_counter_event(fun, "instruction_obfuscation statements",
+                             num_obfuscated);
+    if (dump_enabled_p())
+      dump_printf_loc(MSG_OPTIMIZED_LOCATIONS,
+                      dump_user_location_t::from_function_decl(fun->decl),
+                      "obfuscated %d add statements\n", num_obfuscated);
+  }
+
+  return num_obfuscated;
+}
+
+#ifndef KOVID_COMBINED_PLUGIN
+
+// Basic pass data for a GIMPLE pass
+static const pass_data my_pass_data = {
+    GIMPLE_PASS,                // type
+    "instruction_obfuscation",  // name
+    OPTGROUP_OTHER,             // optinfo_flags
+    KOVID_TV_PASS,              // tv_id
+    0,                          // properties_required
+    0,                          // properties_provided
+    0,                          // properties_destroyed
+    0,                          // todo_flags_start
+    0                           // todo_flags_finish
+};
+
+namespace {
+
+struct instruction_obfuscation_plugin : gimple_opt_pass {
+  instruction_obfuscation_plugin(gcc::context *ctx)
+      : gimple_opt_pass(my_pass_data, ctx) {}
+
+  unsigned int execute(function *fun) override {
+    kovid_obfuscate_instructions(fun);
+    kovid_report_budget(fun);
+
     // We transformed statements, no preservation
     return 0;
   }
@@ -161,6 +219,14 @@ int plugin_init(struct plugin_name_args *plugin_info,
     return 1;
   }
 
+  if (!kovid_init_selection(plugin_info->base_name,
+                            "Instruction Obfuscation Plugin",
+                            kovid_rules_argument(plugin_info)))
+    return 1;
+
+  kovid_parse_budget_arguments(plugin_info);
+  kovid_seed_key() = STR_GCC_CRYPTO_KEY;
+
   // For '-fplugin-info' diagnostic
   static struct plugin_info my_plugin_info = {
       .version = "1.0",
@@ -184,3 +250,5 @@ int plugin_init(struct plugin_name_args *plugin_info,
   fprintf(stderr, "KoviD Instruction Obfuscation Plugin loaded.\n");
   return 0;
 }
+
+#endif // KOVID_COMBINED_PLUGIN
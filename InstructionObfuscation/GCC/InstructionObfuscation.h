@@ -0,0 +1,19 @@
+/*
+ * Instruction Obfuscation GCC Plugin
+ * -----------------------------------
+ *
+ * The transform of the plugin, shared by the standalone plugin and the
+ * combined KoviD GCC plugin. Include it after the GCC headers.
+ *
+ * Author: djolertrk
+ * License: Apache License v2.0 with LLVM Exceptions
+ */
+
+#ifndef KOVID_INSTRUCTIONOBFUSCATION_GCC_H
+#define KOVID_INSTRUCTIONOBFUSCATION_GCC_H
+
+// Replace the integer add statements of fun by the multi-step sequence.
+// Returns the number of statements replaced.
+int kovid_obfuscate_instructions(function *fun);
+
+#endif // KOVID_INSTRUCTIONOBFUSCATION_GCC_H
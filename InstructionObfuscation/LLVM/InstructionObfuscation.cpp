@@ -19,16 +19,71 @@
 //
 // the pass replaces it with an equivalent sequence that computes:
 //
-//    dummy = add i32 42, 0           // a dummy computation that yields 42.
-//    temp  = sub i32 dummy, 42        // subtract 42: result is 0.
+//    load  = load volatile i32, slot  // the slot is known to hold K.
+//    dummy = add i32 load, C          // a dummy computation that yields K+C.
+//    temp  = sub i32 dummy, K+C       // subtract K+C: result is 0.
 //    left  = add i32 %a, temp         // effectively, %a + 0 = %a.
 //    %new  = add i32 left, %b         // computes %a + %b.
 //
+// The slots come from a per-function pool: they are allocated and stored to
+// (volatile) once, in the entry block, so obfuscating adds inside loops
+// neither creates dynamic allocas nor grows the stack. K and C differ from
+// slot to slot and from rewrite to rewrite; they are derived from a keyed
+// hash of the function before it is rewritten (see KoviDSeed.h), so the
+// output only depends on the key and the code of the function.
+//
 // Each inserted instruction is tagged with metadata ("obf") to help prevent
 // these dummy operations from being optimized away.
 //
+// With -kovid-instr-obf-hot-mode, the pass reads the profile (frontend PGO
+// or sample profiles) through BlockFrequencyInfo and ProfileSummaryInfo, and
+// adds in hot blocks are either left alone or rewritten without the volatile
+// memory round-trip:
+//
+//    %not  = xor i32 %b, -1           // ~b = -b - 1
+//    %sub  = sub i32 %a, %not         // a + b + 1
+//    %new  = sub i32 %sub, 1          // computes %a + %b.
+//
+// The full rewrite adds four instructions, the light one two, and the first
+// full rewrite of a function also sets up the opaque slots. They are charged
+// to the growth budget (-kovid-max-function-growth and
+// -kovid-max-module-growth); a candidate the full rewrite does not fit gets
+// the light one, or none.
+//
+// With -kovid-instr-obf-mode=mba, the pass rewrites add, sub, xor, and and or
+// of any integer or integer vector type with mixed boolean-arithmetic
+// identities instead, such as
+//
+//    a + b  ==  (a ^ b) + 2 * (a & b)
+//
+// mixed with an opaque zero z, so that they cannot be folded back:
+//
+//    %t    = xor i64 %a, %z
+//    %x    = xor i64 %t, %b
+//    %o    = or  i64 %a, %z
+//    %m    = and i64 %o, %b
+//    %s    = add i64 %m, %m             // 2 * %m, also for i1
+//    %new  = add i64 %x, %s             // computes %a + %b.
+//
+// z is a plain load, in the entry block, of a module variable that holds 0
+// but is externally_initialized, so the optimizer cannot assume its value.
+// Unlike the volatile slots it is loop invariant: loops that contain the
+// rewrites are still vectorized, with a splat of z. The steps of induction
+// variables and reductions, and the instructions that compute addresses,
+// are left alone, since the vectorizers must recognize them.
+//
+
+#include "InstructionObfuscation.h"
+#include "KoviDOptions.h"
+#include "KoviDSeed.h"
+#include "KoviDSelection.h"
+#include "KoviDTimeTrace.h"
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
@@ -36,103 +91,492 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/PassManager.h"
-#include "llvm/Pass.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/Passes/PassPlugin.h"
-#include "llvm/Support/WithColor.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "kovid-instruction-obfuscation"
+
+STATISTIC(NumInstrsObfuscated, "Number of instructions obfuscated");
+STATISTIC(NumInstrsLightened,
+          "Number of instructions given the light rewrite");
+STATISTIC(NumInstrsSkipped, "Number of hot instructions left alone");
+STATISTIC(NumInstrsOverBudget,
+          "Number of instructions left alone for the growth budget");
+
 namespace {
 
-// This, for now, implements "Arithmetic code obfuscation" only.
-struct InstructionObfuscationPass : public PassInfoMixin<InstructionObfuscationPass> {
-  PreservedAnalyses run(Function &F, FunctionAnalysisManager &FAM) {
-    // Process each basic block in the function.
-    for (BasicBlock &BB : F) {
-      // Collect add instructions in this basic block.
-      SmallVector<Instruction *, 8> AddInsts;
-      for (Instruction &I : BB) {
-        if (auto *BO = dyn_cast<BinaryOperator>(&I)) {
-          if (BO->getOpcode() == Instruction::Add)
-            AddInsts.push_back(&I);
-        }
-      }
+enum class HotBlockMode { Off, Skip, Light };
 
-      // Process each add instruction.
-      for (Instruction *I : AddInsts) {
-        llvm::WithColor::note() << "Complicating: " << *I << '\n';
-
-        IRBuilder<> Builder(I);
-        LLVMContext &Ctx = F.getContext();
-        Type *Int32Ty = Type::getInt32Ty(Ctx);
-
-        // To prevent constant folding, use a volatile load from an alloca.
-        // Assume there is an alloca inserted at the beginning of the function
-        // that holds 0. For our purposes, we create one here.
-        AllocaInst *dummyAlloca =
-            Builder.CreateAlloca(Int32Ty, nullptr, "dummyForObf");
-        // Store 0 into it, mark the store as volatile.
-        StoreInst *store0 =
-            Builder.CreateStore(ConstantInt::get(Int32Ty, 0), dummyAlloca);
-        store0->setVolatile(true);
-
-        // Load from dummyAlloca (volatile, so it won't be folded).
-        LoadInst *dummyLoad =
-            Builder.CreateLoad(Int32Ty, dummyAlloca, "dummy.load");
-        dummyLoad->setVolatile(true);
-
-        // Now, build the dummy arithmetic sequence:
-        // dummy = add i32 (dummyLoad, 42)
-        Instruction *dummy = cast<Instruction>(Builder.CreateAdd(
-            dummyLoad, ConstantInt::get(Int32Ty, 42), "dummy"));
-        dummy->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
-
-        // temp = sub i32 (dummy, 42)  ; This should yield the original
-        // dummyLoad value (0)
-        Instruction *temp = cast<Instruction>(
-            Builder.CreateSub(dummy, ConstantInt::get(Int32Ty, 42), "temp"));
-        temp->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
-
-        // Now, replace:  %result = add i32 %a, %b
-        // with:
-        // left = add i32 (%a, temp)   ; (%a + 0)
-        // newAdd = add i32 (left, %b)
-        Value *a = I->getOperand(0);
-        Instruction *left =
-            cast<Instruction>(Builder.CreateAdd(a, temp, "left"));
-        left->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
-
-        Value *b = I->getOperand(1);
-        Instruction *newAdd =
-            cast<Instruction>(Builder.CreateAdd(left, b, "obf.add"));
-        newAdd->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
-
-        // Replace all uses of the original add with the newAdd and remove it.
-        I->replaceAllUsesWith(newAdd);
-        I->eraseFromParent();
-      }
-    }
-    return PreservedAnalyses::none();
+enum class RewriteMode { Classic, MBA };
+
+static cl::opt<RewriteMode> &Mode = kovid::getSharedOption<RewriteMode>(
+    "kovid-instr-obf-mode",
+    cl::desc("The rewrites of the arithmetic obfuscation"),
+    cl::init(RewriteMode::Classic),
+    cl::values(clEnumValN(RewriteMode::Classic, "classic",
+                          "Hide adds behind volatile stack slots"),
+               clEnumValN(RewriteMode::MBA, "mba",
+                          "Mixed boolean-arithmetic rewrites of add, sub, "
+                          "xor, and and or that keep loops vectorizable")));
+
+static cl::opt<HotBlockMode> &HotMode = kovid::getSharedOption<HotBlockMode>(
+    "kovid-instr-obf-hot-mode",
+    cl::desc("How the arithmetic obfuscation treats blocks that the profile "
+             "marks as hot"),
+    cl::init(HotBlockMode::Off),
+    cl::values(clEnumValN(HotBlockMode::Off, "off",
+                          "Obfuscate hot blocks like any other block"),
+               clEnumValN(HotBlockMode::Skip, "skip",
+                          "Do not obfuscate hot blocks"),
+               clEnumValN(HotBlockMode::Light, "light",
+                          "Use the cheap, memory free rewrite in hot blocks")));
+
+static cl::opt<unsigned> &OpaqueSlots = kovid::getSharedOption<unsigned>(
+    "kovid-instr-obf-opaque-slots",
+    cl::desc("Number of entry block slots each function draws its opaque "
+             "values from"),
+    cl::init(1));
+
+static cl::opt<int> &HotPercentile = kovid::getSharedOption<int>(
+    "kovid-instr-obf-hot-percentile",
+    cl::desc("Blocks within this percentile of the profile count (out of "
+             "1000000) are hot"),
+    cl::init(990000));
+
+/// The growth of each rewrite, net of the instruction it replaces.
+static const unsigned FullRewriteCost = 4;
+static const unsigned LightRewriteCost = 2;
+
+/// The growth of the classic rewrite of \p I, with the conversion of the
+/// opaque value to a type other than i32.
+static unsigned classicRewriteCost(const Instruction &I) {
+  Type *Ty = I.getType();
+  unsigned Cost = FullRewriteCost;
+  if (!Ty->isIntegerTy(32))
+    Cost += Ty->isVectorTy() ? 2 + !Ty->getScalarType()->isIntegerTy(32) : 1;
+  return Cost;
+}
+
+/// The growth of the MBA rewrite of \p I.
+static unsigned mbaRewriteCost(const Instruction &I) {
+  switch (I.getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+    return 5;
+  default:
+    return 4;
   }
-};
+}
+
+static void tagObfuscated(Value *V) {
+  if (auto *I = dyn_cast<Instruction>(V)) {
+    LLVMContext &Ctx = I->getContext();
+    I->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
+  }
+}
+
+/// Whether \p I steps a loop recurrence (an induction variable or a
+/// reduction) or computes an address. The vectorizers need to recognize
+/// those, so the MBA rewrites leave them alone.
+static bool feedsLoopAnalysis(const Instruction &I) {
+  for (const Value *Op : I.operands())
+    if (auto *Phi = dyn_cast<PHINode>(Op))
+      if (is_contained(Phi->incoming_values(), &I))
+        return true;
+  for (const User *U : I.users())
+    if (isa<GetElementPtrInst>(U))
+      return true;
+  return false;
+}
 
 } // end anonymous namespace
 
-PassPluginLibraryInfo getPassPluginInfo() {
-  const auto callback = [](PassBuilder &PB) {
-    PB.registerPipelineEarlySimplificationEPCallback(
-        [&](ModulePassManager &MPM, auto) {
-          MPM.addPass(createModuleToFunctionPassAdaptor(InstructionObfuscationPass()));
-          return true;
-        });
+bool kovid::isObfuscationCandidate(const Instruction &I) {
+  auto *BO = dyn_cast<BinaryOperator>(&I);
+  if (!BO)
+    return false;
+  if (Mode == RewriteMode::Classic)
+    return BO->getOpcode() == Instruction::Add;
+
+  switch (BO->getOpcode()) {
+  case Instruction::Add:
+  case Instruction::Sub:
+  case Instruction::Xor:
+  case Instruction::And:
+  case Instruction::Or:
+    return !feedsLoopAnalysis(I);
+  default:
+    return false;
+  }
+}
+
+kovid::OpaqueValuePool::OpaqueValuePool(Function &F, unsigned NumSlots,
+                                        uint64_t Seed)
+    : F(F), NumSlots(NumSlots ? NumSlots : 1), Seed(Seed) {}
+
+uint32_t kovid::OpaqueValuePool::nextConstant() {
+  // The first NumSlots constants are the values of the slots.
+  return hash::derive(Seed, NumSlots + NextConstant++);
+}
+
+Value *kovid::OpaqueValuePool::loadOpaqueValue(Instruction *InsertBefore,
+                                               uint32_t &Known) {
+  Type *Int32Ty = Type::getInt32Ty(F.getContext());
+
+  if (Slots.empty()) {
+    // Put the slots at the top of the entry block, so their initialization
+    // dominates every use and runs only once per call.
+    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+    for (unsigned i = 0; i < NumSlots; ++i) {
+      uint32_t K = hash::derive(Seed, i);
+      AllocaInst *Slot = Builder.CreateAlloca(Int32Ty, nullptr, "dummyForObf");
+      StoreInst *Init =
+          Builder.CreateStore(ConstantInt::get(Int32Ty, K), Slot);
+      Init->setVolatile(true);
+      Slots.push_back({Slot, K});
+    }
+  }
+
+  auto &Slot = Slots[NextSlot];
+  NextSlot = (NextSlot + 1) % Slots.size();
+
+  // Load from the slot (volatile, so it won't be folded).
+  IRBuilder<> Builder(InsertBefore);
+  LoadInst *Load = Builder.CreateLoad(Int32Ty, Slot.first, "dummy.load");
+  Load->setVolatile(true);
+  Known = Slot.second;
+  return Load;
+}
+
+kovid::OpaqueZero::OpaqueZero(Function &F) : F(F) {}
+
+unsigned kovid::OpaqueZero::setupCost(Type *Ty) const {
+  if (Values.count(Ty))
+    return 0;
+  unsigned Cost = Load ? 0 : 1;
+  if (Ty->getScalarSizeInBits() != 64)
+    ++Cost;
+  if (Ty->isVectorTy())
+    Cost += 2;
+  return Cost;
+}
+
+Value *kovid::OpaqueZero::get(Type *Ty) {
+  Value *&Zero = Values[Ty];
+  if (Zero)
+    return Zero;
+
+  if (!Load) {
+    Module &M = *F.getParent();
+    Type *Int64Ty = Type::getInt64Ty(F.getContext());
+    GlobalVariable *GV = M.getNamedGlobal("kovid.opaque");
+    if (!GV) {
+      GV = new GlobalVariable(M, Int64Ty, /*isConstant=*/false,
+                              GlobalValue::InternalLinkage,
+                              ConstantInt::get(Int64Ty, 0), "kovid.opaque");
+      GV->setExternallyInitialized(true);
+    }
+    IRBuilder<> Builder(&*F.getEntryBlock().getFirstInsertionPt());
+    Load = Builder.CreateLoad(Int64Ty, GV, "opaque.zero");
+  }
+
+  // Everything derived from the load stays next to it, in the entry block.
+  IRBuilder<> Builder(Load->getNextNode());
+  Zero = Builder.CreateZExtOrTrunc(Load, Ty->getScalarType());
+  if (auto *VTy = dyn_cast<VectorType>(Ty))
+    Zero = Builder.CreateVectorSplat(VTy->getElementCount(), Zero);
+  if (Zero != Load)
+    Zero->setName("opaque.zero");
+  return Zero;
+}
+
+void kovid::obfuscateInstruction(Instruction *I, OpaqueValuePool &Pool) {
+  LLVM_DEBUG(dbgs() << "Complicating: " << *I << '\n');
+
+  IRBuilder<> Builder(I);
+  LLVMContext &Ctx = I->getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+
+  // To prevent constant folding, use a volatile load from one of the
+  // function's opaque slots.
+  uint32_t Known = 0;
+  Value *dummyLoad = Pool.loadOpaqueValue(I, Known);
+
+  // Now, build the dummy arithmetic sequence:
+  // dummy = add i32 (dummyLoad, C)
+  uint32_t C = Pool.nextConstant();
+  Instruction *dummy = cast<Instruction>(
+      Builder.CreateAdd(dummyLoad, ConstantInt::get(Int32Ty, C), "dummy"));
+  dummy->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
+
+  // temp = sub i32 (dummy, Known + C)  ; This should yield 0
+  Instruction *temp = cast<Instruction>(Builder.CreateSub(
+      dummy, ConstantInt::get(Int32Ty, Known + C), "temp"));
+  temp->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
+
+  // Now, replace:  %result = add i32 %a, %b
+  // with:
+  // left = add i32 (%a, temp)   ; (%a + 0)
+  // newAdd = add i32 (left, %b)
+  // For other types, temp is first converted to the type of the add, and
+  // splat for vectors.
+  Value *zero = temp;
+  Type *Ty = I->getType();
+  if (Ty != Int32Ty) {
+    zero = Builder.CreateZExtOrTrunc(temp, Ty->getScalarType(), "temp.ext");
+    if (auto *VTy = dyn_cast<VectorType>(Ty))
+      zero = Builder.CreateVectorSplat(VTy->getElementCount(), zero,
+                                       "temp.splat");
+  }
+  Value *a = I->getOperand(0);
+  Instruction *left = cast<Instruction>(Builder.CreateAdd(a, zero, "left"));
+  left->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
+
+  Value *b = I->getOperand(1);
+  Instruction *newAdd =
+      cast<Instruction>(Builder.CreateAdd(left, b, "obf.add"));
+  newAdd->setMetadata("obf", MDNode::get(Ctx, MDString::get(Ctx, "obf")));
+
+  // Replace all uses of the original add with the newAdd and remove it.
+  I->replaceAllUsesWith(newAdd);
+  I->eraseFromParent();
+}
+
+void kovid::obfuscateInstructionMBA(Instruction *I, OpaqueZero &Zero) {
+  LLVM_DEBUG(dbgs() << "Complicating (MBA): " << *I << '\n');
+  IRBuilder<> Builder(I);
+  Value *z = Zero.get(I->getType());
+  Value *a = I->getOperand(0);
+  Value *b = I->getOperand(1);
+  auto Tag = [](Value *V) {
+    tagObfuscated(V);
+    return V;
+  };
+
+  Value *New = nullptr;
+  switch (I->getOpcode()) {
+  case Instruction::Add: {
+    // a + b  ==  (a ^ b) + 2 * (a & b)
+    Value *t = Tag(Builder.CreateXor(a, z, "mba.t"));
+    Value *x = Tag(Builder.CreateXor(t, b, "mba.x"));
+    Value *o = Tag(Builder.CreateOr(a, z, "mba.o"));
+    Value *m = Tag(Builder.CreateAnd(o, b, "mba.m"));
+    // 2 * m as m + m: a shift by one is poison for i1.
+    Value *s = Tag(Builder.CreateAdd(m, m, "mba.s"));
+    New = Builder.CreateAdd(x, s, "mba.add");
+    break;
+  }
+  case Instruction::Sub: {
+    // a - b  ==  (a ^ b) - 2 * (~a & b)
+    Value *t = Tag(Builder.CreateXor(a, z, "mba.t"));
+    Value *x = Tag(Builder.CreateXor(t, b, "mba.x"));
+    Value *n = Tag(Builder.CreateNot(t, "mba.n"));
+    Value *m = Tag(Builder.CreateAnd(n, b, "mba.m"));
+    Value *s = Tag(Builder.CreateAdd(m, m, "mba.s"));
+    New = Builder.CreateSub(x, s, "mba.sub");
+    break;
+  }
+  case Instruction::Xor: {
+    // a ^ b  ==  (a | b) - (a & b)
+    Value *o = Tag(Builder.CreateOr(a, b, "mba.o"));
+    Value *oz = Tag(Builder.CreateXor(o, z, "mba.oz"));
+    Value *t = Tag(Builder.CreateXor(a, z, "mba.t"));
+    Value *m = Tag(Builder.CreateAnd(t, b, "mba.m"));
+    New = Builder.CreateSub(oz, m, "mba.xor");
+    break;
+  }
+  case Instruction::And: {
+    // a & b  ==  (a + b) - (a | b)
+    Value *t = Tag(Builder.CreateXor(a, z, "mba.t"));
+    Value *s = Tag(Builder.CreateAdd(t, b, "mba.s"));
+    Value *bz = Tag(Builder.CreateXor(b, z, "mba.bz"));
+    Value *o = Tag(Builder.CreateOr(a, bz, "mba.o"));
+    New = Builder.CreateSub(s, o, "mba.and");
+    break;
+  }
+  case Instruction::Or: {
+    // a | b  ==  (a ^ b) + (a & b)
+    Value *t = Tag(Builder.CreateXor(a, z, "mba.t"));
+    Value *x = Tag(Builder.CreateXor(t, b, "mba.x"));
+    Value *o = Tag(Builder.CreateOr(a, z, "mba.o"));
+    Value *m = Tag(Builder.CreateAnd(o, b, "mba.m"));
+    New = Builder.CreateAdd(x, m, "mba.or");
+    break;
+  }
+  default:
+    llvm_unreachable("not an MBA candidate");
+  }
+  Tag(New);
+
+  I->replaceAllUsesWith(New);
+  I->eraseFromParent();
+}
+
+void kovid::obfuscateInstructionLight(Instruction *I) {
+  LLVM_DEBUG(dbgs() << "Lightly complicating: " << *I << '\n');
+  IRBuilder<> Builder(I);
+
+  // The instructions are created directly, not through the builder, so that
+  // a constant operand is not folded back into the original instruction.
+  Value *a = I->getOperand(0);
+  Value *b = I->getOperand(1);
+  auto Emit = [&](Instruction *New, const char *Name) {
+    Builder.Insert(New, Name);
+    tagObfuscated(New);
+    return New;
+  };
+
+  Instruction *New = nullptr;
+  switch (I->getOpcode()) {
+  case Instruction::Add: {
+    // a + b  ==  (a - ~b) - 1
+    Instruction *notB = Emit(BinaryOperator::CreateNot(b), "obf.not");
+    Instruction *sub = Emit(BinaryOperator::CreateSub(a, notB), "obf.sub");
+    Constant *One = ConstantInt::get(I->getType(), 1);
+    New = Emit(BinaryOperator::CreateSub(sub, One), "obf.add");
+    break;
+  }
+  case Instruction::Sub: {
+    // a - b  ==  ~(~a + b)
+    Instruction *notA = Emit(BinaryOperator::CreateNot(a), "obf.not");
+    Instruction *add = Emit(BinaryOperator::CreateAdd(notA, b), "obf.add");
+    New = Emit(BinaryOperator::CreateNot(add), "obf.sub");
+    break;
+  }
+  case Instruction::Xor: {
+    // a ^ b  ==  (a | b) - (a & b)
+    Instruction *o = Emit(BinaryOperator::CreateOr(a, b), "obf.or");
+    Instruction *m = Emit(BinaryOperator::CreateAnd(a, b), "obf.and");
+    New = Emit(BinaryOperator::CreateSub(o, m), "obf.xor");
+    break;
+  }
+  case Instruction::And: {
+    // a & b  ==  (a + b) - (a | b)
+    Instruction *s = Emit(BinaryOperator::CreateAdd(a, b), "obf.add");
+    Instruction *o = Emit(BinaryOperator::CreateOr(a, b), "obf.or");
+    New = Emit(BinaryOperator::CreateSub(s, o), "obf.and");
+    break;
+  }
+  case Instruction::Or: {
+    // a | b  ==  (a ^ b) + (a & b)
+    Instruction *x = Emit(BinaryOperator::CreateXor(a, b), "obf.xor");
+    Instruction *m = Emit(BinaryOperator::CreateAnd(a, b), "obf.and");
+    New = Emit(BinaryOperator::CreateAdd(x, m), "obf.or");
+    break;
+  }
+  default:
+    llvm_unreachable("not an obfuscation candidate");
+  }
+
+  I->replaceAllUsesWith(New);
+  I->eraseFromParent();
+}
+
+void kovid::obfuscateCandidates(Function &F, ArrayRef<Instruction *> Candidates,
+                                FunctionAnalysisManager &FAM,
+                                GrowthBudget *Budget) {
+  if (Candidates.empty() || !shouldTransform(F, rules::InstructionObfuscation))
+    return;
+  TransformTimeScope Trace(rules::InstructionObfuscation, "rewrite",
+                           F.getName(), Candidates.size(), "candidates");
+
+  // kovid_heavy functions get the full rewrite in hot blocks too.
+  ProfileSummaryInfo *PSI = nullptr;
+  BlockFrequencyInfo *BFI = nullptr;
+  if (HotMode != HotBlockMode::Off && !isHeavy(F)) {
+    auto &MAMProxy = FAM.getResult<ModuleAnalysisManagerFunctionProxy>(F);
+    PSI = MAMProxy.getCachedResult<ProfileSummaryAnalysis>(*F.getParent());
+    // Without a profile nothing is hot, so there is no need for BFI.
+    if (PSI && PSI->hasProfileSummary())
+      BFI = &FAM.getResult<BlockFrequencyAnalysis>(F);
+  }
+
+  // Seeded before the first rewrite, from the code as it came in.
+  OpaqueValuePool Pool(F, OpaqueSlots,
+                       functionSeed(F, rules::InstructionObfuscation));
+  OpaqueZero Zero(F);
+  auto Fits = [&](unsigned Cost) {
+    return !Budget || Budget->charge(F, rules::InstructionObfuscation, Cost);
   };
 
-  return {LLVM_PLUGIN_API_VERSION, "kovid-instruction-obf", "0.0.1", callback};
-};
+  unsigned NumObfuscated = 0, NumLightened = 0, NumSkipped = 0;
+  // The candidates the budget gave the light rewrite, or none.
+  unsigned NumLightenedForBudget = 0, NumOverBudget = 0;
+  for (Instruction *I : Candidates) {
+    bool Hot = BFI && PSI->isHotBlockNthPercentile(HotPercentile,
+                                                   I->getParent(), BFI);
+    if (Hot && HotMode == HotBlockMode::Skip) {
+      ++NumSkipped;
+      continue;
+    }
+    if (!Hot && Mode == RewriteMode::MBA &&
+        Fits(mbaRewriteCost(*I) + Zero.setupCost(I->getType()))) {
+      obfuscateInstructionMBA(I, Zero);
+      ++NumObfuscated;
+      continue;
+    }
+    if (!Hot && Mode == RewriteMode::Classic &&
+        Fits(classicRewriteCost(*I) + Pool.setupCost())) {
+      obfuscateInstruction(I, Pool);
+      ++NumObfuscated;
+      continue;
+    }
+    if (!Fits(LightRewriteCost)) {
+      ++NumOverBudget;
+      continue;
+    }
+    obfuscateInstructionLight(I);
+    ++(Hot ? NumLightened : NumLightenedForBudget);
+  }
+
+  NumInstrsObfuscated += NumObfuscated;
+  NumInstrsLightened += NumLightened + NumLightenedForBudget;
+  NumInstrsSkipped += NumSkipped;
+  NumInstrsOverBudget += NumOverBudget;
+
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  ORE.emit([&]() {
+    OptimizationRemark R(DEBUG_TYPE, "InstructionsObfuscated", &F);
+    R << "obfuscated " << ore::NV("NumObfuscated", NumObfuscated)
+      << " instructions";
+    if (BFI)
+      R << ", " << ore::NV("NumLightened", NumLightened) << " lightened and "
+        << ore::NV("NumSkipped", NumSkipped) << " skipped in hot blocks";
+    if (NumLightenedForBudget || NumOverBudget)
+      R << ", " << ore::NV("NumLightenedForBudget", NumLightenedForBudget)
+        << " lightened and " << ore::NV("NumOverBudget", NumOverBudget)
+        << " left alone for the growth budget";
+    return R;
+  });
+}
+
+PreservedAnalyses
+kovid::InstructionObfuscationPass::run(Function &F,
+                                       FunctionAnalysisManager &FAM) {
+  TransformTimeScope Trace(rules::InstructionObfuscation, "", F.getName());
+
+  // Collect the candidates of the whole function first, so the hotness of
+  // each block is known before the function is modified.
+  SmallVector<Instruction *, 16> Candidates;
+  {
+    TransformTimeScope Collect(rules::InstructionObfuscation, "collect",
+                               F.getName());
+    for (BasicBlock &BB : F) {
+      for (Instruction &I : BB) {
+        if (isObfuscationCandidate(I))
+          Candidates.push_back(&I);
+      }
+    }
+  }
 
-extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
-  return getPassPluginInfo();
+  // Process each candidate.
+  std::shared_ptr<GrowthBudget> Budget =
+      UseBudget ? GrowthBudget::get(*F.getParent()) : nullptr;
+  obfuscateCandidates(F, Candidates, FAM, Budget.get());
+  if (Budget)
+    Budget->emitReport(F, FAM.getResult<OptimizationRemarkEmitterAnalysis>(F));
+  return PreservedAnalyses::none();
 }
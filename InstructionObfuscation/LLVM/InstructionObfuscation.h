@@ -0,0 +1,132 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_INSTRUCTIONOBFUSCATION_H
+#define KOVID_INSTRUCTIONOBFUSCATION_H
+
+#include "KoviDGrowthBudget.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/PassManager.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace kovid {
+
+/// A per-function pool of stack slots that hold known constants behind
+/// volatile accesses. The slots are created once, in the entry block, the
+/// first time an opaque value is requested, and all obfuscated sequences of
+/// the function draw their opaque values from them. The stack use therefore
+/// stays constant, no matter how many instructions are obfuscated or how
+/// often a loop runs.
+///
+/// The values the slots hold and the offsets of the dummy arithmetic are
+/// derived from \p Seed, the content-keyed seed of the function (see
+/// KoviDSeed.h), so they are the same on every build of the same code.
+class OpaqueValuePool {
+public:
+  OpaqueValuePool(llvm::Function &F, unsigned NumSlots, uint64_t Seed);
+
+  /// Emit a volatile load of the next slot before \p InsertBefore. The
+  /// value the slot is known to hold is returned in \p Known.
+  llvm::Value *loadOpaqueValue(llvm::Instruction *InsertBefore,
+                               uint32_t &Known);
+
+  /// The next constant of the dummy arithmetic of the function.
+  uint32_t nextConstant();
+
+  /// The instructions the next loadOpaqueValue adds to the entry block to
+  /// set up the slots.
+  unsigned setupCost() const { return Slots.empty() ? 2 * NumSlots : 0; }
+
+private:
+  llvm::Function &F;
+  unsigned NumSlots;
+  uint64_t Seed;
+  unsigned NextSlot = 0;
+  unsigned NextConstant = 0;
+  llvm::SmallVector<std::pair<llvm::AllocaInst *, uint32_t>, 4> Slots;
+};
+
+/// A per-function source of opaque zeros for the MBA rewrites: one plain
+/// load, in the entry block, of a module variable that holds 0 but is
+/// externally_initialized, so the optimizer cannot fold it. It is loop
+/// invariant, so it does not stop vectorization the way the volatile slots
+/// do. Each integer or integer vector type gets its own conversion or splat
+/// of the load, also in the entry block.
+class OpaqueZero {
+public:
+  explicit OpaqueZero(llvm::Function &F);
+
+  /// The opaque zero of type \p Ty.
+  llvm::Value *get(llvm::Type *Ty);
+
+  /// The instructions the next get(Ty) adds to the entry block.
+  unsigned setupCost(llvm::Type *Ty) const;
+
+private:
+  llvm::Function &F;
+  llvm::LoadInst *Load = nullptr;
+  llvm::SmallDenseMap<llvm::Type *, llvm::Value *, 4> Values;
+};
+
+/// Returns true if \p I is an instruction the arithmetic obfuscation knows
+/// how to rewrite: integer adds, and also subs, xors, ands and ors with
+/// -kovid-instr-obf-mode=mba, except for the loop steps and address
+/// computations that the vectorizers must recognize.
+bool isObfuscationCandidate(const llvm::Instruction &I);
+
+/// Replace the add \p I with an equivalent, more complex sequence and erase
+/// it. The opaque value of the sequence comes from \p Pool.
+void obfuscateInstruction(llvm::Instruction *I, OpaqueValuePool &Pool);
+
+/// Replace the candidate \p I with an equivalent mixed boolean-arithmetic
+/// sequence of the same type, built around the opaque zero from \p Zero,
+/// and erase it.
+void obfuscateInstructionMBA(llvm::Instruction *I, OpaqueZero &Zero);
+
+/// Replace the candidate \p I with a short, memory free equivalent sequence
+/// and erase it. Used for hot blocks with -kovid-instr-obf-hot-mode=light.
+void obfuscateInstructionLight(llvm::Instruction *I);
+
+/// Rewrite the \p Candidates collected from \p F, unless the selection
+/// rules exclude \p F. When a profile is available and
+/// -kovid-instr-obf-hot-mode is set, candidates in hot blocks are skipped or
+/// get the light rewrite (except in kovid_heavy functions), and a
+/// per-function report is printed. The ProfileSummaryAnalysis is only used if
+/// it is already cached. With a \p Budget, a candidate whose full rewrite
+/// does not fit gets the light one, or is left alone if that does not fit
+/// either.
+void obfuscateCandidates(llvm::Function &F,
+                         llvm::ArrayRef<llvm::Instruction *> Candidates,
+                         llvm::FunctionAnalysisManager &FAM,
+                         GrowthBudget *Budget = nullptr);
+
+// This, for now, implements "Arithmetic code obfuscation" only.
+// With UseBudget, the rewrites are charged to the growth budget of the
+// module that all loaded KoviD plugins share (GrowthBudget::get).
+struct InstructionObfuscationPass
+    : public llvm::PassInfoMixin<InstructionObfuscationPass> {
+  explicit InstructionObfuscationPass(bool UseBudget = false)
+      : UseBudget(UseBudget) {}
+
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+
+private:
+  bool UseBudget;
+};
+
+} // namespace kovid
+
+#endif // KOVID_INSTRUCTIONOBFUSCATION_H
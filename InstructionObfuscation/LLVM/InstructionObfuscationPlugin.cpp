@@ -0,0 +1,41 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#include "InstructionObfuscation.h"
+#include "KoviDPipeline.h"
+#include "KoviDSelection.h"
+
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+using namespace llvm;
+
+static PassPluginLibraryInfo getPassPluginInfo() {
+  const auto callback = [](PassBuilder &PB) {
+    kovid::TransformPasses Passes;
+    Passes.Setup = [](ModulePassManager &MPM) {
+      // The profile summary is a module analysis, so make sure it is
+      // cached before the function pass asks for it.
+      MPM.addPass(RequireAnalysisPass<ProfileSummaryAnalysis, Module>());
+      MPM.addPass(kovid::ApplyAnnotationsPass());
+      // Releases the growth budget of the module after the pipeline.
+      MPM.addPass(RequireAnalysisPass<kovid::GrowthBudgetAnalysis, Module>());
+    };
+    Passes.Run = [](FunctionPassManager &FPM) {
+      FPM.addPass(kovid::InstructionObfuscationPass(/*UseBudget=*/true));
+    };
+    kovid::registerGrowthBudgetAnalysis(PB);
+    kovid::registerTransformPasses(PB, kovid::rules::InstructionObfuscation,
+                                   Passes);
+  };
+
+  return {LLVM_PLUGIN_API_VERSION, "kovid-instruction-obf", "0.0.1", callback};
+};
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return getPassPluginInfo();
+}
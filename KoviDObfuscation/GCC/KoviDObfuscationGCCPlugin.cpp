@@ -0,0 +1,338 @@
+/*
+ * KoviD Obfuscation GCC Plugin
+ * ----------------------------
+ *
+ * All KoviD GCC transforms in one plugin. The transforms and the keys are
+ * chosen with plugin arguments, so one build of the plugin serves every
+ * configuration:
+ *
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-transforms=<t1,t2,...>
+ *        rename-code, dummy-code-insertion, instruction-obf,
+ *        string-encryption and metadata-unused-code-removal, as for the
+ *        combined LLVM plugin (default: the first three).
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-key=<key>
+ *        The crypto key of all transforms; rename-key= and string-key=
+ *        override it for one of them. Without any, the keys generated when
+ *        the plugin was built are used. The constants of the arithmetic
+ *        rewrites and the dummy code are derived from the string key, so
+ *        the output is the same for the same key and source.
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-rules=<file>
+ *        The allow/deny rules that select the symbols of each transform,
+ *        see Common/KoviDRules.h.
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-max-function-growth=<percent>,
+ *   -max-module-growth=<percent>
+ *        The code-growth budget of the arithmetic rewrites and the dummy
+ *        code, see Common/KoviDBudget.h.
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-dummy-placement=<entry|cold>
+ *        Where the dummy code goes, as -kovid-dummy-placement for LLVM.
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-string-decryption=<mode>
+ *        none, startup or page: how the strings are decrypted at run time,
+ *        as decryption= of the standalone StringEncryption plugin.
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-compact, -map=<file|dir>
+ *   -fplugin-arg-libKoviDObfuscationGCCPlugin-verbose
+ *        The options of the standalone RenameCode and
+ *        RemoveMetadataAndUnusedCode plugins.
+ *
+ * The per-function transforms run in a single GIMPLE pass after "cfg", so
+ * each function is visited once instead of once per plugin, and the
+ * function is renamed last. The string encryption and the unused-code
+ * removal are simple IPA passes after "visibility", so they run once per
+ * unit, after every function was renamed; the renaming records the original
+ * names, so the rules still match those (see KoviDSelection.h).
+ *
+ * Author: djolertrk
+ * License: Apache v2.0 with LLVM-exception
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// GCC plugin headers
+#include "gcc-plugin.h"
+#include "plugin-version.h"
+
+#include "context.h"
+#include "tree.h"
+#include "tree-pass.h"
+#include "gimple.h"
+#include "gimple-iterator.h"
+#include "basic-block.h"
+#include "cgraph.h"
+#include "diagnostic.h"
+#include "opts.h"
+#include "dumpfile.h"
+#include "statistics.h"
+
+#include "DummyCodeInsertion.h"
+#include "InstructionObfuscation.h"
+#include "KoviDSelection.h"
+#include "KoviDGrowthBudget.h"
+#include "KoviDSeed.h"
+#include "KoviDTimevar.h"
+#include "RemoveMetadataAndUnusedCode.h"
+#include "RenameCode.h"
+#include "StringEncryption.h"
+
+int plugin_is_GPL_compatible;
+extern struct gcc_options global_options;
+
+#ifndef CRYPTO_KEY
+#define CRYPTO_KEY "default_key"
+#endif
+
+#ifndef STR_GCC_CRYPTO_KEY
+#define STR_GCC_CRYPTO_KEY "default_key"
+#endif
+
+namespace {
+
+struct obfuscation_options {
+  bool rename_code = false;
+  bool dummy_code_insertion = false;
+  bool instruction_obfuscation = false;
+  bool string_encryption = false;
+  bool remove_metadata_and_unused_code = false;
+
+  kovid_rename_options rename;
+  std::string string_key;
+  const char *rules = nullptr;
+  bool verbose = false;
+  // dummy-placement=cold
+  bool cold_dummy_placement = false;
+  // string-decryption=
+  kovid_string_decryption string_decryption = KOVID_DECRYPT_NONE;
+};
+
+static obfuscation_options options;
+
+// Enable the transform called name. Returns false for an unknown name.
+static bool enable_transform(const std::string &name) {
+  if (name == "rename-code")
+    options.rename_code = true;
+  else if (name == "dummy-code-insertion")
+    options.dummy_code_insertion = true;
+  else if (name == "instruction-obf")
+    options.instruction_obfuscation = true;
+  else if (name == "string-encryption")
+    options.string_encryption = true;
+  else if (name == "metadata-unused-code-removal")
+    options.remove_metadata_and_unused_code = true;
+  else
+    return false;
+  return true;
+}
+
+static bool parse_transforms(const char *list) {
+  std::string names(list);
+  size_t start = 0;
+  while (start <= names.size()) {
+    size_t end = names.find(',', start);
+    if (end == std::string::npos)
+      end = names.size();
+    std::string name = names.substr(start, end - start);
+    if (!name.empty() && !enable_transform(name)) {
+      fprintf(stderr, "KoviD Obfuscation: unknown transform '%s'\n",
+              name.c_str());
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+// The value of a plugin argument that needs one, or nullptr after reporting
+// it missing.
+static const char *required_value(const plugin_argument &arg) {
+  if (!arg.value || !*arg.value)
+    fprintf(stderr, "KoviD Obfuscation: '%s' needs a value\n", arg.key);
+  return arg.value && *arg.value ? arg.value : nullptr;
+}
+
+static bool parse_arguments(const plugin_name_args *plugin_info) {
+  bool have_transforms = false;
+  const char *key = nullptr, *rename_key = nullptr, *string_key = nullptr;
+
+  for (int i = 0; i < plugin_info->argc; ++i) {
+    const plugin_argument &arg = plugin_info->argv[i];
+    if (!strcmp(arg.key, "transforms")) {
+      const char *value = required_value(arg);
+      if (!value || !parse_transforms(value))
+        return false;
+      have_transforms = true;
+    } else if (!strcmp(arg.key, "key")) {
+      if (!(key = required_value(arg)))
+        return false;
+    } else if (!strcmp(arg.key, "rename-key")) {
+      if (!(rename_key = required_value(arg)))
+        return false;
+    } else if (!strcmp(arg.key, "string-key")) {
+      if (!(string_key = required_value(arg)))
+        return false;
+    } else if (!strcmp(arg.key, "compact")) {
+      options.rename.compact = true;
+    } else if (!strcmp(arg.key, "map")) {
+      const char *value = required_value(arg);
+      if (!value)
+        return false;
+      options.rename.map_path = value;
+    } else if (!strcmp(arg.key, "rules")) {
+      if (!(options.rules = required_value(arg)))
+        return false;
+    } else if (!strcmp(arg.key, "dummy-placement")) {
+      const char *value = required_value(arg);
+      if (!value)
+        return false;
+      if (strcmp(value, "entry") && strcmp(value, "cold")) {
+        fprintf(stderr, "KoviD Obfuscation: unknown dummy-placement '%s'\n",
+                value);
+        return false;
+      }
+      options.cold_dummy_placement = !strcmp(value, "cold");
+    } else if (!strcmp(arg.key, "string-decryption")) {
+      if (!kovid_parse_string_decryption(arg.value,
+                                         options.string_decryption)) {
+        fprintf(stderr, "KoviD Obfuscation: string-decryption must be none, "
+                        "startup or page\n");
+        return false;
+      }
+    } else if (kovid_parse_budget_argument(arg)) {
+      // max-function-growth= or max-module-growth=.
+    } else if (!strcmp(arg.key, "verbose")) {
+      options.verbose = true;
+    } else {
+      fprintf(stderr, "KoviD Obfuscation: unknown argument '%s'\n", arg.key);
+      return false;
+    }
+  }
+
+  if (!have_transforms) {
+    options.rename_code = true;
+    options.dummy_code_insertion = true;
+    options.instruction_obfuscation = true;
+  }
+
+  options.rename.key = rename_key ? rename_key : key ? key : CRYPTO_KEY;
+  options.string_key =
+      string_key ? string_key : key ? key : STR_GCC_CRYPTO_KEY;
+  kovid_seed_key() = options.string_key;
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// The fused per-function pass
+// -----------------------------------------------------------------------------
+
+static const pass_data obfuscation_pass_data = {
+    GIMPLE_PASS,       // type
+    "kovid_obfuscate", // name
+    OPTGROUP_OTHER,    // optinfo_flags
+    KOVID_TV_PASS,     // tv_id
+    0,                 // properties_required
+    0,                 // properties_provided
+    0,                 // properties_destroyed
+    0,                 // todo_flags_start
+    0                  // todo_flags_finish
+};
+
+struct obfuscation_pass : gimple_opt_pass {
+  obfuscation_pass(gcc::context *ctx)
+      : gimple_opt_pass(obfuscation_pass_data, ctx) {}
+
+  unsigned int execute(function *fun) override {
+    // Before the dummy code, so that its statements are left alone.
+    if (options.instruction_obfuscation)
+      kovid_obfuscate_instructions(fun);
+
+    // Trivial functions ICE at -O0, as for the standalone plugin.
+    if (options.dummy_code_insertion && global_options.x_optimize > 0)
+      kovid_insert_dummy_code(fun, options.cold_dummy_placement);
+
+    kovid_report_budget(fun);
+
+    // After the dummy code, so that its statements lose their locations too.
+    if (options.remove_metadata_and_unused_code)
+      kovid_strip_locations(fun);
+
+    // Last; the selection rules keep seeing the original name after it.
+    if (options.rename_code)
+      kovid_rename_function(fun, options.rename);
+
+    return 0;
+  }
+};
+
+} // end anonymous namespace
+
+static void finish_unit(void *, void *) {
+  if (options.rename_code)
+    kovid_write_rename_map(options.rename);
+}
+
+// -----------------------------------------------------------------------------
+// plugin_init
+// -----------------------------------------------------------------------------
+int plugin_init(struct plugin_name_args *plugin_info,
+                struct plugin_gcc_version *version) {
+  if (!plugin_default_version_check(version, &gcc_version)) {
+    fprintf(stderr, "KoviD Obfuscation: Incompatible GCC version\n");
+    return 1;
+  }
+
+  if (!parse_arguments(plugin_info) ||
+      !kovid_init_selection(plugin_info->base_name, "KoviD Obfuscation",
+                            options.rules))
+    return 1;
+
+  static struct plugin_info my_plugin_info = {
+      .version = "1.0",
+      .help = "All KoviD transforms; select them with -fplugin-arg-<plugin>-"
+              "transforms=<t1,t2,...> and the key with -fplugin-arg-<plugin>-"
+              "key=<key>."};
+  register_callback(plugin_info->base_name, PLUGIN_INFO, nullptr,
+                    &my_plugin_info);
+
+  if (options.dummy_code_insertion && global_options.x_optimize == 0)
+    fprintf(stderr, "KoviD Obfuscation: dummy-code-insertion is skipped at "
+                    "-O0, use it with -O1 and higher.\n");
+
+  struct register_pass_info pass_info;
+  pass_info.pass = new obfuscation_pass(g);
+  pass_info.reference_pass_name = "cfg";
+  pass_info.ref_pass_instance_number = 1;
+  pass_info.pos_op = PASS_POS_INSERT_AFTER;
+  register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, nullptr,
+                    &pass_info);
+
+  // Registered first, so that it runs after the unused-code removal, which
+  // is then inserted between it and "visibility".
+  if (options.string_encryption) {
+    struct register_pass_info string_pass_info;
+    string_pass_info.pass = make_kovid_string_encryption_pass(
+        g, options.string_key, options.string_decryption);
+    string_pass_info.reference_pass_name = "visibility";
+    string_pass_info.ref_pass_instance_number = 1;
+    string_pass_info.pos_op = PASS_POS_INSERT_AFTER;
+    register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP,
+                      nullptr, &string_pass_info);
+  }
+
+  if (options.remove_metadata_and_unused_code) {
+    kovid_disable_debug_info();
+
+    struct register_pass_info ipa_pass_info;
+    ipa_pass_info.pass = make_kovid_remove_unused_pass(g, options.verbose);
+    ipa_pass_info.reference_pass_name = "visibility";
+    ipa_pass_info.ref_pass_instance_number = 1;
+    ipa_pass_info.pos_op = PASS_POS_INSERT_AFTER;
+    register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP,
+                      nullptr, &ipa_pass_info);
+  }
+
+  if (options.rename_code)
+    register_callback(plugin_info->base_name, PLUGIN_FINISH_UNIT, finish_unit,
+                      nullptr);
+
+  fprintf(stderr, "KoviD Obfuscation GCC Plugin loaded.\n");
+  return 0;
+}
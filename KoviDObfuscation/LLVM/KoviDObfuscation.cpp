@@ -0,0 +1,156 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+//
+// Combined KoviD Obfuscation Pass for LLVM
+// ------------------------------------------
+//
+// Loading every KoviD plugin separately costs one plugin load and one full
+// traversal of the IR per transform. This pass drives all of them from a
+// single walk instead:
+//
+// 1. Module level work runs first. Unused code is removed before the
+//    per-function walk, so no time is spent obfuscating code that is about to
+//    be thrown away, and string globals are encrypted.
+// 2. Every defined function is then visited once. Each of its instructions
+//    is visited once to strip debug locations and to collect the arithmetic
+//    candidates, the candidates are rewritten, the dummy code is inserted
+//    and finally the function is renamed, so that the selection rules see
+//    the original name. Function analyses (such as the block frequencies
+//    used for hot blocks) come from the shared FunctionAnalysisManager.
+//    Candidates are collected before any rewriting, so no transform sees the
+//    code inserted by another one. The arithmetic rewrites and the dummy
+//    code share one growth budget, in that order of priority.
+//
+// Since everything runs under the name of this one pass, each transform and
+// phase has a time-trace entry of its own (see KoviDTimeTrace.h).
+//
+
+#include "KoviDObfuscation.h"
+#include "DummyCodeInsertion.h"
+#include "InstructionObfuscation.h"
+#include "KoviDSelection.h"
+#include "KoviDTimeTrace.h"
+#include "RemoveMetadataAndUnusedCode.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/LLVMContext.h"
+
+using namespace llvm;
+
+PreservedAnalyses kovid::KoviDObfuscationPass::run(Module &M,
+                                                   ModuleAnalysisManager &MAM) {
+  // The functions the transforms ran on already, see RunAttribute. The
+  // available_externally copies of the functions that a ThinLTO backend
+  // imports belong to other modules.
+  auto AlreadyRun = [&](const Function &F) {
+    return !Opts.RunAttribute.empty() && F.hasFnAttribute(Opts.RunAttribute);
+  };
+  unsigned NumRun = 0, NumNew = 0;
+  for (const Function &F : M)
+    if (!F.isDeclaration() && !F.hasAvailableExternallyLinkage())
+      ++(AlreadyRun(F) ? NumRun : NumNew);
+  if (NumRun && !NumNew)
+    return PreservedAnalyses::all();
+  if (NumRun && Opts.StringEncryption) {
+    M.getContext().emitError(
+        Twine("KoviD: ") + M.getModuleIdentifier() + " merges " +
+        Twine(NumRun) + " functions obfuscated at compile time with " +
+        Twine(NumNew) + " others, and the string encryption cannot tell their "
+        "strings apart; load the plugin in all the compiles or in none of "
+        "them, or pass -kovid-defer-to-lto to all of them");
+    return PreservedAnalyses::all();
+  }
+
+  auto &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+  bool Changed = applyAnnotations(M);
+
+  if (Opts.RemoveMetadataAndUnusedCode) {
+    stripModuleDebugInfo(M);
+    // Results cached for the erased functions must not outlive them.
+    if (removeUnusedGlobals(M))
+      FAM.clear();
+    Changed = true;
+  }
+
+  // Computed once here, all functions share it.
+  if (Opts.InstructionObfuscation)
+    MAM.getResult<ProfileSummaryAnalysis>(M);
+
+  if (Opts.StringEncryption)
+    Changed |= encryptModuleStrings(M, Opts.StringCryptoKey);
+
+  RenameMap RenamedNames;
+  // Shared with the standalone plugins loaded into the same compiler.
+  std::shared_ptr<GrowthBudget> Budget = GrowthBudget::get(M);
+  SmallVector<Instruction *, 16> Candidates;
+  for (Function &F : M) {
+    if (F.isDeclaration() || AlreadyRun(F))
+      continue;
+
+    auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+    bool StripDebugInfo =
+        Opts.RemoveMetadataAndUnusedCode &&
+        shouldTransform(F, rules::RemoveMetadataAndUnusedCode);
+    bool Obfuscate = Opts.InstructionObfuscation &&
+                     shouldTransform(F, rules::InstructionObfuscation);
+
+    if (StripDebugInfo)
+      stripFunctionDebugInfo(F);
+
+    Candidates.clear();
+    {
+      // Traced as the collection of the candidates when there is one, the
+      // stripping is cheap next to it.
+      TransformTimeScope Walk(Obfuscate ? rules::InstructionObfuscation
+                                        : rules::RemoveMetadataAndUnusedCode,
+                              Obfuscate ? "collect" : "strip debug info",
+                              F.getName());
+      for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+          if (StripDebugInfo)
+            stripInstructionDebugInfo(I);
+          if (Obfuscate && isObfuscationCandidate(I))
+            Candidates.push_back(&I);
+        }
+      }
+    }
+
+    obfuscateCandidates(F, Candidates, FAM, Budget.get());
+    Changed |= !Candidates.empty();
+
+    if (Opts.DummyCodeInsertion)
+      Changed |= insertDummyCode(F, FAM, Budget.get());
+    Budget->emitReport(F, ORE);
+
+    // Last, so that the selection rules see the original name.
+    if (Opts.RenameCode)
+      Changed |= renameFunction(F, Opts.RenameCryptoKey, ORE, &RenamedNames);
+  }
+
+  if (Opts.RenameCode)
+    writeRenameMap(M, RenamedNames, Opts.RenameCryptoKey);
+
+  // On the functions, so that the marks survive the merge of the full LTO
+  // modules; also on those the rules left alone and on the ones the
+  // transforms added.
+  if (!Opts.RunAttribute.empty()) {
+    for (Function &F : M)
+      if (!F.isDeclaration())
+        F.addFnAttr(Opts.RunAttribute);
+    Changed = true;
+  }
+
+  if (!Changed)
+    return PreservedAnalyses::all();
+
+  return PreservedAnalyses::none();
+}
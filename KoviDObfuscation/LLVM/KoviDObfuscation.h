@@ -0,0 +1,53 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_KOVIDOBFUSCATION_H
+#define KOVID_KOVIDOBFUSCATION_H
+
+#include "RenameCode.h"
+#include "StringEncryption.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+
+#include <string>
+
+namespace kovid {
+
+/// The set of transforms the combined pass runs, and the keys they use.
+struct ObfuscationOptions {
+  bool RenameCode = false;
+  bool DummyCodeInsertion = false;
+  bool InstructionObfuscation = false;
+  bool StringEncryption = false;
+  bool RemoveMetadataAndUnusedCode = false;
+
+  std::string RenameCryptoKey = CRYPTO_KEY;
+  std::string StringCryptoKey = SE_LLVM_CRYPTO_KEY;
+
+  /// A function attribute recording that these transforms ran on the
+  /// function, or empty. Functions that have it already are left alone: the
+  /// plugin may be loaded by the compiles and by the linker, and the ThinLTO
+  /// backends (or the full LTO pipeline) would run the transforms a second
+  /// time on the code the compiles obfuscated. A full LTO module merged from
+  /// compiles with and without the plugin only gets the other functions
+  /// obfuscated; the string encryption cannot tell the strings of the two
+  /// apart, so it is an error there.
+  std::string RunAttribute;
+};
+
+/// Runs all enabled KoviD transforms in a single walk over the module.
+struct KoviDObfuscationPass : public llvm::PassInfoMixin<KoviDObfuscationPass> {
+  ObfuscationOptions Opts;
+  KoviDObfuscationPass(ObfuscationOptions Opts = ObfuscationOptions())
+      : Opts(Opts) {}
+
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+} // namespace kovid
+
+#endif // KOVID_KOVIDOBFUSCATION_H
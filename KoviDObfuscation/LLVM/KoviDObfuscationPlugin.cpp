@@ -0,0 +1,275 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#include "KoviDGrowthBudget.h"
+#include "KoviDObfuscation.h"
+#include "KoviDOptions.h"
+#include "KoviDPipeline.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <optional>
+
+using namespace llvm;
+
+namespace {
+
+enum class Transform {
+  RenameCode,
+  DummyCodeInsertion,
+  InstructionObfuscation,
+  StringEncryption,
+  RemoveMetadataAndUnusedCode
+};
+
+// The names match the ones of the standalone plugins, without the "kovid-"
+// prefix.
+static cl::list<Transform> &EnabledTransforms = kovid::getSharedList<Transform>(
+    "kovid-transforms",
+    cl::desc("Transforms run by the combined KoviD pass (default: "
+             "rename-code,dummy-code-insertion,instruction-obf)"),
+    cl::CommaSeparated,
+    cl::values(
+        clEnumValN(Transform::RenameCode, "rename-code", "Rename functions"),
+        clEnumValN(Transform::DummyCodeInsertion, "dummy-code-insertion",
+                   "Insert dummy code"),
+        clEnumValN(Transform::InstructionObfuscation, "instruction-obf",
+                   "Obfuscate arithmetic instructions"),
+        clEnumValN(Transform::StringEncryption, "string-encryption",
+                   "Encrypt string globals"),
+        clEnumValN(Transform::RemoveMetadataAndUnusedCode,
+                   "metadata-unused-code-removal",
+                   "Remove debug metadata and unused functions")));
+
+// In (Thin)LTO builds the plugin is better run at link time, after the
+// linker has internalized everything that is not exported: only then can
+// most functions be renamed or removed. Compiles that share their flags with
+// the link can pass this to leave the work to the link step.
+static cl::opt<bool> &DeferToLTO = kovid::getSharedOption<bool>(
+    "kovid-defer-to-lto",
+    cl::desc("Do not run the combined KoviD pass in this (-flto) compile; "
+             "it runs when the plugin is loaded at link time"),
+    cl::init(false));
+
+} // end anonymous namespace
+
+static void enableTransform(kovid::ObfuscationOptions &Opts, Transform T) {
+  switch (T) {
+  case Transform::RenameCode:
+    Opts.RenameCode = true;
+    break;
+  case Transform::DummyCodeInsertion:
+    Opts.DummyCodeInsertion = true;
+    break;
+  case Transform::InstructionObfuscation:
+    Opts.InstructionObfuscation = true;
+    break;
+  case Transform::StringEncryption:
+    Opts.StringEncryption = true;
+    break;
+  case Transform::RemoveMetadataAndUnusedCode:
+    Opts.RemoveMetadataAndUnusedCode = true;
+    break;
+  }
+}
+
+/// Build the options from -kovid-transforms. String encryption and metadata
+/// removal are only exposed through -passes by their standalone plugins, so
+/// they have to be asked for explicitly here as well.
+static kovid::ObfuscationOptions getOptionsFromCommandLine() {
+  kovid::ObfuscationOptions Opts;
+  if (EnabledTransforms.empty()) {
+    Opts.RenameCode = true;
+    Opts.DummyCodeInsertion = true;
+    Opts.InstructionObfuscation = true;
+    return Opts;
+  }
+
+  for (Transform T : EnabledTransforms)
+    enableTransform(Opts, T);
+  return Opts;
+}
+
+/// The transforms of \p Opts that -kovid-extension-point puts at \p EP. The
+/// combined pass is a module pass, so the transforms asked to run at the
+/// vectorizer start EP, a function pass one, run at the optimizer last EP,
+/// the next one after it.
+static kovid::ObfuscationOptions
+atExtensionPoint(kovid::ObfuscationOptions Opts, kovid::ExtensionPoint EP) {
+  auto RunsAt = [EP](kovid::rules::Transform T) {
+    kovid::ExtensionPoint At = kovid::getExtensionPoint(T);
+    if (At == kovid::ExtensionPoint::VectorizerStart)
+      At = kovid::ExtensionPoint::OptimizerLast;
+    return At == EP;
+  };
+  Opts.RenameCode &= RunsAt(kovid::rules::RenameCode);
+  Opts.DummyCodeInsertion &= RunsAt(kovid::rules::DummyCodeInsertion);
+  Opts.InstructionObfuscation &= RunsAt(kovid::rules::InstructionObfuscation);
+  Opts.StringEncryption &= RunsAt(kovid::rules::StringEncryption);
+  Opts.RemoveMetadataAndUnusedCode &=
+      RunsAt(kovid::rules::RemoveMetadataAndUnusedCode);
+  return Opts;
+}
+
+/// Add the combined pass for the transforms that run at \p EP, if any. The
+/// pass records that it ran in a function attribute of its own per EP, so
+/// that a plugin loaded by both the compiles and the linker does not
+/// obfuscate the functions a second time at link time.
+static void addObfuscationPass(ModulePassManager &MPM,
+                               kovid::ExtensionPoint EP) {
+  kovid::ObfuscationOptions Opts =
+      atExtensionPoint(getOptionsFromCommandLine(), EP);
+  if (!Opts.RenameCode && !Opts.DummyCodeInsertion &&
+      !Opts.InstructionObfuscation && !Opts.StringEncryption &&
+      !Opts.RemoveMetadataAndUnusedCode)
+    return;
+  Opts.RunAttribute = EP == kovid::ExtensionPoint::EarlySimplification
+                     ? "kovid.obfuscated.early-simplification"
+                     : "kovid.obfuscated.optimizer-last";
+  MPM.addPass(kovid::KoviDObfuscationPass(Opts));
+}
+
+namespace {
+
+/// Run in the compiles that -kovid-defer-to-lto leaves the work to the link.
+/// Before LLVM 16 there is no hook into the full LTO pipeline, so the pass
+/// would never run on a full LTO module; that is an error rather than an
+/// unobfuscated binary. Clang marks these modules with a "ThinLTO" flag of
+/// 0 before the pipeline runs.
+struct CheckDeferToLTOPass : PassInfoMixin<CheckDeferToLTOPass> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+#if LLVM_VERSION_MAJOR < 16
+    auto *ThinLTO =
+        mdconst::extract_or_null<ConstantInt>(M.getModuleFlag("ThinLTO"));
+    if (ThinLTO && ThinLTO->isZero())
+      M.getContext().emitError(
+          Twine("-kovid-defer-to-lto: ") + M.getModuleIdentifier() +
+          " is a full LTO module, and the KoviD plugin can only run at full "
+          "LTO link time with LLVM 16 or newer; use -flto=thin or drop "
+          "-kovid-defer-to-lto");
+#else
+    (void)M;
+#endif
+    return PreservedAnalyses::all();
+  }
+};
+
+} // end anonymous namespace
+
+/// Keep the growth budget of the module, which the standalone plugins
+/// loaded into the same compiler share, until the pipeline is done with it.
+static void requireGrowthBudget(ModulePassManager &MPM) {
+  MPM.addPass(RequireAnalysisPass<kovid::GrowthBudgetAnalysis, Module>());
+}
+
+/// Parse the parameters of "kovid-obfuscate<rename-code;string-encryption>".
+static bool parseTransforms(StringRef Params, kovid::ObfuscationOptions &Opts) {
+  SmallVector<StringRef, 8> Names;
+  Params.split(Names, ';', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (StringRef Name : Names) {
+    std::optional<Transform> T =
+        StringSwitch<std::optional<Transform>>(Name)
+            .Case("rename-code", Transform::RenameCode)
+            .Case("dummy-code-insertion", Transform::DummyCodeInsertion)
+            .Case("instruction-obf", Transform::InstructionObfuscation)
+            .Case("string-encryption", Transform::StringEncryption)
+            .Case("metadata-unused-code-removal",
+                  Transform::RemoveMetadataAndUnusedCode)
+            .Default(std::nullopt);
+    if (!T) {
+      llvm::WithColor::error()
+          << "kovid-obfuscate: unknown transform '" << Name << "'\n";
+      return false;
+    }
+    enableTransform(Opts, *T);
+  }
+  return true;
+}
+
+static PassPluginLibraryInfo getPassPluginInfo() {
+  const auto callback = [](PassBuilder &PB) {
+    kovid::registerGrowthBudgetAnalysis(PB);
+    // This covers regular compiles and, when the plugin is loaded by the
+    // linker, the ThinLTO backends: they run the module simplification
+    // pipeline again, one module per --thinlto-jobs thread. The same goes
+    // for the optimizer last EP and the optimization pipeline. A backend
+    // skips the modules the compiles obfuscated already (see
+    // addObfuscationPass).
+    PB.registerPipelineEarlySimplificationEPCallback(
+        [&](ModulePassManager &MPM, auto) {
+          if (DeferToLTO) {
+            MPM.addPass(CheckDeferToLTOPass());
+            return true;
+          }
+          requireGrowthBudget(MPM);
+          addObfuscationPass(MPM, kovid::ExtensionPoint::EarlySimplification);
+          return true;
+        });
+    PB.registerOptimizerLastEPCallback([&](ModulePassManager &MPM, auto) {
+      if (DeferToLTO)
+        return true;
+      addObfuscationPass(MPM, kovid::ExtensionPoint::OptimizerLast);
+      return true;
+    });
+#if LLVM_VERSION_MAJOR >= 16
+    // Full LTO does not run the simplification pipeline on the merged
+    // module, so it needs its own hooks.
+    PB.registerFullLinkTimeOptimizationEarlyEPCallback(
+        [&](ModulePassManager &MPM, auto) {
+          requireGrowthBudget(MPM);
+          addObfuscationPass(MPM, kovid::ExtensionPoint::EarlySimplification);
+          return true;
+        });
+    PB.registerFullLinkTimeOptimizationLastEPCallback(
+        [&](ModulePassManager &MPM, auto) {
+          addObfuscationPass(MPM, kovid::ExtensionPoint::OptimizerLast);
+          return true;
+        });
+#endif
+    PB.registerPipelineParsingCallback(
+        [](StringRef Name, ModulePassManager &MPM,
+           ArrayRef<PassBuilder::PipelineElement>) {
+          if (!Name.consume_front("kovid-obfuscate"))
+            return false;
+
+          if (Name.empty()) {
+            requireGrowthBudget(MPM);
+            MPM.addPass(
+                kovid::KoviDObfuscationPass(getOptionsFromCommandLine()));
+            return true;
+          }
+
+          if (!Name.consume_front("<") || !Name.consume_back(">"))
+            return false;
+
+          kovid::ObfuscationOptions Opts;
+          if (!parseTransforms(Name, Opts))
+            return false;
+          requireGrowthBudget(MPM);
+          MPM.addPass(kovid::KoviDObfuscationPass(Opts));
+          return true;
+        });
+  };
+
+  return {LLVM_PLUGIN_API_VERSION, "kovid-obfuscation", "0.0.1", callback};
+}
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return getPassPluginInfo();
+}
@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# A module merged from a module obfuscated at compile time and one that was
+# not, as full LTO makes them: the link-time run obfuscates only the
+# functions of the second one, and is an error with string encryption.
+#
+# Usage: lto-mixed-modules.sh <opt> <llvm-link> <plugin> <dir>
+#
+# License: Apache License v2.0 with LLVM Exceptions
+# Author: djolertrk
+
+set -e
+
+OPT=$1
+LINK=$2
+PLUGIN=$3
+DIR=$4
+
+mkdir -p "$DIR"
+
+cat > "$DIR/lto-mixed-a.ll" <<'IR'
+define internal i32 @add_a(i32 %a, i32 %b) noinline {
+  %s = add i32 %a, %b
+  ret i32 %s
+}
+
+define i32 @entry_a(i32 %x) {
+  %r = call i32 @add_a(i32 %x, i32 3)
+  ret i32 %r
+}
+IR
+sed 's/_a/_b/g' "$DIR/lto-mixed-a.ll" > "$DIR/lto-mixed-b.ll"
+
+run() {
+  "$OPT" -load "$PLUGIN" -load-pass-plugin="$PLUGIN" -passes='default<O1>' \
+    "$@"
+}
+
+# The first module is obfuscated at compile time, the second one is not.
+run -kovid-transforms=instruction-obf "$DIR/lto-mixed-a.ll" \
+  -o "$DIR/lto-mixed-a.bc"
+"$LINK" "$DIR/lto-mixed-a.bc" "$DIR/lto-mixed-b.ll" -o "$DIR/lto-mixed.bc"
+
+run -kovid-transforms=instruction-obf "$DIR/lto-mixed.bc" -S \
+  -o "$DIR/lto-mixed.ll"
+# One rewritten add in each function: add_a is not obfuscated again.
+STORES=$(grep -c 'store volatile' "$DIR/lto-mixed.ll")
+if [ "$STORES" != 2 ]; then
+  echo "expected 2 obfuscated adds, found $STORES:" >&2
+  cat "$DIR/lto-mixed.ll" >&2
+  exit 1
+fi
+
+if run -kovid-transforms=instruction-obf,string-encryption \
+  "$DIR/lto-mixed.bc" -o /dev/null 2> "$DIR/lto-mixed.err"; then
+  echo "string encryption of the mixed module did not fail" >&2
+  exit 1
+fi
+grep -q 'cannot tell their strings apart' "$DIR/lto-mixed.err"
@@ -0,0 +1,70 @@
+#!/bin/sh
+#
+# The per-function constants do not depend on debug info: the arithmetic
+# rewrites and the dummy code of a function are the same with and without
+# its llvm.dbg.value calls, once those are stripped from the output.
+#
+# Usage: seed-debug-info.sh <opt> <plugin> <dir>
+#
+# License: Apache License v2.0 with LLVM Exceptions
+# Author: djolertrk
+
+set -e
+
+OPT=$1
+PLUGIN=$2
+DIR=$3
+
+mkdir -p "$DIR"
+
+cat > "$DIR/seed-debug-info.ll" <<'IR'
+define internal i32 @mix(i32 %a, i32 %b) !dbg !5 {
+entry:
+  call void @llvm.dbg.value(metadata i32 %a, metadata !9, metadata !DIExpression()), !dbg !10
+  %s = add i32 %a, %b
+  call void @llvm.dbg.value(metadata i32 %s, metadata !9, metadata !DIExpression()), !dbg !10
+  %x = xor i32 %s, 7
+  %m = mul i32 %x, %b
+  ret i32 %m
+}
+
+define i32 @main() {
+entry:
+  %r = call i32 @mix(i32 40, i32 2)
+  ret i32 %r
+}
+
+declare void @llvm.dbg.value(metadata, metadata, metadata)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "kovid", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "seed-debug-info.c", directory: "/tmp")
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = !{i32 7, !"Dwarf Version", i32 5}
+!5 = distinct !DISubprogram(name: "mix", scope: !1, file: !1, line: 1, type: !6, scopeLine: 1, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0)
+!6 = !DISubroutineType(types: !7)
+!7 = !{!8, !8, !8}
+!8 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!9 = !DILocalVariable(name: "a", arg: 1, scope: !5, file: !1, line: 1, type: !8)
+!10 = !DILocation(line: 1, column: 1, scope: !5)
+IR
+
+# The stripped outputs are read from stdin, so that the module IDs match.
+"$OPT" -strip-debug -S < "$DIR/seed-debug-info.ll" \
+  -o "$DIR/seed-debug-info-nodbg.ll"
+for input in seed-debug-info seed-debug-info-nodbg; do
+  "$OPT" -load "$PLUGIN" -load-pass-plugin="$PLUGIN" \
+    -passes='kovid-obfuscate<instruction-obf;dummy-code-insertion>' \
+    < "$DIR/$input.ll" -o "$DIR/$input.bc"
+  "$OPT" -strip-debug -S < "$DIR/$input.bc" -o "$DIR/$input.out.ll"
+done
+
+if ! cmp -s "$DIR/seed-debug-info.out.ll" "$DIR/seed-debug-info-nodbg.out.ll"
+then
+  echo "debug info changed the output of the transforms:" >&2
+  diff "$DIR/seed-debug-info.out.ll" "$DIR/seed-debug-info-nodbg.out.ll" >&2
+  exit 1
+fi
+# The transforms did run.
+grep -q volatile "$DIR/seed-debug-info.out.ll"
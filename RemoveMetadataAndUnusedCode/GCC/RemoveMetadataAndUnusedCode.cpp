@@ -4,7 +4,9 @@
  *
  * 1) Disables debug info (no DWARF).
  * 2) Clears statement locations in each function (strips line info).
- * 3) Removes local unused functions (no callers, not address-taken, etc.).
+ * 3) Removes the functions and variables that cannot be reached from the
+ *    symbols that have to be kept, in a simple IPA pass that runs right
+ *    after "visibility", before the bodies are optimized.
  *
  * Author: djolertrk
  * License: Apache v2.0 with LLVM-exception
@@ -12,7 +14,6 @@
 
 #include <cstdio>
 #include <cstring>
-#include <vector>
 
 // GCC plugin headers
 #include "gcc-plugin.h"
@@ -31,17 +32,46 @@
 #include "print-tree.h"
 #include "symtab.h"
 #include "function.h"
+#include "dumpfile.h"
 
+#include "KoviDSelection.h"
+#include "KoviDTimevar.h"
+#include "RemoveMetadataAndUnusedCode.h"
+
+#ifndef KOVID_COMBINED_PLUGIN
 int plugin_is_GPL_compatible;
+#endif
 
 // -----------------------------------------------------------------------------
 // 1) A GIMPLE pass that clears statement locations in each function
 // -----------------------------------------------------------------------------
 
+void kovid_strip_locations(function *fun) {
+  if (!kovid_should_transform(fun->decl,
+                              kovid::rules::RemoveMetadataAndUnusedCode))
+    return;
+  auto_client_timevar tv(g_timer,
+                         "KoviD metadata-unused-code-removal: strip locations");
+
+  // For each statement in each basic block, set location to UNKNOWN_LOCATION
+  basic_block bb;
+  FOR_ALL_BB_FN(bb, fun) {
+    for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+         gsi_next(&gsi)) {
+      gimple *stmt = gsi_stmt(gsi);
+      gimple_set_location(stmt, UNKNOWN_LOCATION);
+    }
+  }
+
+  // Also clear the function's DECL source location
+  if (fun->decl)
+    DECL_SOURCE_LOCATION(fun->decl) = BUILTINS_LOCATION;
+}
+
 static const pass_data dbg_removal_pass_data = {
     GIMPLE_PASS,          // type
     "rm_dbg_info_plugin", // name
-    OPTGROUP_NONE,        TV_NONE, 0, 0, 0, 0, 0};
+    OPTGROUP_NONE,        KOVID_TV_PASS, 0, 0, 0, 0, 0};
 
 namespace {
 
@@ -49,24 +79,9 @@ struct rm_dbg_info_pass : gimple_opt_pass {
   rm_dbg_info_pass(gcc::context *ctx)
       : gimple_opt_pass(dbg_removal_pass_data, ctx) {}
 
-  unsigned int execute(function *) override {
-    if (!cfun)
-      return 0;
-
-    // For each statement in each basic block, set location to UNKNOWN_LOCATION
-    basic_block bb;
-    FOR_ALL_BB_FN(bb, cfun) {
-      for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
-           gsi_next(&gsi)) {
-        gimple *stmt = gsi_stmt(gsi);
-        gimple_set_location(stmt, UNKNOWN_LOCATION);
-      }
-    }
-
-    // Also clear the function's DECL source location
-    if (cfun->decl)
-      DECL_SOURCE_LOCATION(cfun->decl) = BUILTINS_LOCATION;
-
+  unsigned int execute(function *fun) override {
+    if (fun)
+      kovid_strip_locations(fun);
     return 0;
   }
 };
@@ -77,72 +92,152 @@ struct rm_dbg_info_pass : gimple_opt_pass {
 // 2) Immediately disable debug info generation
 // -----------------------------------------------------------------------------
 
-static void disable_global_debug_info() {
+void kovid_disable_debug_info() {
   debug_info_level = DINFO_LEVEL_NONE; // Turn off all debug info
   write_symbols = NO_DEBUG;
 }
 
 // -----------------------------------------------------------------------------
-// 3) Callback at PLUGIN_FINISH_UNIT: remove unused local functions
-//    i.e., if they have no callers, aren't address-taken, etc.
+// 3) A simple IPA pass that removes the unreachable functions and variables
 // -----------------------------------------------------------------------------
 
-static void remove_unused_local_functions(void *, void *) {
-  fprintf(
-      stderr,
-      "[RemoveMetadataUnusedCode] Checking for unused local functions...\n");
+static const pass_data remove_unused_pass_data = {
+    SIMPLE_IPA_PASS,        // type
+    "kovid_remove_unused",  // name
+    OPTGROUP_OTHER,         // optinfo_flags
+    KOVID_TV_PASS,          // tv_id
+    0,                      // properties_required
+    0,                      // properties_provided
+    0,                      // properties_destroyed
+    0,                      // todo_flags_start
+    TODO_remove_functions}; // todo_flags_finish
+
+namespace {
 
-  // We'll gather the cgraph_node + symtab_node pairs to remove
-  std::vector<std::pair<cgraph_node *, symtab_node *>> to_remove;
+// Symbols that stay even if nothing refers to them: everything visible
+// outside of the unit, marked used, constructors, those excluded by the
+// selection rules and so on.
+static bool must_keep(symtab_node *node) {
+  if (!node->definition)
+    return true;
+  if (!kovid_should_transform(node->decl,
+                              kovid::rules::RemoveMetadataAndUnusedCode))
+    return true;
+  if (cgraph_node *cnode = dyn_cast<cgraph_node *>(node))
+    return !cnode->can_remove_if_no_direct_calls_and_refs_p();
+  if (varpool_node *vnode = dyn_cast<varpool_node *>(node))
+    return !vnode->can_remove_if_no_refs_p();
+  return true;
+}
 
-  // Iterate over all symtab nodes
-  for (symtab_node *snode = symtab->nodes; snode; snode = snode->next) {
-    // 1) Check if 'decl' is a function (FUNCTION_DECL)
-    if (!snode->decl || TREE_CODE(snode->decl) != FUNCTION_DECL)
-      continue;
+struct remove_unused_pass : simple_ipa_opt_pass {
+  // Also list the removed symbols on stderr, besides the pass dump
+  // (-fdump-ipa-kovid_remove_unused-details).
+  bool verbose;
 
-    // 2) Get the corresponding cgraph_node from this decl
-    cgraph_node *cnode = cgraph_node::get(snode->decl);
-    if (!cnode)
-      continue;
+  remove_unused_pass(gcc::context *ctx, bool verbose)
+      : simple_ipa_opt_pass(remove_unused_pass_data, ctx), verbose(verbose) {}
 
-    // Only consider local function definitions that can be discarded
-    // (i.e., not externally visible or required).
-    if (!cnode->definition || !cnode->can_be_discarded_p())
-      continue;
+  unsigned int execute(function *) override {
+    auto_client_timevar tv(g_timer, "KoviD metadata-unused-code-removal");
+    auto_client_timevar collect_tv(
+        g_timer, "KoviD metadata-unused-code-removal: collect");
+
+    // Mark everything reachable from the symbols that have to be kept.
+    hash_set<symtab_node *> live;
+    auto_vec<symtab_node *> worklist;
+    auto mark = [&](symtab_node *node) {
+      if (!live.add(node))
+        worklist.safe_push(node);
+    };
+
+    symtab_node *node;
+    FOR_EACH_SYMBOL(node) {
+      if (must_keep(node))
+        mark(node);
+    }
 
-    // "No callers" => cnode->callers == nullptr
-    bool no_callers = (cnode->callers == nullptr);
+    while (!worklist.is_empty()) {
+      node = worklist.pop();
 
-    // "Not address-taken"
-    bool not_address_taken = !cnode->address_taken;
+      // References cover taken addresses, initializers and alias targets.
+      ipa_ref *ref = NULL;
+      for (unsigned i = 0; node->iterate_reference(i, ref); i++)
+        mark(ref->referred);
 
-    // If both conditions hold, mark it for removal
-    if (no_callers && not_address_taken)
-      to_remove.emplace_back(cnode, snode);
-  }
+      if (cgraph_node *cnode = dyn_cast<cgraph_node *>(node))
+        for (cgraph_edge *e = cnode->callees; e; e = e->next_callee)
+          mark(e->callee);
 
-  // Actually remove them
-  for (auto &pair : to_remove) {
-    cgraph_node *cnode = pair.first;
-    symtab_node *snode = pair.second;
+      // Comdat groups are kept or dropped as a whole.
+      if (node->same_comdat_group)
+        for (symtab_node *next = node->same_comdat_group; next != node;
+             next = next->same_comdat_group)
+          mark(next);
+    }
 
-    // Print out function name
-    const char *name = nullptr;
-    if (cnode->decl)
-      name = get_name(cnode->decl);
+    auto_vec<symtab_node *> dead;
+    FOR_EACH_SYMBOL(node) {
+      if (!live.contains(node))
+        dead.safe_push(node);
+    }
 
-    fprintf(stderr, "  Removing unused function: %s\n",
-            name ? name : "(unknown)");
+    // The timer only runs the innermost item, so the cleanup does not count
+    // towards the collection.
+    auto_client_timevar cleanup_tv(
+        g_timer, "KoviD metadata-unused-code-removal: cleanup");
+    unsigned num_functions = 0, num_variables = 0;
+    unsigned i;
+    symtab_node *dead_node;
+    FOR_EACH_VEC_ELT(dead, i, dead_node) {
+      bool is_function = is_a<cgraph_node *>(dead_node);
+      const char *name = dead_node->name();
+
+      if (dump_file && (dump_flags & TDF_DETAILS))
+        fprintf(dump_file, "Removing unused %s %s\n",
+                is_function ? "function" : "variable", name);
+      if (verbose)
+        fprintf(stderr, "  Removing unused %s: %s\n",
+                is_function ? "function" : "variable", name);
+      if (dump_enabled_p()) {
+        dump_user_location_t loc =
+            is_function
+                ? dump_user_location_t::from_function_decl(dead_node->decl)
+                : dump_user_location_t::from_location_t(
+                      DECL_SOURCE_LOCATION(dead_node->decl));
+        dump_printf_loc(MSG_OPTIMIZED_LOCATIONS, loc, "removed unused %s %s\n",
+                        is_function ? "function" : "variable", name);
+      }
 
-    // 1) Remove from the call graph
-    cnode->remove();
+      if (is_function)
+        ++num_functions;
+      else
+        ++num_variables;
+      // Removing a node also drops its edges and references, which may only
+      // point at other dead nodes by now.
+      dead_node->remove();
+    }
 
-    // 2) Remove from the global symbol table
-    snode->remove();
+    statistics_counter_event(NULL, "kovid_remove_unused functions removed",
+                             num_functions);
+    statistics_counter_event(NULL, "kovid_remove_unused variables removed",
+                             num_variables);
+    if (dump_file)
+      fprintf(dump_file, "Removed %u functions and %u variables\n",
+              num_functions, num_variables);
+    return 0;
   }
+};
+
+} // end anonymous namespace
+
+simple_ipa_opt_pass *make_kovid_remove_unused_pass(gcc::context *ctx,
+                                                   bool verbose) {
+  return new remove_unused_pass(ctx, verbose);
 }
 
+#ifndef KOVID_COMBINED_PLUGIN
+
 // -----------------------------------------------------------------------------
 // plugin_init
 // -----------------------------------------------------------------------------
@@ -155,14 +250,26 @@ int plugin_init(struct plugin_name_args *plugin_info,
     return 1;
   }
 
+  if (!kovid_init_selection(plugin_info->base_name,
+                            "RemoveMetadataUnusedCode",
+                            kovid_rules_argument(plugin_info)))
+    return 1;
+
+  // Set by -fplugin-arg-<plugin>-verbose.
+  bool verbose = false;
+  for (int i = 0; i < plugin_info->argc; ++i) {
+    if (!strcmp(plugin_info->argv[i].key, "verbose"))
+      verbose = true;
+  }
+
   // Provide plugin info
   static struct plugin_info my_plugin_info = {
-      .version = "1.0", .help = "Removes debug info & unused local functions"};
+      .version = "1.0", .help = "Removes debug info & unreachable local code"};
   register_callback(plugin_info->base_name, PLUGIN_INFO, nullptr,
                     &my_plugin_info);
 
   // 1) Immediately disable debug info
-  disable_global_debug_info();
+  kovid_disable_debug_info();
 
   // 2) Register the pass that clears statement locations in each function
   rm_dbg_info_pass *pass_obj = new rm_dbg_info_pass(g);
@@ -175,10 +282,19 @@ int plugin_init(struct plugin_name_args *plugin_info,
   register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, nullptr,
                     &pass_info);
 
-  // 3) At the end of compilation, remove unused local functions
-  register_callback(plugin_info->base_name, PLUGIN_FINISH_UNIT,
-                    remove_unused_local_functions, nullptr);
+  // 3) Remove the unreachable code early in the small IPA passes, before
+  //    the bodies go through SSA construction and the early optimizations.
+  struct register_pass_info ipa_pass_info;
+  ipa_pass_info.pass = make_kovid_remove_unused_pass(g, verbose);
+  ipa_pass_info.reference_pass_name = "visibility";
+  ipa_pass_info.ref_pass_instance_number = 1;
+  ipa_pass_info.pos_op = PASS_POS_INSERT_AFTER;
+
+  register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, nullptr,
+                    &ipa_pass_info);
 
   fprintf(stderr, "KoviD RemoveMetadataUnusedCode Plugin loaded.\n");
   return 0;
 }
+
+#endif // KOVID_COMBINED_PLUGIN
@@ -0,0 +1,27 @@
+/*
+ * Remove Metadata & Unused Code GCC Plugin
+ * ----------------------------------------
+ *
+ * The transforms of the plugin, shared by the standalone plugin and the
+ * combined KoviD GCC plugin. Include it after the GCC headers.
+ *
+ * Author: djolertrk
+ * License: Apache v2.0 with LLVM-exception
+ */
+
+#ifndef KOVID_REMOVEMETADATAANDUNUSEDCODE_GCC_H
+#define KOVID_REMOVEMETADATAANDUNUSEDCODE_GCC_H
+
+// Turn off the debug info of the whole compilation (no DWARF).
+void kovid_disable_debug_info();
+
+// Clear the locations of all statements of fun and of its declaration.
+void kovid_strip_locations(function *fun);
+
+// The "kovid_remove_unused" simple IPA pass, which removes the functions and
+// variables that cannot be reached. With verbose, the removed symbols are
+// also listed on stderr.
+simple_ipa_opt_pass *make_kovid_remove_unused_pass(gcc::context *ctx,
+                                                   bool verbose);
+
+#endif // KOVID_REMOVEMETADATAANDUNUSEDCODE_GCC_H
@@ -15,92 +15,382 @@
 //    - Clears debug metadata from all instructions and global variables.
 //    - Removes function-level debug info by setting each function's subprogram
 // to null.
+//    - Erases the debug intrinsics, which are not valid without locations.
+//    - With -kovid-strip-debug=full, everything else that only serves
+//      debugging goes in the same sweep: the debug records, all "llvm.dbg.*"
+//      named metadata, "llvm.ident" and
+//      "llvm.commandline", the debug module flags, the locations inside loop
+//      metadata and every attachment kind that does not affect code
+//      generation. Nothing in the module refers to the debug metadata graph
+//      afterwards, so later passes and the backend do not walk it at all.
 // 
 // 2. Unused Code Removal:
-//    - Iterates over defined functions with internal linkage.
-//    - If a function has no uses (i.e. it is not referenced anywhere), it is
-// removed.
+//    - Marks everything reachable from the globals that have to stay (the
+//      ones with non-local linkage, and the members of llvm.used and
+//      llvm.compiler.used), following the references of function bodies,
+//      initializers, aliasees and ifunc resolvers with a worklist.
+//    - Removes every function, variable, alias and ifunc with local linkage
+//      that was not reached, and then the comdats left without members.
+//      Chains and cycles of dead code go in a single run.
+//
+// Functions and globals that kovid_skip or the -kovid-rules file exclude are
+// left alone: they are never removed, functions keep their debug info, and
+// the module keeps the compile units that it refers to.
 // 
 // Together, these techniques reduce the amount of information available to an
 // attacker and help obscure the program's logic.
 //
 
+#include "RemoveMetadataAndUnusedCode.h"
+#include "KoviDOptions.h"
+#include "KoviDSelection.h"
+#include "KoviDTimeTrace.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
-#include "llvm/IR/Constants.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalVariable.h"
-#include "llvm/IR/IRBuilder.h"
-#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Metadata.h"
-#include "llvm/IR/Module.h"
-#include "llvm/IR/PassManager.h"
-#include "llvm/Pass.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
+#define DEBUG_TYPE "kovid-metadata-unused-code-removal"
+
+STATISTIC(NumFunctionsRemoved, "Number of unused functions removed");
+STATISTIC(NumVariablesRemoved, "Number of unused global variables removed");
+STATISTIC(NumAliasesRemoved, "Number of unused aliases and ifuncs removed");
+STATISTIC(NumComdatsRemoved, "Number of comdats removed");
+STATISTIC(NumDebugIntrinsicsRemoved, "Number of debug intrinsics removed");
+
 namespace {
+enum class DebugStripMode { Locations, Full };
+} // end anonymous namespace
 
-struct RemoveMetadataAndUnusedCodePass
-    : public PassInfoMixin<RemoveMetadataAndUnusedCodePass> {
-  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
-    // 1. Remove debug metadata from the module.
+static cl::opt<DebugStripMode> &StripMode =
+    kovid::getSharedOption<DebugStripMode>(
+        "kovid-strip-debug", cl::desc("How much debug information to remove"),
+        cl::values(clEnumValN(DebugStripMode::Locations, "locations",
+                              "Compile units, subprograms and debug locations"),
+                   clEnumValN(DebugStripMode::Full, "full",
+                              "All debug intrinsics, records and metadata, and "
+                              "all attachments that do not affect codegen")),
+        cl::init(DebugStripMode::Locations));
+
+/// The attachment kinds kept in full mode: the ones that carry semantics or
+/// optimization facts. Everything else, including kinds unknown to us, is
+/// dropped.
+static const unsigned EssentialMDKinds[] = {
+    LLVMContext::MD_tbaa,
+    LLVMContext::MD_tbaa_struct,
+    LLVMContext::MD_prof,
+    LLVMContext::MD_fpmath,
+    LLVMContext::MD_range,
+    LLVMContext::MD_invariant_load,
+    LLVMContext::MD_alias_scope,
+    LLVMContext::MD_noalias,
+    LLVMContext::MD_nontemporal,
+    LLVMContext::MD_mem_parallel_loop_access,
+    LLVMContext::MD_nonnull,
+    LLVMContext::MD_dereferenceable,
+    LLVMContext::MD_dereferenceable_or_null,
+    LLVMContext::MD_make_implicit,
+    LLVMContext::MD_unpredictable,
+    LLVMContext::MD_invariant_group,
+    LLVMContext::MD_align,
+    LLVMContext::MD_loop,
+    LLVMContext::MD_type,
+    LLVMContext::MD_section_prefix,
+    LLVMContext::MD_absolute_symbol,
+    LLVMContext::MD_associated,
+    LLVMContext::MD_callees,
+    LLVMContext::MD_irr_loop,
+    LLVMContext::MD_access_group,
+    LLVMContext::MD_callback,
+    LLVMContext::MD_vcall_visibility,
+    LLVMContext::MD_noundef,
+};
+
+/// Erase every call to the debug intrinsics, except in the \p Kept
+/// functions, and the declarations left unused, by walking their use lists
+/// rather than every instruction.
+static void removeDebugIntrinsics(Module &M,
+                                  const SmallPtrSetImpl<Function *> &Kept) {
+  for (Function &F : make_early_inc_range(M)) {
+    if (!F.isIntrinsic() || !F.getName().startswith("llvm.dbg."))
+      continue;
+    for (User *U : make_early_inc_range(F.users())) {
+      auto *Call = cast<Instruction>(U);
+      if (Kept.count(Call->getFunction()))
+        continue;
+      Call->eraseFromParent();
+      ++NumDebugIntrinsicsRemoved;
+    }
+    if (F.use_empty())
+      F.eraseFromParent();
+  }
+}
+
+/// Drop the named metadata and module flags that only describe debug info.
+static void removeDebugModuleMetadata(Module &M) {
+  for (NamedMDNode &NMD : make_early_inc_range(M.named_metadata())) {
+    StringRef Name = NMD.getName();
+    if (Name.startswith("llvm.dbg.") || Name == "llvm.ident" ||
+        Name == "llvm.commandline")
+      M.eraseNamedMetadata(&NMD);
+  }
+
+  NamedMDNode *Flags = M.getModuleFlagsMetadata();
+  if (!Flags)
+    return;
+  SmallVector<MDNode *, 8> Kept;
+  for (MDNode *Flag : Flags->operands()) {
+    auto *Key = Flag->getNumOperands() >= 2
+                    ? dyn_cast<MDString>(Flag->getOperand(1))
+                    : nullptr;
+    if (Key && (Key->getString() == "Debug Info Version" ||
+                Key->getString() == "Dwarf Version" ||
+                Key->getString() == "CodeView"))
+      continue;
+    Kept.push_back(Flag);
+  }
+  if (Kept.size() == Flags->getNumOperands())
+    return;
+  if (Kept.empty()) {
+    M.eraseNamedMetadata(Flags);
+    return;
+  }
+  Flags->clearOperands();
+  for (MDNode *Flag : Kept)
+    Flags->addOperand(Flag);
+}
+
+void kovid::stripModuleDebugInfo(Module &M) {
+  TransformTimeScope Trace(rules::RemoveMetadataAndUnusedCode,
+                           "strip debug info", M.getName());
+  // The functions that keep their debug info need the compile units, and
+  // the module flags that describe them.
+  SmallPtrSet<Function *, 8> Kept;
+  for (Function &F : M)
+    if (!F.isDeclaration() && F.getSubprogram() &&
+        !shouldTransform(F, rules::RemoveMetadataAndUnusedCode))
+      Kept.insert(&F);
+
+  if (Kept.empty())
     if (NamedMDNode *NMD = M.getNamedMetadata("llvm.dbg.cu"))
       M.eraseNamedMetadata(NMD);
 
-    for (Function &F : M) {
-      if (!F.isDeclaration()) {
-        // Clear function-level debug information.
-        F.setSubprogram(nullptr);
-        // Remove per-instruction debug metadata.
-        for (BasicBlock &BB : F) {
-          for (Instruction &I : BB) {
-            I.setMetadata("dbg", nullptr);
-          }
-        }
-      }
-    }
-    for (GlobalVariable &GV : M.globals())
+  for (GlobalVariable &GV : M.globals())
+    if (shouldTransform(GV, rules::RemoveMetadataAndUnusedCode))
       GV.setMetadata("dbg", nullptr);
 
-    // 2. Remove unused functions.
-    SmallVector<Function *, 16> ToRemove;
-    for (Function &F : M) {
-      // Only consider functions that are defined and have internal linkage.
-      if (!F.isDeclaration() && F.hasInternalLinkage() && F.use_empty()) {
-        ToRemove.push_back(&F);
-      }
-    }
-    for (Function *F : ToRemove) {
-      errs() << "Removing unused function: " << F->getName() << "\n";
-      F->eraseFromParent();
+  // Debug intrinsics are invalid without the locations that are cleared
+  // below, so they go in both modes.
+  removeDebugIntrinsics(M, Kept);
+
+  if (StripMode != DebugStripMode::Full || !Kept.empty())
+    return;
+
+  removeDebugModuleMetadata(M);
+  // Declarations can carry subprograms for call site information too.
+  for (Function &F : M)
+    if (F.isDeclaration())
+      F.setSubprogram(nullptr);
+}
+
+void kovid::stripFunctionDebugInfo(Function &F) { F.setSubprogram(nullptr); }
+
+void kovid::stripInstructionDebugInfo(Instruction &I) {
+  I.setMetadata("dbg", nullptr);
+  if (StripMode != DebugStripMode::Full)
+    return;
+
+#if LLVM_VERSION_MAJOR >= 19
+  I.dropDbgRecords();
+#endif
+  // Loop metadata names the locations of the loop start and end.
+  if (I.getMetadata(LLVMContext::MD_loop))
+    updateLoopMetadataDebugLocations(
+        I, [](Metadata *MD) { return isa<DILocation>(MD) ? nullptr : MD; });
+  I.dropUnknownNonDebugMetadata(EssentialMDKinds);
+}
+
+namespace {
+/// Marks the globals reachable from the ones that have to be kept.
+class LiveGlobals {
+  SmallPtrSet<const GlobalValue *, 32> Live;
+  SmallPtrSet<const Constant *, 32> VisitedConstants;
+  SmallVector<const GlobalValue *, 64> Worklist;
+
+  void markLive(const GlobalValue *GV) {
+    if (Live.insert(GV).second)
+      Worklist.push_back(GV);
+  }
+
+  /// Mark the globals that \p C refers to, looking through constant
+  /// expressions and aggregates (each of them only once).
+  void markOperands(const Constant *C) {
+    if (auto *GV = dyn_cast<GlobalValue>(C)) {
+      markLive(GV);
+      return;
     }
+    if (!VisitedConstants.insert(C).second)
+      return;
+    for (const Use &Op : C->operands())
+      if (auto *OpC = dyn_cast<Constant>(Op))
+        markOperands(OpC);
+  }
+
+  void markReferences(const GlobalValue *GV) {
+    // The initializer, aliasee, resolver, or personality and prefix data.
+    for (const Use &Op : GV->operands())
+      if (auto *C = dyn_cast_or_null<Constant>(Op.get()))
+        markOperands(C);
 
-    return PreservedAnalyses::none();
+    // Comdats are kept or dropped as a whole.
+    if (const Comdat *C = GV->getComdat())
+      for (const GlobalValue *Member : ComdatMembers.lookup(C))
+        markLive(Member);
+
+    if (auto *F = dyn_cast<Function>(GV))
+      for (const BasicBlock &BB : *F)
+        for (const Instruction &I : BB)
+          for (const Use &Op : I.operands())
+            if (auto *C = dyn_cast<Constant>(Op))
+              markOperands(C);
   }
-};
 
-} // end anonymous namespace
+  DenseMap<const Comdat *, SmallVector<const GlobalValue *, 2>> ComdatMembers;
+
+public:
+  explicit LiveGlobals(Module &M) {
+    for (GlobalValue &GV : M.global_values())
+      if (const Comdat *C = GV.getComdat())
+        ComdatMembers[C].push_back(&GV);
 
-PassPluginLibraryInfo getPassPluginInfo() {
-  const auto callback = [](PassBuilder &PB) {
-    PB.registerPipelineParsingCallback(
-        [](StringRef Name, ModulePassManager &MPM,
-           ArrayRef<PassBuilder::PipelineElement>) {
-          if (Name == "kovid-metadata-unused-code-removal") {
-            MPM.addPass(RemoveMetadataAndUnusedCodePass());
-            return true;
-          }
-          return false;
-        });
-  };
-
-  return {LLVM_PLUGIN_API_VERSION, "kovid-metadata-unused-code-removal",
-          "0.0.1", callback};
+    SmallVector<GlobalValue *, 8> Used;
+    collectUsedGlobalVariables(M, Used, /*CompilerUsed=*/false);
+    collectUsedGlobalVariables(M, Used, /*CompilerUsed=*/true);
+    for (GlobalValue *GV : Used)
+      markLive(GV);
+    for (GlobalValue &GV : M.global_values())
+      if (!GV.hasLocalLinkage() || GV.getName().startswith("llvm.") ||
+          !kovid::shouldTransform(GV,
+                                  kovid::rules::RemoveMetadataAndUnusedCode))
+        markLive(&GV);
+
+    while (!Worklist.empty())
+      markReferences(Worklist.pop_back_val());
+  }
+
+  bool isLive(const GlobalValue &GV) const { return Live.count(&GV); }
 };
+} // end anonymous namespace
+
+unsigned kovid::removeUnusedGlobals(Module &M) {
+  SmallVector<GlobalValue *, 16> ToRemove;
+  {
+    TransformTimeScope Collect(rules::RemoveMetadataAndUnusedCode, "collect",
+                               M.getName(),
+                               M.size() + M.global_size() + M.alias_size() +
+                                   M.ifunc_size(),
+                               "globals");
+    LiveGlobals Live(M);
+    for (GlobalValue &GV : M.global_values())
+      if (!Live.isLive(GV))
+        ToRemove.push_back(&GV);
+  }
+  if (ToRemove.empty())
+    return 0;
+  TransformTimeScope Cleanup(rules::RemoveMetadataAndUnusedCode, "cleanup",
+                             M.getName(), ToRemove.size(), "unused globals");
+
+  // Break the references between the dead globals first, so that they can
+  // be erased in any order.
+  for (GlobalValue *GV : ToRemove) {
+    LLVM_DEBUG(dbgs() << "Removing unused global: " << GV->getName() << "\n");
+    if (auto *F = dyn_cast<Function>(GV)) {
+      OptimizationRemarkEmitter ORE(F);
+      ORE.emit([&]() {
+        return OptimizationRemark(DEBUG_TYPE, "FunctionRemoved", F)
+               << "removed unused function "
+               << ore::NV("Function", F->getName());
+      });
+      F->deleteBody();
+      ++NumFunctionsRemoved;
+    } else if (auto *Var = dyn_cast<GlobalVariable>(GV)) {
+      Var->setInitializer(nullptr);
+      ++NumVariablesRemoved;
+    } else if (auto *GA = dyn_cast<GlobalAlias>(GV)) {
+      GA->setAliasee(nullptr);
+      ++NumAliasesRemoved;
+    } else if (auto *GI = dyn_cast<GlobalIFunc>(GV)) {
+      GI->setResolver(nullptr);
+      ++NumAliasesRemoved;
+    }
+  }
+
+  SmallPtrSet<const Comdat *, 8> DeadComdats;
+  for (GlobalValue *GV : ToRemove) {
+    if (auto *GO = dyn_cast<GlobalObject>(GV))
+      if (Comdat *C = GO->getComdat()) {
+        DeadComdats.insert(C);
+        GO->setComdat(nullptr);
+      }
+    GV->removeDeadConstantUsers();
+    if (!GV->use_empty())
+      GV->replaceAllUsesWith(PoisonValue::get(GV->getType()));
+    GV->eraseFromParent();
+  }
+
+  // A comdat is dead once none of its members is left; the live ones keep
+  // all of their members.
+  for (const GlobalObject &GO : M.global_objects())
+    DeadComdats.erase(GO.getComdat());
+  for (const Comdat *C : DeadComdats) {
+    M.getComdatSymbolTable().erase(C->getName());
+    ++NumComdatsRemoved;
+  }
+
+  LLVM_DEBUG(dbgs() << "Removed " << ToRemove.size() << " unused globals and "
+                    << DeadComdats.size() << " comdats\n");
+  return ToRemove.size();
+}
+
+PreservedAnalyses
+kovid::RemoveMetadataAndUnusedCodePass::run(Module &M,
+                                            ModuleAnalysisManager &) {
+  TransformTimeScope Trace(rules::RemoveMetadataAndUnusedCode, "", M.getName());
+  applyAnnotations(M);
+
+  // 1. Remove debug metadata from the module.
+  stripModuleDebugInfo(M);
+
+  for (Function &F : M) {
+    if (!F.isDeclaration() &&
+        shouldTransform(F, rules::RemoveMetadataAndUnusedCode)) {
+      // Clear function-level debug information.
+      stripFunctionDebugInfo(F);
+      // Remove per-instruction debug metadata.
+      for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+          stripInstructionDebugInfo(I);
+        }
+      }
+    }
+  }
+
+  // 2. Remove unused functions and globals.
+  removeUnusedGlobals(M);
 
-extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
-  return getPassPluginInfo();
+  return PreservedAnalyses::none();
 }
@@ -0,0 +1,42 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+#ifndef KOVID_REMOVEMETADATAANDUNUSEDCODE_H
+#define KOVID_REMOVEMETADATAANDUNUSEDCODE_H
+
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+
+namespace kovid {
+
+/// Erase the module level debug info ("llvm.dbg.cu") and clear the debug
+/// attachments of all global variables, and erase the debug intrinsics. With
+/// -kovid-strip-debug=full, also erase all other debug-only module metadata.
+/// The functions that the selection rules exclude keep their debug info, and
+/// then so do the compile units and module flags.
+void stripModuleDebugInfo(llvm::Module &M);
+
+/// Clear the function-level debug information (the subprogram) of \p F.
+void stripFunctionDebugInfo(llvm::Function &F);
+
+/// Clear the debug location of \p I. With -kovid-strip-debug=full, also its
+/// debug records, the locations in its loop metadata and every attachment
+/// that does not affect code generation.
+void stripInstructionDebugInfo(llvm::Instruction &I);
+
+/// Erase the functions, variables, aliases and ifuncs with local linkage that
+/// cannot be reached from the globals that have to be kept (including the
+/// ones the selection rules exclude), and the comdats left empty. Returns the
+/// number of removed globals.
+unsigned removeUnusedGlobals(llvm::Module &M);
+
+struct RemoveMetadataAndUnusedCodePass
+    : public llvm::PassInfoMixin<RemoveMetadataAndUnusedCodePass> {
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+} // namespace kovid
+
+#endif // KOVID_REMOVEMETADATAANDUNUSEDCODE_H
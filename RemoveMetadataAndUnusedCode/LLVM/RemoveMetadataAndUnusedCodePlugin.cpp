@@ -0,0 +1,31 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+#include "RemoveMetadataAndUnusedCode.h"
+
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+using namespace llvm;
+
+static PassPluginLibraryInfo getPassPluginInfo() {
+  const auto callback = [](PassBuilder &PB) {
+    PB.registerPipelineParsingCallback(
+        [](StringRef Name, ModulePassManager &MPM,
+           ArrayRef<PassBuilder::PipelineElement>) {
+          if (Name == "kovid-metadata-unused-code-removal") {
+            MPM.addPass(kovid::RemoveMetadataAndUnusedCodePass());
+            return true;
+          }
+          return false;
+        });
+  };
+
+  return {LLVM_PLUGIN_API_VERSION, "kovid-metadata-unused-code-removal",
+          "0.0.1", callback};
+};
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
+  return getPassPluginInfo();
+}
@@ -0,0 +1,283 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// KoviD Rename Map
+// ----------------
+//
+// Compact names and the sidecar file that maps them back to the original
+// function names. This header is shared by the LLVM and GCC RenameCode
+// plugins and by the deobfuscation tools, so it only depends on the C++11
+// standard library.
+//
+// In compact mode a function is renamed to "_k" followed by 12 hex digits of
+// a hash of the crypto key and its original name, instead of the hex encoded
+// XOR of the name. The original names are then only recoverable from the map
+// file, which is laid out to be memory mapped and searched in place:
+//
+//   Header   magic "KVDRMAP2", the number of entries and of hash buckets,
+//            the offset and size of the string pool, and a keyed hash that
+//            tells the readers whether they were given the right key.
+//   Buckets  NumBuckets (a power of two) 32-bit entry indexes plus one, 0 for
+//            an empty bucket, filled by linear probing on the name hash.
+//   Entries  NumEntries records of the name hash and the offsets and sizes of
+//            the new and the original name in the string pool.
+//   Strings  The new names in clear, the original names XORed with the key.
+//
+// All fields are in the byte order of the host that wrote the file.
+//
+
+#ifndef KOVID_RENAMEMAP_H
+#define KOVID_RENAMEMAP_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "KoviDCrypto.h"
+
+namespace kovid {
+namespace renamemap {
+
+static const char Magic[8] = {'K', 'V', 'D', 'R', 'M', 'A', 'P', '2'};
+
+struct Header {
+  char Magic[8];
+  uint32_t NumEntries;
+  uint32_t NumBuckets;
+  uint64_t StringsOffset;
+  uint64_t StringsSize;
+  uint64_t KeyCheck;
+};
+
+struct Entry {
+  uint64_t Hash;
+  uint32_t NameOffset;
+  uint32_t NameSize;
+  uint32_t OriginalOffset;
+  uint32_t OriginalSize;
+};
+
+/// 64-bit FNV-1a, continuing from \p Hash.
+inline uint64_t hash(const char *Data, size_t Size,
+                     uint64_t Hash = 0xcbf29ce484222325ULL) {
+  for (size_t I = 0; I < Size; ++I) {
+    Hash ^= static_cast<unsigned char>(Data[I]);
+    Hash *= 0x100000001b3ULL;
+  }
+  return Hash;
+}
+
+inline uint64_t hash(const std::string &S) { return hash(S.data(), S.size()); }
+
+/// The KeyCheck of the maps written with \p Key. XORing the original names
+/// with any key "succeeds", so this is the only way to tell a wrong key.
+inline uint64_t keyCheck(const std::string &Key) {
+  static const char Tag[] = "kovid-rename-map-key";
+  uint64_t H = hash(Tag, sizeof(Tag));
+  return hash(Key.data(), Key.size(), H);
+}
+
+/// XOR \p Data with the repeated \p Key; applying it twice is the identity.
+inline void applyKey(std::string &Data, const std::string &Key) {
+  crypto::getCipher(Key).apply(Data);
+}
+
+/// Whether \p Name has the form of a compact name.
+inline bool isCompactName(const char *Name, size_t Size) {
+  if (Size != 14 || Name[0] != '_' || Name[1] != 'k')
+    return false;
+  for (size_t I = 2; I < Size; ++I) {
+    char C = Name[I];
+    if (!((C >= '0' && C <= '9') || (C >= 'a' && C <= 'f')))
+      return false;
+  }
+  return true;
+}
+
+/// The compact name of \p Name: "_k" and 12 hex digits of a keyed hash.
+/// Callers that get a name that is already taken retry with the next
+/// \p Salt.
+inline std::string compactName(const std::string &Name, const std::string &Key,
+                               unsigned Salt = 0) {
+  uint64_t H = hash(Key.data(), Key.size());
+  H = hash("", 1, H);
+  H = hash(Name.data(), Name.size(), H);
+  H = hash(reinterpret_cast<const char *>(&Salt), sizeof(Salt), H);
+
+  static const char Digits[] = "0123456789abcdef";
+  std::string Result = "_k";
+  for (int Shift = 44; Shift >= 0; Shift -= 4)
+    Result.push_back(Digits[(H >> Shift) & 0xf]);
+  return Result;
+}
+
+/// The name of the map file of the unit compiled from \p SourcePath, an
+/// absolute path, in a map directory: the file name of the source, 16 hex
+/// digits of a hash of the whole path, and ".kovidmap". The units of sources
+/// with the same file name in different directories get different files.
+inline std::string fileName(const std::string &SourcePath) {
+  size_t Slash = SourcePath.find_last_of("/\\");
+  std::string Result =
+      Slash == std::string::npos ? SourcePath : SourcePath.substr(Slash + 1);
+
+  uint64_t H = hash(SourcePath);
+  static const char Digits[] = "0123456789abcdef";
+  Result.push_back('.');
+  for (int Shift = 60; Shift >= 0; Shift -= 4)
+    Result.push_back(Digits[(H >> Shift) & 0xf]);
+  return Result + ".kovidmap";
+}
+
+/// Serialize the (new name, original name) pairs of \p Names into the image
+/// of a map file.
+inline std::string
+write(const std::vector<std::pair<std::string, std::string>> &Names,
+      const std::string &Key) {
+  uint32_t NumBuckets = 2;
+  while (NumBuckets < 2 * Names.size())
+    NumBuckets *= 2;
+
+  std::vector<uint32_t> Buckets(NumBuckets, 0);
+  std::vector<Entry> Entries;
+  std::string Strings;
+  Entries.reserve(Names.size());
+  for (size_t I = 0; I < Names.size(); ++I) {
+    std::string Original = Names[I].second;
+    applyKey(Original, Key);
+
+    Entry E;
+    E.Hash = hash(Names[I].first);
+    E.NameOffset = Strings.size();
+    E.NameSize = Names[I].first.size();
+    Strings += Names[I].first;
+    E.OriginalOffset = Strings.size();
+    E.OriginalSize = Original.size();
+    Strings += Original;
+    Entries.push_back(E);
+
+    uint32_t B = E.Hash & (NumBuckets - 1);
+    while (Buckets[B])
+      B = (B + 1) & (NumBuckets - 1);
+    Buckets[B] = I + 1;
+  }
+
+  Header H = Header();
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.NumEntries = Entries.size();
+  H.NumBuckets = NumBuckets;
+  H.StringsOffset = sizeof(Header) + NumBuckets * sizeof(uint32_t) +
+                    Entries.size() * sizeof(Entry);
+  H.StringsSize = Strings.size();
+  H.KeyCheck = keyCheck(Key);
+
+  std::string Image;
+  Image.reserve(H.StringsOffset + Strings.size());
+  Image.append(reinterpret_cast<const char *>(&H), sizeof(H));
+  Image.append(reinterpret_cast<const char *>(Buckets.data()),
+               Buckets.size() * sizeof(uint32_t));
+  if (!Entries.empty())
+    Image.append(reinterpret_cast<const char *>(&Entries[0]),
+                 Entries.size() * sizeof(Entry));
+  Image += Strings;
+  return Image;
+}
+
+/// Looks names up in a map file image, typically memory mapped, without
+/// copying it.
+class Reader {
+public:
+  /// Returns false if \p Data is not a well formed map file.
+  bool init(const char *Data, size_t Size) {
+    if (Size < sizeof(Header))
+      return false;
+    std::memcpy(&H, Data, sizeof(H));
+    if (std::memcmp(H.Magic, Magic, sizeof(Magic)) != 0 || H.NumBuckets == 0 ||
+        (H.NumBuckets & (H.NumBuckets - 1)) != 0 ||
+        H.StringsOffset != sizeof(Header) + uint64_t(H.NumBuckets) * 4 +
+                               uint64_t(H.NumEntries) * sizeof(Entry) ||
+        H.StringsOffset + H.StringsSize > Size)
+      return false;
+    Base = Data;
+    for (uint32_t I = 0; I < H.NumEntries; ++I) {
+      Entry E = entry(I);
+      if (uint64_t(E.NameOffset) + E.NameSize > H.StringsSize ||
+          uint64_t(E.OriginalOffset) + E.OriginalSize > H.StringsSize) {
+        Base = nullptr;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t size() const { return H.NumEntries; }
+
+  /// Whether the map was written with \p Key. The original names decrypted
+  /// with another key are garbage.
+  bool hasKey(const std::string &Key) const {
+    return Base && H.KeyCheck == keyCheck(Key);
+  }
+
+  /// The new name of entry \p I.
+  std::string name(uint32_t I) const {
+    Entry E = entry(I);
+    return std::string(strings() + E.NameOffset, E.NameSize);
+  }
+
+  /// The original name of entry \p I, decrypted with \p Key.
+  std::string original(uint32_t I, const std::string &Key) const {
+    Entry E = entry(I);
+    std::string Original(strings() + E.OriginalOffset, E.OriginalSize);
+    applyKey(Original, Key);
+    return Original;
+  }
+
+  /// Find the original name of \p Name. Returns false if it is not mapped,
+  /// or if the map was written with another key than \p Key.
+  bool lookup(const char *Name, size_t Size, const std::string &Key,
+              std::string &Original) const {
+    if (!hasKey(Key))
+      return false;
+    uint64_t Hash = hash(Name, Size);
+    for (uint32_t B = Hash & (H.NumBuckets - 1), Probes = 0;
+         Probes < H.NumBuckets; B = (B + 1) & (H.NumBuckets - 1), ++Probes) {
+      uint32_t Index;
+      std::memcpy(&Index, Base + sizeof(Header) + B * sizeof(uint32_t),
+                  sizeof(Index));
+      if (Index == 0 || Index > H.NumEntries)
+        return false;
+      Entry E = entry(Index - 1);
+      if (E.Hash == Hash && E.NameSize == Size &&
+          std::memcmp(strings() + E.NameOffset, Name, Size) == 0) {
+        Original = original(Index - 1, Key);
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  const char *Base = nullptr;
+  Header H = Header();
+
+  const char *strings() const { return Base + H.StringsOffset; }
+
+  Entry entry(uint32_t I) const {
+    Entry E;
+    std::memcpy(&E,
+                Base + sizeof(Header) + H.NumBuckets * sizeof(uint32_t) +
+                    I * sizeof(Entry),
+                sizeof(E));
+    return E;
+  }
+};
+
+} // namespace renamemap
+} // namespace kovid
+
+#endif // KOVID_RENAMEMAP_H
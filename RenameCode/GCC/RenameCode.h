@@ -0,0 +1,31 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+// Author: djolertrk
+
+// The function renaming of the GCC plugin, shared by the standalone plugin
+// and the combined KoviD GCC plugin. Include it after the GCC headers.
+
+#ifndef KOVID_RENAMECODE_GCC_H
+#define KOVID_RENAMECODE_GCC_H
+
+#include <string>
+
+struct kovid_rename_options {
+  // The crypto key the names are encrypted (or, in compact mode, hashed) with.
+  std::string key;
+  // Rename to "_k" and 12 hex digits of a keyed hash.
+  bool compact = false;
+  // Where to write the map back to the original names: a file, or a
+  // directory for <dir>/<source file>.<hash>.kovidmap, the hash being that
+  // of the absolute path of the source. Empty for no map.
+  std::string map_path;
+};
+
+// Rename fun if it has local linkage. Returns true if it was renamed.
+bool kovid_rename_function(function *fun, const kovid_rename_options &opts);
+
+// Write the map of the functions renamed so far in this unit, if
+// opts.map_path is set, and forget them. Called at the end of the unit.
+void kovid_write_rename_map(const kovid_rename_options &opts);
+
+#endif // KOVID_RENAMECODE_GCC_H
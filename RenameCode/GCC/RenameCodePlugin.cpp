@@ -3,9 +3,16 @@
 // Author: djolertrk
 
 #include <cstdio>
-#include <iomanip>
-#include <sstream>
+#include <cstring>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "KoviDCrypto.h"
+#include "KoviDRenameMap.h"
 
 // This is the first gcc header to be included
 #include "gcc-plugin.h"
@@ -31,38 +38,160 @@
 #include "function.h"
 #include "cgraph.h"
 #include "config.h"
+#include "dumpfile.h"
+#include "statistics.h"
+
+#include "KoviDSelection.h"
+#include "KoviDTimevar.h"
+#include "RenameCode.h"
 
+#ifndef KOVID_COMBINED_PLUGIN
 // Ensure GPL compatibility
 int plugin_is_GPL_compatible;
+#endif
 
 #ifndef CRYPTO_KEY
 #define CRYPTO_KEY "default_key"
 #endif
 
+// The names renamed in this unit, for the map file.
+static std::vector<std::pair<std::string, std::string>> renamed_names;
+
+// ----------------------------------------------------------------------
+// Rename one function. Shared with the combined KoviD plugin.
+bool kovid_rename_function(function *fun, const kovid_rename_options &opts) {
+  tree fndecl = fun->decl;
+
+  // Skip if there is no function body.
+  if (!gimple_has_body_p(fndecl))
+    return false;
+
+  // TODO: Handle those.
+  if (TREE_PUBLIC(fndecl))
+    return false;
+  if (DECL_EXTERNAL(fndecl))
+    return false;
+
+  // Only rename functions with local linkage (typically static functions).
+  if (!TREE_STATIC(fndecl))
+    return false;
+
+  // Skip `inline` functions for now.
+  if (DECL_DECLARED_INLINE_P(fndecl))
+    return false;
+
+  if (!kovid_should_transform(fndecl, kovid::rules::RenameCode))
+    return false;
+  auto_client_timevar tv(g_timer, "KoviD rename-code");
+
+  // Get the original function name.
+  const char *origNameC = IDENTIFIER_POINTER(DECL_NAME(fndecl));
+  if (!origNameC)
+    return false;
+  std::string originalName(origNameC);
+
+  std::string newName;
+  if (opts.compact) {
+    // Unlike the encrypted names, truncated hashes can collide.
+    unsigned salt = 0;
+    do
+      newName = kovid::renamemap::compactName(originalName, opts.key, salt++);
+    while (maybe_get_identifier(newName.c_str()));
+  } else {
+    // Encrypt the name, XOR with the key and hex, and prepend an underscore
+    // to it.
+    newName = "_" + kovid::crypto::encryptName(
+                        originalName, kovid::crypto::getCipher(opts.key));
+  }
+  if (!opts.map_path.empty())
+    renamed_names.emplace_back(newName, originalName);
+
+  // Details go to the pass dump (-fdump-tree-kovid_rename-details).
+  if (dump_file && (dump_flags & TDF_DETAILS))
+    fprintf(dump_file, "Renaming %s to %s\n", originalName.c_str(),
+            newName.c_str());
+
+  // The passes that run after this one, such as the unused-code removal,
+  // still match the rules against the original name.
+  kovid_record_original_name(fndecl);
+
+  // Set the new name as the function's identifier.
+  DECL_NAME(fndecl) = get_identifier(newName.c_str());
+  SET_DECL_ASSEMBLER_NAME(fndecl, get_identifier(newName.c_str()));
+
+  // Also update the cgraph node if available.
+  if (cgraph_node *node = cgraph_node::get(fndecl))
+    node->decl = fndecl;
+
+  // Counted with -fdump-statistics, reported with -fopt-info.
+  statistics_counter_event(fun, "kovid_rename functions renamed", 1);
+  if (dump_enabled_p())
+    dump_printf_loc(MSG_OPTIMIZED_LOCATIONS,
+                    dump_user_location_t::from_function_decl(fndecl),
+                    "renamed %s to %s\n", originalName.c_str(),
+                    newName.c_str());
+
+  return true;
+}
+
 // ----------------------------------------------------------------------
-// Encryption helper: XOR each character with the key (repeating as needed)
-// and then convert the result to a hex string.
-static std::string encryptFunctionName(const std::string &name,
-                                       const std::string &key) {
-  std::string xored;
-  xored.reserve(name.size());
-  for (size_t i = 0; i < name.size(); ++i)
-    xored.push_back(name[i] ^ key[i % key.size()]);
-
-  std::ostringstream oss;
-  oss << std::hex << std::setw(2) << std::setfill('0');
-  for (unsigned char c : xored)
-    oss << std::setw(2) << static_cast<int>(c);
-  return oss.str();
+// Write the names renamed in this unit to the map file, if one was asked for.
+void kovid_write_rename_map(const kovid_rename_options &opts) {
+  if (opts.map_path.empty())
+    return;
+  auto_client_timevar tv(g_timer, "KoviD rename-code: write map");
+
+  std::string path = opts.map_path;
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    std::string source = main_input_filename;
+    if (!IS_ABSOLUTE_PATH(source.c_str())) {
+      char cwd[4096];
+      if (getcwd(cwd, sizeof(cwd)))
+        source = std::string(cwd) + "/" + source;
+    }
+    path += "/" + kovid::renamemap::fileName(source);
+  }
+
+  // Written to a new file next to it, then renamed over it, so that neither
+  // a reader nor a unit writing the same map at the same time ever sees a
+  // partial one.
+  std::string temp = path + ".tmp-XXXXXX";
+  int fd = mkstemp(&temp[0]);
+  bool written = false;
+  if (fd >= 0) {
+    std::string contents = kovid::renamemap::write(renamed_names, opts.key);
+    // mkstemp makes the file private; give it the mode of a new file.
+    mode_t mask = umask(0);
+    umask(mask);
+    written = fchmod(fd, 0666 & ~mask) == 0 &&
+              write(fd, contents.data(), contents.size()) ==
+                  (ssize_t)contents.size();
+    written = close(fd) == 0 && written &&
+              rename(temp.c_str(), path.c_str()) == 0;
+    if (!written)
+      unlink(temp.c_str());
+  }
+  if (!written)
+    error("KoviD Rename plugin: cannot write rename map %qs", path.c_str());
+  renamed_names.clear();
 }
 
+#ifndef KOVID_COMBINED_PLUGIN
+
+// Set from the plugin arguments: -fplugin-arg-<plugin>-compact renames to
+// short names derived from a keyed hash, as -kovid-rename-compact does for
+// the LLVM plugin, and -fplugin-arg-<plugin>-map=<file|dir> says where the
+// mapping back to the original names is written at the end of the unit.
+static kovid_rename_options rename_options;
+
 // ----------------------------------------------------------------------
 // Define pass data for our GIMPLE pass.
 static const pass_data kovid_rename_pass_data = {
     GIMPLE_PASS,    // type of pass
     "kovid_rename", // name
-    OPTGROUP_NONE,  // optinfo_flags
-    TV_NONE,        // tv_id
+    OPTGROUP_OTHER, // optinfo_flags
+    KOVID_TV_PASS,  // tv_id
     0,              // properties_required
     0,              // properties_provided
     0,              // properties_destroyed
@@ -72,60 +201,12 @@ static const pass_data kovid_rename_pass_data = {
 
 // Our pass: it derives from gimple_opt_pass and operates on one function.
 struct kovid_rename_pass : gimple_opt_pass {
-  std::string CryptoKey;
-
   kovid_rename_pass(gcc::context *ctx)
-      : gimple_opt_pass(kovid_rename_pass_data, ctx), CryptoKey(CRYPTO_KEY) {}
+      : gimple_opt_pass(kovid_rename_pass_data, ctx) {}
 
   // Execute the pass on the current function.
   virtual unsigned int execute(function *fun) override {
-    tree fndecl = fun->decl;
-
-    // Skip if there is no function body.
-    if (!gimple_has_body_p(fndecl))
-      return 0;
-
-    // TODO: Handle those.
-    if (TREE_PUBLIC(fndecl))
-      return 0;
-    if (DECL_EXTERNAL(fndecl))
-      return 0;
-
-    // Only rename functions with local linkage (typically static functions).
-    if (!TREE_STATIC(fndecl))
-      return 0;
-
-    // Skip `inline` functions for now.
-    if (DECL_DECLARED_INLINE_P(fndecl))
-      return 0;
-
-    // Get the original function name.
-    const char *origNameC = IDENTIFIER_POINTER(DECL_NAME(fndecl));
-    if (!origNameC)
-      return 0;
-    std::string originalName(origNameC);
-
-    // Debug output.
-    fprintf(stderr, "KoviD Rename: Original function name: %s\n",
-            originalName.c_str());
-    fprintf(stderr, "KoviD Rename: Using crypto key: %s\n", CryptoKey.c_str());
-
-    // Encrypt the name.
-    std::string encryptedName = encryptFunctionName(originalName, CryptoKey);
-    fprintf(stderr, "KoviD Rename: Encrypted name: %s\n\n",
-            encryptedName.c_str());
-
-    // Prepend an underscore to the encrypted name.
-    std::string newName = "_" + encryptedName;
-
-    // Set the new name as the function's identifier.
-    DECL_NAME(fndecl) = get_identifier(newName.c_str());
-    SET_DECL_ASSEMBLER_NAME(fndecl, get_identifier(newName.c_str()));
-
-    // Also update the cgraph node if available.
-    if (cgraph_node *node = cgraph_node::get(fndecl))
-      node->decl = fndecl;
-
+    kovid_rename_function(fun, rename_options);
     return 0;
   }
 
@@ -142,6 +223,10 @@ static struct register_pass_info kovid_rename_pass_info = {
     PASS_POS_INSERT_AFTER     // insert after the referenced pass
 };
 
+static void write_rename_map(void *, void *) {
+  kovid_write_rename_map(rename_options);
+}
+
 // ----------------------------------------------------------------------
 // Plugin initialization function.
 int plugin_init(struct plugin_name_args *plugin_info,
@@ -151,13 +236,36 @@ int plugin_init(struct plugin_name_args *plugin_info,
     return 1;
   }
 
-  // Register plugin information.
-  register_callback(plugin_info->base_name, PLUGIN_INFO, NULL, plugin_info);
+  if (!kovid_init_selection(plugin_info->base_name, "KoviD Rename plugin",
+                            kovid_rules_argument(plugin_info)))
+    return 1;
+
+  rename_options.key = CRYPTO_KEY;
+  for (int i = 0; i < plugin_info->argc; ++i) {
+    if (!strcmp(plugin_info->argv[i].key, "compact"))
+      rename_options.compact = true;
+    else if (!strcmp(plugin_info->argv[i].key, "map") &&
+             plugin_info->argv[i].value)
+      rename_options.map_path = plugin_info->argv[i].value;
+  }
+
+  // For '-fplugin-info' diagnostic
+  static struct plugin_info my_plugin_info = {
+      .version = "1.0",
+      .help = "Renames the functions of the unit to their encrypted names; "
+              "compact uses keyed hashes instead, map=<file|dir> writes "
+              "the original names to a sidecar file."};
+  register_callback(plugin_info->base_name, PLUGIN_INFO, NULL, &my_plugin_info);
 
   // Register our pass.
   register_callback(plugin_info->base_name, PLUGIN_PASS_MANAGER_SETUP, NULL,
                     &kovid_rename_pass_info);
 
+  register_callback(plugin_info->base_name, PLUGIN_FINISH_UNIT,
+                    write_rename_map, NULL);
+
   fprintf(stderr, "KoviD Rename Code GCC Plugin loaded successfully\n");
   return 0;
 }
+
+#endif // KOVID_COMBINED_PLUGIN
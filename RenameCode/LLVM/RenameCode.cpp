@@ -0,0 +1,159 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+#include "RenameCode.h"
+#include "KoviDCrypto.h"
+#include "KoviDOptions.h"
+#include "KoviDRenameMap.h"
+#include "KoviDSelection.h"
+#include "KoviDTimeTrace.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+
+#define DEBUG_TYPE "kovid-rename-code"
+
+STATISTIC(NumFunctionsRenamed, "Number of functions renamed");
+
+using namespace llvm;
+
+static cl::opt<bool> &CompactNames = kovid::getSharedOption<bool>(
+    "kovid-rename-compact",
+    cl::desc("Rename functions to short names derived from a keyed hash; the "
+             "original names are only kept in the -kovid-rename-map file"),
+    cl::init(false));
+
+static cl::opt<std::string> &RenameMapPath =
+    kovid::getSharedOption<std::string>(
+        "kovid-rename-map",
+        cl::desc("Write the mapping from new to original function names to "
+                 "<file>, or to <dir>/<source file>.<hash>.kovidmap"),
+        cl::value_desc("file|dir"), cl::init(""));
+
+bool kovid::renameFunction(Function &F, const std::string &CryptoKey,
+                           OptimizationRemarkEmitter &ORE, RenameMap *Map) {
+  if (F.isDeclaration()) {
+    LLVM_DEBUG(dbgs() << "Skipping function declaration.\n");
+    return false;
+  }
+
+  if (!F.hasLocalLinkage()) {
+    LLVM_DEBUG(dbgs() << "Skipping function with non local linkage: "
+                      << F.getName() << "\n");
+    return false;
+  }
+
+  if (!shouldTransform(F, rules::RenameCode)) {
+    LLVM_DEBUG(dbgs() << "Skipping deselected function: " << F.getName()
+                      << "\n");
+    return false;
+  }
+
+  // Get the original function name.
+  std::string originalName = F.getName().str();
+  TransformTimeScope Trace(rules::RenameCode, "", originalName);
+
+  std::string newName;
+  if (CompactNames) {
+    // Unlike the encrypted names, truncated hashes can collide.
+    Module &M = *F.getParent();
+    for (unsigned Salt = 0;; ++Salt) {
+      newName = renamemap::compactName(originalName, CryptoKey, Salt);
+      if (!M.getNamedValue(newName))
+        break;
+    }
+  } else {
+    // Encrypt the function name using the provided CryptoKey. The XOR cipher
+    // is hex encoded so that the name only has valid characters; see
+    // KoviDCrypto.h.
+    newName = "_" + crypto::encryptName(originalName,
+                                        crypto::getCipher(CryptoKey));
+  }
+  LLVM_DEBUG(dbgs() << "Renaming " << originalName << " to " << newName
+                    << "\n");
+
+  // Rename the function with the new name.
+  F.setName(newName);
+  ++NumFunctionsRenamed;
+  if (Map)
+    Map->emplace_back(F.getName().str(), originalName);
+
+  ORE.emit([&]() {
+    return OptimizationRemark(DEBUG_TYPE, "FunctionRenamed", &F)
+           << "renamed " << ore::NV("OriginalName", originalName) << " to "
+           << ore::NV("NewName", F.getName());
+  });
+
+  return true;
+}
+
+PreservedAnalyses kovid::RenameCode::run(Function &F,
+                                         FunctionAnalysisManager &FAM) {
+  auto &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+  renameFunction(F, CryptoKey, ORE, Map.get());
+
+  return PreservedAnalyses::all();
+}
+
+bool kovid::isRenameMapRequested() { return !RenameMapPath.empty(); }
+
+void kovid::writeRenameMap(const Module &M, const RenameMap &Map,
+                           const std::string &CryptoKey) {
+  if (RenameMapPath.empty())
+    return;
+  TransformTimeScope Trace(rules::RenameCode, "write map", M.getName(),
+                           Map.size(), "names");
+
+  SmallString<128> Path(RenameMapPath);
+  if (sys::fs::is_directory(Path)) {
+    SmallString<128> Source(M.getSourceFileName());
+    sys::fs::make_absolute(Source);
+    sys::path::remove_dots(Source, /*remove_dot_dot=*/true);
+    sys::path::append(Path, renamemap::fileName(std::string(Source)));
+  }
+
+  // Written to a new file next to it, then renamed over it, so that neither
+  // a reader nor a unit writing the same map at the same time ever sees a
+  // partial one.
+  int FD;
+  SmallString<128> TempPath;
+  std::error_code EC =
+      sys::fs::createUniqueFile(Path + ".tmp-%%%%%%%%", FD, TempPath);
+  if (!EC) {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << renamemap::write(Map, CryptoKey);
+    OS.close();
+    EC = OS.error();
+    OS.clear_error();
+    if (!EC)
+      EC = sys::fs::rename(TempPath, Path);
+    if (EC)
+      sys::fs::remove(TempPath);
+  }
+  if (EC) {
+    M.getContext().emitError(Twine("cannot write rename map '") + Path +
+                             "': " + EC.message());
+    return;
+  }
+  LLVM_DEBUG(dbgs() << "Wrote " << Map.size() << " names to " << Path << "\n");
+}
+
+PreservedAnalyses kovid::WriteRenameMap::run(Module &M,
+                                             ModuleAnalysisManager &) {
+  writeRenameMap(M, *Map, CryptoKey);
+  Map->clear();
+  return PreservedAnalyses::all();
+}
@@ -0,0 +1,78 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+#ifndef KOVID_RENAMECODE_H
+#define KOVID_RENAMECODE_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class OptimizationRemarkEmitter;
+} // namespace llvm
+
+#ifndef CRYPTO_KEY
+#define CRYPTO_KEY "default_key"
+#endif
+
+namespace kovid {
+
+/// The (new name, original name) pairs of the functions renamed in a module,
+/// for the sidecar map file requested with -kovid-rename-map.
+using RenameMap = std::vector<std::pair<std::string, std::string>>;
+
+/// Rename \p F to "_" followed by the hex encoded XOR of its original name
+/// with \p CryptoKey, or with -kovid-rename-compact to a short name derived
+/// from a keyed hash. Only defined functions with local linkage that the
+/// selection rules do not exclude are renamed.
+/// Returns true if the function was renamed, which is reported through
+/// \p ORE and recorded in \p Map if given.
+bool renameFunction(llvm::Function &F, const std::string &CryptoKey,
+                    llvm::OptimizationRemarkEmitter &ORE,
+                    RenameMap *Map = nullptr);
+
+/// Whether a map file was requested with -kovid-rename-map.
+bool isRenameMapRequested();
+
+/// Write \p Map, with the original names encrypted with \p CryptoKey, to the
+/// file named by -kovid-rename-map, atomically. If that names a directory,
+/// the file is <directory>/<source file name>.<hash>.kovidmap, where the
+/// hash is that of the absolute path of the source (see
+/// renamemap::fileName). Errors are reported through the context of \p M.
+void writeRenameMap(const llvm::Module &M, const RenameMap &Map,
+                    const std::string &CryptoKey);
+
+struct RenameCode : llvm::PassInfoMixin<RenameCode> {
+  std::string CryptoKey;
+  /// Shared with the WriteRenameMap pass that runs after this one, if any.
+  std::shared_ptr<RenameMap> Map;
+  RenameCode(std::string Key = CRYPTO_KEY,
+             std::shared_ptr<RenameMap> Map = nullptr)
+      : CryptoKey(Key), Map(std::move(Map)) {}
+
+  llvm::PreservedAnalyses run(llvm::Function &F,
+                              llvm::FunctionAnalysisManager &FAM);
+};
+
+/// Writes and then clears the names collected by RenameCode for the module.
+struct WriteRenameMap : llvm::PassInfoMixin<WriteRenameMap> {
+  std::string CryptoKey;
+  std::shared_ptr<RenameMap> Map;
+  WriteRenameMap(std::shared_ptr<RenameMap> Map,
+                 std::string Key = CRYPTO_KEY)
+      : CryptoKey(Key), Map(std::move(Map)) {}
+
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+} // namespace kovid
+
+#endif // KOVID_RENAMECODE_H
@@ -0,0 +1,37 @@
+/*
+ * The string encryption of the GCC plugin, shared by the standalone plugin
+ * and the combined KoviD GCC plugin. Include it after the GCC headers.
+ *
+ * Author: djolertrk
+ */
+
+#ifndef KOVID_STRINGENCRYPTION_GCC_H
+#define KOVID_STRINGENCRYPTION_GCC_H
+
+#include <string>
+
+// How the strings are decrypted at run time, chosen with decryption=.
+enum kovid_string_decryption {
+  // Never, the strings stay encrypted.
+  KOVID_DECRYPT_NONE,
+  // All at once, by a constructor.
+  KOVID_DECRYPT_STARTUP,
+  // A page at a time, the first time the page is touched.
+  KOVID_DECRYPT_PAGE
+};
+
+// The "kovid_string_encryption" simple IPA pass, which packs the string
+// literals the global initializers point to into one array encrypted with
+// key, and XORs the char arrays initialized from literals in place. Unless
+// decryption is KOVID_DECRYPT_NONE, a constructor hands them to the string
+// runtime.
+simple_ipa_opt_pass *
+make_kovid_string_encryption_pass(gcc::context *ctx, const std::string &key,
+                                  kovid_string_decryption decryption);
+
+// Parse the value of the decryption= plugin argument, "none", "startup" or
+// "page". Returns false for anything else.
+bool kovid_parse_string_decryption(const char *value,
+                                   kovid_string_decryption &decryption);
+
+#endif // KOVID_STRINGENCRYPTION_GCC_H
@@ -1,16 +1,51 @@
 /*
- * In-Place XOR of STRING_CST data via a GIMPLE Pass (GCC 12-compatible)
+ * String Encryption GCC Plugin
+ * ----------------------------
  *
- * This plugin finds global variables with string initializers
- * and XORs the data in place **early** in the pipeline,
- * ensuring the emitted object file has the XORed data.
+ * A simple IPA pass, "kovid_string_encryption", that runs once per unit
+ * after "visibility", whether or not the unit has function bodies, and
+ * encrypts the string literals in the initializers of its global variables
+ * with the repeated key (XOR).
+ *
+ * The literals the initializers point to, as in
+ *
+ *   const char *greeting = "hello";
+ *   const char *names[] = {"a", "b", "a"};
+ *
+ * are packed, once per distinct contents, into a single array,
+ * __kovid_strings, in the .kovid.strings section, and the initializers are
+ * rewritten to point into it. The array is encrypted as a whole, as one key
+ * stream, and __kovid_string_offsets holds where each string starts, then
+ * the size of the array. The strings of the unit are then next to each
+ * other, and one call decrypts all of them. Char arrays initialized from a
+ * literal (char s[] = "...") own their storage, so they are still encrypted
+ * in place.
+ *
+ * With -fplugin-arg-<plugin>-decryption=startup, a constructor that runs
+ * before those of the program decrypts the array and the char arrays, and
+ * the program has to be linked with libKoviDStringEncryptionRuntime.a. With
+ * decryption=page the array goes to the kovid_strings section instead, and
+ * the constructor registers it with __kovid_protect_strings: the runtime
+ * keeps its pages no-access and decrypts each of them the first time it is
+ * touched (see KoviDStringPages.c). The array is then aligned to 4096 bytes
+ * and padded to a multiple of them, so that it shares no page with other
+ * data. By default (decryption=none) the strings stay encrypted.
+ *
+ * A system call given a string on a no-access page fails with EFAULT, so
+ * with decryption=page the strings of the variables whose value a function
+ * of the unit passes to a C library function that hands it to the kernel
+ * (see KoviDSystemCalls.h) go to a second array, __kovid_strings_startup,
+ * which the constructor decrypts at once. Only the loads of a variable into
+ * the argument of the call, in the same function, are seen.
  *
  * Author: djolertrk
  */
 
 #include <cstdio>
 #include <cstring>
+#include <map>
 #include <string>
+#include <vector>
 
 // GCC plugin headers:
 #include "gcc-plugin.h"
@@ -20,13 +55,29 @@
 #include "cp/cp-tree.h"
 #include "context.h"
 #include "tree-pass.h"
+#include "gimple.h"
+#include "gimple-iterator.h"
+#include "basic-block.h"
+#include "tree-iterator.h"
+#include "stringpool.h"
+#include "fold-const.h"
 #include "cgraph.h"
 #include "diagnostic.h"
 #include "config.h"
 #include "print-tree.h"
 #include "tree-pretty-print.h"
+#include "dumpfile.h"
+#include "statistics.h"
+
+#include "KoviDCrypto.h"
+#include "KoviDSelection.h"
+#include "KoviDSystemCalls.h"
+#include "KoviDTimevar.h"
+#include "StringEncryption.h"
 
+#ifndef KOVID_COMBINED_PLUGIN
 int plugin_is_GPL_compatible;
+#endif
 
 // For demonstration, define an XOR key unless overridden at compile time:
 //   -DSTR_GCC_CRYPTO_KEY=\"464e40d1dce5c98d\"
@@ -34,58 +85,120 @@ int plugin_is_GPL_compatible;
 #define STR_GCC_CRYPTO_KEY "default_key"
 #endif
 
-// --------------------------------------------------------------------------
-// A simple XOR loop.
-// --------------------------------------------------------------------------
-static void xor_inplace(char *data, int length, const char *key,
-                        size_t keylen) {
-  for (int i = 0; i < length; i++)
-    data[i] = data[i] ^ key[i % keylen];
+namespace {
+
+// The strings of the unit, as they are found.
+struct string_scan {
+  // The plaintext of the packed strings, and where each one starts.
+  std::string blob;
+  std::vector<unsigned> offsets;
+  // The offset of each distinct contents, to pack it only once.
+  std::map<std::string, unsigned> packed;
+
+  // The initializer operands to point into the blob: the ADDR_EXPR to
+  // replace, and the offset of what it pointed to.
+  struct reference {
+    tree *slot;
+    unsigned offset;
+  };
+  std::vector<reference> references;
+
+  // The char arrays encrypted in place, and their encrypted size.
+  std::vector<std::pair<tree, int>> in_place;
+
+  unsigned pack(tree str) {
+    std::string contents(TREE_STRING_POINTER(str), TREE_STRING_LENGTH(str));
+    std::map<std::string, unsigned>::iterator it = packed.find(contents);
+    if (it != packed.end())
+      return it->second;
+    unsigned offset = blob.size();
+    offsets.push_back(offset);
+    blob += contents;
+    packed[contents] = offset;
+    return offset;
+  }
+};
+
+// The blob of page decryption is aligned to this and padded to a multiple
+// of it, so that none of its pages holds other data. It is the page size of
+// the usual targets; larger pages only get partial pages at the ends.
+const unsigned kovid_string_page_size = 4096;
+
+// The array emitted for the packed strings of a string_scan.
+struct packed_blob {
+  tree blob = NULL_TREE;
+  tree offsets = NULL_TREE;
+  size_t count = 0;
+  size_t size = 0;
+};
+
+} // end anonymous namespace
+
+// Whether str is a literal of single byte characters, which can be packed.
+static bool is_narrow_string(tree str) {
+  tree type = TREE_TYPE(str);
+  return TREE_CODE(type) == ARRAY_TYPE &&
+         TYPE_PRECISION(TREE_TYPE(type)) == CHAR_TYPE_SIZE;
 }
 
 // --------------------------------------------------------------------------
-// Mutate the STRING_CST contents in place by XORing them with
-// STR_GCC_CRYPTO_KEY.
+// Mutate the STRING_CST contents in place by XORing them with the key.
 // --------------------------------------------------------------------------
-static void mutate_string_cst(tree cst_node) {
-  if (!cst_node || TREE_CODE(cst_node) != STRING_CST)
-    return;
-
+static int mutate_string_cst(tree cst_node, const std::string &key) {
   const int length = TREE_STRING_LENGTH(cst_node);
   if (length <= 0)
-    return;
+    return 0;
 
   // Access the array from the embedded union inside STRING_CST.
   char *array_ptr = &STRING_CST_CHECK(cst_node)->string.str[0];
 
-  const char *key = STR_GCC_CRYPTO_KEY;
-  fprintf(stderr, "    Using key: %s\n", key);
-
-  // XOR in place:
-  xor_inplace(array_ptr, length, STR_GCC_CRYPTO_KEY,
-              strlen(STR_GCC_CRYPTO_KEY));
+  // Encrypt in place:
+  kovid::crypto::getCipher(key).apply(array_ptr, length);
+  return length;
 }
 
 // --------------------------------------------------------------------------
-// Recursively walk an initializer, XORing any STRING_CST found.
+// Recursively walk the initializer *slot of decl. The char arrays are XORed
+// in place, the literals pointed to are queued for the blob. Returns the
+// number of strings found.
 // --------------------------------------------------------------------------
-static void scan_initializer(tree init) {
+static int scan_initializer(tree decl, tree *slot, const std::string &key,
+                            bool decrypt, string_scan &scan) {
+  tree init = *slot;
   if (!init)
-    return;
+    return 0;
 
+  // The before/after dumps format every string, so they only go to the pass
+  // dump (-fdump-ipa-kovid_string_encryption-details).
+  bool details = dump_file && (dump_flags & TDF_DETAILS);
+  int count = 0;
   switch (TREE_CODE(init)) {
-  case STRING_CST:
-    fprintf(stderr, "  Found STRING_CST:\n");
-    fprintf(stderr, "    Before XOR: ");
-    print_generic_expr(stderr, init, TDF_NONE);
-    fprintf(stderr, "\n");
+  case STRING_CST: {
+    // Only a whole char array can be decrypted at startup; the ones inside
+    // aggregates stay as they are then.
+    bool whole = slot == &DECL_INITIAL(decl);
+    if (decrypt && !whole)
+      break;
+
+    if (details) {
+      fprintf(dump_file, "  Found STRING_CST:\n");
+      fprintf(dump_file, "    Before XOR: ");
+      print_generic_expr(dump_file, init, TDF_NONE);
+      fprintf(dump_file, "\n");
+    }
 
-    mutate_string_cst(init);
+    int length = mutate_string_cst(init, key);
+    if (length && whole)
+      scan.in_place.push_back(std::make_pair(decl, length));
+    count = 1;
 
-    fprintf(stderr, "    After XOR:  ");
-    print_generic_expr(stderr, init, TDF_NONE);
-    fprintf(stderr, "\n");
+    if (details) {
+      fprintf(dump_file, "    After XOR:  ");
+      print_generic_expr(dump_file, init, TDF_NONE);
+      fprintf(dump_file, "\n");
+    }
     break;
+  }
 
   case CONSTRUCTOR: {
     // Recursively scan each element of a constructor.
@@ -93,87 +206,451 @@ static void scan_initializer(tree init) {
     for (unsigned i = 0; i < n; i++) {
       constructor_elt *elt = CONSTRUCTOR_ELT(init, i);
       if (elt)
-        scan_initializer(elt->value);
+        count += scan_initializer(decl, &elt->value, key, decrypt, scan);
     }
     break;
   }
 
-  // If the initializer is something like &"some string", or a cast,
-  // we can scan its operand as well.
-  case ADDR_EXPR:
+  case ADDR_EXPR: {
+    // &"some string", or &"some string"[i].
+    tree str = TREE_OPERAND(init, 0);
+    unsigned index = 0;
+    if (TREE_CODE(str) == ARRAY_REF &&
+        TREE_CODE(TREE_OPERAND(str, 1)) == INTEGER_CST) {
+      index = TREE_INT_CST_LOW(TREE_OPERAND(str, 1));
+      str = TREE_OPERAND(str, 0);
+    }
+    if (TREE_CODE(str) != STRING_CST)
+      break;
+    // Wide strings are left alone.
+    if (TREE_STRING_LENGTH(str) <= 0 || !is_narrow_string(str) ||
+        index >= (unsigned)TREE_STRING_LENGTH(str))
+      break;
+
+    if (details) {
+      fprintf(dump_file, "  Packing STRING_CST: ");
+      print_generic_expr(dump_file, str, TDF_NONE);
+      fprintf(dump_file, "\n");
+    }
+    string_scan::reference ref = {slot, scan.pack(str) + index};
+    scan.references.push_back(ref);
+    count = 1;
+    break;
+  }
+
+  // If the initializer is a cast or an offset, scan its operand as well.
   case NOP_EXPR:
   case BIT_CAST_EXPR:
-  case CONVERT_EXPR: {
-    tree op = TREE_OPERAND(init, 0);
-    scan_initializer(op);
+  case CONVERT_EXPR:
+  case POINTER_PLUS_EXPR:
+    count += scan_initializer(decl, &TREE_OPERAND(init, 0), key, decrypt,
+                              scan);
     break;
-  }
 
   default:
     // Not handling other node codes
     break;
   }
+  return count;
 }
 
-// --------------------------------------------------------------------------
-// A GIMPLE pass that scans **global** variables once, early in the pass
-// pipeline.
-// --------------------------------------------------------------------------
-namespace {
+// A new static variable of the unit, initialized with init.
+static tree build_static_variable(const char *name, tree type, tree init,
+                                  bool readonly) {
+  tree decl = build_decl(BUILTINS_LOCATION, VAR_DECL, get_identifier(name),
+                         type);
+  TREE_STATIC(decl) = 1;
+  TREE_PUBLIC(decl) = 0;
+  TREE_USED(decl) = 1;
+  TREE_ADDRESSABLE(decl) = 1;
+  TREE_READONLY(decl) = readonly;
+  DECL_ARTIFICIAL(decl) = 1;
+  DECL_IGNORED_P(decl) = 1;
+  DECL_INITIAL(decl) = init;
+  varpool_node::finalize_decl(decl);
+  return decl;
+}
 
-static const pass_data my_pass_data = {.type = GIMPLE_PASS,
-                                       .name = "string_encryption_plugin",
-                                       .optinfo_flags =
-                                           OPTGROUP_NONE, // Instead of '0'
-                                       .tv_id = TV_NONE,  // Instead of '0'
-                                       .properties_required = 0,
-                                       .properties_provided = 0,
-                                       .properties_destroyed = 0,
-                                       .todo_flags_start = 0,
-                                       .todo_flags_finish = 0};
-
-struct string_encryption_plugin : gimple_opt_pass {
-  // We use a static boolean so we only scan once, even though
-  // the pass might be invoked for multiple functions.
-  static bool done_global_scan;
-
-  string_encryption_plugin(gcc::context *ctx)
-      : gimple_opt_pass(my_pass_data, ctx) {}
+// A char array variable holding the size bytes at data.
+static tree build_string_variable(const char *name, const char *data,
+                                  size_t size, bool readonly) {
+  tree type = build_array_type_nelts(char_type_node, size);
+  tree init = build_string(size, data);
+  TREE_TYPE(init) = type;
+  return build_static_variable(name, type, init, readonly);
+}
 
-  unsigned int execute(function *) override {
-    // Only do this once to handle top-level (global) initializers.
-    if (!done_global_scan) {
-      done_global_scan = true;
+// &array[offset], as a pointer of type type.
+static tree build_array_address(tree array, unsigned offset, tree type) {
+  tree element = build4(ARRAY_REF, char_type_node, array, size_int(offset),
+                        NULL_TREE, NULL_TREE);
+  return fold_convert(type, build_fold_addr_expr(element));
+}
 
-      fprintf(stderr,
-              "\n[string_encryption_plugin] Scanning global variables...\n");
+// The extern "C" declaration of the runtime function name.
+static tree build_runtime_function(const char *name, tree type) {
+  tree decl =
+      build_decl(BUILTINS_LOCATION, FUNCTION_DECL, get_identifier(name), type);
+  TREE_PUBLIC(decl) = 1;
+  DECL_EXTERNAL(decl) = 1;
+  DECL_ARTIFICIAL(decl) = 1;
+  return decl;
+}
 
-      varpool_node *vnode;
-      FOR_EACH_VARIABLE(vnode) {
-        tree decl = vnode->decl;
-        if (!decl)
-          continue;
+// The call of __kovid_decrypt_blob for packed.
+static tree build_decrypt_blob_call(const packed_blob &packed, tree key_addr,
+                                    tree key_size) {
+  // void __kovid_decrypt_blob(char *, const unsigned *, size_t,
+  //                           const char *, size_t)
+  tree fn = build_runtime_function(
+      "__kovid_decrypt_blob",
+      build_function_type_list(void_type_node, ptr_type_node,
+                               const_ptr_type_node, size_type_node,
+                               const_ptr_type_node, size_type_node,
+                               NULL_TREE));
+  return build_call_expr(fn, 5,
+                         build_array_address(packed.blob, 0, ptr_type_node),
+                         build_fold_addr_expr(packed.offsets),
+                         size_int(packed.count), key_addr, key_size);
+}
 
-        tree init = DECL_INITIAL(decl);
-        if (!init)
-          continue;
+// Emit the constructor that decrypts the blob, or registers it for page
+// decryption, decrypts the startup blob of page decryption, if any, and
+// decrypts the in-place char arrays of scan, with the runtime functions.
+static void build_decryption_constructor(const string_scan &scan,
+                                         const packed_blob &packed,
+                                         const packed_blob &startup,
+                                         const std::string &key,
+                                         kovid_string_decryption decryption) {
+  tree key_var = build_string_variable("__kovid_string_key", key.data(),
+                                       key.size(), true);
+  tree key_addr = build_array_address(key_var, 0, const_ptr_type_node);
+  tree key_size = size_int(key.size());
+  tree body = NULL_TREE;
+
+  if (packed.blob && decryption == KOVID_DECRYPT_PAGE) {
+    // void __kovid_protect_strings(char *, size_t, const char *, size_t)
+    tree fn = build_runtime_function(
+        "__kovid_protect_strings",
+        build_function_type_list(void_type_node, ptr_type_node,
+                                 size_type_node, const_ptr_type_node,
+                                 size_type_node, NULL_TREE));
+    append_to_statement_list(
+        build_call_expr(fn, 4,
+                        build_array_address(packed.blob, 0, ptr_type_node),
+                        size_int(packed.size), key_addr, key_size),
+        &body);
+  } else if (packed.blob) {
+    append_to_statement_list(build_decrypt_blob_call(packed, key_addr,
+                                                     key_size),
+                             &body);
+  }
+  if (startup.blob)
+    append_to_statement_list(build_decrypt_blob_call(startup, key_addr,
+                                                     key_size),
+                             &body);
+
+  if (!scan.in_place.empty()) {
+    // void __kovid_apply_cipher(unsigned, char *, size_t, const char *,
+    //                           size_t, size_t)
+    tree fn = build_runtime_function(
+        "__kovid_apply_cipher",
+        build_function_type_list(void_type_node, unsigned_type_node,
+                                 ptr_type_node, size_type_node,
+                                 const_ptr_type_node, size_type_node,
+                                 size_type_node, NULL_TREE));
+    tree cipher = build_int_cst(
+        unsigned_type_node,
+        static_cast<unsigned>(kovid::crypto::CipherKind::Xor));
+    for (size_t i = 0; i < scan.in_place.size(); ++i) {
+      tree decl = scan.in_place[i].first;
+      append_to_statement_list(
+          build_call_expr(fn, 6, cipher,
+                          fold_convert(ptr_type_node,
+                                       build_fold_addr_expr(decl)),
+                          size_int(scan.in_place[i].second), key_addr,
+                          key_size, size_int(0)),
+          &body);
+    }
+  }
 
-        const char *name =
-            (DECL_NAME(decl) ? IDENTIFIER_POINTER(DECL_NAME(decl))
-                             : "<unknown>");
-        fprintf(stderr, "  XORing strings in global: %s\n", name);
+  // Before the constructors of the program, which may use the strings.
+  cgraph_build_static_cdtor('I', body, MAX_RESERVED_INIT_PRIORITY + 1);
+}
 
-        scan_initializer(init);
+// The global variable whose memory t is in, or whose address t is, or
+// NULL_TREE.
+static tree global_base(tree t) {
+  if (TREE_CODE(t) == ADDR_EXPR)
+    t = TREE_OPERAND(t, 0);
+  tree base = get_base_address(t);
+  return base && VAR_P(base) && is_global_var(base) ? base : NULL_TREE;
+}
+
+// Add to globals the variables whose value, or address, a function of the
+// unit passes to a C library function that hands it to the kernel as it is.
+// Only the arguments loaded from the variable in the same function are
+// seen.
+static void find_system_call_globals(hash_set<tree> &globals) {
+  cgraph_node *node;
+  FOR_EACH_FUNCTION_WITH_GIMPLE_BODY(node) {
+    function *fun = DECL_STRUCT_FUNCTION(node->decl);
+    if (!fun || !fun->cfg)
+      continue;
+
+    // The variable each temporary of fun was loaded from, and the arguments
+    // of the calls.
+    hash_map<tree, tree> loaded_from;
+    std::vector<tree> arguments;
+    basic_block bb;
+    FOR_EACH_BB_FN(bb, fun) {
+      for (gimple_stmt_iterator gsi = gsi_start_bb(bb); !gsi_end_p(gsi);
+           gsi_next(&gsi)) {
+        gimple *stmt = gsi_stmt(gsi);
+        if (gimple_assign_single_p(stmt)) {
+          if (tree base = global_base(gimple_assign_rhs1(stmt)))
+            loaded_from.put(gimple_assign_lhs(stmt), base);
+          continue;
+        }
+        if (!is_gimple_call(stmt))
+          continue;
+        tree callee = gimple_call_fndecl(stmt);
+        if (!callee || !DECL_NAME(callee) ||
+            !kovid::passesStringsToKernel(
+                IDENTIFIER_POINTER(DECL_NAME(callee))))
+          continue;
+        for (unsigned i = 0; i < gimple_call_num_args(stmt); ++i)
+          arguments.push_back(gimple_call_arg(stmt, i));
       }
     }
-    return 0; // no function-body modifications
+
+    for (size_t i = 0; i < arguments.size(); ++i) {
+      tree base = global_base(arguments[i]);
+      if (!base) {
+        tree *loaded = loaded_from.get(arguments[i]);
+        base = loaded ? *loaded : NULL_TREE;
+      }
+      if (base)
+        globals.add(base);
+    }
+  }
+}
+
+// Encrypt the blob of scan as one key stream, emit it as name in section,
+// with its offsets as offsets_name, and point the references of scan into
+// it.
+// With page_size, the blob is aligned to it and padded to a multiple of it,
+// with bytes that decrypt to zeros.
+static packed_blob emit_packed_blob(string_scan &scan, const char *name,
+                                    const char *offsets_name,
+                                    const char *section,
+                                    const std::string &key, bool readonly,
+                                    unsigned page_size = 0) {
+  packed_blob packed;
+  if (page_size)
+    scan.blob.resize((scan.blob.size() + page_size - 1) / page_size *
+                     page_size);
+  // One key stream over the whole blob.
+  kovid::crypto::getCipher(key).apply(scan.blob);
+  packed.blob = build_string_variable(name, scan.blob.data(),
+                                      scan.blob.size(), readonly);
+  set_decl_section_name(packed.blob, section);
+  if (page_size) {
+    SET_DECL_ALIGN(packed.blob, page_size * BITS_PER_UNIT);
+    DECL_USER_ALIGN(packed.blob) = 1;
+  }
+  packed.count = scan.offsets.size();
+  packed.size = scan.blob.size();
+
+  // The start of each string, then the end of the blob.
+  scan.offsets.push_back(scan.blob.size());
+  tree offsets_type =
+      build_array_type_nelts(unsigned_type_node, scan.offsets.size());
+  vec<constructor_elt, va_gc> *elts = NULL;
+  for (size_t i = 0; i < scan.offsets.size(); ++i)
+    CONSTRUCTOR_APPEND_ELT(elts, size_int(i),
+                           build_int_cst(unsigned_type_node, scan.offsets[i]));
+  tree offsets_init = build_constructor(offsets_type, elts);
+  TREE_CONSTANT(offsets_init) = 1;
+  TREE_STATIC(offsets_init) = 1;
+  packed.offsets = build_static_variable(offsets_name, offsets_type,
+                                         offsets_init, true);
+  // Kept for the tools even when nothing decrypts at startup.
+  varpool_node::get(packed.offsets)->force_output = true;
+  scan.offsets.pop_back();
+
+  for (size_t i = 0; i < scan.references.size(); ++i) {
+    tree *slot = scan.references[i].slot;
+    *slot = build_array_address(packed.blob, scan.references[i].offset,
+                                TREE_TYPE(*slot));
+  }
+
+  statistics_counter_event(cfun, "string_encryption packed strings",
+                           scan.offsets.size());
+  statistics_counter_event(cfun, "string_encryption packed bytes",
+                           scan.blob.size());
+  if (dump_file && (dump_flags & TDF_DETAILS))
+    fprintf(dump_file, "Packed %zu strings, %zu bytes, for %zu references "
+                       "into %s\n",
+            scan.offsets.size(), scan.blob.size(), scan.references.size(),
+            name);
+  return packed;
+}
+
+// --------------------------------------------------------------------------
+// Encrypt the string initializers of all global variables. Returns the
+// number of strings encrypted.
+// --------------------------------------------------------------------------
+static int encrypt_global_strings(const std::string &key,
+                                  kovid_string_decryption decryption) {
+  auto_client_timevar tv(g_timer, "KoviD string-encryption");
+  bool decrypt = decryption != KOVID_DECRYPT_NONE;
+  bool details = dump_file && (dump_flags & TDF_DETAILS);
+  if (details)
+    fprintf(dump_file, "Scanning global variables...\n");
+
+  // With page decryption, the strings of the variables that reach the
+  // kernel are decrypted at startup, from a blob of their own.
+  bool paged = decryption == KOVID_DECRYPT_PAGE;
+  hash_set<tree> system_call_globals;
+  if (paged)
+    find_system_call_globals(system_call_globals);
+
+  string_scan scan, startup_scan;
+  // The variables whose initializers point into the blobs.
+  std::vector<varpool_node *> rewritten;
+  int total = 0;
+  auto_client_timevar rewrite_tv(g_timer, "KoviD string-encryption: rewrite");
+  varpool_node *vnode;
+  FOR_EACH_VARIABLE(vnode) {
+    tree decl = vnode->decl;
+    if (!decl || vnode->alias)
+      continue;
+
+    tree init = DECL_INITIAL(decl);
+    if (!init || init == error_mark_node ||
+        !kovid_should_transform(decl, kovid::rules::StringEncryption))
+      continue;
+
+    const char *name =
+        (DECL_NAME(decl) ? IDENTIFIER_POINTER(DECL_NAME(decl)) : "<unknown>");
+    if (details)
+      fprintf(dump_file, "  Encrypting strings in global: %s\n", name);
+
+    bool startup = paged && system_call_globals.contains(decl);
+    string_scan &target = startup ? startup_scan : scan;
+    size_t num_references = target.references.size();
+    size_t num_in_place = target.in_place.size();
+    int count =
+        scan_initializer(decl, &DECL_INITIAL(decl), key, decrypt, target);
+    if (!count)
+      continue;
+    total += count;
+    if (target.references.size() != num_references)
+      rewritten.push_back(vnode);
+    // The arrays are written to at startup.
+    if (decrypt && target.in_place.size() != num_in_place)
+      TREE_READONLY(decl) = 0;
+    if (startup) {
+      statistics_counter_event(cfun, "string_encryption strings not paged",
+                               count);
+      if (details)
+        fprintf(dump_file, "    Passed to a system call, decrypted at "
+                           "startup\n");
+    }
+
+    statistics_counter_event(cfun, "string_encryption strings", count);
+    if (dump_enabled_p())
+      dump_printf_loc(
+          MSG_OPTIMIZED_LOCATIONS,
+          dump_user_location_t::from_location_t(DECL_SOURCE_LOCATION(decl)),
+          "encrypted %d strings in %s\n", count, name);
+  }
+
+  packed_blob packed, startup;
+  if (!scan.offsets.empty() || !startup_scan.offsets.empty()) {
+    auto_client_timevar pack_tv(g_timer, "KoviD string-encryption: pack");
+    // The runtime finds the section of page decryption by its name.
+    if (!scan.offsets.empty())
+      packed = emit_packed_blob(scan, "__kovid_strings",
+                                "__kovid_string_offsets",
+                                paged ? "kovid_strings" : ".kovid.strings",
+                                key, !decrypt,
+                                paged ? kovid_string_page_size : 0);
+    if (!startup_scan.offsets.empty())
+      startup = emit_packed_blob(startup_scan, "__kovid_strings_startup",
+                                 "__kovid_string_offsets_startup",
+                                 ".kovid.strings", key, false);
+    // The initializers now refer to the blobs instead of the literals.
+    for (size_t i = 0; i < rewritten.size(); ++i) {
+      rewritten[i]->remove_all_references();
+      record_references_in_initializer(rewritten[i]->decl, false);
+    }
   }
+
+  // The in-place char arrays of the variables that reach the kernel are
+  // decrypted at startup like the others.
+  scan.in_place.insert(scan.in_place.end(), startup_scan.in_place.begin(),
+                       startup_scan.in_place.end());
+  if (decrypt && (packed.blob || startup.blob || !scan.in_place.empty()))
+    build_decryption_constructor(scan, packed, startup, key, decryption);
+  return total;
+}
+
+static const pass_data string_encryption_pass_data = {
+    SIMPLE_IPA_PASS,           // type
+    "kovid_string_encryption", // name
+    OPTGROUP_OTHER,            // optinfo_flags
+    KOVID_TV_PASS,             // tv_id
+    0,                         // properties_required
+    0,                         // properties_provided
+    0,                         // properties_destroyed
+    0,                         // todo_flags_start
+    0                          // todo_flags_finish
 };
 
-bool string_encryption_plugin::done_global_scan = false;
+namespace {
+
+struct string_encryption_pass : simple_ipa_opt_pass {
+  std::string key;
+  kovid_string_decryption decryption;
+
+  string_encryption_pass(gcc::context *ctx, const std::string &key,
+                         kovid_string_decryption decryption)
+      : simple_ipa_opt_pass(string_encryption_pass_data, ctx), key(key),
+        decryption(decryption) {}
+
+  unsigned int execute(function *) override {
+    encrypt_global_strings(key, decryption);
+    return 0;
+  }
+};
 
 } // end anonymous namespace
 
+simple_ipa_opt_pass *
+make_kovid_string_encryption_pass(gcc::context *ctx, const std::string &key,
+                                  kovid_string_decryption decryption) {
+  return new string_encryption_pass(ctx, key, decryption);
+}
+
+// Handle the decryption= plugin argument, as the string-decryption= one of
+// the combined plugin. Returns false for an unknown value.
+bool kovid_parse_string_decryption(const char *value,
+                                   kovid_string_decryption &decryption) {
+  if (value && !strcmp(value, "none"))
+    decryption = KOVID_DECRYPT_NONE;
+  else if (value && !strcmp(value, "startup"))
+    decryption = KOVID_DECRYPT_STARTUP;
+  else if (value && !strcmp(value, "page"))
+    decryption = KOVID_DECRYPT_PAGE;
+  else
+    return false;
+  return true;
+}
+
+#ifndef KOVID_COMBINED_PLUGIN
+
 // --------------------------------------------------------------------------
 // plugin_init: register the pass and the plugin info
 // --------------------------------------------------------------------------
@@ -185,22 +662,37 @@ int plugin_init(struct plugin_name_args *plugin_info,
     return 1;
   }
 
+  if (!kovid_init_selection(plugin_info->base_name,
+                            "In-Place String XOR Plugin",
+                            kovid_rules_argument(plugin_info)))
+    return 1;
+
+  kovid_string_decryption decryption = KOVID_DECRYPT_NONE;
+  for (int i = 0; i < plugin_info->argc; ++i) {
+    const plugin_argument &arg = plugin_info->argv[i];
+    if (!strcmp(arg.key, "decryption") &&
+        !kovid_parse_string_decryption(arg.value, decryption)) {
+      fprintf(stderr, "In-Place String XOR Plugin: decryption must be none, "
+                      "startup or page\n");
+      return 1;
+    }
+  }
+
   // For '-fplugin-info' diagnostic
   static struct plugin_info my_plugin_info = {
       .version = "1.0",
-      .help = "XORs global STRING_CST data in place (GIMPLE pass)."};
+      .help = "Packs the string literals of the global initializers into one "
+              "encrypted array (simple IPA pass); decryption=startup "
+              "decrypts it before main, decryption=page on first touch."};
   register_callback(plugin_info->base_name, PLUGIN_INFO, NULL, &my_plugin_info);
 
-  // Create and register our pass. We do NOT directly access 'pass_manager' in
-  // GCC 12+; we use 'PLUGIN_PASS_MANAGER_SETUP' with a register_pass_info
-  // struct.
-  string_encryption_plugin *xor_pass = new string_encryption_plugin(g);
-
+  // Once per unit, after "visibility", whether or not it has functions. We
+  // do NOT directly access 'pass_manager' in GCC 12+; we use
+  // 'PLUGIN_PASS_MANAGER_SETUP' with a register_pass_info struct.
   struct register_pass_info pass_info;
-  pass_info.pass = xor_pass;
-  // Insert after the "cfg" pass as an example; you could choose another
-  // reference pass.
-  pass_info.reference_pass_name = "cfg";
+  pass_info.pass =
+      make_kovid_string_encryption_pass(g, STR_GCC_CRYPTO_KEY, decryption);
+  pass_info.reference_pass_name = "visibility";
   pass_info.ref_pass_instance_number = 1;
   pass_info.pos_op = PASS_POS_INSERT_AFTER;
 
@@ -208,6 +700,8 @@ int plugin_init(struct plugin_name_args *plugin_info,
                     /* callback = */ NULL,
                     /* user_data = */ &pass_info);
 
-  fprintf(stderr, "KoviD String XOR Plugin (early pass) loaded.\n");
+  fprintf(stderr, "KoviD String XOR Plugin (IPA pass) loaded.\n");
   return 0;
 }
+
+#endif // KOVID_COMBINED_PLUGIN
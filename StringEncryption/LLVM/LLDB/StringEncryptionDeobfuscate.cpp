@@ -1,76 +1,540 @@
 /*
- * KoviD String Deobfuscation LLDB Plugin
- * --------------------------------------
+ * KoviD Deobfuscation LLDB Plugin
+ * -------------------------------
  *
  * This LLDB plugin registers a new multiword command "deobfuscate" with a
- * subcommand "string" that decrypts an obfuscated global string. The plugin
+ * subcommand "string" that decrypts an obfuscated global string, and the
+ * subcommands "symbols" and "backtrace" for the functions renamed by the
+ * RenameCode plugins. The plugin
  * assumes that global strings have been encrypted by the KoviD String
  * Encryption LLVM pass using a simple XOR cipher. At runtime, this plugin uses
  * the same crypto key (provided via the SE_LLVM_CRYPTO_KEY macro) to decrypt
  * the string.
  *
+ * Both ciphertext encodings of the pass are understood: the default hex
+ * encoding and the raw bytes of -kovid-string-encoding=binary. The encoding
+ * is detected from the contents of the global, unless --hex or --binary is
+ * given.
+ *
+ * The encrypted globals of every module are decrypted once, the first time
+ * the module is looked at, into a table indexed by file address and by name.
+ * The table is built from the data of the object file, so it keeps working
+ * after lazily decrypted strings have been decrypted in place at run time.
+ * "deobfuscate string --all" prints the whole table, and a type summary
+ * provider shows encrypted char arrays decrypted in "frame variable" and "p".
+ *
+ * The renamed functions are handled the same way: the symbol table of every
+ * module is decoded once, the first time the module is looked at, into a
+ * table of original names indexed by file address and by name. "_<hex>"
+ * names are decrypted with the RenameCode key (KOVID_RENAME_CRYPTO_KEY);
+ * compact names ("_k" and 12 hex digits) can only be looked up in the
+ * sidecar maps written with -kovid-rename-map or map=, which "deobfuscate
+ * symbols --map" loads. "deobfuscate backtrace" then prints the frames of
+ * one or all threads with the original names, at the cost of one table
+ * lookup per frame.
+ *
  * Usage in LLDB:
- *   (lldb) deobfuscate string <global_variable_name>
+ *   (lldb) deobfuscate string [--hex|--binary] <global_variable_name>
+ *   (lldb) deobfuscate string --all
+ *   (lldb) deobfuscate symbols [--map <file|dir>]... [<name>...]
+ *   (lldb) deobfuscate backtrace [--all] [--count <n>]
  *
  * License: Apache License v2.0 with LLVM Exceptions
  * Author: djolertrk
  */
 
+#include <cctype>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <exception>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <lldb/API/SBCommandInterpreter.h>
 #include <lldb/API/SBCommandReturnObject.h>
+#include <lldb/API/SBData.h>
 #include <lldb/API/SBDebugger.h>
+#include <lldb/API/SBError.h>
 #include <lldb/API/SBFrame.h>
+#include <lldb/API/SBLineEntry.h>
+#include <lldb/API/SBModule.h>
+#include <lldb/API/SBProcess.h>
+#include <lldb/API/SBSection.h>
+#include <lldb/API/SBStream.h>
+#include <lldb/API/SBSymbol.h>
 #include <lldb/API/SBTarget.h>
 #include <lldb/API/SBThread.h>
+#include <lldb/API/SBTypeCategory.h>
+#include <lldb/API/SBTypeNameSpecifier.h>
+#include <lldb/API/SBTypeSummary.h>
 #include <lldb/API/SBValue.h>
 
 #include "llvm/Support/WithColor.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include "KoviDCrypto.h"
+#include "KoviDRenameMap.h"
+
 // If SE_LLVM_CRYPTO_KEY is not provided by the parent CMake project, default to
 // "default_key".
 #ifndef SE_LLVM_CRYPTO_KEY
 #define SE_LLVM_CRYPTO_KEY "default_key"
 #endif
 
-// A simple XOR decryption helper: given an encrypted string and a key,
-// it reverses the XOR encryption.
+// The key of the LLVM function renaming, likewise.
+#ifndef KOVID_RENAME_CRYPTO_KEY
+#define KOVID_RENAME_CRYPTO_KEY "default_key"
+#endif
+
+// Reverse the XOR encryption of hex encoded ciphertext. Returns an empty
+// string if hexStr is not hex.
 static std::string decryptString(const std::string &hexStr,
                                  const std::string &key) {
-  std::string xored;
-  // First, convert the hex string back into the binary (XORed) form.
-  for (size_t i = 0; i < hexStr.size(); i += 2) {
-    std::string byteStr = hexStr.substr(i, 2);
-    char byte = static_cast<char>(std::stoi(byteStr, nullptr, 16));
-    xored.push_back(byte);
-  }
-  // Then, reverse the XOR operation to recover the original name.
   std::string original;
-  original.reserve(xored.size());
-  for (size_t i = 0; i < xored.size(); ++i) {
-    original.push_back(xored[i] ^ key[i % key.size()]);
-  }
+  if (!kovid::crypto::decryptName(hexStr, kovid::crypto::getCipher(key),
+                                  original))
+    return std::string();
   return original;
 }
 
+// Reverse the XOR encryption of raw (binary encoded) ciphertext.
+static std::string decryptBytes(const std::string &bytes,
+                                const std::string &key) {
+  std::string original = bytes;
+  kovid::crypto::getCipher(key).apply(original);
+  // The terminator was encrypted along with the rest of the string.
+  while (!original.empty() && original.back() == '\0')
+    original.pop_back();
+  return original;
+}
+
+// Hex encoded ciphertext consists of an even number of lowercase hex digits,
+// followed by the terminator.
+static bool isHexCiphertext(const std::string &bytes) {
+  size_t len = bytes.find('\0');
+  if (len == std::string::npos || len == 0 || len % 2 != 0)
+    return false;
+  for (size_t i = 0; i < len; ++i) {
+    char c = bytes[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+      return false;
+  }
+  return true;
+}
+
+// Whether a decryption looks like text rather than an unrelated global that
+// happened to pass the format checks. The terminator must have been
+// encrypted along with the string.
+static bool isPlausibleText(const std::string &str, bool needTerminator) {
+  size_t len = str.size();
+  if (needTerminator) {
+    if (len < 2 || str.back() != '\0')
+      return false;
+    --len;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = str[i];
+    if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+      return false;
+  }
+  return len != 0;
+}
+
+// Read the raw contents of a value: binary ciphertext may contain embedded
+// zeros, so it cannot be read as a C-string.
+static bool readValueBytes(lldb::SBValue value, std::string &bytes) {
+  lldb::SBData data = value.GetData();
+  bytes.assign(data.GetByteSize(), '\0');
+  lldb::SBError error;
+  return !bytes.empty() &&
+         data.ReadRawData(error, 0, &bytes[0], bytes.size()) == bytes.size() &&
+         error.Success();
+}
+
+// Modules are keyed by UUID and path, so a rebuilt binary gets new tables.
+static std::string getModuleKey(lldb::SBModule module) {
+  std::string key;
+  if (const char *uuid = module.GetUUIDString())
+    key = uuid;
+  char path[4096];
+  if (module.GetFileSpec().GetPath(path, sizeof(path)))
+    key += std::string(":") + path;
+  return key;
+}
+
+// ----------------------------------------------------------------------
+// The decrypted strings of all modules seen so far.
+class DecryptedStringCache {
+public:
+  struct Entry {
+    std::string name;
+    uint64_t fileAddress;
+    std::string ciphertext;
+    std::string plaintext;
+    bool binary;
+  };
+
+  // The entries of the module, decrypting its globals on first use.
+  const std::vector<Entry> &getEntries(lldb::SBModule module) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return getTable(module).entries;
+  }
+
+  // The entry for the global at the given address, if it is encrypted.
+  const Entry *lookup(lldb::SBAddress address) {
+    lldb::SBModule module = address.GetModule();
+    if (!module.IsValid())
+      return nullptr;
+    std::lock_guard<std::mutex> lock(mutex);
+    const Table &table = getTable(module);
+    auto it = table.byAddress.find(address.GetFileAddress());
+    return it == table.byAddress.end() ? nullptr : &table.entries[it->second];
+  }
+
+  // The entry for the named global in any module of the target.
+  const Entry *lookup(lldb::SBTarget target, const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0, e = target.GetNumModules(); i < e; ++i) {
+      const Table &table = getTable(target.GetModuleAtIndex(i));
+      auto it = table.byName.find(name);
+      if (it != table.byName.end())
+        return &table.entries[it->second];
+    }
+    return nullptr;
+  }
+
+private:
+  struct Table {
+    std::vector<Entry> entries;
+    std::map<uint64_t, size_t> byAddress;
+    std::map<std::string, size_t> byName;
+  };
+
+  std::map<std::string, Table> tables;
+  std::mutex mutex;
+
+  Table &getTable(lldb::SBModule module) {
+    auto inserted = tables.emplace(getModuleKey(module), Table());
+    if (inserted.second)
+      buildTable(module, inserted.first->second);
+    return inserted.first->second;
+  }
+
+  static void buildTable(lldb::SBModule module, Table &table) {
+    for (size_t i = 0, e = module.GetNumSymbols(); i < e; ++i) {
+      lldb::SBSymbol symbol = module.GetSymbolAtIndex(i);
+      if (!symbol.IsValid() || symbol.GetType() != lldb::eSymbolTypeData ||
+          !symbol.GetName())
+        continue;
+
+      lldb::SBAddress start = symbol.GetStartAddress();
+      lldb::SBAddress end = symbol.GetEndAddress();
+      lldb::SBSection section = start.GetSection();
+      if (!section.IsValid() || !end.IsValid() ||
+          end.GetOffset() <= start.GetOffset())
+        continue;
+
+      // The contents as stored in the object file.
+      lldb::SBData data = section.GetSectionData(
+          start.GetOffset(), end.GetOffset() - start.GetOffset());
+      std::string bytes(data.GetByteSize(), '\0');
+      lldb::SBError error;
+      if (bytes.empty() ||
+          data.ReadRawData(error, 0, &bytes[0], bytes.size()) !=
+              bytes.size() ||
+          error.Fail())
+        continue;
+
+      Entry entry;
+      entry.name = symbol.GetName();
+      entry.fileAddress = start.GetFileAddress();
+      entry.binary = !isHexCiphertext(bytes);
+      if (entry.binary) {
+        std::string dec = decryptBytes(bytes, SE_LLVM_CRYPTO_KEY);
+        // decryptBytes drops the terminator; check it was there.
+        dec.resize(bytes.size());
+        if (!isPlausibleText(dec, /*needTerminator=*/true))
+          continue;
+        entry.plaintext = dec.substr(0, dec.find('\0'));
+        entry.ciphertext = bytes;
+      } else {
+        entry.ciphertext = bytes.substr(0, bytes.find('\0'));
+        entry.plaintext = decryptString(entry.ciphertext, SE_LLVM_CRYPTO_KEY);
+        if (!entry.plaintext.empty() && entry.plaintext.back() == '\0')
+          entry.plaintext.pop_back();
+        if (!isPlausibleText(entry.plaintext, /*needTerminator=*/false))
+          continue;
+      }
+
+      size_t index = table.entries.size();
+      table.byAddress.emplace(entry.fileAddress, index);
+      table.byName.emplace(entry.name, index);
+      // Globals whose type had to change are renamed to <name>.encrypted.
+      const std::string suffix = ".encrypted";
+      if (entry.name.size() > suffix.size() &&
+          entry.name.compare(entry.name.size() - suffix.size(), suffix.size(),
+                             suffix) == 0)
+        table.byName.emplace(
+            entry.name.substr(0, entry.name.size() - suffix.size()), index);
+      table.entries.push_back(std::move(entry));
+    }
+  }
+};
+
+static DecryptedStringCache &getStringCache() {
+  static DecryptedStringCache cache;
+  return cache;
+}
+
+// ----------------------------------------------------------------------
+// Renamed functions.
+
+// Whether a decryption is a plausible symbol name rather than the result of
+// decrypting an unrelated hex-looking symbol.
+static bool isPlausibleName(const std::string &name) {
+  if (name.empty() || isdigit(static_cast<unsigned char>(name[0])))
+    return false;
+  for (unsigned char c : name)
+    if (!isalnum(c) && c != '_' && c != '$' && c != '.')
+      return false;
+  return true;
+}
+
+// Decrypt a "_<hex>" name produced by the RenameCode plugins. Returns false
+// if name is not one.
+static bool decryptFunctionName(const std::string &name,
+                                const std::string &key,
+                                std::string &original) {
+  if (name.size() < 3 || name[0] != '_')
+    return false;
+  return kovid::crypto::decryptName(name.data() + 1, name.size() - 1,
+                                    kovid::crypto::getCipher(key),
+                                    original) &&
+         isPlausibleName(original);
+}
+
+// The original names of the renamed functions of all modules seen so far.
+class RenamedSymbolCache {
+public:
+  struct Entry {
+    std::string name;
+    uint64_t fileAddress;
+    std::string original;
+  };
+
+  // Load a rename map file, or every .kovidmap file of a directory. The
+  // tables built so far are dropped, so that their compact names are looked
+  // up again. Returns the number of maps loaded, or -1 with error set.
+  int loadMaps(const std::string &path, std::string &error) {
+    std::vector<std::string> files;
+    std::error_code ec;
+    if (std::filesystem::is_directory(path, ec)) {
+      for (const auto &file : std::filesystem::directory_iterator(path, ec))
+        if (file.path().extension() == ".kovidmap")
+          files.push_back(file.path().string());
+    } else {
+      files.push_back(path);
+    }
+    if (ec) {
+      error = "cannot read '" + path + "': " + ec.message();
+      return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::string &file : files) {
+      std::ifstream in(file, std::ios::binary);
+      if (!in) {
+        error = "cannot read '" + file + "'";
+        return -1;
+      }
+      // The readers point into the images, which never move.
+      images.emplace_back((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+      kovid::renamemap::Reader reader;
+      if (!reader.init(images.back().data(), images.back().size())) {
+        images.pop_back();
+        error = file + ": not a rename map file";
+        return -1;
+      }
+      if (!reader.hasKey(KOVID_RENAME_CRYPTO_KEY)) {
+        images.pop_back();
+        error = file + ": the map was written with another crypto key";
+        return -1;
+      }
+      maps.push_back(reader);
+    }
+    tables.clear();
+    lastTable = nullptr;
+    return files.size();
+  }
+
+  // The entries of the module, decoding its symbols on first use.
+  const std::vector<Entry> &getEntries(lldb::SBModule module) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return getTable(module).entries;
+  }
+
+  // The original name of the function that contains address, if it was
+  // renamed.
+  const Entry *lookup(lldb::SBAddress address) {
+    lldb::SBModule module = address.GetModule();
+    lldb::SBSymbol symbol = address.GetSymbol();
+    if (!module.IsValid() || !symbol.IsValid())
+      return nullptr;
+    std::lock_guard<std::mutex> lock(mutex);
+    const Table &table = getTable(module);
+    auto it = table.byAddress.find(symbol.GetStartAddress().GetFileAddress());
+    return it == table.byAddress.end() ? nullptr : &table.entries[it->second];
+  }
+
+  // The entry for the renamed function in any module of the target, by its
+  // new name.
+  const Entry *lookup(lldb::SBTarget target, const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (uint32_t i = 0, e = target.GetNumModules(); i < e; ++i) {
+      const Table &table = getTable(target.GetModuleAtIndex(i));
+      auto it = table.byName.find(name);
+      if (it != table.byName.end())
+        return &table.entries[it->second];
+    }
+    return nullptr;
+  }
+
+private:
+  struct Table {
+    std::vector<Entry> entries;
+    std::map<uint64_t, size_t> byAddress;
+    std::map<std::string, size_t> byName;
+  };
+
+  std::map<std::string, Table> tables;
+  std::list<std::string> images;
+  std::vector<kovid::renamemap::Reader> maps;
+  // The frames of a backtrace are mostly in the same module, whose key
+  // costs a path lookup.
+  lldb::SBModule lastModule;
+  Table *lastTable = nullptr;
+  std::mutex mutex;
+
+  Table &getTable(lldb::SBModule module) {
+    if (lastTable && module == lastModule)
+      return *lastTable;
+    auto inserted = tables.emplace(getModuleKey(module), Table());
+    if (inserted.second)
+      buildTable(module, inserted.first->second);
+    lastModule = module;
+    lastTable = &inserted.first->second;
+    return *lastTable;
+  }
+
+  bool resolve(const std::string &name, std::string &original) const {
+    // The maps also know the "_<hex>" names, and do not depend on the
+    // plausibility check.
+    for (const kovid::renamemap::Reader &map : maps)
+      if (map.lookup(name.data(), name.size(), KOVID_RENAME_CRYPTO_KEY,
+                     original))
+        return true;
+    return !kovid::renamemap::isCompactName(name.data(), name.size()) &&
+           decryptFunctionName(name, KOVID_RENAME_CRYPTO_KEY, original);
+  }
+
+  void buildTable(lldb::SBModule module, Table &table) const {
+    for (size_t i = 0, e = module.GetNumSymbols(); i < e; ++i) {
+      lldb::SBSymbol symbol = module.GetSymbolAtIndex(i);
+      if (!symbol.IsValid() || symbol.GetType() != lldb::eSymbolTypeCode ||
+          !symbol.GetName() || symbol.GetName()[0] != '_')
+        continue;
+
+      Entry entry;
+      entry.name = symbol.GetName();
+      if (!resolve(entry.name, entry.original))
+        continue;
+      entry.fileAddress = symbol.GetStartAddress().GetFileAddress();
+
+      size_t index = table.entries.size();
+      table.byAddress.emplace(entry.fileAddress, index);
+      table.byName.emplace(entry.name, index);
+      table.entries.push_back(std::move(entry));
+    }
+  }
+};
+
+static RenamedSymbolCache &getSymbolCache() {
+  static RenamedSymbolCache cache;
+  return cache;
+}
+
+// ----------------------------------------------------------------------
+// Summary provider for char arrays: encrypted globals are shown decrypted,
+// everything else as the usual C-string.
+static bool EncryptedStringSummary(lldb::SBValue value,
+                                   lldb::SBTypeSummaryOptions,
+                                   lldb::SBStream &stream) {
+  std::string bytes;
+  if (!readValueBytes(value, bytes))
+    return false;
+
+  const DecryptedStringCache::Entry *entry =
+      getStringCache().lookup(value.GetAddress());
+  // Lazily decrypted strings may already hold their plaintext.
+  bool encrypted = entry && bytes.compare(0, entry->ciphertext.size(),
+                                          entry->ciphertext) == 0;
+  const std::string &text =
+      encrypted ? entry->plaintext : bytes.substr(0, bytes.find('\0'));
+
+  stream.Printf("\"");
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\')
+      stream.Printf("\\%c", c);
+    else if (c == '\n')
+      stream.Printf("\\n");
+    else if (c < 0x20 || c >= 0x7f)
+      stream.Printf("\\x%02x", c);
+    else
+      stream.Printf("%c", c);
+  }
+  stream.Printf("\"");
+  if (encrypted)
+    stream.Printf(" (decrypted)");
+  return true;
+}
+
 // ----------------------------------------------------------------------
 // A class implementing the LLDB command interface for "deobfuscate string".
 class DeobfStringCommand : public lldb::SBCommandPluginInterface {
 public:
   virtual bool DoExecute(lldb::SBDebugger debugger, char **command,
                          lldb::SBCommandReturnObject &result) override {
-    if (!command || !command[0]) {
-      result.Printf("Usage: deobfuscate string <global_variable_name>\n");
+    enum class Format { Auto, Hex, Binary } format = Format::Auto;
+    bool all = false;
+    for (; command && command[0] && command[0][0] == '-'; ++command) {
+      std::string flag(command[0]);
+      if (flag == "--hex") {
+        format = Format::Hex;
+      } else if (flag == "--binary") {
+        format = Format::Binary;
+      } else if (flag == "--all") {
+        all = true;
+      } else {
+        result.Printf("Unknown option '%s'.\n", flag.c_str());
+        result.SetStatus(lldb::eReturnStatusFailed);
+        return false;
+      }
+    }
+    if (!all && (!command || !command[0])) {
+      result.Printf("Usage: deobfuscate string [--hex|--binary] "
+                    "<global_variable_name>\n"
+                    "       deobfuscate string --all\n");
       result.SetStatus(lldb::eReturnStatusFailed);
       return false;
     }
-    std::string varName(command[0]);
 
     lldb::SBTarget target = debugger.GetSelectedTarget();
     if (!target.IsValid()) {
@@ -78,6 +542,24 @@ public:
       result.SetStatus(lldb::eReturnStatusFailed);
       return false;
     }
+
+    if (all)
+      return printAll(target, result);
+
+    std::string varName(command[0]);
+    // Globals found in the cache need neither a lookup of the variable nor a
+    // decryption. An explicit format bypasses the autodetection of the cache.
+    if (format == Format::Auto) {
+      if (const DecryptedStringCache::Entry *entry =
+              getStringCache().lookup(target, varName)) {
+        std::ostringstream oss;
+        oss << "Decrypted string for global '" << varName
+            << "': " << entry->plaintext << "\n";
+        result.AppendMessage(oss.str().c_str());
+        result.SetStatus(lldb::eReturnStatusSuccessFinishResult);
+        return true;
+      }
+    }
     // Look up the global variable by name.
     lldb::SBValue globalVar = target.FindFirstGlobalVariable(varName.c_str());
     if (!globalVar.IsValid()) {
@@ -85,23 +567,30 @@ public:
       result.SetStatus(lldb::eReturnStatusFailed);
       return false;
     }
-    const char *encCStr = globalVar.GetSummary();
-    if (!encCStr) {
-      result.Printf("Failed to read global variable '%s' as a C-string.\n",
+
+    std::string encStr;
+    if (!readValueBytes(globalVar, encStr)) {
+      result.Printf("Failed to read global variable '%s'.\n",
                     varName.c_str());
       result.SetStatus(lldb::eReturnStatusFailed);
       return false;
     }
-    std::string encStr(encCStr);
-
-    // Remove surrounding quotes if present.
-    if (!encStr.empty() && encStr.front() == '"' && encStr.back() == '"') {
-      encStr = encStr.substr(1, encStr.size() - 2);
-    }
 
-    llvm::WithColor::note() << "Value is " << encStr << '\n';
+    if (format == Format::Auto)
+      format = isHexCiphertext(encStr) ? Format::Hex : Format::Binary;
 
-    std::string decStr = decryptString(encStr, SE_LLVM_CRYPTO_KEY);
+    std::string decStr;
+    if (format == Format::Hex) {
+      size_t end = encStr.find('\0');
+      if (end != std::string::npos)
+        encStr.resize(end);
+      llvm::WithColor::note() << "Value is " << encStr << '\n';
+      decStr = decryptString(encStr, SE_LLVM_CRYPTO_KEY);
+    } else {
+      llvm::WithColor::note()
+          << "Value is " << encStr.size() << " bytes of binary ciphertext\n";
+      decStr = decryptBytes(encStr, SE_LLVM_CRYPTO_KEY);
+    }
     std::ostringstream oss;
     oss << "Decrypted string for global '" << varName << "': " << decStr
         << "\n";
@@ -109,13 +598,212 @@ public:
     result.SetStatus(lldb::eReturnStatusSuccessFinishResult);
     return true;
   }
+
+private:
+  // Print every encrypted global of every module of the target.
+  static bool printAll(lldb::SBTarget target,
+                       lldb::SBCommandReturnObject &result) {
+    std::ostringstream oss;
+    size_t count = 0;
+    for (uint32_t i = 0, e = target.GetNumModules(); i < e; ++i) {
+      lldb::SBModule module = target.GetModuleAtIndex(i);
+      const char *moduleName = module.GetFileSpec().GetFilename();
+      for (const DecryptedStringCache::Entry &entry :
+           getStringCache().getEntries(module)) {
+        char address[32];
+        snprintf(address, sizeof(address), "0x%llx",
+                 (unsigned long long)entry.fileAddress);
+        oss << (moduleName ? moduleName : "<unknown>") << "`" << entry.name
+            << " [" << address << ", " << (entry.binary ? "binary" : "hex")
+            << "]: " << entry.plaintext << "\n";
+        ++count;
+      }
+    }
+    oss << count << " encrypted strings found.\n";
+    result.AppendMessage(oss.str().c_str());
+    result.SetStatus(lldb::eReturnStatusSuccessFinishResult);
+    return true;
+  }
+};
+
+// ----------------------------------------------------------------------
+// "deobfuscate symbols": load rename maps, and print the original names of
+// the given renamed functions, or of all of them.
+class DeobfSymbolsCommand : public lldb::SBCommandPluginInterface {
+public:
+  virtual bool DoExecute(lldb::SBDebugger debugger, char **command,
+                         lldb::SBCommandReturnObject &result) override {
+    std::ostringstream oss;
+    bool loaded = false;
+    for (; command && command[0] && command[0][0] == '-'; ++command) {
+      std::string flag(command[0]);
+      if (flag != "--map" || !command[1]) {
+        result.Printf("Usage: deobfuscate symbols [--map <file|dir>]... "
+                      "[<name>...]\n");
+        result.SetStatus(lldb::eReturnStatusFailed);
+        return false;
+      }
+      ++command;
+      std::string error;
+      int count = getSymbolCache().loadMaps(command[0], error);
+      if (count < 0) {
+        result.Printf("%s\n", error.c_str());
+        result.SetStatus(lldb::eReturnStatusFailed);
+        return false;
+      }
+      oss << "Loaded " << count << " rename maps from " << command[0] << "\n";
+      loaded = true;
+    }
+
+    lldb::SBTarget target = debugger.GetSelectedTarget();
+    if (!target.IsValid()) {
+      if (loaded && (!command || !command[0])) {
+        result.AppendMessage(oss.str().c_str());
+        result.SetStatus(lldb::eReturnStatusSuccessFinishResult);
+        return true;
+      }
+      result.Printf("No valid target selected.\n");
+      result.SetStatus(lldb::eReturnStatusFailed);
+      return false;
+    }
+
+    if (command && command[0]) {
+      for (; command[0]; ++command) {
+        const RenamedSymbolCache::Entry *entry =
+            getSymbolCache().lookup(target, command[0]);
+        if (entry)
+          oss << entry->name << " -> " << entry->original << "\n";
+        else
+          oss << command[0] << ": not a renamed function\n";
+      }
+    } else if (!loaded) {
+      // Just loading maps does not list the whole target.
+      printAll(target, oss);
+    }
+    result.AppendMessage(oss.str().c_str());
+    result.SetStatus(lldb::eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+private:
+  static void printAll(lldb::SBTarget target, std::ostringstream &oss) {
+    size_t count = 0;
+    for (uint32_t i = 0, e = target.GetNumModules(); i < e; ++i) {
+      lldb::SBModule module = target.GetModuleAtIndex(i);
+      const char *moduleName = module.GetFileSpec().GetFilename();
+      for (const RenamedSymbolCache::Entry &entry :
+           getSymbolCache().getEntries(module)) {
+        char address[32];
+        snprintf(address, sizeof(address), "0x%llx",
+                 (unsigned long long)entry.fileAddress);
+        oss << (moduleName ? moduleName : "<unknown>") << "`" << entry.name
+            << " [" << address << "]: " << entry.original << "\n";
+        ++count;
+      }
+    }
+    oss << count << " renamed functions found.\n";
+  }
+};
+
+// ----------------------------------------------------------------------
+// "deobfuscate backtrace": the backtrace of the selected thread, or of all
+// threads, with the original names of the renamed functions.
+class DeobfBacktraceCommand : public lldb::SBCommandPluginInterface {
+public:
+  virtual bool DoExecute(lldb::SBDebugger debugger, char **command,
+                         lldb::SBCommandReturnObject &result) override {
+    bool all = false;
+    uint32_t maxFrames = UINT32_MAX;
+    for (; command && command[0]; ++command) {
+      std::string flag(command[0]);
+      if (flag == "--all") {
+        all = true;
+      } else if (flag == "--count" && command[1]) {
+        maxFrames = strtoul(*++command, nullptr, 10);
+      } else {
+        result.Printf("Usage: deobfuscate backtrace [--all] "
+                      "[--count <n>]\n");
+        result.SetStatus(lldb::eReturnStatusFailed);
+        return false;
+      }
+    }
+
+    lldb::SBProcess process = debugger.GetSelectedTarget().GetProcess();
+    if (!process.IsValid()) {
+      result.Printf("No valid process.\n");
+      result.SetStatus(lldb::eReturnStatusFailed);
+      return false;
+    }
+
+    std::ostringstream oss;
+    if (all) {
+      for (uint32_t i = 0, e = process.GetNumThreads(); i < e; ++i)
+        printThread(process.GetThreadAtIndex(i), maxFrames, oss);
+    } else {
+      printThread(process.GetSelectedThread(), maxFrames, oss);
+    }
+    result.AppendMessage(oss.str().c_str());
+    result.SetStatus(lldb::eReturnStatusSuccessFinishResult);
+    return true;
+  }
+
+private:
+  static void printThread(lldb::SBThread thread, uint32_t maxFrames,
+                          std::ostringstream &oss) {
+    if (!thread.IsValid())
+      return;
+    char line[64];
+    snprintf(line, sizeof(line), "thread #%u, tid = 0x%llx", thread.GetIndexID(),
+             (unsigned long long)thread.GetThreadID());
+    oss << line;
+    if (const char *name = thread.GetName())
+      oss << ", name = '" << name << "'";
+    oss << "\n";
+
+    uint32_t numFrames = thread.GetNumFrames();
+    if (numFrames > maxFrames)
+      numFrames = maxFrames;
+    for (uint32_t i = 0; i < numFrames; ++i)
+      printFrame(thread.GetFrameAtIndex(i), oss);
+  }
+
+  static void printFrame(lldb::SBFrame frame, std::ostringstream &oss) {
+    char line[64];
+    snprintf(line, sizeof(line), "  frame #%u: 0x%016llx ", frame.GetFrameID(),
+             (unsigned long long)frame.GetPC());
+    oss << line;
+
+    lldb::SBAddress pc = frame.GetPCAddress();
+    const char *moduleName = pc.GetModule().GetFileSpec().GetFilename();
+    oss << (moduleName ? moduleName : "???") << "`";
+
+    const RenamedSymbolCache::Entry *entry = getSymbolCache().lookup(pc);
+    const char *name = frame.GetDisplayFunctionName();
+    if (entry)
+      oss << entry->original;
+    else
+      oss << (name ? name : "???");
+
+    lldb::SBSymbol symbol = pc.GetSymbol();
+    if (symbol.IsValid()) {
+      uint64_t start = symbol.GetStartAddress().GetFileAddress();
+      if (pc.GetFileAddress() > start)
+        oss << " + " << pc.GetFileAddress() - start;
+    }
+
+    lldb::SBLineEntry lineEntry = frame.GetLineEntry();
+    if (lineEntry.IsValid() && lineEntry.GetFileSpec().GetFilename())
+      oss << " at " << lineEntry.GetFileSpec().GetFilename() << ":"
+          << lineEntry.GetLine();
+    oss << "\n";
+  }
 };
 
 #define API __attribute__((used))
 namespace lldb {
 
 // Plugin entry point: registers the "deobfuscate" multiword command with the
-// "string" subcommand.
+// "string", "symbols" and "backtrace" subcommands.
 API bool PluginInitialize(lldb::SBDebugger debugger) {
   // Get the LLDB command interpreter.
   lldb::SBCommandInterpreter interpreter = debugger.GetCommandInterpreter();
@@ -134,14 +822,46 @@ API bool PluginInitialize(lldb::SBDebugger debugger) {
   // name, a plugin interface pointer, a help string, and a syntax string
   // (nullptr).
   lldb::SBCommand stringCmd = deobfCommand.AddCommand(
-      "string", stringCommand, "Decrypt an obfuscated global string", nullptr);
+      "string", stringCommand,
+      "Decrypt an obfuscated global string, or all of them with --all",
+      nullptr);
   if (!stringCmd.IsValid()) {
     fprintf(stderr, "Failed to register 'deobfuscate string' command\n");
     return false;
   }
 
+  lldb::SBCommand symbolsCmd = deobfCommand.AddCommand(
+      "symbols", new DeobfSymbolsCommand(),
+      "Print the original names of renamed functions, or of all of them; "
+      "--map loads the rename maps of compact names",
+      "deobfuscate symbols [--map <file|dir>]... [<name>...]");
+  lldb::SBCommand backtraceCmd = deobfCommand.AddCommand(
+      "backtrace", new DeobfBacktraceCommand(),
+      "Print the backtrace of the selected thread, or of all threads with "
+      "--all, with the original names of renamed functions",
+      "deobfuscate backtrace [--all] [--count <n>]");
+  if (!symbolsCmd.IsValid() || !backtraceCmd.IsValid()) {
+    fprintf(stderr, "Failed to register the 'deobfuscate' symbol commands\n");
+    return false;
+  }
+
+  // Show encrypted char arrays decrypted wherever LLDB prints a value.
+  lldb::SBTypeCategory category = debugger.CreateCategory("kovid");
+  lldb::SBTypeSummary summary = lldb::SBTypeSummary::CreateWithCallback(
+      EncryptedStringSummary, 0, "KoviD encrypted string");
+  if (!category.IsValid() || !summary.IsValid() ||
+      !category.AddTypeSummary(
+          lldb::SBTypeNameSpecifier(
+              "^(const )?(unsigned |signed )?char ?\\[[0-9]+\\]$",
+              /*is_regex=*/true),
+          summary)) {
+    fprintf(stderr, "Failed to register the encrypted string summary\n");
+  } else {
+    category.SetEnabled(true);
+  }
+
   printf(
-      "KoviD String Deobfuscation LLDB Plugin loaded. SE_LLVM_CRYPTO_KEY: %s\n",
+      "KoviD Deobfuscation LLDB Plugin loaded. SE_LLVM_CRYPTO_KEY: %s\n",
       SE_LLVM_CRYPTO_KEY);
   return true;
 }
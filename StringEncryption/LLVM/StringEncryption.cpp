@@ -14,163 +14,722 @@
 // encrypting their contents using a simple XOR cipher with a provided key,
 // and replacing them in the IR with encrypted data.
 //
-// In a production environment, a runtime decryption routine must be provided
-// so that the original string values can be recovered when needed. This pass
-// only performs the compile‑time encryption.
+// By default the pass only performs the compile‑time encryption, and a
+// runtime decryption routine must be provided so that the original string
+// values can be recovered when needed.
+//
+// With -kovid-string-decryption=lazy, every use of an encrypted string goes
+// through a small generated accessor instead:
+//
+//    %state = load atomic i8, ptr @str.once acquire
+//    %ready = icmp eq i8 %state, 2    // KOVID_STRING_DECRYPTED
+//    br i1 %ready, label %done, label %decrypt
+//  decrypt:                           // cold, taken once per string
+//    call void @__kovid_decrypt_string(ptr @str, i64 len, ptr @key, ...)
+//
+// The string is decrypted in place the first time it is used and costs one
+// well predicted branch afterwards; strings that are never used are never
+// decrypted. __kovid_decrypt_string lives in the KoviD string runtime
+// library, which the program has to be linked with. Only strings with local
+// linkage whose uses all end up in instructions can be served this way;
+// others (e.g. strings referenced from another global's initializer) are
+// left unencrypted in this mode.
+//
+// With -kovid-string-decryption=page, the uses are left alone. The strings
+// with local linkage are packed, as raw XOR output, into one array of the
+// module in the kovid_strings section, encrypted as a single key stream,
+// and a constructor hands the array to __kovid_protect_strings. The array
+// is aligned to -kovid-string-page-size and padded to a multiple of it, so
+// that none of its pages holds other data. The runtime
+// keeps the pages of the section no-access and decrypts each of them the
+// first time it is touched, from a fault handler, so the code reading the
+// strings is exactly what it was:
+//
+//    @kovid.strings = private externally_initialized global [N x i8] ...,
+//                     section "kovid_strings"
+//    ; each use of @str becomes a use of
+//    getelementptr inbounds ([N x i8], ptr @kovid.strings, i64 0, i64 Offset)
+//
+// The kernel does not fault for the program: a system call given a string
+// on a no-access page fails with EFAULT. The strings that would be packed
+// and reach a C library function that hands them to the kernel (see
+// KoviDSystemCalls.h), directly or through the functions and globals of the
+// module, are decrypted on their first use instead, as in lazy mode.
+//
+// The ciphertext is hex encoded by default, which doubles the size of every
+// string and forces a new, larger global for each of them. With
+// -kovid-string-encoding=binary the raw XOR output is stored instead: the
+// global keeps its [N x i8] type and only its initializer is replaced.
+//
+// The ciphertext is written straight from the raw data of the initializer
+// into one buffer that is reused for every global, with no intermediate
+// copies, so that encrypting a multi-megabyte array costs little more than
+// the new initializer itself. The same happens to
+// constant arrays of i16 and i32 with -kovid-encrypt-data-arrays; their
+// bytes are encrypted in the order the target keeps them in memory, so the
+// runtime does not need to know the element type. In lazy mode, arrays of
+// at least -kovid-string-page-threshold bytes are packed and decrypted a
+// page at a time instead, as in page mode, so that a large table does not
+// have to be decrypted all at once on its first use.
 //
 
+#include "StringEncryption.h"
+#include "KoviDCrypto.h"
+#include "KoviDOptions.h"
+#include "KoviDSelection.h"
+#include "KoviDSystemCalls.h"
+#include "KoviDTimeTrace.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
 #include "llvm/IR/Constants.h"
-#include "llvm/IR/GlobalVariable.h"
-#include "llvm/IR/Module.h"
-#include "llvm/IR/PassManager.h"
-#include "llvm/Pass.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/Passes/PassPlugin.h"
-#include "llvm/Support/WithColor.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/SwapByteOrder.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
 
-#include <iomanip>
-#include <sstream>
+#include <cstring>
 #include <string>
 
 using namespace llvm;
 
-#ifndef SE_LLVM_CRYPTO_KEY
-#define SE_LLVM_CRYPTO_KEY "default_key"
-#endif
+#define DEBUG_TYPE "kovid-string-encryption"
+
+STATISTIC(NumStringsEncrypted, "Number of strings encrypted");
+STATISTIC(NumStringBytesEncrypted, "Number of string bytes encrypted");
+STATISTIC(NumStringsNotLazy,
+          "Number of strings left alone because they cannot be decrypted "
+          "lazily");
+STATISTIC(NumStringsNotPaged,
+          "Number of strings not decrypted a page at a time because they are "
+          "passed to system calls");
+
+namespace {
+
+enum class DecryptionMode { None, Lazy, Page };
+
+static cl::opt<DecryptionMode> &Decryption =
+    kovid::getSharedOption<DecryptionMode>(
+        "kovid-string-decryption",
+        cl::desc("How encrypted strings are decrypted at run time"),
+        cl::init(DecryptionMode::None),
+        cl::values(clEnumValN(DecryptionMode::None, "none",
+                              "No runtime decryption is emitted"),
+                   clEnumValN(DecryptionMode::Lazy, "lazy",
+                              "Decrypt each string on its first use"),
+                   clEnumValN(DecryptionMode::Page, "page",
+                              "Decrypt the strings a page at a time, the first "
+                              "time the page is touched")));
+
+enum class CiphertextEncoding { Hex, Binary };
+
+static cl::opt<CiphertextEncoding> &Encoding =
+    kovid::getSharedOption<CiphertextEncoding>(
+        "kovid-string-encoding",
+        cl::desc("How the encrypted bytes of a string are stored"),
+        cl::init(CiphertextEncoding::Hex),
+        cl::values(clEnumValN(CiphertextEncoding::Hex, "hex",
+                              "Two hex characters per byte, in a new global"),
+                   clEnumValN(CiphertextEncoding::Binary, "binary",
+                              "Raw bytes, in place of the original string")));
+
+static cl::opt<bool> &EncryptDataArrays = kovid::getSharedOption<bool>(
+    "kovid-encrypt-data-arrays",
+    cl::desc("Also encrypt constant arrays of i16 and i32"), cl::init(false));
+
+static cl::opt<uint64_t> &PageThreshold = kovid::getSharedOption<uint64_t>(
+    "kovid-string-page-threshold",
+    cl::desc("In lazy mode, decrypt the arrays of at least this many bytes a "
+             "page at a time, as in page mode (0 = never)"),
+    cl::init(0));
+
+static cl::opt<uint64_t> &PageSize = kovid::getSharedOption<uint64_t>(
+    "kovid-string-page-size",
+    cl::desc("The page size of the target, to which the packed strings are "
+             "aligned and padded (rounded up to a power of two)"),
+    cl::init(4096));
+
+// Matches KOVID_STRING_DECRYPTED in the string runtime.
+constexpr uint8_t StringDecrypted = 2;
+
+} // end anonymous namespace
+
+namespace {
+
+/// The raw data of an initializer being encrypted, without a copy: the
+/// elements, of Width bytes each, in the byte order of the host.
+struct RawData {
+  StringRef Bytes;
+  unsigned Width;
+  /// The target keeps the bytes of an element in the other order.
+  bool Swapped;
+
+  RawData(const ConstantDataArray &CDA, const DataLayout &DL)
+      : Bytes(CDA.getRawDataValues()), Width(CDA.getElementByteSize()),
+        Swapped(Width > 1 && DL.isBigEndian() != sys::IsBigEndianHost) {}
+
+  /// Where byte I of Bytes is in the memory of the target.
+  size_t memoryIndex(size_t I) const {
+    return Swapped ? I - I % Width + (Width - 1 - I % Width) : I;
+  }
+};
+
+/// How encryptData lays out the ciphertext.
+enum class Layout {
+  /// As the raw data of an initializer of the same type.
+  Host,
+  /// In the byte order of the target.
+  Memory,
+  /// Two lowercase hex digits per byte, in the byte order of the target.
+  Hex
+};
+
+} // end anonymous namespace
 
-// A simple XOR-based encryption routine for strings.
-static std::string encryptString(const std::string &str,
-                                 const std::string &key) {
-  std::string encrypted;
-  encrypted.reserve(str.size());
-  for (size_t i = 0; i < str.size(); ++i) {
-    encrypted.push_back(str[i] ^ key[i % key.size()]);
+/// Encrypt \p Data, as it is laid out in the memory of the target, as the
+/// part of the key stream starting at \p Start, and write the result to \p Out.
+/// Out has room for Data.Bytes.size() bytes, or twice as many with
+/// Layout::Hex.
+static void encryptData(const RawData &Data,
+                        const kovid::crypto::Cipher &Key, uint64_t Start,
+                        Layout L, char *Out) {
+  size_t Size = Data.Bytes.size();
+  // Unless the bytes are swapped, Host and Memory are the raw data itself.
+  if (L != Layout::Hex && !Data.Swapped) {
+    std::memcpy(Out, Data.Bytes.data(), Size);
+    Key.apply(Out, Size, Start);
+    return;
   }
 
-  // Convert the binary result into a hex string.
-  std::ostringstream oss;
-  for (unsigned char c : encrypted) {
-    oss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+  std::string Memory(Size, '\0');
+  for (size_t I = 0; I != Size; ++I)
+    Memory[Data.memoryIndex(I)] = Data.Bytes[I];
+  Key.apply(Memory, Start);
+  switch (L) {
+  case Layout::Host:
+    for (size_t I = 0; I != Size; ++I)
+      Out[I] = Memory[Data.memoryIndex(I)];
+    break;
+  case Layout::Memory:
+    std::memcpy(Out, Memory.data(), Size);
+    break;
+  case Layout::Hex:
+    kovid::crypto::hexEncode(Memory.data(), Size, Out);
+    break;
   }
+}
 
-  return oss.str();
+/// Returns true if every use of \p C, possibly through constant
+/// expressions, is an instruction.
+static bool hasOnlyInstructionUses(const Constant *C) {
+  for (const User *U : C->users()) {
+    if (isa<Instruction>(U))
+      continue;
+    if (auto *CE = dyn_cast<ConstantExpr>(U)) {
+      if (hasOnlyInstructionUses(CE))
+        continue;
+    }
+    return false;
+  }
+  return true;
 }
 
 namespace {
 
-struct StringEncryptionPass : public PassInfoMixin<StringEncryptionPass> {
-  std::string CryptoKey;
-  StringEncryptionPass(std::string Key = SE_LLVM_CRYPTO_KEY) : CryptoKey(Key) {}
+/// Finds the C library function to which a pointer is passed and which
+/// hands it to the kernel as it is. The pointer is followed through address
+/// arithmetic, the arguments of the functions of the module and the
+/// initializers of its globals, but not when an instruction stores it to
+/// memory.
+class SystemCallFinder {
+public:
+  /// The function the pointer \p V reaches, or null.
+  const Function *find(const Value *V) {
+    if (!Values.insert(V).second)
+      return nullptr;
+    for (const Use &U : V->uses()) {
+      const User *Usr = U.getUser();
+      const Function *F = nullptr;
+      if (isa<ConstantExpr>(Usr) || isa<ConstantAggregate>(Usr) ||
+          isAddressArithmetic(Usr)) {
+        F = find(Usr);
+      } else if (auto *GV = dyn_cast<GlobalVariable>(Usr)) {
+        // V is in the initializer of GV.
+        F = findInMemory(GV);
+      } else if (auto *CB = dyn_cast<CallBase>(Usr)) {
+        F = getWrapper(U);
+        const Function *Callee = getCallee(*CB);
+        if (!F && Callee && !Callee->isDeclaration() && CB->isArgOperand(&U) &&
+            CB->getArgOperandNo(&U) < Callee->arg_size())
+          F = find(Callee->getArg(CB->getArgOperandNo(&U)));
+      }
+      if (F)
+        return F;
+    }
+    return nullptr;
+  }
+
+private:
+  SmallPtrSet<const Value *, 16> Values;
+  SmallPtrSet<const Value *, 16> Memory;
 
-  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
-    // Collect globals to process in a separate container to avoid modifying
-    // the iterator while in the loop.
-    SmallVector<GlobalVariable *> GlobalsToProcess;
+  static bool isAddressArithmetic(const User *U) {
+    return isa<GetElementPtrInst>(U) || isa<CastInst>(U) ||
+           isa<PHINode>(U) || isa<SelectInst>(U);
+  }
 
-    for (GlobalVariable &GV : M.globals()) {
-      // Process only globals with an initializer.
-      if (!GV.hasInitializer())
-        continue;
+  static const Function *getCallee(const CallBase &CB) {
+    return dyn_cast<Function>(CB.getCalledOperand()->stripPointerCasts());
+  }
 
-      // Only process globals that are constant arrays of i8.
-      Type *GVType = GV.getValueType();
-      if (auto *AT = dyn_cast<ArrayType>(GVType)) {
-        if (AT->getElementType()->isIntegerTy(8)) {
-          if (auto *CDA = dyn_cast<ConstantDataArray>(GV.getInitializer())) {
-            if (CDA->isString()) {
-              GlobalsToProcess.push_back(&GV);
-            }
-          }
-        }
-      }
+  /// The callee of \p U, if U is an argument of a call to a function that
+  /// hands it to the kernel.
+  static const Function *getWrapper(const Use &U) {
+    auto *CB = dyn_cast<CallBase>(U.getUser());
+    if (!CB || !CB->isArgOperand(&U))
+      return nullptr;
+    const Function *Callee = getCallee(*CB);
+    if (Callee && kovid::passesStringsToKernel(Callee->getName().str()))
+      return Callee;
+    return nullptr;
+  }
+
+  /// The function that the pointers in the memory at \p Ptr reach, either
+  /// once loaded or with the memory itself, as the argument vector of
+  /// execv is, or null.
+  const Function *findInMemory(const Value *Ptr) {
+    if (!Memory.insert(Ptr).second)
+      return nullptr;
+    for (const Use &U : Ptr->uses()) {
+      const User *Usr = U.getUser();
+      const Function *F = getWrapper(U);
+      if (!F && isa<LoadInst>(Usr))
+        F = find(Usr);
+      else if (!F && (isa<ConstantExpr>(Usr) || isAddressArithmetic(Usr)))
+        F = findInMemory(Usr);
+      if (F)
+        return F;
     }
+    return nullptr;
+  }
+};
 
-    for (GlobalVariable *GV : GlobalsToProcess) {
-      auto *CDA = cast<ConstantDataArray>(GV->getInitializer());
-      std::string origStr = CDA->getAsString().str();
-
-      llvm::WithColor::note()
-          << "Original string in " << GV->getName() << ": " << origStr << "\n";
-
-      // Check if the original array had a null terminator.
-      // For example, a [6 x i8] might store "Hello\0".
-      auto *AT = cast<ArrayType>(GV->getValueType());
-      unsigned origNumElements = AT->getNumElements();
-      // If the array size is exactly origStr.size() + 1,
-      // that implies there's a trailing '\0'.
-      bool hadTerminator = (origNumElements == origStr.size() + 1);
-
-      // If there was a null terminator, explicitly append it
-      // before encrypting. That way, the '\0' itself is also XOR'd.
-      if (hadTerminator) {
-        // Make sure we only append if the last character isn't already '\0'.
-        // getAsString() usually strips trailing null, but just to be safe:
-        if (origStr.empty() || origStr.back() != '\0') {
-          origStr.push_back('\0');
-        }
-      }
+} // end anonymous namespace
 
-      // Encrypt everything (including the terminator if present).
-      std::string encStr = encryptString(origStr, CryptoKey);
-      llvm::WithColor::note() << "Using key: " << CryptoKey << '\n';
-      llvm::WithColor::note() << "Encrypted string: " << encStr << "\n";
-
-      Constant *NewInit = ConstantDataArray::getString(M.getContext(), encStr,
-                                                       /*AddNull=*/true);
-
-      // Now check if the type changed (e.g. length changed).
-      Type *NewArrTy = NewInit->getType(); // something like [N x i8]
-      Type *OldArrTy = GV->getValueType();
-
-      if (NewArrTy != OldArrTy) {
-        // Create a new global with the corrected type.
-        auto *NewGV = new GlobalVariable(M, NewArrTy,
-                                         /*isConstant=*/false, GV->getLinkage(),
-                                         NewInit, GV->getName() + ".encrypted");
-
-        if (GV->getAlignment())
-          NewGV->setAlignment(GV->getAlign());
-        NewGV->setVisibility(GV->getVisibility());
-        NewGV->setDSOLocal(GV->isDSOLocal());
-
-        // Replace uses with a bitcast if pointer types differ.
-        if (NewGV->getType() != GV->getType()) {
-          auto *BC = ConstantExpr::getPointerBitCastOrAddrSpaceCast(
-              NewGV, GV->getType());
-          GV->replaceAllUsesWith(BC);
-        } else {
-          GV->replaceAllUsesWith(NewGV);
-        }
-        GV->eraseFromParent();
-      } else {
-        // If lengths match, just replace the initializer in place.
-        GV->setInitializer(NewInit);
-        GV->setConstant(false);
-      }
+/// Turn the constant expressions between \p C and the instructions that use
+/// them into instructions, so that \p C is only used by instructions.
+static void expandConstantExprUsers(Constant *C) {
+  SmallVector<ConstantExpr *, 4> CEUsers;
+  for (User *U : C->users())
+    if (auto *CE = dyn_cast<ConstantExpr>(U))
+      CEUsers.push_back(CE);
+
+  for (ConstantExpr *CE : CEUsers) {
+    // Expand the outer expressions first; afterwards CE itself is only used
+    // by instructions.
+    expandConstantExprUsers(CE);
+
+    SmallVector<Use *, 4> Uses;
+    for (Use &U : CE->uses())
+      Uses.push_back(&U);
+    for (Use *U : Uses) {
+      auto *I = cast<Instruction>(U->getUser());
+      Instruction *InsertPt = I;
+      if (auto *PN = dyn_cast<PHINode>(I))
+        InsertPt = PN->getIncomingBlock(*U)->getTerminator();
+      Instruction *NewI = CE->getAsInstruction();
+      NewI->insertBefore(InsertPt);
+      U->set(NewI);
     }
+  }
+  C->removeDeadConstantUsers();
+}
 
-    return PreservedAnalyses::none();
+/// The global holding \p CryptoKey for the runtime. The key is shared by all
+/// strings of the module.
+static GlobalVariable *getKeyGlobal(Module &M, const std::string &CryptoKey) {
+  GlobalVariable *KeyGV = M.getGlobalVariable("kovid.string.key", true);
+  if (!KeyGV) {
+    Constant *KeyInit = ConstantDataArray::getString(
+        M.getContext(), CryptoKey, /*AddNull=*/false);
+    KeyGV = new GlobalVariable(M, KeyInit->getType(), /*isConstant=*/true,
+                               GlobalValue::PrivateLinkage, KeyInit,
+                               "kovid.string.key");
+  }
+  return KeyGV;
+}
+
+/// Create the accessor through which all uses of \p GV go. It returns a
+/// pointer to \p Data, the global holding the ciphertext, with the type of
+/// \p GV, decrypting the \p Len bytes of plaintext with the runtime
+/// function \p DecryptFn first if needed.
+static Function *createAccessor(Module &M, GlobalVariable *GV,
+                                GlobalVariable *Data, uint64_t Len,
+                                const std::string &CryptoKey,
+                                StringRef DecryptFn) {
+  LLVMContext &Ctx = M.getContext();
+  Type *Int8Ty = Type::getInt8Ty(Ctx);
+  Type *Int8PtrTy = PointerType::getUnqual(Int8Ty);
+  Type *SizeTy = M.getDataLayout().getIntPtrType(Ctx);
+
+  GlobalVariable *KeyGV = getKeyGlobal(M, CryptoKey);
+
+  FunctionCallee Decrypt = M.getOrInsertFunction(
+      DecryptFn, Type::getVoidTy(Ctx), Int8PtrTy, SizeTy,
+      Int8PtrTy, SizeTy, Int8PtrTy);
+
+  auto *Once = new GlobalVariable(M, Int8Ty, /*isConstant=*/false,
+                                  GlobalValue::PrivateLinkage,
+                                  ConstantInt::get(Int8Ty, 0),
+                                  GV->getName() + ".once");
+
+  Function *Get =
+      Function::Create(FunctionType::get(GV->getType(), /*isVarArg=*/false),
+                       GlobalValue::InternalLinkage, GV->getName() + ".get", M);
+  Get->addFnAttr(Attribute::AlwaysInline);
+  Get->addFnAttr(Attribute::NoUnwind);
+
+  BasicBlock *Entry = BasicBlock::Create(Ctx, "entry", Get);
+  BasicBlock *Slow = BasicBlock::Create(Ctx, "decrypt", Get);
+  BasicBlock *Done = BasicBlock::Create(Ctx, "done", Get);
+
+  IRBuilder<> Builder(Entry);
+  LoadInst *State = Builder.CreateLoad(Int8Ty, Once, "state");
+  State->setAtomic(AtomicOrdering::Acquire);
+  State->setAlignment(Align(1));
+  Value *Ready =
+      Builder.CreateICmpEQ(State, ConstantInt::get(Int8Ty, StringDecrypted));
+  Builder.CreateCondBr(Ready, Done, Slow,
+                       MDBuilder(Ctx).createBranchWeights(2000, 1));
+
+  Builder.SetInsertPoint(Slow);
+  CallInst *Call = Builder.CreateCall(
+      Decrypt, {ConstantExpr::getPointerCast(Data, Int8PtrTy),
+                ConstantInt::get(SizeTy, Len),
+                ConstantExpr::getPointerCast(KeyGV, Int8PtrTy),
+                ConstantInt::get(SizeTy, CryptoKey.size()), Once});
+  Call->addFnAttr(Attribute::Cold);
+  Builder.CreateBr(Done);
+
+  Builder.SetInsertPoint(Done);
+  Builder.CreateRet(ConstantExpr::getPointerCast(Data, GV->getType()));
+  return Get;
+}
+
+/// Replace each of the instruction \p Uses of a string global with a call
+/// to its accessor \p Get.
+static void routeUsesThroughAccessor(ArrayRef<Use *> Uses, Function *Get) {
+  for (Use *U : Uses) {
+    auto *I = cast<Instruction>(U->getUser());
+    Instruction *InsertPt = I;
+    if (auto *PN = dyn_cast<PHINode>(I))
+      InsertPt = PN->getIncomingBlock(*U)->getTerminator();
+    U->set(CallInst::Create(Get, "", InsertPt));
+  }
+}
+
+/// The strings of a module packed for page decryption, encrypted as one key
+/// stream as they are added.
+struct PackedStrings {
+  std::string Ciphertext;
+  SmallVector<std::pair<GlobalVariable *, uint64_t>, 16> Offsets;
+  Align MaxAlign;
+
+  void add(GlobalVariable *GV, const RawData &Data, Align A,
+           const kovid::crypto::Cipher &Key) {
+    MaxAlign = std::max(MaxAlign, A);
+    uint64_t Offset = alignTo(Ciphertext.size(), A);
+    // The padding decrypts to zeros.
+    uint64_t End = Ciphertext.size();
+    Ciphertext.resize(Offset, '\0');
+    Key.apply(&Ciphertext[End], Offset - End, End);
+    Offsets.push_back({GV, Offset});
+    Ciphertext.resize(Offset + Data.Bytes.size());
+    encryptData(Data, Key, Offset, Layout::Memory, &Ciphertext[Offset]);
+  }
+
+  /// Align the array to \p Page and pad it to a multiple of it, so that it
+  /// shares no page with other data and all of it is decrypted on first
+  /// touch.
+  void padToPages(const kovid::crypto::Cipher &Key, Align Page) {
+    MaxAlign = std::max(MaxAlign, Page);
+    uint64_t End = Ciphertext.size();
+    Ciphertext.resize(alignTo(End, Page), '\0');
+    Key.apply(&Ciphertext[End], Ciphertext.size() - End, End);
   }
 };
 
-} // end anonymous namespace
+/// Emit the packed array of \p Packed, point the uses of its strings into it
+/// and register it with the runtime from a constructor.
+static void emitStringPages(Module &M, PackedStrings &Packed,
+                            const std::string &CryptoKey) {
+  LLVMContext &Ctx = M.getContext();
+  Constant *Init = ConstantDataArray::getString(Ctx, Packed.Ciphertext,
+                                                /*AddNull=*/false);
+  // Written by the runtime, and never to be folded by the optimizer.
+  auto *Blob = new GlobalVariable(M, Init->getType(), /*isConstant=*/false,
+                                  GlobalValue::PrivateLinkage, Init,
+                                  "kovid.strings");
+  Blob->setExternallyInitialized(true);
+  Blob->setSection("kovid_strings");
+  Blob->setAlignment(Packed.MaxAlign);
 
-PassPluginLibraryInfo getPassPluginInfo() {
-  const auto callback = [](PassBuilder &PB) {
-    PB.registerPipelineParsingCallback(
-        [](StringRef Name, ModulePassManager &MPM,
-           ArrayRef<PassBuilder::PipelineElement>) {
-          MPM.addPass(StringEncryptionPass());
-          return true;
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  for (auto &Entry : Packed.Offsets) {
+    GlobalVariable *GV = Entry.first;
+    Constant *Indices[] = {ConstantInt::get(Int64Ty, 0),
+                           ConstantInt::get(Int64Ty, Entry.second)};
+    Constant *Ptr = ConstantExpr::getPointerBitCastOrAddrSpaceCast(
+        ConstantExpr::getInBoundsGetElementPtr(Init->getType(), Blob, Indices),
+        GV->getType());
+    GV->replaceAllUsesWith(Ptr);
+    GV->eraseFromParent();
+  }
+
+  Type *Int8PtrTy = Type::getInt8PtrTy(Ctx);
+  Type *SizeTy = M.getDataLayout().getIntPtrType(Ctx);
+  FunctionCallee Protect = M.getOrInsertFunction(
+      "__kovid_protect_strings", Type::getVoidTy(Ctx), Int8PtrTy, SizeTy,
+      Int8PtrTy, SizeTy);
+  Function *Ctor = Function::Create(
+      FunctionType::get(Type::getVoidTy(Ctx), /*isVarArg=*/false),
+      GlobalValue::InternalLinkage, "kovid.strings.init", M);
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Ctor));
+  Builder.CreateCall(
+      Protect, {ConstantExpr::getPointerCast(Blob, Int8PtrTy),
+                ConstantInt::get(SizeTy, Packed.Ciphertext.size()),
+                ConstantExpr::getPointerCast(getKeyGlobal(M, CryptoKey),
+                                             Int8PtrTy),
+                ConstantInt::get(SizeTy, CryptoKey.size())});
+  Builder.CreateRetVoid();
+  // Before the constructors of the program, which may use the strings.
+  appendToGlobalCtors(M, Ctor, /*Priority=*/101);
+}
+
+/// Returns the first instruction that uses \p C, possibly through constant
+/// expressions, or null. Remarks about a string are attached to it, since a
+/// remark needs a function.
+static const Instruction *findInstructionUser(const Constant *C) {
+  for (const User *U : C->users()) {
+    if (auto *I = dyn_cast<Instruction>(U))
+      return I;
+    if (auto *CE = dyn_cast<ConstantExpr>(U))
+      if (const Instruction *I = findInstructionUser(CE))
+        return I;
+  }
+  return nullptr;
+}
+
+/// Emit the remark built by \p Build for the string in \p GV, if it is used
+/// by any instruction.
+template <typename RemarkBuilder>
+static void emitStringRemark(const GlobalVariable &GV, RemarkBuilder Build) {
+  const Instruction *I = findInstructionUser(&GV);
+  if (!I)
+    return;
+  OptimizationRemarkEmitter ORE(I->getFunction());
+  ORE.emit([&]() { return Build(I); });
+}
+
+bool kovid::isEncryptionCandidate(const GlobalVariable &GV) {
+  // Process only globals with an initializer.
+  if (!GV.hasInitializer())
+    return false;
+
+  // Only process globals that are constant arrays of i8, or of i16 and i32
+  // if asked to.
+  auto *CDA = dyn_cast<ConstantDataArray>(GV.getInitializer());
+  if (!CDA)
+    return false;
+  if (CDA->isString())
+    return true;
+  Type *EltTy = CDA->getElementType();
+  return EncryptDataArrays &&
+         (EltTy->isIntegerTy(16) || EltTy->isIntegerTy(32));
+}
+
+bool kovid::encryptModuleStrings(Module &M, const std::string &CryptoKey) {
+  TransformTimeScope Trace(rules::StringEncryption, "", M.getName());
+
+  // Collect globals to process in a separate container to avoid modifying
+  // the iterator while in the loop.
+  SmallVector<GlobalVariable *> GlobalsToProcess;
+  {
+    TransformTimeScope Collect(rules::StringEncryption, "collect", M.getName(),
+                               M.global_size(), "globals");
+    for (GlobalVariable &GV : M.globals()) {
+      if (isEncryptionCandidate(GV) &&
+          shouldTransform(GV, rules::StringEncryption))
+        GlobalsToProcess.push_back(&GV);
+    }
+  }
+  Optional<TransformTimeScope> Rewrite;
+  Rewrite.emplace(rules::StringEncryption, "rewrite", M.getName(),
+                  GlobalsToProcess.size(), "strings");
+
+  bool Binary = Encoding == CiphertextEncoding::Binary;
+  StringRef DecryptFn =
+      Binary ? "__kovid_decrypt_string_binary" : "__kovid_decrypt_string";
+
+  bool Paged = Decryption == DecryptionMode::Page;
+  PackedStrings Packed;
+
+  const DataLayout &DL = M.getDataLayout();
+  // The ciphertext of one global, before it becomes its initializer.
+  std::string Buffer;
+  // Owned: what getCipher returns only lives until its next call.
+  std::unique_ptr<kovid::crypto::Cipher> Cipher =
+      kovid::crypto::createCipher(CryptoKey);
+  const kovid::crypto::Cipher &Key = *Cipher;
+
+  bool Changed = false;
+  for (GlobalVariable *GV : GlobalsToProcess) {
+    auto *CDA = cast<ConstantDataArray>(GV->getInitializer());
+    RawData Data(*CDA, DL);
+    uint64_t Size = Data.Bytes.size();
+
+    bool Lazy = Decryption == DecryptionMode::Lazy;
+    // Only strings that are not referenced by name from other modules can
+    // be moved into the packed array.
+    bool Pack = (Paged || (Lazy && PageThreshold && Size >= PageThreshold)) &&
+                GV->hasLocalLinkage();
+    // The kernel fails with EFAULT, instead of faulting, on a no-access
+    // page, so the strings it reads are decrypted on their first use.
+    if (Pack) {
+      if (const Function *SysCall = SystemCallFinder().find(GV)) {
+        ++NumStringsNotPaged;
+        emitStringRemark(*GV, [&](const Instruction *I) {
+          return OptimizationRemarkMissed(DEBUG_TYPE, "PassedToSystemCall", I)
+                 << "decrypting " << ore::NV("Global", GV->getName())
+                 << " on its first use instead of a page at a time: it is "
+                    "passed to "
+                 << ore::NV("Callee", SysCall->getName())
+                 << ", which hands it to the kernel";
         });
-  };
+        Pack = false;
+        Lazy = true;
+      }
+    }
+    if ((Paged && !Lazy && !Pack) ||
+        (Lazy && !Pack &&
+         (!GV->hasLocalLinkage() || !hasOnlyInstructionUses(GV)))) {
+      ++NumStringsNotLazy;
+      emitStringRemark(*GV, [&](const Instruction *I) {
+        return OptimizationRemarkMissed(DEBUG_TYPE, "NotDecryptableLazily", I)
+               << "not encrypting " << ore::NV("Global", GV->getName())
+               << ": it cannot be decrypted lazily";
+      });
+      continue;
+    }
+
+    LLVM_DEBUG(dbgs() << "Encrypting " << GV->getName() << " (" << Size
+                      << " bytes)\n");
+
+    ++NumStringsEncrypted;
+    NumStringBytesEncrypted += Size;
+    emitStringRemark(*GV, [&](const Instruction *I) {
+      return OptimizationRemark(DEBUG_TYPE, "StringEncrypted", I)
+             << "encrypted " << ore::NV("Global", GV->getName()) << " ("
+             << ore::NV("Bytes", Size) << " bytes)";
+    });
+
+    // The ciphertext may end up in an array of another type.
+    Align A = DL.getValueOrABITypeAlignment(GV->getAlign(), GV->getValueType());
+
+    Changed = true;
+    if (Pack) {
+      // The whole array, encrypted with the others.
+      Packed.add(GV, Data, A, Key);
+      continue;
+    }
+
+    // Encrypt everything, including the terminator if present.
+    Constant *NewInit;
+    if (Binary) {
+      // Keep exactly the original bytes, so the type does not change.
+      Buffer.resize(Size);
+      encryptData(Data, Key, 0, Layout::Host, &Buffer[0]);
+      NewInit = ConstantDataArray::getRaw(Buffer, CDA->getNumElements(),
+                                          CDA->getElementType());
+    } else {
+      Buffer.resize(2 * Size + 1);
+      encryptData(Data, Key, 0, Layout::Hex, &Buffer[0]);
+      Buffer.back() = '\0';
+      NewInit = ConstantDataArray::getString(M.getContext(), Buffer,
+                                             /*AddNull=*/false);
+    }
+
+    // Now check if the type changed (e.g. length changed).
+    Type *NewArrTy = NewInit->getType(); // something like [N x i8]
+    Type *OldArrTy = GV->getValueType();
+
+    // In lazy mode, collect the uses that are going to be routed through the
+    // accessor before anything else refers to GV.
+    SmallVector<Use *, 8> Uses;
+    if (Lazy) {
+      expandConstantExprUsers(GV);
+      for (Use &U : GV->uses())
+        Uses.push_back(&U);
+    }
 
-  return {LLVM_PLUGIN_API_VERSION, "kovid-string-encryption", "0.0.1",
-          callback};
+    if (NewArrTy != OldArrTy) {
+      // Create a new global with the corrected type.
+      auto *NewGV = new GlobalVariable(M, NewArrTy,
+                                       /*isConstant=*/false, GV->getLinkage(),
+                                       NewInit, GV->getName() + ".encrypted");
+
+      NewGV->setAlignment(A);
+      NewGV->setVisibility(GV->getVisibility());
+      NewGV->setDSOLocal(GV->isDSOLocal());
+
+      if (Lazy)
+        routeUsesThroughAccessor(
+            Uses, createAccessor(M, GV, NewGV, Size, CryptoKey, DecryptFn));
+
+      // Replace uses with a bitcast if pointer types differ.
+      if (NewGV->getType() != GV->getType()) {
+        auto *BC = ConstantExpr::getPointerBitCastOrAddrSpaceCast(
+            NewGV, GV->getType());
+        GV->replaceAllUsesWith(BC);
+      } else {
+        GV->replaceAllUsesWith(NewGV);
+      }
+      GV->eraseFromParent();
+    } else {
+      // If lengths match, just replace the initializer in place.
+      GV->setInitializer(NewInit);
+      GV->setConstant(false);
+
+      if (Lazy)
+        routeUsesThroughAccessor(
+            Uses, createAccessor(M, GV, GV, Size, CryptoKey, DecryptFn));
+    }
+  }
+
+  Rewrite.reset();
+  if (!Packed.Offsets.empty()) {
+    TransformTimeScope Pack(rules::StringEncryption, "pack", M.getName(),
+                            Packed.Offsets.size(), "strings");
+    Align Page(PowerOf2Ceil(std::max<uint64_t>(PageSize, 1)));
+    Packed.padToPages(Key, Page);
+    emitStringPages(M, Packed, CryptoKey);
+  }
+  return Changed;
 }
 
-extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo() {
-  return getPassPluginInfo();
+PreservedAnalyses kovid::StringEncryptionPass::run(Module &M,
+                                                   ModuleAnalysisManager &) {
+  // The annotation strings are candidates themselves, so read them first.
+  bool Changed = applyAnnotations(M);
+  if (!encryptModuleStrings(M, CryptoKey) && !Changed)
+    return PreservedAnalyses::all();
+
+  return PreservedAnalyses::none();
 }
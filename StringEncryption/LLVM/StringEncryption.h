@@ -0,0 +1,39 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+// author: djolertrk
+
+#ifndef KOVID_STRINGENCRYPTION_H
+#define KOVID_STRINGENCRYPTION_H
+
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+
+#include <string>
+
+#ifndef SE_LLVM_CRYPTO_KEY
+#define SE_LLVM_CRYPTO_KEY "default_key"
+#endif
+
+namespace kovid {
+
+/// Returns true if \p GV is a global with a constant string initializer, or
+/// with an i16 or i32 array one under -kovid-encrypt-data-arrays.
+bool isEncryptionCandidate(const llvm::GlobalVariable &GV);
+
+/// Encrypt all string globals of \p M with \p CryptoKey. Returns true if any
+/// global was changed.
+bool encryptModuleStrings(llvm::Module &M, const std::string &CryptoKey);
+
+struct StringEncryptionPass : public llvm::PassInfoMixin<StringEncryptionPass> {
+  std::string CryptoKey;
+  StringEncryptionPass(std::string Key = SE_LLVM_CRYPTO_KEY) : CryptoKey(Key) {}
+
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &);
+};
+
+} // namespace kovid
+
+#endif // KOVID_STRINGENCRYPTION_H
@@ -0,0 +1,48 @@
+/*
+ * KoviD String Encryption Runtime - Ciphers
+ * -----------------------------------------
+ *
+ * The table of the ciphers the runtime can decrypt, indexed by the
+ * KOVID_CIPHER_* ids, which are those of kovid::crypto::CipherKind in
+ * Common/KoviDCrypto.h. Every entry point of the runtime decrypts through
+ * __kovid_apply_cipher. The only cipher is the repeating-key XOR, whose
+ * vector kernels are in KoviDStringXor.c.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "KoviDStringRuntime.h"
+
+#include <stdlib.h>
+
+typedef void (*kovid_cipher)(char *buf, size_t len, const char *key,
+                             size_t keylen, size_t start);
+
+/* The key stream starting at key[start % keylen]. */
+static void xor_from(char *buf, size_t len, const char *key, size_t keylen,
+                     size_t start) {
+  if (keylen == 0)
+    return;
+  size_t k = start % keylen;
+  if (k) {
+    size_t head = keylen - k < len ? keylen - k : len;
+    for (size_t i = 0; i < head; ++i)
+      buf[i] ^= key[k + i];
+    buf += head;
+    len -= head;
+  }
+  __kovid_xor_keystream(buf, len, key, keylen);
+}
+
+static const kovid_cipher ciphers[KOVID_CIPHER_COUNT] = {
+    [KOVID_CIPHER_XOR] = xor_from,
+};
+
+void __kovid_apply_cipher(unsigned cipher, char *buf, size_t len,
+                          const char *key, size_t keylen, size_t start) {
+  /* Returning would leave the ciphertext in place of the strings. */
+  if (cipher >= KOVID_CIPHER_COUNT)
+    abort();
+  ciphers[cipher](buf, len, key, keylen, start);
+}
@@ -0,0 +1,269 @@
+/*
+ * KoviD String Encryption Runtime - Page Granular Decryption
+ * ----------------------------------------------------------
+ *
+ * Decrypts the kovid_strings section a page at a time, the first time the
+ * page is touched, so that the code reading the strings has no extra
+ * instructions at all and startup only pays for the pages that are used.
+ *
+ * Every module built with -kovid-string-decryption=page (LLVM) or
+ * decryption=page (GCC) packs its strings into one blob in the section,
+ * encrypted as one key stream, and registers it from a constructor with
+ * __kovid_protect_strings. The first registration:
+ *
+ *   - moves the pages that lie entirely inside the section to a private
+ *     place with mremap, where they keep the ciphertext, and maps no-access
+ *     pages in their stead;
+ *   - installs a SIGSEGV handler.
+ *
+ * When a no-access page is touched, the handler decrypts, where the
+ * ciphertext of the page was moved, the bytes of every blob registered so
+ * far, and moves that page over the no-access one, again with mremap. That
+ * is the only system call the handler makes, and it runs with every signal
+ * blocked. Other threads touching the page in the meantime fault too and
+ * wait, so no thread ever sees ciphertext, and the faulting instruction is
+ * simply restarted. __kovid_protect_strings blocks every signal while it
+ * holds the lock the handler takes, so that no handler can interrupt it on
+ * its own thread and wait for it forever.
+ *
+ * The passes align each blob to the page size and pad it to a multiple of
+ * it, so the section starts and ends on a page boundary. Otherwise (a blob
+ * built for smaller pages than those of the system), the partial pages at
+ * both ends of the section are shared with other data, so the blobs' bytes
+ * there are decrypted when they are registered, as are the bytes of a blob
+ * whose page was decrypted before it was registered.
+ * Faults outside the section go to the handler that was installed before.
+ *
+ * Without mremap (anything but Linux), the blobs are decrypted when they
+ * are registered.
+ *
+ * The kernel does not fault on behalf of the program: a system call given a
+ * string on a no-access page, such as open() of an encrypted path, fails
+ * with EFAULT and never reaches the handler. The passes keep the strings
+ * they see passed to the C library functions that hand them to the kernel
+ * (see Common/KoviDSystemCalls.h) out of the section; LLVM decrypts them on
+ * their first use instead, GCC at startup. A string that gets to the kernel
+ * in a way the passes cannot see, e.g. through a function of another module,
+ * has to be excluded from string encryption with a kovid_skip annotation
+ * or a rules file.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "KoviDStringRuntime.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define KOVID_STRING_PAGES 1
+#endif
+
+#ifdef KOVID_STRING_PAGES
+
+/* The section bounds, defined by the linker. */
+extern char __start_kovid_strings[] __attribute__((weak, visibility("hidden")));
+extern char __stop_kovid_strings[] __attribute__((weak, visibility("hidden")));
+
+struct blob {
+  char *data;
+  size_t size;
+  const char *key;
+  size_t keylen;
+  struct blob *next;
+};
+
+static struct {
+  /* The pages that start no-access, and where their ciphertext went. */
+  uintptr_t lo, hi;
+  char *ciphertext;
+  /* One byte per page, nonzero once the page is decrypted. */
+  unsigned char *decrypted;
+  size_t page_size;
+  /* The blobs registered so far; the handler only ever reads the list. */
+  struct blob *blobs;
+  struct sigaction previous;
+  int initialized;
+  int lock;
+} pages;
+
+static void lock_pages(void) {
+  while (__atomic_exchange_n(&pages.lock, 1, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+static void unlock_pages(void) {
+  __atomic_store_n(&pages.lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Decrypt the bytes of b in [begin, end), which are at dest + (p - begin)
+ * for each address p. */
+static void decrypt_range(const struct blob *b, uintptr_t begin, uintptr_t end,
+                          char *dest) {
+  uintptr_t first = (uintptr_t)b->data, last = first + b->size;
+  if (first < begin)
+    first = begin;
+  if (last > end)
+    last = end;
+  if (first < last)
+    __kovid_apply_cipher(KOVID_CIPHER_XOR, dest + (first - begin),
+                         last - first, b->key, b->keylen,
+                         first - (uintptr_t)b->data);
+}
+
+/* Decrypt the page at page in the private place its ciphertext was moved
+ * to, and move it back over the no-access page in one step. Called from the
+ * handler, with the lock held. Returns nonzero on success. */
+static int decrypt_page(uintptr_t page) {
+  char *source = pages.ciphertext + (page - pages.lo);
+  for (const struct blob *b = __atomic_load_n(&pages.blobs, __ATOMIC_ACQUIRE);
+       b; b = b->next)
+    decrypt_range(b, page, page + pages.page_size, source);
+
+  if (mremap(source, pages.page_size, pages.page_size,
+             MREMAP_MAYMOVE | MREMAP_FIXED, (void *)page) == MAP_FAILED)
+    return 0;
+  pages.decrypted[(page - pages.lo) / pages.page_size] = 1;
+  return 1;
+}
+
+/* Return from the handler to fault again, and die, with the default
+ * action. */
+static void fault_with_default_action(int sig) {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = SIG_DFL;
+  sigaction(sig, &action, NULL);
+}
+
+static void handle_fault(int sig, siginfo_t *info, void *context) {
+  uintptr_t addr = (uintptr_t)info->si_addr;
+  if (addr >= pages.lo && addr < pages.hi) {
+    uintptr_t page = addr & ~(uintptr_t)(pages.page_size - 1);
+    int decrypted = 1;
+    lock_pages();
+    if (!pages.decrypted[(page - pages.lo) / pages.page_size])
+      decrypted = decrypt_page(page);
+    unlock_pages();
+    if (!decrypted)
+      fault_with_default_action(sig);
+    return;
+  }
+
+  /* Not ours. */
+  if (pages.previous.sa_flags & SA_SIGINFO) {
+    pages.previous.sa_sigaction(sig, info, context);
+  } else if (pages.previous.sa_handler != SIG_DFL &&
+             pages.previous.sa_handler != SIG_IGN) {
+    pages.previous.sa_handler(sig);
+  } else {
+    fault_with_default_action(sig);
+  }
+}
+
+/* Move the pages inside the section away and leave no-access pages behind.
+ * Returns nonzero on success. */
+static int protect_section(void) {
+  pages.page_size = (size_t)sysconf(_SC_PAGESIZE);
+  uintptr_t mask = pages.page_size - 1;
+  pages.lo = ((uintptr_t)__start_kovid_strings + mask) & ~mask;
+  pages.hi = (uintptr_t)__stop_kovid_strings & ~mask;
+  if (!__start_kovid_strings || pages.lo >= pages.hi)
+    return 0;
+
+  size_t size = pages.hi - pages.lo;
+  pages.decrypted = calloc(size / pages.page_size, 1);
+  if (!pages.decrypted)
+    return 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handle_fault;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  /* No other handler can run, and wait for the lock, on top of this one. */
+  sigfillset(&action.sa_mask);
+  if (sigaction(SIGSEGV, &action, &pages.previous))
+    return 0;
+
+  /* Fails if the section spans several mappings; then it is all decrypted
+   * at registration. */
+  char *moved =
+      mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (moved == MAP_FAILED ||
+      mremap((void *)pages.lo, size, size, MREMAP_MAYMOVE | MREMAP_FIXED,
+             moved) == MAP_FAILED) {
+    if (moved != MAP_FAILED)
+      munmap(moved, size);
+    sigaction(SIGSEGV, &pages.previous, NULL);
+    return 0;
+  }
+  pages.ciphertext = moved;
+  if (mmap((void *)pages.lo, size, PROT_NONE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    abort();
+  return 1;
+}
+
+void __kovid_protect_strings(char *blob, size_t size, const char *key,
+                             size_t keylen) {
+  struct blob *b = malloc(sizeof(*b));
+  if (!b) {
+    __kovid_apply_cipher(KOVID_CIPHER_XOR, blob, size, key, keylen, 0);
+    return;
+  }
+  b->data = blob;
+  b->size = size;
+  b->key = key;
+  b->keylen = keylen;
+
+  /* No handler may run on this thread while it holds the lock. On Linux
+   * sigprocmask only changes the mask of the calling thread. */
+  sigset_t all, previous_mask;
+  sigfillset(&all);
+  sigprocmask(SIG_SETMASK, &all, &previous_mask);
+  lock_pages();
+  if (!pages.initialized) {
+    pages.initialized = 1;
+    if (!protect_section())
+      pages.lo = pages.hi = 0;
+  }
+
+  /* The bytes outside the no-access pages, and those in pages that were
+   * decrypted before this blob was known, are decrypted now. */
+  uintptr_t begin = (uintptr_t)blob, end = begin + size;
+  if (begin < pages.lo)
+    decrypt_range(b, begin, pages.lo < end ? pages.lo : end, blob);
+  if (end > pages.hi)
+    decrypt_range(b, pages.hi > begin ? pages.hi : begin, end,
+                  blob + ((pages.hi > begin ? pages.hi : begin) - begin));
+  uintptr_t page = begin & ~(uintptr_t)(pages.page_size - 1);
+  if (page < pages.lo)
+    page = pages.lo;
+  for (; page < pages.hi && page < end; page += pages.page_size)
+    if (pages.decrypted[(page - pages.lo) / pages.page_size])
+      decrypt_range(b, page, page + pages.page_size, (char *)page);
+
+  b->next = pages.blobs;
+  __atomic_store_n(&pages.blobs, b, __ATOMIC_RELEASE);
+  unlock_pages();
+  sigprocmask(SIG_SETMASK, &previous_mask, NULL);
+}
+
+#else
+
+void __kovid_protect_strings(char *blob, size_t size, const char *key,
+                             size_t keylen) {
+  __kovid_apply_cipher(KOVID_CIPHER_XOR, blob, size, key, keylen, 0);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * KoviD String Encryption Runtime
+ * -------------------------------
+ *
+ * Decrypts strings encrypted by the KoviD String Encryption passes the first
+ * time they are used. The ciphertext is either the hex encoding of the string
+ * encrypted with the crypto key, so decoding reads two bytes for every byte it
+ * writes and can safely work in place, front to back, or the raw encrypted
+ * bytes. Both are decrypted through __kovid_apply_cipher.
+ * The strings the GCC plugin packs into one blob are decrypted all at once,
+ * at startup.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "KoviDStringRuntime.h"
+
+#include <sched.h>
+
+static unsigned char hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return (unsigned char)(c - '0');
+  if (c >= 'a' && c <= 'f')
+    return (unsigned char)(c - 'a' + 10);
+  return (unsigned char)(c - 'A' + 10);
+}
+
+/* Returns nonzero if the caller has to decrypt the string guarded by once;
+ * otherwise waits until whoever does it is done. */
+static int begin_decryption(unsigned char *once) {
+  unsigned char expected = KOVID_STRING_ENCRYPTED;
+  if (__atomic_compare_exchange_n(once, &expected, KOVID_STRING_DECRYPTING, 0,
+                                  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    return 1;
+
+  /* Someone else is (or was) decrypting this string; wait for it. */
+  while (__atomic_load_n(once, __ATOMIC_ACQUIRE) != KOVID_STRING_DECRYPTED)
+    sched_yield();
+  return 0;
+}
+
+static void end_decryption(unsigned char *once) {
+  __atomic_store_n(once, KOVID_STRING_DECRYPTED, __ATOMIC_RELEASE);
+}
+
+__attribute__((cold, noinline)) void
+__kovid_decrypt_string(char *buf, size_t len, const char *key, size_t keylen,
+                       unsigned char *once) {
+  if (!begin_decryption(once))
+    return;
+
+  for (size_t i = 0; i < len; ++i)
+    buf[i] = (char)((hex_value(buf[2 * i]) << 4) | hex_value(buf[2 * i + 1]));
+  __kovid_apply_cipher(KOVID_CIPHER_XOR, buf, len, key, keylen, 0);
+
+  end_decryption(once);
+}
+
+__attribute__((cold, noinline)) void
+__kovid_decrypt_string_binary(char *buf, size_t len, const char *key,
+                              size_t keylen, unsigned char *once) {
+  if (!begin_decryption(once))
+    return;
+
+  __kovid_apply_cipher(KOVID_CIPHER_XOR, buf, len, key, keylen, 0);
+
+  end_decryption(once);
+}
+
+__attribute__((cold, noinline)) void
+__kovid_decrypt_blob(char *blob, const unsigned *offsets, size_t count,
+                     const char *key, size_t keylen) {
+  __kovid_apply_cipher(KOVID_CIPHER_XOR, blob, offsets[count], key, keylen,
+                       0);
+}
@@ -0,0 +1,76 @@
+/*
+ * KoviD String Encryption Runtime
+ * -------------------------------
+ *
+ * Runtime support for the code emitted by the KoviD String Encryption
+ * passes. Programs built with runtime decryption enabled have to be linked
+ * against libKoviDStringEncryptionRuntime.a.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#ifndef KOVID_STRING_RUNTIME_H
+#define KOVID_STRING_RUNTIME_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* States of the per-string once flag. The accessors emitted by the pass only
+ * take the fast path when the flag reads KOVID_STRING_DECRYPTED. */
+enum {
+  KOVID_STRING_ENCRYPTED = 0,
+  KOVID_STRING_DECRYPTING = 1,
+  KOVID_STRING_DECRYPTED = 2
+};
+
+/* The ciphers of the runtime, numbered like kovid::crypto::CipherKind. The
+ * strings are encrypted with KOVID_CIPHER_XOR, the repeating-key XOR. */
+enum { KOVID_CIPHER_XOR = 0, KOVID_CIPHER_COUNT };
+
+/* Encrypt or decrypt the len bytes of buf, the part of the key stream of
+ * cipher that starts at position start. An unknown cipher aborts. Safe to
+ * call from a signal handler. */
+void __kovid_apply_cipher(unsigned cipher, char *buf, size_t len,
+                          const char *key, size_t keylen, size_t start);
+
+/* Decrypt the hex encoded ciphertext in buf, which decodes to len bytes,
+ * into the first len bytes of buf. Only the first caller decrypts; callers
+ * racing with it wait until the plaintext is in place. */
+void __kovid_decrypt_string(char *buf, size_t len, const char *key,
+                            size_t keylen, unsigned char *once);
+
+/* Same as __kovid_decrypt_string, for the raw len bytes of ciphertext
+ * emitted with -kovid-string-encoding=binary. */
+void __kovid_decrypt_string_binary(char *buf, size_t len, const char *key,
+                                   size_t keylen, unsigned char *once);
+
+/* Decrypt, in place, the strings the GCC string encryption packed into
+ * blob. String i starts at offsets[i], and offsets[count] is the size of
+ * the blob, which is encrypted as one key stream. Called once, before main,
+ * by the constructor the plugin emits with decryption=startup. */
+void __kovid_decrypt_blob(char *blob, const unsigned *offsets, size_t count,
+                          const char *key, size_t keylen);
+
+/* Register the size bytes at blob, in the kovid_strings section and
+ * encrypted as one key stream, to be decrypted a page at a time, the first
+ * time each page is touched. Called before main by the constructor of each
+ * module built with page decryption. A system call given a string on a page
+ * that was not touched yet fails with EFAULT. See KoviDStringPages.c. */
+void __kovid_protect_strings(char *blob, size_t size, const char *key,
+                             size_t keylen);
+
+/* XOR the len bytes of buf with the repeated key, using the widest vector
+ * kernel the CPU supports. This is the KOVID_CIPHER_XOR stream from position
+ * 0. */
+void __kovid_xor_keystream(char *buf, size_t len, const char *key,
+                           size_t keylen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KOVID_STRING_RUNTIME_H */
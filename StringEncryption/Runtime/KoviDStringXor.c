@@ -0,0 +1,165 @@
+/*
+ * KoviD String Encryption Runtime - Key Stream XOR
+ * ------------------------------------------------
+ *
+ * XORs a buffer with the repeated crypto key. Besides the byte at a time
+ * fallback there are 16 (SSE2, NEON) and 64 (AVX2) bytes at a time kernels;
+ * the best one for the CPU is picked once, when the runtime is loaded.
+ *
+ * The vector kernels do not compute key[i % keylen] per byte. The key is
+ * expanded once into a stream of keylen + W bytes, so that the W key bytes
+ * for any position start at stream[k] with k < keylen, and k advances by
+ * W % keylen after every block.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "KoviDStringRuntime.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KOVID_XOR_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KOVID_XOR_NEON 1
+#endif
+
+/* Keys longer than this are handled by the scalar kernel. */
+#define KOVID_XOR_MAX_KEY 256
+#define KOVID_XOR_MAX_BLOCK 64
+
+typedef void (*xor_kernel)(unsigned char *buf, size_t len,
+                           const unsigned char *key, size_t keylen);
+
+static void xor_scalar(unsigned char *buf, size_t len, const unsigned char *key,
+                       size_t keylen) {
+  size_t k = 0;
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] ^= key[k];
+    if (++k == keylen)
+      k = 0;
+  }
+}
+
+/* Fill stream with keylen + width bytes of the repeated key. */
+static void expand_key(unsigned char *stream, const unsigned char *key,
+                       size_t keylen, size_t width) {
+  size_t k = 0;
+  for (size_t i = 0; i < keylen + width; ++i) {
+    stream[i] = key[k];
+    if (++k == keylen)
+      k = 0;
+  }
+}
+
+/* XOR the final, partial block; stream + k holds at least width bytes. */
+static void xor_tail(unsigned char *buf, size_t len,
+                     const unsigned char *stream) {
+  for (size_t i = 0; i < len; ++i)
+    buf[i] ^= stream[i];
+}
+
+#if defined(KOVID_XOR_X86)
+__attribute__((target("sse2"))) static void
+xor_sse2(unsigned char *buf, size_t len, const unsigned char *key,
+         size_t keylen) {
+  unsigned char stream[KOVID_XOR_MAX_KEY + KOVID_XOR_MAX_BLOCK];
+  expand_key(stream, key, keylen, 16);
+
+  size_t step = 16 % keylen, k = 0, i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i data = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i ks = _mm_loadu_si128((const __m128i *)(stream + k));
+    _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(data, ks));
+    k += step;
+    if (k >= keylen)
+      k -= keylen;
+  }
+  xor_tail(buf + i, len - i, stream + k);
+}
+
+__attribute__((target("avx2"))) static void
+xor_avx2(unsigned char *buf, size_t len, const unsigned char *key,
+         size_t keylen) {
+  unsigned char stream[KOVID_XOR_MAX_KEY + KOVID_XOR_MAX_BLOCK];
+  expand_key(stream, key, keylen, 64);
+
+  /* Key stream offsets of the second half of a block and of the next one. */
+  size_t half = 32 % keylen, step = 64 % keylen, k = 0, i = 0;
+  for (; i + 64 <= len; i += 64) {
+    size_t k2 = k + half;
+    if (k2 >= keylen)
+      k2 -= keylen;
+    __m256i lo = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(buf + i + 32));
+    __m256i kslo = _mm256_loadu_si256((const __m256i *)(stream + k));
+    __m256i kshi = _mm256_loadu_si256((const __m256i *)(stream + k2));
+    _mm256_storeu_si256((__m256i *)(buf + i), _mm256_xor_si256(lo, kslo));
+    _mm256_storeu_si256((__m256i *)(buf + i + 32), _mm256_xor_si256(hi, kshi));
+    k += step;
+    if (k >= keylen)
+      k -= keylen;
+  }
+  xor_tail(buf + i, len - i, stream + k);
+}
+#endif
+
+#if defined(KOVID_XOR_NEON)
+static void xor_neon(unsigned char *buf, size_t len, const unsigned char *key,
+                     size_t keylen) {
+  unsigned char stream[KOVID_XOR_MAX_KEY + KOVID_XOR_MAX_BLOCK];
+  expand_key(stream, key, keylen, 16);
+
+  size_t step = 16 % keylen, k = 0, i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t data = vld1q_u8(buf + i);
+    vst1q_u8(buf + i, veorq_u8(data, vld1q_u8(stream + k)));
+    k += step;
+    if (k >= keylen)
+      k -= keylen;
+  }
+  xor_tail(buf + i, len - i, stream + k);
+}
+#endif
+
+static xor_kernel select_kernel(void) {
+#if defined(KOVID_XOR_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return xor_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return xor_sse2;
+#elif defined(KOVID_XOR_NEON)
+  return xor_neon;
+#endif
+  return xor_scalar;
+}
+
+static void xor_resolve(unsigned char *buf, size_t len,
+                        const unsigned char *key, size_t keylen);
+
+/* Starts out as the resolver, in case a string is decrypted before the
+ * constructor below has run (e.g. from another constructor). */
+static xor_kernel vector_kernel = xor_resolve;
+
+__attribute__((constructor)) static void init_kernel(void) {
+  __atomic_store_n(&vector_kernel, select_kernel(), __ATOMIC_RELAXED);
+}
+
+static void xor_resolve(unsigned char *buf, size_t len,
+                        const unsigned char *key, size_t keylen) {
+  init_kernel();
+  __atomic_load_n(&vector_kernel, __ATOMIC_RELAXED)(buf, len, key, keylen);
+}
+
+void __kovid_xor_keystream(char *buf, size_t len, const char *key,
+                           size_t keylen) {
+  if (keylen == 0)
+    return;
+
+  xor_kernel kernel = xor_scalar;
+  if (keylen <= KOVID_XOR_MAX_KEY && len >= 16)
+    kernel = __atomic_load_n(&vector_kernel, __ATOMIC_RELAXED);
+  kernel((unsigned char *)buf, len, (const unsigned char *)key, keylen);
+}
@@ -0,0 +1,97 @@
+#!/bin/sh
+#
+# Page decryption of the strings a program passes to the kernel: opens a
+# file through an encrypted path literal, which sits between two strings
+# that are decrypted a page at a time, and sums the bytes of those.
+#
+# Usage: page-decryption-syscall.sh <opt> <llc> <cc> <plugin> <runtime> <dir>
+#
+# License: Apache License v2.0 with LLVM Exceptions
+# Author: djolertrk
+
+set -e
+
+OPT=$1
+LLC=$2
+CC=$3
+PLUGIN=$4
+RUNTIME=$5
+DIR=$6
+
+mkdir -p "$DIR"
+FILE="$DIR/page-decryption-syscall.txt"
+echo kovid > "$FILE"
+
+# Two strings of 600 times the 16 hex digits, 9600 bytes each, so that the
+# path between them is on a page of its own that nothing else touches.
+DIGITS=0123456789abcdef
+FILLER=
+i=0
+while [ $i -lt 600 ]; do
+  FILLER=$FILLER$DIGITS
+  i=$((i + 1))
+done
+# The digits add up to 1122.
+SUM=$((2 * 600 * 1122))
+PATH_SIZE=$((${#FILE} + 1))
+
+cat > "$DIR/page-decryption-syscall.ll" <<IR
+@head = private unnamed_addr constant [9601 x i8] c"$FILLER\00"
+@path = private unnamed_addr constant [$PATH_SIZE x i8] c"$FILE\00"
+@tail = private unnamed_addr constant [9601 x i8] c"$FILLER\00"
+
+declare i32 @open(i8*, i32, ...)
+declare i32 @close(i32)
+
+define internal i64 @sum(i8* %p) {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %next, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %add, %loop ]
+  %q = getelementptr i8, i8* %p, i64 %i
+  %c = load volatile i8, i8* %q
+  %z = zext i8 %c to i64
+  %add = add i64 %s, %z
+  %next = add i64 %i, 1
+  %done = icmp eq i64 %next, 9600
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i64 %add
+}
+
+define i32 @main() {
+entry:
+  %fd = call i32 (i8*, i32, ...) @open(i8* getelementptr ([$PATH_SIZE x i8], [$PATH_SIZE x i8]* @path, i64 0, i64 0), i32 0)
+  %failed = icmp slt i32 %fd, 0
+  br i1 %failed, label %open_failed, label %opened
+opened:
+  %closed = call i32 @close(i32 %fd)
+  %h = call i64 @sum(i8* getelementptr ([9601 x i8], [9601 x i8]* @head, i64 0, i64 0))
+  %t = call i64 @sum(i8* getelementptr ([9601 x i8], [9601 x i8]* @tail, i64 0, i64 0))
+  %total = add i64 %h, %t
+  %right = icmp eq i64 %total, $SUM
+  br i1 %right, label %ok, label %wrong_sum
+ok:
+  ret i32 0
+open_failed:
+  ret i32 1
+wrong_sum:
+  ret i32 2
+}
+IR
+
+"$OPT" -load "$PLUGIN" -load-pass-plugin="$PLUGIN" -passes=string-encryption \
+  -kovid-string-decryption=page "$DIR/page-decryption-syscall.ll" \
+  -o "$DIR/page-decryption-syscall.bc"
+"$LLC" -relocation-model=pic -filetype=obj "$DIR/page-decryption-syscall.bc" \
+  -o "$DIR/page-decryption-syscall.o"
+"$CC" "$DIR/page-decryption-syscall.o" "$RUNTIME" \
+  -o "$DIR/page-decryption-syscall"
+
+# Neither the path nor the other strings are in the program in plaintext.
+if grep -q -e "$DIGITS" -e "$FILE" "$DIR/page-decryption-syscall"; then
+  echo "plaintext strings in $DIR/page-decryption-syscall" >&2
+  exit 1
+fi
+"$DIR/page-decryption-syscall"
@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Compile-time benchmark for the KoviD GCC plugins.
+#
+# Compiles the C version of the kovid-bench synthetic module (a fixed corpus
+# for a given set of sizes) with each plugin alone, with all of them and with
+# the combined plugin, and reports the wall time, peak RSS and .text growth
+# of every compilation, to compare with the LLVM numbers from kovid-bench.
+#
+# Usage:
+#   gcc-bench.sh <build dir> [kovid-bench options, e.g. -functions=2000]
+#
+# Set CC to choose the compiler (default gcc-12) and CFLAGS to change the
+# flags (default -O2). Peak RSS needs GNU time in /usr/bin/time.
+#
+# License: Apache License v2.0 with LLVM Exceptions
+# Author: djolertrk
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 <build dir> [kovid-bench options]" >&2
+  exit 1
+fi
+
+BUILD_DIR=$1
+shift
+CC=${CC:-gcc-12}
+CFLAGS=${CFLAGS:--O2}
+LIB_DIR="$BUILD_DIR/lib"
+WORK_DIR=$(mktemp -d)
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+"$BUILD_DIR/bin/kovid-bench" "$@" -emit-c="$WORK_DIR/corpus.c"
+
+# Prints "<seconds> <peak RSS in KB>" for compiling the corpus with the given
+# extra flags into $WORK_DIR/out.o.
+measure() {
+  if [ -x /usr/bin/time ]; then
+    /usr/bin/time -f "%e %M" -o "$WORK_DIR/time" \
+      $CC $CFLAGS "$@" -c "$WORK_DIR/corpus.c" -o "$WORK_DIR/out.o" \
+      >/dev/null 2>&1
+    cat "$WORK_DIR/time"
+  else
+    start=$(date +%s.%N)
+    $CC $CFLAGS "$@" -c "$WORK_DIR/corpus.c" -o "$WORK_DIR/out.o" \
+      >/dev/null 2>&1
+    end=$(date +%s.%N)
+    echo "$(awk "BEGIN { print $end - $start }") -"
+  fi
+}
+
+text_size() {
+  size -A "$WORK_DIR/out.o" | awk '$1 == ".text" { print $2 }'
+}
+
+set -- baseline:
+for plugin in RenameCode DummyCodeInsertion InstructionObfuscation \
+              StringEncryption RemoveMetadataAndUnusedCode; do
+  so="$LIB_DIR/libKoviD${plugin}GCCPlugin.so"
+  if [ -f "$so" ]; then
+    set -- "$@" "$plugin:-fplugin=$so"
+    ALL="$ALL -fplugin=$so"
+  fi
+done
+[ -n "$ALL" ] && set -- "$@" "all:$ALL"
+# The same transforms from the combined plugin, in a single pass.
+so="$LIB_DIR/libKoviDObfuscationGCCPlugin.so"
+if [ -f "$so" ]; then
+  set -- "$@" "combined:-fplugin=$so -fplugin-arg-libKoviDObfuscationGCCPlugin-transforms=rename-code,dummy-code-insertion,instruction-obf,string-encryption,metadata-unused-code-removal"
+fi
+
+printf "%-30s %10s %12s %12s\n" config "wall(s)" "peakRSS(KB)" ".text(B)"
+for config in "$@"; do
+  name=${config%%:*}
+  flags=${config#*:}
+  result=$(measure $flags)
+  printf "%-30s %10s %12s %12s\n" "$name" ${result% *} ${result#* } \
+    "$(text_size)"
+done
@@ -0,0 +1,490 @@
+// Under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+// author: djolertrk
+
+//
+// kovid-bench: compile-time benchmark for the KoviD LLVM passes
+// -------------------------------------------------------------
+//
+// Generates synthetic modules of configurable size (functions, blocks, adds
+// and string globals, with debug info), or reads real ones, and runs every
+// KoviD pass on them alone, the five passes one after the other, and the
+// combined pass. For each run it reports the wall time of the pass pipeline,
+// the peak RSS of the process and the number of instructions added per
+// second.
+//
+// On Unix every measurement runs in a forked child, so that the peak RSS of
+// one configuration does not hide the one of the next.
+//
+// With -emit-c the synthetic module is written out as C instead, to be used
+// as the corpus for the GCC plugins (see gcc-bench.sh).
+//
+
+#include "DummyCodeInsertion.h"
+#include "InstructionObfuscation.h"
+#include "KoviDGrowthBudget.h"
+#include "KoviDObfuscation.h"
+#include "RemoveMetadataAndUnusedCode.h"
+#include "RenameCode.h"
+#include "StringEncryption.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+namespace {
+using namespace cl;
+OptionCategory KovidBenchCategory("Benchmark Options");
+
+static opt<unsigned> NumFunctions("functions",
+                                  desc("Number of functions to generate"),
+                                  init(1000), cat(KovidBenchCategory));
+static opt<unsigned> NumBlocks("blocks",
+                               desc("Number of basic blocks per function"),
+                               init(8), cat(KovidBenchCategory));
+static opt<unsigned> NumAdds("adds", desc("Number of adds per basic block"),
+                             init(16), cat(KovidBenchCategory));
+static opt<unsigned> NumStrings("strings",
+                                desc("Number of string globals to generate"),
+                                init(1000), cat(KovidBenchCategory));
+static opt<unsigned> StringLength("string-length",
+                                  desc("Length of each generated string"),
+                                  init(32), cat(KovidBenchCategory));
+static opt<bool> DebugInfo("debug-info",
+                           desc("Attach debug info to generated functions"),
+                           init(true), cat(KovidBenchCategory));
+static opt<unsigned> Repeat("repeat", desc("Number of runs per measurement"),
+                            init(3), cat(KovidBenchCategory));
+static list<std::string>
+    Only("only", CommaSeparated,
+         desc("Only run these configurations (rename-code, "
+              "dummy-code-insertion, instruction-obf, string-encryption, "
+              "metadata-unused-code-removal, separate, combined)"),
+         cat(KovidBenchCategory));
+static opt<bool> CSV("csv", desc("Print the results as CSV"), init(false),
+                     cat(KovidBenchCategory));
+static opt<std::string> EmitC("emit-c",
+                              desc("Write the synthetic module as C to the "
+                                   "given file and exit"),
+                              value_desc("file"), cat(KovidBenchCategory));
+static list<std::string> InputFiles(Positional,
+                                    desc("[<module.ll|module.bc> ...]"),
+                                    cat(KovidBenchCategory));
+
+/// One benchmarked pipeline.
+struct Config {
+  const char *Name;
+  void (*AddPasses)(ModulePassManager &MPM);
+};
+
+/// The outcome of the runs of one configuration on one module.
+struct Result {
+  double BestSeconds = 0;
+  double MeanSeconds = 0;
+  long PeakRSSKB = 0;
+  long InstrsAdded = 0;
+};
+} // namespace
+
+static void addRenameCode(ModulePassManager &MPM) {
+  MPM.addPass(createModuleToFunctionPassAdaptor(kovid::RenameCode()));
+}
+
+static void addDummyCodeInsertion(ModulePassManager &MPM) {
+  MPM.addPass(createModuleToFunctionPassAdaptor(kovid::DummyCodeInsertion()));
+}
+
+static void addInstructionObfuscation(ModulePassManager &MPM) {
+  // The same pipeline as the plugin registers.
+  MPM.addPass(RequireAnalysisPass<ProfileSummaryAnalysis, Module>());
+  MPM.addPass(
+      createModuleToFunctionPassAdaptor(kovid::InstructionObfuscationPass()));
+}
+
+static void addStringEncryption(ModulePassManager &MPM) {
+  MPM.addPass(kovid::StringEncryptionPass());
+}
+
+static void addRemoveMetadataAndUnusedCode(ModulePassManager &MPM) {
+  MPM.addPass(kovid::RemoveMetadataAndUnusedCodePass());
+}
+
+static void addSeparate(ModulePassManager &MPM) {
+  addRemoveMetadataAndUnusedCode(MPM);
+  addStringEncryption(MPM);
+  addRenameCode(MPM);
+  addInstructionObfuscation(MPM);
+  addDummyCodeInsertion(MPM);
+}
+
+static void addCombined(ModulePassManager &MPM) {
+  kovid::ObfuscationOptions Opts;
+  Opts.RenameCode = true;
+  Opts.DummyCodeInsertion = true;
+  Opts.InstructionObfuscation = true;
+  Opts.StringEncryption = true;
+  Opts.RemoveMetadataAndUnusedCode = true;
+  MPM.addPass(kovid::KoviDObfuscationPass(Opts));
+}
+
+static const Config Configs[] = {
+    {"rename-code", addRenameCode},
+    {"dummy-code-insertion", addDummyCodeInsertion},
+    {"instruction-obf", addInstructionObfuscation},
+    {"string-encryption", addStringEncryption},
+    {"metadata-unused-code-removal", addRemoveMetadataAndUnusedCode},
+    {"separate", addSeparate},
+    {"combined", addCombined},
+};
+
+/// Build a synthetic module. Every function is internal and takes two i32
+/// arguments; its blocks form a chain, each with NumAdds dependent adds.
+/// Every fourth function is never called, the others are called from the
+/// exported kovid_bench_entry, which also passes each string to puts.
+static std::unique_ptr<Module> generateModule(LLVMContext &Ctx) {
+  auto M = std::make_unique<Module>("kovid-bench", Ctx);
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+  Type *Int8PtrTy = Type::getInt8PtrTy(Ctx);
+  FunctionType *FTy = FunctionType::get(Int32Ty, {Int32Ty, Int32Ty}, false);
+
+  std::unique_ptr<DIBuilder> DIB;
+  DIFile *File = nullptr;
+  DISubroutineType *DITy = nullptr;
+  if (DebugInfo) {
+    DIB = std::make_unique<DIBuilder>(*M);
+    File = DIB->createFile("kovid-bench.c", ".");
+    DIB->createCompileUnit(dwarf::DW_LANG_C, File, "kovid-bench",
+                           /*isOptimized=*/false, "", 0);
+    DITy = DIB->createSubroutineType(DIB->getOrCreateTypeArray({}));
+    M->addModuleFlag(Module::Warning, "Debug Info Version",
+                     DEBUG_METADATA_VERSION);
+  }
+
+  unsigned Line = 1;
+  auto AttachDebugInfo = [&](Function *F, IRBuilder<> &Builder) {
+    if (!DIB)
+      return;
+    DISubprogram *SP = DIB->createFunction(
+        File, F->getName(), F->getName(), File, Line, DITy, Line,
+        DINode::FlagZero, DISubprogram::SPFlagDefinition);
+    F->setSubprogram(SP);
+    Builder.SetCurrentDebugLocation(DILocation::get(Ctx, Line++, 1, SP));
+  };
+
+  SmallVector<Function *, 0> Called;
+  for (unsigned i = 0; i < NumFunctions; ++i) {
+    Function *F = Function::Create(FTy, GlobalValue::InternalLinkage,
+                                   "bench_fn_" + Twine(i), *M);
+    if (i % 4 != 3)
+      Called.push_back(F);
+
+    IRBuilder<> Builder(Ctx);
+    SmallVector<BasicBlock *, 8> Blocks;
+    for (unsigned b = 0; b < std::max(1u, NumBlocks.getValue()); ++b)
+      Blocks.push_back(BasicBlock::Create(Ctx, "bb" + Twine(b), F));
+
+    Value *A = F->getArg(0), *B = F->getArg(1);
+    Value *Acc = A;
+    for (unsigned b = 0; b < Blocks.size(); ++b) {
+      Builder.SetInsertPoint(Blocks[b]);
+      if (b == 0)
+        AttachDebugInfo(F, Builder);
+      for (unsigned k = 0; k < NumAdds; ++k)
+        Acc = Builder.CreateAdd(Acc, k % 2 ? A : B, "acc");
+      if (b + 1 < Blocks.size())
+        Builder.CreateBr(Blocks[b + 1]);
+      else
+        Builder.CreateRet(Acc);
+    }
+  }
+
+  FunctionCallee Puts = M->getOrInsertFunction(
+      "puts", FunctionType::get(Int32Ty, {Int8PtrTy}, false));
+  Function *Entry =
+      Function::Create(FunctionType::get(Int32Ty, {Int32Ty}, false),
+                       GlobalValue::ExternalLinkage, "kovid_bench_entry", *M);
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Entry));
+  AttachDebugInfo(Entry, Builder);
+
+  Value *Sum = Entry->getArg(0);
+  for (Function *F : Called)
+    Sum = Builder.CreateCall(F, {Sum, Entry->getArg(0)});
+  for (unsigned i = 0; i < NumStrings; ++i) {
+    std::string Str = "kovid bench string " + std::to_string(i) + " ";
+    Str.resize(std::max<size_t>(StringLength, Str.size()), 'x');
+    Constant *Init = ConstantDataArray::getString(Ctx, Str);
+    auto *GV = new GlobalVariable(*M, Init->getType(), /*isConstant=*/true,
+                                  GlobalValue::PrivateLinkage, Init,
+                                  ".str." + Twine(i));
+    GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    Builder.CreateCall(Puts, Builder.CreatePointerCast(GV, Int8PtrTy));
+  }
+  Builder.CreateRet(Sum);
+
+  if (DIB)
+    DIB->finalize();
+  return M;
+}
+
+/// Write the same program generateModule builds as C, for the GCC plugins.
+static bool emitC(StringRef Path) {
+  std::error_code EC;
+  raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error() << "cannot open '" << Path << "': " << EC.message()
+                       << "\n";
+    return false;
+  }
+
+  OS << "/* Generated by kovid-bench. */\n#include <stdio.h>\n\n";
+  for (unsigned i = 0; i < NumStrings; ++i) {
+    std::string Str = "kovid bench string " + std::to_string(i) + " ";
+    Str.resize(std::max<size_t>(StringLength, Str.size()), 'x');
+    OS << "static const char str_" << i << "[] = \"" << Str << "\";\n";
+  }
+  for (unsigned i = 0; i < NumFunctions; ++i) {
+    OS << "\nstatic int bench_fn_" << i << "(int a, int b) {\n  int acc = a;\n";
+    for (unsigned b = 0; b < std::max(1u, NumBlocks.getValue()); ++b) {
+      // Keep the blocks apart, as in the IR version.
+      for (unsigned k = 0; k < NumAdds; ++k)
+        OS << "  acc = acc + " << (k % 2 ? 'a' : 'b') << ";\n";
+      OS << "  __asm__ volatile(\"\" ::: \"memory\");\n";
+    }
+    OS << "  return acc;\n}\n";
+  }
+  OS << "\nint kovid_bench_entry(int x) {\n  int sum = x;\n";
+  for (unsigned i = 0; i < NumFunctions; ++i)
+    if (i % 4 != 3)
+      OS << "  sum = bench_fn_" << i << "(sum, x);\n";
+  for (unsigned i = 0; i < NumStrings; ++i)
+    OS << "  puts(str_" << i << ");\n";
+  OS << "  return sum;\n}\n\nint main(int argc, char **argv) {\n"
+     << "  (void)argv;\n  return kovid_bench_entry(argc) == 0;\n}\n";
+  return true;
+}
+
+static long countInstructions(const Module &M) {
+  long Count = 0;
+  for (const Function &F : M)
+    Count += F.getInstructionCount();
+  return Count;
+}
+
+static long peakRSSKB() {
+#ifdef LLVM_ON_UNIX
+  struct rusage Usage;
+  getrusage(RUSAGE_SELF, &Usage);
+#ifdef __APPLE__
+  return Usage.ru_maxrss / 1024;
+#else
+  return Usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+/// Create (generate or parse) a fresh module and run \p C on it once.
+/// Returns the time the pipeline took and the number of instructions it
+/// added in \p Seconds and \p Added.
+static bool runOnce(const Config &C, StringRef Input, double &Seconds,
+                    long &Added) {
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M;
+  if (Input.empty()) {
+    M = generateModule(Ctx);
+  } else {
+    SMDiagnostic Err;
+    M = parseIRFile(Input, Err, Ctx);
+    if (!M) {
+      Err.print("kovid-bench", errs());
+      return false;
+    }
+  }
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB;
+  kovid::registerGrowthBudgetAnalysis(PB);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  // Every run builds a module at the same address, with the same name.
+  MPM.addPass(RequireAnalysisPass<kovid::GrowthBudgetAnalysis, Module>());
+  C.AddPasses(MPM);
+
+  long Before = countInstructions(*M);
+  auto Start = std::chrono::steady_clock::now();
+  MPM.run(*M, MAM);
+  auto End = std::chrono::steady_clock::now();
+  Seconds = std::chrono::duration<double>(End - Start).count();
+  Added = countInstructions(*M) - Before;
+  return true;
+}
+
+static bool runConfig(const Config &C, StringRef Input, Result &R) {
+  std::vector<double> Times;
+  for (unsigned i = 0; i < std::max(1u, Repeat.getValue()); ++i) {
+    double Seconds = 0;
+    long Added = 0;
+    if (!runOnce(C, Input, Seconds, Added))
+      return false;
+    Times.push_back(Seconds);
+    R.InstrsAdded = Added;
+  }
+  R.BestSeconds = *std::min_element(Times.begin(), Times.end());
+  double Sum = 0;
+  for (double T : Times)
+    Sum += T;
+  R.MeanSeconds = Sum / Times.size();
+  R.PeakRSSKB = peakRSSKB();
+  return true;
+}
+
+/// Run \p C in a child process where possible, so that its peak RSS is its
+/// own.
+static bool measure(const Config &C, StringRef Input, Result &R) {
+#ifdef LLVM_ON_UNIX
+  outs().flush();
+  errs().flush();
+  int Pipe[2];
+  if (pipe(Pipe) != 0)
+    return runConfig(C, Input, R);
+
+  pid_t Pid = fork();
+  if (Pid == 0) {
+    close(Pipe[0]);
+    Result Child;
+    bool OK = runConfig(C, Input, Child);
+    if (OK && write(Pipe[1], &Child, sizeof(Child)) != sizeof(Child))
+      OK = false;
+    close(Pipe[1]);
+    _exit(OK ? 0 : 1);
+  }
+  close(Pipe[1]);
+  if (Pid < 0) {
+    close(Pipe[0]);
+    return runConfig(C, Input, R);
+  }
+
+  bool OK = read(Pipe[0], &R, sizeof(R)) == sizeof(R);
+  close(Pipe[0]);
+  int Status = 0;
+  waitpid(Pid, &Status, 0);
+  return OK && WIFEXITED(Status) && WEXITSTATUS(Status) == 0;
+#else
+  return runConfig(C, Input, R);
+#endif
+}
+
+static void printResult(StringRef ModuleName, const Config &C,
+                        const Result &R) {
+  double Rate = R.BestSeconds > 0 ? R.InstrsAdded / R.BestSeconds : 0;
+  if (CSV) {
+    outs() << ModuleName << "," << C.Name << ","
+           << format("%.6f,%.6f", R.BestSeconds, R.MeanSeconds) << ","
+           << R.PeakRSSKB << "," << R.InstrsAdded << ","
+           << format("%.0f", Rate) << "\n";
+    return;
+  }
+  outs() << format("%-30s %10.2f %10.2f %12.1f %12ld %14.0f\n", C.Name,
+                   R.BestSeconds * 1000, R.MeanSeconds * 1000,
+                   R.PeakRSSKB / 1024.0, R.InstrsAdded, Rate);
+}
+
+int main(int argc, char const *argv[]) {
+  cl::ParseCommandLineOptions(
+      argc, argv,
+      "=== kovid bench ===\n\n"
+      "  Measures the compile time, peak memory and instruction growth of\n"
+      "  the KoviD passes on synthetic or given modules.\n");
+
+  if (!EmitC.empty())
+    return emitC(EmitC) ? 0 : 1;
+
+  for (const std::string &Name : Only) {
+    if (std::none_of(std::begin(Configs), std::end(Configs),
+                     [&](const Config &C) { return Name == C.Name; })) {
+      WithColor::error() << "unknown configuration '" << Name << "'\n";
+      return 1;
+    }
+  }
+
+  std::vector<std::string> Inputs(InputFiles.begin(), InputFiles.end());
+  if (Inputs.empty())
+    Inputs.push_back("");
+
+  if (CSV)
+    outs() << "module,config,best_s,mean_s,peak_rss_kb,instrs_added,"
+              "instrs_added_per_s\n";
+
+  bool Failed = false;
+  for (const std::string &Input : Inputs) {
+    std::string Name =
+        Input.empty() ? ("synthetic functions=" + std::to_string(NumFunctions) +
+                         " blocks=" + std::to_string(NumBlocks) +
+                         " adds=" + std::to_string(NumAdds) +
+                         " strings=" + std::to_string(NumStrings))
+                      : Input;
+    if (!CSV) {
+      outs() << "Module: " << Name << " (best of " << Repeat << ")\n";
+      const char *Columns[] = {"config",       "best(ms)",     "mean(ms)",
+                               "peakRSS(MB)", "instrs added", "added/s"};
+      outs() << format("%-30s %10s %10s %12s %12s %14s\n", Columns[0],
+                       Columns[1], Columns[2], Columns[3], Columns[4],
+                       Columns[5]);
+    }
+    for (const Config &C : Configs) {
+      if (!Only.empty() && std::find(Only.begin(), Only.end(), C.Name) ==
+                               Only.end())
+        continue;
+      Result R;
+      if (!measure(C, Input, R)) {
+        WithColor::error() << "configuration '" << C.Name << "' failed on "
+                           << Name << "\n";
+        Failed = true;
+        continue;
+      }
+      printResult(Name, C, R);
+    }
+    if (!CSV)
+      outs() << "\n";
+  }
+
+  return Failed ? 1 : 0;
+}
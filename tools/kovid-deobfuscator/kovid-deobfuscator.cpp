@@ -4,11 +4,28 @@
 
 // author: djolertrk
 
+#include "KoviDCrypto.h"
+#include "KoviDRenameMap.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/Binary.h"
+#include "llvm/Object/ObjectFile.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Parallel.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/WithColor.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstring>
 #include <cstdlib>
 #include <string>
+#include <vector>
 
 using namespace llvm;
 
@@ -25,32 +42,382 @@ static opt<std::string>
               value_desc("key"), cl::ValueRequired,
               cat(KovidDeobfuscatorCategory));
 
-static opt<std::string> EncryptedFunctionName(Positional,
-                                              desc("<encrypted function name>"),
-                                              init(""),
-                                              cat(KovidDeobfuscatorCategory));
+// --binary reads raw ciphertext, as emitted by the StringEncryption pass with
+// -kovid-string-encoding=binary, from the file named by the positional
+// argument ("-" for stdin).
+static opt<bool>
+    Binary("binary",
+           desc("Decrypt the raw binary ciphertext stored in the given file"),
+           init(false), cat(KovidDeobfuscatorCategory));
+
+// --batch treats the positional arguments as object files, archives or
+// binaries ("-" for a list of names on stdin) and prints the mapping of every
+// renamed symbol found in them.
+static opt<bool>
+    Batch("batch",
+          desc("Decrypt every renamed symbol of the given object files, "
+               "archives or binaries (\"-\" reads names from stdin)"),
+          init(false), cat(KovidDeobfuscatorCategory));
+
+static opt<unsigned>
+    Threads("j",
+            desc("Number of threads used in --batch mode (0 for all cores)"),
+            value_desc("N"), init(0), cat(KovidDeobfuscatorCategory));
+
+static opt<std::string> OutputFilename("o",
+                                       desc("Write the --batch mapping to "
+                                            "<file> instead of stdout"),
+                                       value_desc("file"), init("-"),
+                                       cat(KovidDeobfuscatorCategory));
+
+// --filter copies stdin, or the given files, to stdout with every renamed
+// function replaced by its original name, like c++filt. It is also the
+// default when no positional argument is given.
+static opt<bool>
+    Filter("filter",
+           desc("Replace renamed functions in the text read from stdin (or "
+                "the given files) and write it to stdout"),
+           init(false), cat(KovidDeobfuscatorCategory));
+
+// --map loads the sidecar files written with -kovid-rename-map, which are
+// the only way back from compact names.
+static list<std::string>
+    MapFiles("map",
+             desc("Look names up in the given rename map file (can be "
+                  "repeated)"),
+             value_desc("file"), cat(KovidDeobfuscatorCategory));
+
+static list<std::string> Inputs(Positional,
+                                desc("<encrypted function name | file...>"),
+                                cat(KovidDeobfuscatorCategory));
 } // namespace
 
 /// Decrypt a hex-encoded string produced by encryptFunctionName from the
-/// RenameCode plugin.
-static std::string decryptFunctionName(const std::string &hexStr,
-                                       const std::string &key) {
-  std::string xored;
-  // First, convert the hex string back into the binary (XORed) form.
-  for (size_t i = 0; i < hexStr.size(); i += 2) {
-    std::string byteStr = hexStr.substr(i, 2);
-    char byte = static_cast<char>(std::stoi(byteStr, nullptr, 16));
-    xored.push_back(byte);
-  }
-  // Then, reverse the XOR operation to recover the original name.
-  std::string original;
-  original.reserve(xored.size());
-  for (size_t i = 0; i < xored.size(); ++i) {
-    original.push_back(xored[i] ^ key[i % key.size()]);
-  }
+/// RenameCode plugin. Returns false if \p hexStr is not valid hex.
+static bool decryptFunctionName(StringRef hexStr, const std::string &key,
+                                std::string &original) {
+  return kovid::crypto::decryptName(hexStr.data(), hexStr.size(),
+                                    kovid::crypto::getCipher(key),
+                                    original);
+}
+
+/// Decrypt raw ciphertext produced by the StringEncryption plugin in binary
+/// mode. The encrypted terminator, if any, is dropped.
+static std::string decryptBytes(StringRef bytes, const std::string &key) {
+  std::string original = bytes.str();
+  kovid::crypto::getCipher(key).apply(original);
+  while (!original.empty() && original.back() == '\0')
+    original.pop_back();
   return original;
 }
 
+/// A symbol name that looks like one produced by RenameCode ("_<hex>").
+static bool isRenamedSymbol(StringRef Name) {
+  return Name.size() > 2 && Name[0] == '_' && Name.size() % 2 == 1 &&
+         all_of(Name.drop_front(), isHexDigit);
+}
+
+/// Whether a decryption is a plausible symbol name rather than the result of
+/// decrypting an unrelated hex-looking symbol or using the wrong key.
+static bool isPlausibleName(StringRef Name) {
+  return !Name.empty() && !isDigit(Name[0]) && all_of(Name, [](char C) {
+    return isAlnum(C) || C == '_' || C == '$' || C == '.';
+  });
+}
+
+/// The loaded rename maps; the buffers are memory mapped.
+static std::vector<std::unique_ptr<MemoryBuffer>> MapBuffers;
+static std::vector<kovid::renamemap::Reader> Maps;
+
+static bool loadMaps() {
+  for (const std::string &Path : MapFiles) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr = MemoryBuffer::getFile(
+        Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (std::error_code EC = BufOrErr.getError()) {
+      WithColor::error() << "cannot read '" << Path << "': " << EC.message()
+                         << "\n";
+      return false;
+    }
+    kovid::renamemap::Reader Map;
+    if (!Map.init((*BufOrErr)->getBufferStart(), (*BufOrErr)->getBufferSize())) {
+      WithColor::error() << Path << ": not a rename map file\n";
+      return false;
+    }
+    // Without a key, main reports the missing --crypto-key.
+    if (!CryptoKey.empty() && !Map.hasKey(CryptoKey)) {
+      WithColor::error() << Path
+                         << ": the map was written with another crypto key\n";
+      return false;
+    }
+    Maps.push_back(Map);
+    MapBuffers.push_back(std::move(*BufOrErr));
+  }
+  return true;
+}
+
+static bool isCompactSymbol(StringRef Name) {
+  return !Maps.empty() &&
+         kovid::renamemap::isCompactName(Name.data(), Name.size());
+}
+
+/// Recover the original name of \p Symbol, "_<hex>" or a compact name, from
+/// the rename maps or by decrypting it.
+static bool resolveName(StringRef Symbol, std::string &Original) {
+  for (const kovid::renamemap::Reader &Map : Maps)
+    if (Map.lookup(Symbol.data(), Symbol.size(), CryptoKey, Original))
+      return true;
+  return Symbol.startswith("_") &&
+         decryptFunctionName(Symbol.drop_front(), CryptoKey, Original) &&
+         isPlausibleName(Original);
+}
+
+static void collectSymbols(const object::ObjectFile &Obj,
+                           std::vector<std::string> &Names) {
+  for (const object::SymbolRef &Sym : Obj.symbols()) {
+    Expected<StringRef> NameOrErr = Sym.getName();
+    if (!NameOrErr) {
+      consumeError(NameOrErr.takeError());
+      continue;
+    }
+    StringRef Name = *NameOrErr;
+    // Mach-O prepends another underscore to every C symbol.
+    if (Obj.isMachO())
+      Name.consume_front("_");
+    if (isRenamedSymbol(Name) || isCompactSymbol(Name))
+      Names.push_back(Name.str());
+  }
+}
+
+/// Append the renamed symbols of \p Path to \p Names. The file is memory
+/// mapped; archives are searched member by member.
+static bool collectSymbols(StringRef Path, std::vector<std::string> &Names) {
+  auto reportError = [&](Error E) {
+    WithColor::error() << Path << ": " << toString(std::move(E)) << "\n";
+    return false;
+  };
+
+  Expected<object::OwningBinary<object::Binary>> BinOrErr =
+      object::createBinary(Path);
+  if (!BinOrErr)
+    return reportError(BinOrErr.takeError());
+  object::Binary &Bin = *BinOrErr->getBinary();
+
+  if (auto *Obj = dyn_cast<object::ObjectFile>(&Bin)) {
+    collectSymbols(*Obj, Names);
+    return true;
+  }
+
+  if (auto *Ar = dyn_cast<object::Archive>(&Bin)) {
+    Error Err = Error::success();
+    for (const object::Archive::Child &C : Ar->children(Err)) {
+      Expected<std::unique_ptr<object::Binary>> ChildOrErr = C.getAsBinary();
+      if (!ChildOrErr) {
+        consumeError(ChildOrErr.takeError());
+        continue;
+      }
+      if (auto *Obj = dyn_cast<object::ObjectFile>(ChildOrErr->get()))
+        collectSymbols(*Obj, Names);
+    }
+    if (Err)
+      return reportError(std::move(Err));
+    return true;
+  }
+
+  WithColor::error() << Path << ": unsupported file format\n";
+  return false;
+}
+
+/// Append every name listed on stdin, one or more per line; the leading
+/// underscore is optional.
+static bool collectStdinNames(std::vector<std::string> &Names) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr = MemoryBuffer::getSTDIN();
+  if (std::error_code EC = BufOrErr.getError()) {
+    WithColor::error() << "cannot read stdin: " << EC.message() << "\n";
+    return false;
+  }
+
+  SmallVector<StringRef, 0> Tokens;
+  SplitString((*BufOrErr)->getBuffer(), Tokens);
+  for (StringRef Token : Tokens) {
+    std::string Name = Token.startswith("_") ? Token.str() : "_" + Token.str();
+    if (isRenamedSymbol(Name) || isCompactSymbol(Name))
+      Names.push_back(std::move(Name));
+  }
+  return true;
+}
+
+/// Decrypt all renamed symbols of the positional inputs, in parallel, and
+/// write one "<symbol> <original name>" line for each of them. Without
+/// inputs, the contents of the rename maps are written.
+static int runBatch() {
+  std::vector<std::string> Names;
+  bool Ok = true;
+  for (const std::string &Input : Inputs)
+    Ok &= Input == "-" ? collectStdinNames(Names)
+                       : collectSymbols(Input, Names);
+  if (Inputs.empty())
+    for (const kovid::renamemap::Reader &Map : Maps)
+      for (uint32_t I = 0; I < Map.size(); ++I)
+        Names.push_back(Map.name(I));
+
+  llvm::sort(Names);
+  Names.erase(std::unique(Names.begin(), Names.end()), Names.end());
+
+  std::vector<std::string> Decrypted(Names.size());
+  std::vector<char> Valid(Names.size());
+  auto decryptOne = [&](size_t I) {
+    Valid[I] = resolveName(Names[I], Decrypted[I]);
+  };
+  parallel::strategy = hardware_concurrency(Threads);
+#if LLVM_VERSION_MAJOR >= 15
+  parallelFor(0, Names.size(), decryptOne);
+#else
+  parallelForEachN(0, Names.size(), decryptOne);
+#endif
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC, sys::fs::OF_Text);
+  if (EC) {
+    WithColor::error() << "cannot open '" << OutputFilename
+                       << "': " << EC.message() << "\n";
+    return 1;
+  }
+
+  size_t NumMapped = 0;
+  for (size_t I = 0; I < Names.size(); ++I) {
+    if (!Valid[I])
+      continue;
+    Out.os() << Names[I] << ' ' << Decrypted[I] << '\n';
+    ++NumMapped;
+  }
+  Out.keep();
+
+  WithColor::note() << "decrypted " << NumMapped << " of " << Names.size()
+                    << " candidate symbols\n";
+  return Ok ? 0 : 1;
+}
+
+namespace {
+/// Decryptions of the names seen by the filter. The same few functions show up
+/// over and over in traces, so most tokens are served from here. An empty
+/// value means the token is not a renamed function. The cache is dropped when
+/// it grows past MaxEntries, to keep memory bounded on huge inputs.
+class NameCache {
+  static constexpr unsigned MaxEntries = 1 << 16;
+  StringMap<std::string> Names;
+
+public:
+  StringRef lookup(StringRef Symbol) {
+    auto It = Names.find(Symbol);
+    if (It != Names.end())
+      return It->second;
+
+    if (Names.size() >= MaxEntries)
+      Names.clear();
+    std::string Name;
+    if (!resolveName(Symbol, Name))
+      Name.clear();
+    return Names.try_emplace(Symbol, std::move(Name)).first->second;
+  }
+};
+} // namespace
+
+/// Characters that make up a symbol, so that a renamed token is only
+/// replaced when it is a whole symbol. '.' is not one of them, so suffixes
+/// such as ".cold" or ".llvm.1234" are kept after the original name.
+static bool isSymbolChar(char C) { return isAlnum(C) || C == '_' || C == '$'; }
+
+/// Write \p Text to \p OS with every renamed function replaced.
+static void filterText(StringRef Text, raw_ostream &OS, NameCache &Cache) {
+  size_t Last = 0;
+  for (size_t I = Text.find('_'); I != StringRef::npos;
+       I = Text.find('_', I + 1)) {
+    if (I > 0 && isSymbolChar(Text[I - 1]))
+      continue;
+    // Compact names are "_k" followed by hex digits.
+    size_t Start = I + 1;
+    if (!Maps.empty() && Start < Text.size() && Text[Start] == 'k')
+      ++Start;
+    size_t End = Start;
+    while (End < Text.size() && isHexDigit(Text[End]))
+      ++End;
+    size_t Len = End - Start;
+    if (Len < 2 || Len % 2 != 0 ||
+        (End < Text.size() && isSymbolChar(Text[End]))) {
+      I = End - 1;
+      continue;
+    }
+    StringRef Name = Cache.lookup(Text.slice(I, End));
+    if (!Name.empty()) {
+      OS << Text.slice(Last, I) << Name;
+      Last = End;
+    }
+    I = End - 1;
+  }
+  OS << Text.substr(Last);
+}
+
+/// Filter \p FD into stdout. The input is processed in chunks of whole
+/// lines; a line longer than MaxLine is split.
+static bool filterFile(sys::fs::file_t FD, StringRef Name, NameCache &Cache) {
+  constexpr size_t MaxLine = 16 << 20;
+  std::vector<char> Buf(64 << 10);
+  size_t Pending = 0;
+  for (;;) {
+    Expected<size_t> ReadOrErr = sys::fs::readNativeFile(
+        FD, MutableArrayRef<char>(Buf).drop_front(Pending));
+    if (!ReadOrErr) {
+      WithColor::error() << Name << ": " << toString(ReadOrErr.takeError())
+                         << "\n";
+      return false;
+    }
+    if (*ReadOrErr == 0) {
+      filterText(StringRef(Buf.data(), Pending), outs(), Cache);
+      return true;
+    }
+
+    StringRef Data(Buf.data(), Pending + *ReadOrErr);
+    size_t Split = Data.rfind('\n');
+    if (Split == StringRef::npos) {
+      Pending = Data.size();
+      if (Pending < Buf.size())
+        continue;
+      if (Buf.size() < MaxLine) {
+        Buf.resize(Buf.size() * 2);
+        continue;
+      }
+      Split = Data.size() - 1;
+    }
+    filterText(Data.take_front(Split + 1), outs(), Cache);
+    Pending = Data.size() - Split - 1;
+    std::memmove(Buf.data(), Buf.data() + Split + 1, Pending);
+  }
+}
+
+static int runFilter() {
+  NameCache Cache;
+  if (Inputs.empty())
+    return filterFile(sys::fs::getStdinHandle(), "<stdin>", Cache) ? 0 : 1;
+
+  bool Ok = true;
+  for (const std::string &Input : Inputs) {
+    if (Input == "-") {
+      Ok &= filterFile(sys::fs::getStdinHandle(), "<stdin>", Cache);
+      continue;
+    }
+    Expected<sys::fs::file_t> FDOrErr = sys::fs::openNativeFileForRead(Input);
+    if (!FDOrErr) {
+      WithColor::error() << Input << ": " << toString(FDOrErr.takeError())
+                         << "\n";
+      Ok = false;
+      continue;
+    }
+    Ok &= filterFile(*FDOrErr, Input, Cache);
+    sys::fs::closeFile(*FDOrErr);
+  }
+  return Ok ? 0 : 1;
+}
+
 int main(int argc, char const *argv[]) {
   // Parse command-line options.
   HideUnrelatedOptions({&KovidDeobfuscatorCategory});
@@ -60,17 +427,55 @@ int main(int argc, char const *argv[]) {
     return 0;
   }
 
+  if (!loadMaps())
+    return 1;
+
+  if (!CryptoKey.empty() && (Filter || (Inputs.empty() && !Batch && !Binary)))
+    return runFilter();
+
   // Validate that both the crypto key and encrypted function name are provided.
-  if (CryptoKey.empty() || EncryptedFunctionName.empty()) {
+  if (CryptoKey.empty() || (Inputs.empty() && !(Batch && !Maps.empty()))) {
     llvm::WithColor::error()
         << "both --crypto-key and an encrypted function name must be "
            "provided.\n";
     return 1;
   }
 
-  // Perform decryption.
-  std::string decryptedName =
-      decryptFunctionName(EncryptedFunctionName, CryptoKey);
+  if (Batch)
+    return runBatch();
+
+  if (Inputs.size() != 1) {
+    llvm::WithColor::error()
+        << "only one name can be decrypted at a time; use --batch for more.\n";
+    return 1;
+  }
+  const std::string &Input = Inputs.front();
+
+  if (Binary) {
+    ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+        MemoryBuffer::getFileOrSTDIN(Input);
+    if (std::error_code EC = BufOrErr.getError()) {
+      llvm::WithColor::error()
+          << "cannot read '" << Input << "': " << EC.message() << "\n";
+      return 1;
+    }
+    outs() << "Decrypted string: "
+           << decryptBytes((*BufOrErr)->getBuffer(), CryptoKey) << "\n";
+    return 0;
+  }
+
+  // Perform decryption. The leading underscore of the symbol is optional.
+  std::string decryptedName;
+  bool Found = false;
+  for (const kovid::renamemap::Reader &Map : Maps)
+    if ((Found = Map.lookup(Input.data(), Input.size(), CryptoKey,
+                            decryptedName)))
+      break;
+  if (!Found && !decryptFunctionName(StringRef(Input).ltrim('_'), CryptoKey,
+                                     decryptedName)) {
+    llvm::WithColor::error() << "'" << Input << "' is not a hex string.\n";
+    return 1;
+  }
   outs() << "Decrypted function name: " << decryptedName << "\n";
 
   return 0;
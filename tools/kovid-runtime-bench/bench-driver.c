@@ -0,0 +1,105 @@
+/*
+ * KoviD Runtime Benchmark Driver
+ * ------------------------------
+ *
+ * Runs the kernel it is linked with and prints the cycles and instructions
+ * retired (through perf_event_open, where available) and the wall time of
+ * the measured run, as key=value pairs on one line:
+ *
+ *   cycles=... instructions=... ns=... checksum=...
+ *
+ * Counters that cannot be read are printed as "-". The checksum lets the
+ * harness check that obfuscation did not change what the kernel computes.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "kernel.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int open_counter(uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void start_counter(int fd) {
+  if (fd < 0)
+    return;
+  ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+static void print_counter(const char *name, int fd) {
+  uint64_t value;
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &value, sizeof(value)) == sizeof(value)) {
+      printf("%s=%llu ", name, (unsigned long long)value);
+      return;
+    }
+  }
+  printf("%s=- ", name);
+}
+#else
+static int open_counter(unsigned long config) {
+  (void)config;
+  return -1;
+}
+static void start_counter(int fd) { (void)fd; }
+static void print_counter(const char *name, int fd) {
+  (void)fd;
+  printf("%s=- ", name);
+}
+#endif
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  unsigned iterations = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 10) : 100;
+
+  /* Warm up caches (and decrypt strings, in lazy mode) outside of the
+   * measured run. */
+  unsigned long checksum = kernel_run(1);
+
+#if defined(__linux__)
+  int cycles = open_counter(PERF_COUNT_HW_CPU_CYCLES);
+  int instructions = open_counter(PERF_COUNT_HW_INSTRUCTIONS);
+#else
+  int cycles = open_counter(0);
+  int instructions = open_counter(1);
+#endif
+
+  start_counter(cycles);
+  start_counter(instructions);
+  uint64_t start = now_ns();
+  checksum += kernel_run(iterations);
+  uint64_t end = now_ns();
+  print_counter("cycles", cycles);
+  print_counter("instructions", instructions);
+  printf("ns=%llu checksum=%lu\n", (unsigned long long)(end - start),
+         checksum);
+  return 0;
+}
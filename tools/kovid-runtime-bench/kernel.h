@@ -0,0 +1,17 @@
+/*
+ * KoviD Runtime Benchmark Kernels
+ * -------------------------------
+ *
+ * Every kernel in kernels/ defines kernel_run, which does the kernel's work
+ * the given number of times and returns a checksum of the results.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#ifndef KOVID_RUNTIME_BENCH_KERNEL_H
+#define KOVID_RUNTIME_BENCH_KERNEL_H
+
+unsigned long kernel_run(unsigned iterations);
+
+#endif /* KOVID_RUNTIME_BENCH_KERNEL_H */
@@ -0,0 +1,35 @@
+/*
+ * Call-heavy code: recursion, many small functions and indirect calls
+ * through a table, so that per-function costs such as the dummy code in
+ * every prologue dominate.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "../kernel.h"
+
+static unsigned fib(unsigned n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+static unsigned op_add(unsigned x) { return x + 3; }
+static unsigned op_mul(unsigned x) { return x * 5; }
+static unsigned op_xor(unsigned x) { return x ^ 0x55u; }
+static unsigned op_rot(unsigned x) { return (x << 7) | (x >> 25); }
+
+static unsigned (*const ops[])(unsigned) = {op_add, op_mul, op_xor, op_rot};
+
+__attribute__((noinline)) static unsigned apply(unsigned x, unsigned i) {
+  return ops[i & 3](x);
+}
+
+unsigned long kernel_run(unsigned iterations) {
+  unsigned long checksum = 0;
+  for (unsigned it = 0; it < iterations; ++it) {
+    checksum += fib(18);
+    unsigned x = it;
+    for (unsigned i = 0; i < 4096; ++i)
+      x = apply(x, i);
+    checksum += x;
+  }
+  return checksum;
+}
@@ -0,0 +1,53 @@
+/*
+ * Tight integer loops: element-wise adds and reductions that the loop
+ * vectorizer handles in the plain build, and a serial hash loop that it
+ * does not.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "../kernel.h"
+
+#define N 4096
+
+static int a[N], b[N], c[N];
+
+static void init_arrays(void) {
+  for (int i = 0; i < N; ++i) {
+    a[i] = i * 7;
+    b[i] = N - i;
+  }
+}
+
+static void add_arrays(int *restrict dst, const int *restrict x,
+                       const int *restrict y, int n) {
+  for (int i = 0; i < n; ++i)
+    dst[i] = x[i] + y[i];
+}
+
+static int sum_array(const int *x, int n) {
+  int sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += x[i];
+  return sum;
+}
+
+static unsigned hash_array(const int *x, int n) {
+  unsigned h = 2166136261u;
+  for (int i = 0; i < n; ++i)
+    h = (h ^ (unsigned)x[i]) * 16777619u;
+  return h;
+}
+
+unsigned long kernel_run(unsigned iterations) {
+  unsigned long checksum = 0;
+  init_arrays();
+  for (unsigned it = 0; it < iterations; ++it) {
+    add_arrays(c, a, b, N);
+    checksum += (unsigned)sum_array(c, N);
+    checksum += hash_array(c, N);
+    a[it % N] += 1;
+  }
+  return checksum;
+}
@@ -0,0 +1,63 @@
+/*
+ * String-heavy parsing: splits configuration records into key/value pairs,
+ * looks the keys up in a table of string literals and parses the numbers.
+ *
+ * License: Apache License v2.0 with LLVM Exceptions
+ * Author: djolertrk
+ */
+
+#include "../kernel.h"
+
+#include <string.h>
+
+static const char *records[] = {
+    "name=server;port=8080;threads=16;timeout=30;retries=3",
+    "name=client;port=9090;threads=4;timeout=10;retries=5",
+    "name=proxy;port=3128;threads=32;timeout=60;retries=1",
+    "name=cache;port=6379;threads=8;timeout=5;retries=10",
+};
+
+static const char *keys[] = {"name", "port", "threads", "timeout", "retries"};
+
+static int lookup_key(const char *key, size_t len) {
+  for (unsigned i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+    if (strlen(keys[i]) == len && !memcmp(keys[i], key, len))
+      return (int)i;
+  return -1;
+}
+
+static unsigned long parse_number(const char *s, size_t len) {
+  unsigned long value = 0;
+  for (size_t i = 0; i < len && s[i] >= '0' && s[i] <= '9'; ++i)
+    value = value * 10 + (unsigned long)(s[i] - '0');
+  return value;
+}
+
+static unsigned long parse_record(const char *record) {
+  unsigned long checksum = 0;
+  const char *p = record;
+  while (*p) {
+    const char *eq = strchr(p, '=');
+    if (!eq)
+      break;
+    const char *end = strchr(eq, ';');
+    if (!end)
+      end = eq + strlen(eq);
+
+    int key = lookup_key(p, (size_t)(eq - p));
+    if (key == 0)
+      checksum += (unsigned long)(end - eq - 1);
+    else if (key > 0)
+      checksum += (unsigned long)key * parse_number(eq + 1, end - eq - 1);
+
+    p = *end ? end + 1 : end;
+  }
+  return checksum;
+}
+
+unsigned long kernel_run(unsigned iterations) {
+  unsigned long checksum = 0;
+  for (unsigned it = 0; it < iterations * 256; ++it)
+    checksum += parse_record(records[it % 4]);
+  return checksum;
+}
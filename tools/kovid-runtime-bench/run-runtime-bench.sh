@@ -0,0 +1,164 @@
+#!/bin/sh
+#
+# Runtime-overhead benchmark for the KoviD LLVM passes.
+#
+# Builds every kernel in kernels/ at each optimization level, once plainly
+# and once per transform of the combined KoviD plugin (and with all of them),
+# then runs each binary and reports:
+#
+#   - cycles and instructions retired of the measured run (perf counters,
+#     "-" where perf events are not available) and its wall time,
+#   - the .text and .data size of the kernel object and the .text growth
+#     over the plain build,
+#   - the largest stack frame of the kernel (-fstack-usage; the per-function
+#     numbers are kept in <output dir>/stack/),
+#   - the number of loops the loop vectorizer vectorized.
+#
+# Only the classic arithmetic obfuscation puts volatile loads inside loop
+# bodies, so it is the only transform that is expected to stop
+# vectorization. Its MBA mode (instruction-obf-mba) and its run at the
+# optimizer last EP (instruction-obf-late) do not, and the dummy code is in
+# the entry block only. A vectorized loop lost by any other
+# configuration, or a checksum that differs from the plain build, is
+# reported and makes the script fail.
+#
+# Usage:
+#   run-runtime-bench.sh <build dir> [output dir]
+#
+# Environment: CC (a clang matching the LLVM the plugins were built with,
+# default clang), OPT_LEVELS (default "-O0 -O2 -O3"), ITERATIONS (default
+# 200), CONFIGS (a subset of the configurations, always starting with
+# plain).
+#
+# License: Apache License v2.0 with LLVM Exceptions
+# Author: djolertrk
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "Usage: $0 <build dir> [output dir]" >&2
+  exit 1
+fi
+
+SRC_DIR=$(cd "$(dirname "$0")" && pwd)
+BUILD_DIR=$(cd "$1" && pwd)
+OUT_DIR=${2:-$BUILD_DIR/kovid-runtime-bench}
+CC=${CC:-clang}
+OPT_LEVELS=${OPT_LEVELS:--O0 -O2 -O3}
+ITERATIONS=${ITERATIONS:-200}
+
+PLUGIN="$BUILD_DIR/lib/libKoviDObfuscationLLVMPlugin.so"
+RUNTIME="$BUILD_DIR/lib/libKoviDStringEncryptionRuntime.a"
+CONFIGS=${CONFIGS:-plain rename-code dummy-code-insertion instruction-obf \
+instruction-obf-mba instruction-obf-late string-encryption metadata-unused-code-removal all}
+ALL="rename-code,dummy-code-insertion,instruction-obf,string-encryption,\
+metadata-unused-code-removal"
+
+mkdir -p "$OUT_DIR/stack" "$OUT_DIR/obj"
+RESULTS="$OUT_DIR/results.csv"
+echo "kernel,opt,config,cycles,instructions,ns,text,data,text_growth_pct,max_stack,vectorized_loops,note" \
+  > "$RESULTS"
+
+# The flags that select a configuration.
+config_flags() {
+  case $1 in
+  plain) ;;
+  instruction-obf-mba)
+    echo "-Xclang -load -Xclang $PLUGIN -fpass-plugin=$PLUGIN" \
+      "-mllvm -kovid-transforms=instruction-obf -mllvm -kovid-instr-obf-mode=mba"
+    ;;
+  instruction-obf-late)
+    echo "-Xclang -load -Xclang $PLUGIN -fpass-plugin=$PLUGIN" \
+      "-mllvm -kovid-transforms=instruction-obf" \
+      "-mllvm -kovid-extension-point=optimizer-last"
+    ;;
+  all)
+    echo "-Xclang -load -Xclang $PLUGIN -fpass-plugin=$PLUGIN" \
+      "-mllvm -kovid-transforms=$ALL -mllvm -kovid-string-decryption=lazy"
+    ;;
+  *)
+    echo "-Xclang -load -Xclang $PLUGIN -fpass-plugin=$PLUGIN" \
+      "-mllvm -kovid-transforms=$1 -mllvm -kovid-string-decryption=lazy"
+    ;;
+  esac
+}
+
+section_size() {
+  size -A "$1" | awk -v s="$2" '$1 == s { print $2; found = 1 }
+                                END { if (!found) print 0 }'
+}
+
+counter() {
+  echo "$2" | tr ' ' '\n' | awk -F= -v k="$1" '$1 == k { print $2 }'
+}
+
+FAILED=0
+printf "%-14s %-4s %-30s %14s %14s %10s %8s %8s %7s %6s %4s\n" kernel opt \
+  config cycles instructions "time(ms)" .text .data "growth" stack vec
+for kernel_src in "$SRC_DIR"/kernels/*.c; do
+  kernel=$(basename "$kernel_src" .c)
+  for opt in $OPT_LEVELS; do
+    driver="$OUT_DIR/obj/driver$opt.o"
+    [ -f "$driver" ] || $CC $opt -c "$SRC_DIR/bench-driver.c" -o "$driver"
+
+    plain_text=
+    plain_vec=
+    plain_sum=
+    for config in $CONFIGS; do
+      name="$kernel$opt-$config"
+      obj="$OUT_DIR/obj/$name.o"
+      # shellcheck disable=SC2046
+      if ! $CC $opt -fstack-usage -Rpass=loop-vectorize -I"$SRC_DIR" \
+        $(config_flags "$config") -c "$kernel_src" -o "$obj" \
+        2> "$OUT_DIR/obj/$name.remarks"; then
+        cat "$OUT_DIR/obj/$name.remarks" >&2
+        exit 1
+      fi
+      mv "${obj%.o}.su" "$OUT_DIR/stack/$name.su"
+      $CC "$obj" "$driver" "$RUNTIME" -o "$OUT_DIR/obj/$name"
+
+      run=$("$OUT_DIR/obj/$name" "$ITERATIONS")
+      cycles=$(counter cycles "$run")
+      instructions=$(counter instructions "$run")
+      ns=$(counter ns "$run")
+      sum=$(counter checksum "$run")
+      text=$(section_size "$obj" .text)
+      data=$(section_size "$obj" .data)
+      stack=$(awk -F'\t' '$2 > max { max = $2 } END { print max + 0 }' \
+        "$OUT_DIR/stack/$name.su")
+      vec=$(grep -c "vectorized loop" "$OUT_DIR/obj/$name.remarks" || true)
+
+      note=
+      if [ "$config" = plain ]; then
+        plain_text=$text
+        plain_vec=$vec
+        plain_sum=$sum
+      else
+        if [ "$sum" != "$plain_sum" ]; then
+          note="WRONG RESULT"
+          FAILED=1
+        elif [ "$vec" -lt "$plain_vec" ]; then
+          case $config in
+          instruction-obf | all) note="lost $((plain_vec - vec)) vectorized loops (expected)" ;;
+          *)
+            note="UNEXPECTED: lost $((plain_vec - vec)) vectorized loops"
+            FAILED=1
+            ;;
+          esac
+        fi
+      fi
+      growth=$(awk -v t="$text" -v p="$plain_text" \
+        'BEGIN { if (p > 0) printf "%.1f", (t - p) * 100 / p; else print 0 }')
+
+      printf "%-14s %-4s %-30s %14s %14s %10.3f %8s %8s %6s%% %6s %4s %s\n" \
+        "$kernel" "$opt" "$config" "$cycles" "$instructions" \
+        "$(awk -v n="$ns" 'BEGIN { print n / 1000000 }')" "$text" "$data" \
+        "$growth" "$stack" "$vec" "$note"
+      echo "$kernel,$opt,$config,$cycles,$instructions,$ns,$text,$data,$growth,$stack,$vec,$note" \
+        >> "$RESULTS"
+    done
+  done
+done
+
+echo "Results written to $RESULTS"
+exit $FAILED